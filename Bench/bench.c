@@ -0,0 +1,150 @@
+#include "bench.h"
+
+// Number of measured samples per case, the median is reported
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES 7
+#endif
+
+#define BENCH_MAX_ITERATIONS (1U << 30)
+#define BENCH_LINE_SIZE 256
+
+volatile uint32_t bench_sink;
+
+// -------------------- Formatting --------------------
+
+// Line builder, no printf so the same code runs on the board
+typedef struct
+{
+    char text[BENCH_LINE_SIZE];
+    uint32_t used;
+} line_t;
+
+static void append_string(line_t *line, const char *string)
+{
+    while (*string != '\0' && line->used < BENCH_LINE_SIZE - 1)
+    {
+        line->text[line->used++] = *string++;
+    }
+    line->text[line->used] = '\0';
+}
+
+static void append_unsigned(line_t *line, uint64_t value)
+{
+    char digits[20];
+    int32_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0 && line->used < BENCH_LINE_SIZE - 1)
+    {
+        line->text[line->used++] = digits[--count];
+    }
+    line->text[line->used] = '\0';
+}
+
+// Appends value / 1000 with three decimal places
+static void append_milli(line_t *line, uint64_t milli)
+{
+    uint64_t fraction = milli % 1000;
+
+    append_unsigned(line, milli / 1000);
+    append_string(line, ".");
+    append_string(line, fraction < 100 ? (fraction < 10 ? "00" : "0") : "");
+    append_unsigned(line, fraction);
+}
+
+// -------------------- Measurement --------------------
+
+static uint64_t measure(const bench_case_t *bench_case, uint32_t iterations)
+{
+    uint64_t start = bench_now();
+    bench_case->run(iterations);
+    return bench_now() - start;
+}
+
+// Doubles the number of iterations until one sample takes at least
+// bench_min_sample_time, so timer resolution does not dominate
+static uint32_t calibrate(const bench_case_t *bench_case)
+{
+    uint32_t iterations = 1;
+
+    while (iterations < BENCH_MAX_ITERATIONS &&
+           measure(bench_case, iterations) < bench_min_sample_time)
+    {
+        iterations <<= 1;
+    }
+
+    return iterations;
+}
+
+static void sort(uint64_t *values, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        uint64_t value = values[i];
+        uint32_t j = i;
+
+        for (; j > 0 && values[j - 1] > value; --j)
+        {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+}
+
+static void run_case(const char *suite_name, const bench_case_t *bench_case)
+{
+    uint64_t samples[BENCH_SAMPLES];
+    uint32_t iterations;
+    uint64_t operations;
+    line_t line = {.used = 0};
+
+    if (bench_case->setup)
+    {
+        bench_case->setup();
+    }
+
+    iterations = calibrate(bench_case);
+    operations = (uint64_t)iterations * bench_case->ops_per_iteration;
+
+    for (uint32_t i = 0; i < BENCH_SAMPLES; ++i)
+    {
+        samples[i] = measure(bench_case, iterations);
+    }
+
+    sort(samples, BENCH_SAMPLES);
+
+    append_string(&line, "{\"suite\":\"");
+    append_string(&line, suite_name);
+    append_string(&line, "\",\"bench\":\"");
+    append_string(&line, bench_case->name);
+    append_string(&line, "\",\"platform\":\"");
+    append_string(&line, bench_platform);
+    append_string(&line, "\",\"unit\":\"");
+    append_string(&line, bench_unit);
+    append_string(&line, "\",\"median\":");
+    append_milli(&line, samples[BENCH_SAMPLES / 2] * 1000 / operations);
+    append_string(&line, ",\"min\":");
+    append_milli(&line, samples[0] * 1000 / operations);
+    append_string(&line, ",\"max\":");
+    append_milli(&line, samples[BENCH_SAMPLES - 1] * 1000 / operations);
+    append_string(&line, ",\"ops\":");
+    append_unsigned(&line, operations);
+    append_string(&line, ",\"samples\":");
+    append_unsigned(&line, BENCH_SAMPLES);
+    append_string(&line, "}");
+
+    bench_emit(line.text);
+}
+
+void bench_run_suite(const bench_suite_t *suite)
+{
+    for (uint32_t i = 0; i < suite->cases_number; ++i)
+    {
+        run_case(suite->name, &suite->cases[i]);
+    }
+}
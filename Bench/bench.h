@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// One measured routine: run() executes the routine `iterations` times,
+// every iteration performing `ops_per_iteration` operations
+typedef struct
+{
+    const char *name;
+    void (*setup)(void);
+    void (*run)(uint32_t iterations);
+    uint32_t ops_per_iteration;
+} bench_case_t;
+
+typedef struct
+{
+    const char *name;
+    const bench_case_t *cases;
+    uint32_t cases_number;
+} bench_suite_t;
+
+// Every suite_*.c file defines the suite of its firmware
+extern const bench_suite_t bench_suite;
+
+// Platform hooks, implemented by bench_host.c and target/bench_target.c:
+// bench_now returns nanoseconds (host) or core cycles (target),
+// bench_emit outputs one line of results
+uint64_t bench_now(void);
+void bench_emit(const char *line);
+extern const char *const bench_platform;
+extern const char *const bench_unit;
+extern const uint64_t bench_min_sample_time;
+
+// Values written here are never optimized away
+extern volatile uint32_t bench_sink;
+
+// Runs every case of the suite and emits one JSON line per case
+void bench_run_suite(const bench_suite_t *suite);
+
+#endif /* BENCH_H */
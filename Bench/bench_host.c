@@ -0,0 +1,46 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include "bench.h"
+#include "../Sim/sim.h"
+
+// Host platform of the benchmark harness:
+// nanoseconds from the monotonic clock, results on stdout
+
+const char *const bench_platform = "host";
+const char *const bench_unit = "ns/op";
+
+// 20 ms per sample
+const uint64_t bench_min_sample_time = 20000000;
+
+uint64_t bench_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+void bench_emit(const char *line)
+{
+    puts(line);
+    fflush(stdout);
+}
+
+int main(void)
+{
+    cpu_set_t cpus;
+
+    // Stay on one core, migrations show up as noise in the samples
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+
+    // Plain register memory: no traps on the measured accesses
+    sim_init(SIM_PASSIVE);
+
+    bench_run_suite(&bench_suite);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compares two benchmark result files (JSON lines written by the suites)
+# and fails when the median of any benchmark grew by more than the
+# threshold, in percent.
+#
+# usage: compare.sh baseline.jsonl results.jsonl [threshold]
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 baseline.jsonl results.jsonl [threshold]" >&2
+    exit 2
+fi
+
+awk -v threshold="${3:-10}" '
+function field(line, name,    rest) {
+    rest = line
+    sub(".*\"" name "\":\"?", "", rest)
+    sub("[\",}].*", "", rest)
+    return rest
+}
+{
+    key = field($0, "suite") "." field($0, "bench") " (" field($0, "platform") ")"
+    unit[key] = field($0, "unit")
+}
+FNR == NR {
+    baseline[key] = field($0, "median")
+    next
+}
+{
+    current = field($0, "median")
+    if (!(key in baseline)) {
+        printf "%-48s %12s %12.3f %s  new\n", key, "-", current, unit[key]
+        next
+    }
+    change = baseline[key] > 0 ? 100 * (current - baseline[key]) / baseline[key] : 0
+    verdict = change > threshold ? "REGRESSION" : "ok"
+    if (change > threshold)
+        failed = 1
+    printf "%-48s %12.3f %12.3f %s %+7.1f%%  %s\n", key, baseline[key], current, unit[key], change, verdict
+}
+END { exit failed }
+' "$1" "$2"
@@ -0,0 +1,76 @@
+// Project hot paths: the messages queue used by send() and the
+// DMA handler, and formatting of accelerometer values into frames
+#include "../Project/main.c"
+#include "bench.h"
+
+static messages_queue_t bench_queue;
+
+static void init_pipeline(void)
+{
+    sample_pipeline_init(&sample_pipeline);
+}
+
+// One operation is an enqueue followed by a poll
+static void run_messages_queue_enqueue_poll(uint32_t iterations)
+{
+    char *message = sample_pipeline.frame;
+
+    clear_queue(&bench_queue);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        if (!is_queue_full(&bench_queue))
+        {
+            enqueue(&bench_queue, message);
+        }
+
+        message = queue_poll(&bench_queue);
+    }
+
+    bench_sink = bench_queue.read_position;
+}
+
+// One operation is one message of a burst filling the whole queue
+// and then drained
+static void run_messages_queue_fill_drain(uint32_t iterations)
+{
+    uint32_t sum = 0;
+
+    clear_queue(&bench_queue);
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        while (!is_queue_full(&bench_queue))
+        {
+            enqueue(&bench_queue, sample_pipeline.frame);
+        }
+
+        while (!is_queue_empty(&bench_queue))
+        {
+            sum += (uint32_t)(uintptr_t)queue_poll(&bench_queue);
+        }
+    }
+
+    bench_sink = sum;
+}
+
+// One operation is one axis value written into the frame,
+// X and Y alternate as in I2C1_EV_IRQHandler
+static void run_format_sample(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        write_to_buffer((i & 1) ? OUT_Y : OUT_X, (uint8_t)i);
+    }
+
+    bench_sink = (uint32_t)sample_pipeline.frame[SAMPLE_FRAME_POSITION_X + 1];
+}
+
+static const bench_case_t cases[] = {
+    {"messages_queue_enqueue_poll", init_pipeline, run_messages_queue_enqueue_poll, 1},
+    {"messages_queue_fill_drain", init_pipeline, run_messages_queue_fill_drain,
+     MESSAGES_QUEUE_BUFFER_SIZE},
+    {"format_sample", init_pipeline, run_format_sample, 1}};
+
+const bench_suite_t bench_suite = {"project", cases,
+                                   sizeof(cases) / sizeof(cases[0])};
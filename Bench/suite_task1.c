@@ -0,0 +1,88 @@
+// Task1 hot paths: command parsing in the superloop and
+// queueing button messages for the link
+#include "../Task1/l1_hw.c"
+#include "bench.h"
+
+// Valid, invalid and partial commands, as typed on a terminal
+static const char COMMAND_STREAM[] = "LR1LGTLB0Lg1XLRTLq0LBTLg0LR0";
+
+#define COMMAND_STREAM_LENGTH (sizeof(COMMAND_STREAM) - 1)
+
+static void setup_command_parser(void)
+{
+    RedLEDoff();
+    GreenLEDoff();
+    BlueLEDoff();
+    Green2LEDoff();
+}
+
+// One operation is one received byte fed to parse_byte, as in the main
+// loop, the batch is applied once the line goes idle
+static void run_command_parser(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        for (uint32_t j = 0; j < COMMAND_STREAM_LENGTH; ++j)
+        {
+            parse_byte(COMMAND_STREAM[j]);
+        }
+
+        apply_led_commands();
+    }
+
+    bench_sink = parse_state;
+}
+
+static void setup_tx_enqueue_message(void)
+{
+    tx_queue.read_pos = 0;
+    tx_queue.insert_pos = 0;
+    tx_queue.sent = 0;
+}
+
+// One operation is one button message queued for the link,
+// the queue is emptied before it overflows
+static void run_tx_enqueue_message(uint32_t iterations)
+{
+    uint32_t button = 0;
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        append_message(button);
+
+        button = (button + 1 == BUTTON_NUMS) ? 0 : button + 1;
+
+        if (tx_queue.insert_pos - tx_queue.read_pos == TX_QUEUE_SIZE)
+        {
+            tx_queue.read_pos = tx_queue.insert_pos;
+        }
+    }
+
+    bench_sink = tx_queue.insert_pos;
+}
+
+static void setup_button_scan(void)
+{
+    check_buttons_states();
+}
+
+// One operation is one scan of the seven buttons without any change,
+// the cost paid by every iteration of the main loop
+static void run_button_scan(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        check_buttons_states();
+    }
+
+    bench_sink = tx_queue.insert_pos;
+}
+
+static const bench_case_t cases[] = {
+    {"command_parser", setup_command_parser, run_command_parser,
+     COMMAND_STREAM_LENGTH},
+    {"tx_enqueue_message", setup_tx_enqueue_message, run_tx_enqueue_message, 1},
+    {"button_scan", setup_button_scan, run_button_scan, 1}};
+
+const bench_suite_t bench_suite = {"task1", cases,
+                                   sizeof(cases) / sizeof(cases[0])};
@@ -0,0 +1,52 @@
+// Task2 hot path: the event queue shared by the EXTI handlers
+// and DMA1_Stream6_IRQHandler, rendered into tx_buffer
+#include "../Task2/l2_hw.c"
+#include "bench.h"
+
+// One operation is a push followed by the rendering of that event alone,
+// as when the DMA is idle at every event
+static void run_event_queue_push_render(uint32_t iterations)
+{
+    uint32_t sum = 0;
+
+    clear_queue();
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        queue_push(EVENT_ID(i % CONTROLLER_BUTTONS_NUMBER, i & 1));
+        sum += render_events();
+    }
+
+    bench_sink = sum;
+}
+
+// One operation is one event of a burst filling the whole queue and
+// then rendered batch by batch, as during a contact bounce storm
+static void run_event_queue_fill_drain(uint32_t iterations)
+{
+    uint32_t sum = 0;
+
+    clear_queue();
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        for (uint32_t j = 0; !is_queue_full(); ++j)
+        {
+            queue_push(EVENT_ID(j % CONTROLLER_BUTTONS_NUMBER, j & 1));
+        }
+
+        while (!is_queue_empty())
+        {
+            sum += render_events();
+        }
+    }
+
+    bench_sink = sum;
+}
+
+static const bench_case_t cases[] = {
+    {"event_queue_push_render", NULL, run_event_queue_push_render, 1},
+    {"event_queue_fill_drain", NULL, run_event_queue_fill_drain, EVENT_QUEUE_SIZE}};
+
+const bench_suite_t bench_suite = {"task2", cases,
+                                   sizeof(cases) / sizeof(cases[0])};
@@ -0,0 +1,82 @@
+#include <gpio.h>
+#include <stm32.h>
+#include "../bench.h"
+
+// Target platform of the benchmark harness:
+// core cycles from the DWT cycle counter, results sent over USART2
+// with polling so that no interrupt disturbs the measurement
+
+// Faster than the firmware link, results are long
+#define BAUD_RATE 115200U
+#include "usart2.h"
+
+const char *const bench_platform = "stm32f411";
+const char *const bench_unit = "cycles/op";
+
+// 1M cycles per sample, about 60 ms at 16 MHz
+const uint64_t bench_min_sample_time = 1000000;
+
+// CYCCNT is 32-bit, wraps are counted on every read
+static uint32_t last_cycles;
+static uint64_t cycles_high;
+
+uint64_t bench_now(void)
+{
+    uint32_t cycles = DWT->CYCCNT;
+
+    if (cycles < last_cycles)
+    {
+        cycles_high += 1ULL << 32;
+    }
+    last_cycles = cycles;
+
+    return cycles_high | cycles;
+}
+
+static void send_char(char c)
+{
+    while (!(USART2->SR & USART_SR_TXE))
+    {
+    }
+    USART2->DR = c;
+}
+
+void bench_emit(const char *line)
+{
+    while (*line != '\0')
+    {
+        send_char(*line++);
+    }
+    send_char('\r');
+    send_char('\n');
+}
+
+// Enable the DWT cycle counter
+static void DWT_configure(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+int main(void)
+{
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN |
+                    RCC_AHB1ENR_GPIOBEN |
+                    RCC_AHB1ENR_GPIOCEN;
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+
+    __NOP();
+
+    usart2_configure(0, 0);
+    usart2_enable();
+    DWT_configure();
+
+    bench_run_suite(&bench_suite);
+
+    for (;;)
+    {
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stm32.h>
+
+// Clocks: the core and the APB1 and APB2 peripherals run from HSI,
+// undivided
+#define HSI_HZ 16000000U
+#define PCLK1_HZ HSI_HZ
+#define PCLK2_HZ HSI_HZ
+
+// Speed of the USART2 link, shared by every firmware and the computer
+// side (-DBAUD_RATE=... to change it)
+#ifndef BAUD_RATE
+#define BAUD_RATE 9600U
+#endif
+
+// LEDs of the board: red, green and blue are active low, green2 is
+// active high
+#define RED_LED_GPIO GPIOA
+#define GREEN_LED_GPIO GPIOA
+#define BLUE_LED_GPIO GPIOB
+#define GREEN2_LED_GPIO GPIOA
+
+#define RED_LED_PIN 6
+#define GREEN_LED_PIN 7
+#define BLUE_LED_PIN 0
+#define GREEN2_LED_PIN 5
+
+#define RedLEDon() \
+    RED_LED_GPIO->BSRR = 1 << (RED_LED_PIN + 16)
+#define RedLEDoff() \
+    RED_LED_GPIO->BSRR = 1 << RED_LED_PIN
+
+#define GreenLEDon() \
+    GREEN_LED_GPIO->BSRR = 1 << (GREEN_LED_PIN + 16)
+#define GreenLEDoff() \
+    GREEN_LED_GPIO->BSRR = 1 << GREEN_LED_PIN
+
+#define BlueLEDon() \
+    BLUE_LED_GPIO->BSRR = 1 << (BLUE_LED_PIN + 16)
+#define BlueLEDoff() \
+    BLUE_LED_GPIO->BSRR = 1 << BLUE_LED_PIN
+
+#define Green2LEDon() \
+    GREEN2_LED_GPIO->BSRR = 1 << GREEN2_LED_PIN
+#define Green2LEDoff() \
+    GREEN2_LED_GPIO->BSRR = 1 << (GREEN2_LED_PIN + 16)
+
+#endif /* BOARD_H */
@@ -0,0 +1,88 @@
+#ifndef BOARD_BUTTONS_H
+#define BOARD_BUTTONS_H
+
+#include <gpio.h>
+#include <stm32.h>
+#include "board.h"
+#include "button_table.h"
+
+/* EXTI vectors: VECTOR(name, lines), the lines 5 to 9 and 10 to 15
+    share one */
+#define BOARD_EXTI_VECTORS(VECTOR) \
+    VECTOR(EXTI0, 0x0001U)         \
+    VECTOR(EXTI1, 0x0002U)         \
+    VECTOR(EXTI2, 0x0004U)         \
+    VECTOR(EXTI3, 0x0008U)         \
+    VECTOR(EXTI4, 0x0010U)         \
+    VECTOR(EXTI9_5, 0x03E0U)       \
+    VECTOR(EXTI15_10, 0xFC00U)
+
+// Configure the buttons:
+// inputs with pull-ups, interrupt on both edges (GPIO and SYSCFG
+// clocks enabled by the caller); one call per button, no loop
+static inline void board_buttons_configure(void)
+{
+#define BOARD_BUTTON_CONFIGURE(name, port, pin, active_high) \
+    GPIOinConfigure(GPIO##port,                              \
+                    pin,                                     \
+                    GPIO_PuPd_UP,                            \
+                    EXTI_Mode_Interrupt,                     \
+                    EXTI_Trigger_Rising_Falling);
+
+    BOARD_BUTTONS(BOARD_BUTTON_CONFIGURE)
+
+#undef BOARD_BUTTON_CONFIGURE
+}
+
+// Enable the EXTI vectors serving some of the lines, at one priority;
+// constant lines leave only the calls of the vectors used
+static inline void board_buttons_nvic_configure(uint32_t lines, uint32_t priority)
+{
+#define BOARD_EXTI_VECTOR_ENABLE(vector, vector_lines) \
+    if (lines & (vector_lines))                        \
+    {                                                  \
+        NVIC_SetPriority(vector##_IRQn, priority);     \
+        NVIC_EnableIRQ(vector##_IRQn);                 \
+    }
+
+    BOARD_EXTI_VECTORS(BOARD_EXTI_VECTOR_ENABLE)
+
+#undef BOARD_EXTI_VECTOR_ENABLE
+}
+
+// Pending lines among lines, read once and cleared at once:
+// an edge after the read raises its line again
+static inline uint32_t board_buttons_pending(uint32_t lines)
+{
+    uint32_t pending = EXTI->PR & lines;
+
+    EXTI->PR = pending;
+
+    return pending;
+}
+
+// Index of the button on an EXTI line, one load
+static inline uint32_t board_button_of_line(uint32_t line)
+{
+#define BOARD_BUTTON_OF_LINE(name, port, pin, active_high) [pin] = BUTTON_##name,
+
+    static const uint8_t buttons_of_lines[16] = {BOARD_BUTTONS(BOARD_BUTTON_OF_LINE)};
+
+#undef BOARD_BUTTON_OF_LINE
+
+    return buttons_of_lines[line];
+}
+
+/* Handlers of every EXTI vector, all running the dispatch of the
+    firmware, static void buttons_exti_dispatch(void): it reads EXTI->PR
+    once and walks the pending lines, whichever vector it runs from.
+    Only the vectors enabled by board_buttons_nvic_configure are taken */
+#define BOARD_EXTI_HANDLER(vector, vector_lines) \
+    void vector##_IRQHandler(void)               \
+    {                                            \
+        buttons_exti_dispatch();                 \
+    }
+
+#define BOARD_BUTTONS_EXTI_HANDLERS() BOARD_EXTI_VECTORS(BOARD_EXTI_HANDLER)
+
+#endif /* BOARD_BUTTONS_H */
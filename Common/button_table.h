@@ -0,0 +1,54 @@
+#ifndef BUTTON_TABLE_H
+#define BUTTON_TABLE_H
+
+/* Buttons of the expander board and of the Nucleo, the only place they
+    are described: BUTTON(name, port, pin, active_high), port being the
+    letter of GPIOx, in the order of their index. MODE is the only one
+    pressed at level 1.
+    Everything about the buttons is generated from it: the indices and
+    the bits of the masks of buttons (the firmware and the computer
+    side), the EXTI lines, pin configuration, NVIC enables and dispatch
+    (board_buttons.h), the scan of Task1 (its messages keep their own
+    order and text, Task1/header.h). No register is named here, the
+    computer side includes it as it is */
+#define BOARD_BUTTONS(BUTTON)  \
+    BUTTON(LEFT, B, 3, 0)      \
+    BUTTON(RIGHT, B, 4, 0)     \
+    BUTTON(UP, B, 5, 0)        \
+    BUTTON(DOWN, B, 6, 0)      \
+    BUTTON(FIRE, B, 10, 0)     \
+    BUTTON(USER, C, 13, 0)     \
+    BUTTON(MODE, A, 0, 1)
+
+#define BOARD_BUTTON_ID(name, port, pin, active_high) BUTTON_##name,
+#define BOARD_BUTTON_PIN(name, port, pin, active_high) BUTTON_##name##_PIN = (pin),
+#define BOARD_BUTTON_LINE_OR(name, port, pin, active_high) | (1U << (pin))
+#define BOARD_BUTTON_LINE_SUM(name, port, pin, active_high) + (1U << (pin))
+#define BOARD_BUTTON_ACTIVE_HIGH(name, port, pin, active_high) \
+    | ((active_high) ? 1U << BUTTON_##name : 0U)
+
+// Index of a button: bit of the masks of buttons, index of the tables
+typedef enum
+{
+    BOARD_BUTTONS(BOARD_BUTTON_ID)
+    BUTTONS_NUMBER
+} button_id_t;
+
+// BUTTON_<name>_PIN, for the constant expressions
+enum
+{
+    BOARD_BUTTONS(BOARD_BUTTON_PIN)
+};
+
+// Mask of the buttons pressed at level 1
+#define BOARD_BUTTONS_ACTIVE_HIGH (0U BOARD_BUTTONS(BOARD_BUTTON_ACTIVE_HIGH))
+
+// EXTI line of a button, and of all of them
+#define BOARD_BUTTON_LINE(name) (1U << BUTTON_##name##_PIN)
+#define BOARD_BUTTONS_LINES (0U BOARD_BUTTONS(BOARD_BUTTON_LINE_OR))
+
+// Lines are shared by the ports (SYSCFG selects one port per line)
+_Static_assert(BOARD_BUTTONS_LINES == (0U BOARD_BUTTONS(BOARD_BUTTON_LINE_SUM)),
+               "two buttons on one EXTI line");
+
+#endif /* BUTTON_TABLE_H */
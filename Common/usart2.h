@@ -0,0 +1,114 @@
+#ifndef USART2_H
+#define USART2_H
+
+#include <gpio.h>
+#include <stm32.h>
+#include "board.h"
+
+/* USART2 driver, shared by Task1, Task2 and the Project:
+    TX on PA2, RX on PA3, 8 data bits, no parity, 1 stop bit at
+    BAUD_RATE; DMA1 Stream6 (channel 4) transmits.
+    Everything is a static inline function on constant registers and
+    masks, a call compiles to the register accesses it stands for */
+
+#define USART2_BRR_VALUE ((PCLK1_HZ + (BAUD_RATE / 2U)) / BAUD_RATE)
+
+/* DMA1 Stream6: channel 4, direct transfer mode, 8-bits transfers,
+    high priority, increasing the memory address after every transfer,
+    interrupt after transfer completion */
+#define USART2_DMA_TX_CR (4U << 25 |         \
+                          DMA_SxCR_PL_1 |    \
+                          DMA_SxCR_MINC |    \
+                          DMA_SxCR_DIR_0 |   \
+                          DMA_SxCR_TCIE)
+
+// Configure USART2, left disabled:
+// Code from Slides 10 to 11 (w8); cr1 adds interrupt enables to RE and
+// TE, cr3 selects the DMA requests. RX is pulled up, a disconnected
+// line stays idle instead of receiving noise
+static inline void usart2_configure(uint32_t cr1, uint32_t cr3)
+{
+    GPIOafConfigure(GPIOA,
+                    2,
+                    GPIO_OType_PP,
+                    GPIO_Fast_Speed,
+                    GPIO_PuPd_NOPULL,
+                    GPIO_AF_USART2);
+
+    GPIOafConfigure(GPIOA,
+                    3,
+                    GPIO_OType_PP,
+                    GPIO_Fast_Speed,
+                    GPIO_PuPd_UP,
+                    GPIO_AF_USART2);
+
+    USART2->CR1 = USART_CR1_RE | USART_CR1_TE | cr1;
+    USART2->CR2 = 0;
+    USART2->BRR = USART2_BRR_VALUE;
+    USART2->CR3 = cr3;
+}
+
+static inline void usart2_enable(void)
+{
+    USART2->CR1 |= USART_CR1_UE;
+}
+
+// Configure DMA1 Stream6 for the transmission, USART2 needs DMAT in CR3:
+// Code from Slides 12 to 14 (w8)
+static inline void usart2_dma_tx_configure(void)
+{
+    DMA1_Stream6->CR = USART2_DMA_TX_CR;
+    DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+    DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+}
+
+// The stream is disabled by the hardware at the end of a transfer
+static inline int usart2_dma_tx_idle(void)
+{
+    return (DMA1_Stream6->CR & DMA_SxCR_EN) == 0;
+}
+
+// Transfer completion signalled and not acknowledged yet
+static inline int usart2_dma_tx_complete(void)
+{
+    return (DMA1->HISR & DMA_HISR_TCIF6) != 0;
+}
+
+static inline void usart2_dma_tx_acknowledge(void)
+{
+    DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+}
+
+// Starting sending, the stream must be idle:
+// Code from Slide 15 (w8)
+static inline void usart2_dma_tx_start(const char *data, uint32_t length)
+{
+    DMA1_Stream6->M0AR = (uint32_t)data;
+    DMA1_Stream6->NDTR = length;
+    DMA1_Stream6->CR |= DMA_SxCR_EN;
+}
+
+/* Double buffer mode: the stream sends buffer0 and buffer1 in turn for
+    ever, the hardware switches at the end of each one (CT) and raises
+    the transfer complete flag, the line never idles. The stream must
+    be idle */
+static inline void usart2_dma_tx_stream(const char *buffer0,
+                                        const char *buffer1,
+                                        uint32_t length)
+{
+    DMA1_Stream6->CR = USART2_DMA_TX_CR | DMA_SxCR_DBM;
+    DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+    DMA1_Stream6->M0AR = (uint32_t)buffer0;
+    DMA1_Stream6->M1AR = (uint32_t)buffer1;
+    DMA1_Stream6->NDTR = length;
+    DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+    DMA1_Stream6->CR |= DMA_SxCR_EN;
+}
+
+// Buffer being sent in double buffer mode, 0 or 1
+static inline uint32_t usart2_dma_tx_current(void)
+{
+    return (DMA1_Stream6->CR & DMA_SxCR_CT) ? 1U : 0U;
+}
+
+#endif /* USART2_H */
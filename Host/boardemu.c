@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "frame.h"
+
+/* Board emulator: impersonates the Project firmware on a pseudo-terminal
+    (or any file, - for stdout) to drive the host tools without hardware.
+    - synthetic frames of a tilting board, optionally clicking FIRE, or
+      the bytes of a capture file replayed as they are (any format)
+    - paced at a frame or byte rate, far above 9600 baud if needed,
+      evenly or in bursts
+    - impairments per byte: noise inserted, bytes dropped, bytes corrupted
+*/
+
+#define CHUNK_SIZE 65536
+
+// Pacing period when the stream is not bursty
+#define PACING_PERIOD_NS 1000000ULL
+
+typedef struct
+{
+    const char *output;
+    const char *link;
+    const char *replay;
+    int loop;
+    double frame_rate;
+    double byte_rate;
+    double duration_s;
+    uint64_t frames_limit;
+    uint32_t burst_ms;
+    uint32_t noise_ppm;
+    uint32_t drop_ppm;
+    uint32_t corrupt_ppm;
+    double amplitude;
+    double period_s;
+    double click_period_s;
+    uint64_t seed;
+    int wait_reader;
+} options_t;
+
+static options_t options = {
+    .frame_rate = 40,
+    .amplitude = 40,
+    .period_s = 4,
+    .seed = 1};
+
+static struct
+{
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t noise;
+    uint64_t drops;
+    uint64_t corruptions;
+    uint64_t stall_ns;
+} stats;
+
+static uint64_t random_state;
+
+static uint8_t *replay_data;
+static size_t replay_size;
+static size_t replay_position;
+
+// Frame being emitted byte by byte
+static char frame_text[FRAME_LENGTH];
+static uint32_t frame_position = FRAME_LENGTH;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+// xorshift64
+static uint64_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static int random_ppm(uint32_t ppm)
+{
+    return ppm != 0 && random_next() % 1000000 < ppm;
+}
+
+// -------------------- Output --------------------
+
+// Create the pseudo-terminal:
+// raw mode on the board side, its path printed (and linked with -l)
+static int pty_open(void)
+{
+    struct termios tty;
+    const char *name;
+    int slave;
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    {
+        die("posix_openpt");
+    }
+
+    name = ptsname(master);
+    slave = open(name, O_RDWR | O_NOCTTY);
+
+    if (slave < 0 || tcgetattr(slave, &tty) < 0)
+    {
+        die(name);
+    }
+
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+    close(slave);
+
+    if (options.link)
+    {
+        unlink(options.link);
+
+        if (symlink(name, options.link) < 0)
+        {
+            die(options.link);
+        }
+    }
+
+    printf("%s\n", name);
+    fflush(stdout);
+
+    return master;
+}
+
+// Until a reader opens the other end, the master reports a hang up
+static void wait_reader(int master)
+{
+    struct pollfd poll_fd = {.fd = master, .events = POLLOUT};
+
+    for (;;)
+    {
+        if (poll(&poll_fd, 1, 0) >= 0 && !(poll_fd.revents & POLLHUP))
+        {
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+static int output_open(void)
+{
+    int fd;
+
+    if (options.output == NULL)
+    {
+        fd = pty_open();
+
+        if (options.wait_reader)
+        {
+            wait_reader(fd);
+        }
+        return fd;
+    }
+
+    if (strcmp(options.output, "-") == 0)
+    {
+        return STDOUT_FILENO;
+    }
+
+    fd = open(options.output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+        die(options.output);
+    }
+
+    return fd;
+}
+
+// Write all of it:
+// the time blocked by a slow reader is counted as stall
+static int write_all(int fd, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        uint64_t start = now_ns();
+        ssize_t written = write(fd, data, length);
+
+        stats.stall_ns += now_ns() - start;
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // The reader closed its end
+            if (errno == EIO || errno == EPIPE)
+            {
+                return 0;
+            }
+            die("write");
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return 1;
+}
+
+// -------------------- Stream --------------------
+
+static void replay_load(void)
+{
+    struct stat info;
+    int fd = open(options.replay, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &info) < 0)
+    {
+        die(options.replay);
+    }
+
+    replay_size = (size_t)info.st_size;
+    replay_data = malloc(replay_size ? replay_size : 1);
+
+    if (replay_data == NULL || read(fd, replay_data, replay_size) != (ssize_t)replay_size)
+    {
+        die(options.replay);
+    }
+
+    close(fd);
+}
+
+// Tilt of a board moved in a circle,
+// FIRE held during the first half of every click period
+static void next_frame(void)
+{
+    double time_s = (double)stats.frames / options.frame_rate;
+    double phase = 2 * M_PI * time_s / options.period_s;
+    frame_t frame = {
+        (int8_t)lround(options.amplitude * sin(phase)),
+        (int8_t)lround(options.amplitude * cos(phase)),
+        0,
+        0};
+
+    if (options.click_period_s > 0 &&
+        fmod(time_s, options.click_period_s) < options.click_period_s / 2)
+    {
+        frame.buttons = FRAME_BUTTON_FIRE;
+    }
+
+    frame_format(&frame, frame_text);
+    frame_position = 0;
+    stats.frames++;
+}
+
+static int stream_finished(void)
+{
+    if (options.replay)
+    {
+        return !options.loop && replay_position == replay_size;
+    }
+
+    return options.frames_limit != 0 && stats.frames == options.frames_limit &&
+           frame_position == FRAME_LENGTH;
+}
+
+// Next byte of the stream before impairments, -1 at the end
+static int stream_byte(void)
+{
+    if (options.replay)
+    {
+        if (replay_position == replay_size)
+        {
+            if (!options.loop || replay_size == 0)
+            {
+                return -1;
+            }
+            replay_position = 0;
+        }
+        return replay_data[replay_position++];
+    }
+
+    if (frame_position == FRAME_LENGTH)
+    {
+        if (options.frames_limit != 0 && stats.frames == options.frames_limit)
+        {
+            return -1;
+        }
+        next_frame();
+    }
+
+    return (uint8_t)frame_text[frame_position++];
+}
+
+// Fill up to length bytes of the impaired stream
+static size_t stream_fill(uint8_t *out, size_t length)
+{
+    size_t used = 0;
+
+    while (used < length)
+    {
+        int c;
+
+        if (random_ppm(options.noise_ppm))
+        {
+            out[used++] = (uint8_t)random_next();
+            stats.noise++;
+            continue;
+        }
+
+        c = stream_byte();
+
+        if (c < 0)
+        {
+            break;
+        }
+
+        if (random_ppm(options.drop_ppm))
+        {
+            stats.drops++;
+            continue;
+        }
+
+        if (random_ppm(options.corrupt_ppm))
+        {
+            c ^= 1 + (int)(random_next() % 255);
+            stats.corruptions++;
+        }
+
+        out[used++] = (uint8_t)c;
+    }
+
+    return used;
+}
+
+// -------------------- Main --------------------
+
+static void print_stats(double elapsed_s)
+{
+    fprintf(stderr,
+            "{\"bytes\":%llu,\"frames\":%llu,\"noise\":%llu,\"drops\":%llu,"
+            "\"corruptions\":%llu,\"seconds\":%.3f,\"bytes_per_s\":%.0f,"
+            "\"stall_ms\":%.1f}\n",
+            (unsigned long long)stats.bytes,
+            (unsigned long long)stats.frames,
+            (unsigned long long)stats.noise,
+            (unsigned long long)stats.drops,
+            (unsigned long long)stats.corruptions,
+            elapsed_s,
+            elapsed_s > 0 ? stats.bytes / elapsed_s : 0,
+            stats.stall_ns / 1e6);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -o file    write to file (- for stdout) instead of a new pty\n"
+            "  -l path    symlink to the pty\n"
+            "  -w         wait for a reader to open the pty\n"
+            "  -f rate    frames per second (default 40)\n"
+            "  -B rate    bytes per second, overrides -f (0: as fast as possible)\n"
+            "  -d seconds stop after seconds\n"
+            "  -c frames  stop after frames\n"
+            "  -p file    replay the bytes of a capture instead of frames\n"
+            "  -L         loop the replay\n"
+            "  -j ms      bursts: write everything due every ms\n"
+            "  -N ppm     noise bytes inserted, per million bytes\n"
+            "  -D ppm     bytes dropped, per million\n"
+            "  -C ppm     bytes corrupted, per million\n"
+            "  -a digits  tilt amplitude (default 40)\n"
+            "  -T seconds period of the motion (default 4)\n"
+            "  -k seconds period of the FIRE clicks (default none)\n"
+            "  -S seed    seed of the impairments\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t chunk[CHUNK_SIZE];
+    uint64_t start;
+    uint64_t next;
+    uint64_t period_ns;
+    double byte_rate;
+    int option;
+    int fd;
+
+    options.byte_rate = -1;
+
+    while ((option = getopt(argc, argv, "o:l:wf:B:d:c:p:Lj:N:D:C:a:T:k:S:")) != -1)
+    {
+        switch (option)
+        {
+        case 'o':
+            options.output = optarg;
+            break;
+        case 'l':
+            options.link = optarg;
+            break;
+        case 'w':
+            options.wait_reader = 1;
+            break;
+        case 'f':
+            options.frame_rate = strtod(optarg, NULL);
+            break;
+        case 'B':
+            options.byte_rate = strtod(optarg, NULL);
+            break;
+        case 'd':
+            options.duration_s = strtod(optarg, NULL);
+            break;
+        case 'c':
+            options.frames_limit = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            options.replay = optarg;
+            break;
+        case 'L':
+            options.loop = 1;
+            break;
+        case 'j':
+            options.burst_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            options.noise_ppm = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            options.drop_ppm = strtoul(optarg, NULL, 0);
+            break;
+        case 'C':
+            options.corrupt_ppm = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            options.amplitude = strtod(optarg, NULL);
+            break;
+        case 'T':
+            options.period_s = strtod(optarg, NULL);
+            break;
+        case 'k':
+            options.click_period_s = strtod(optarg, NULL);
+            break;
+        case 'S':
+            options.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || options.frame_rate <= 0 || options.period_s <= 0)
+    {
+        usage(argv[0]);
+    }
+
+    random_state = options.seed ? options.seed : 1;
+
+    if (options.replay)
+    {
+        replay_load();
+    }
+
+    byte_rate = options.byte_rate >= 0 ? options.byte_rate
+                                        : options.frame_rate * FRAME_LENGTH;
+    period_ns = options.burst_ms ? options.burst_ms * 1000000ULL : PACING_PERIOD_NS;
+
+    fd = output_open();
+    start = now_ns();
+    next = start;
+
+    for (;;)
+    {
+        uint64_t now = now_ns();
+        double elapsed_s = (now - start) / 1e9;
+        uint64_t due;
+
+        if ((options.duration_s > 0 && elapsed_s >= options.duration_s) ||
+            stream_finished())
+        {
+            break;
+        }
+
+        // Bytes owed since the start, a whole chunk when unpaced
+        if (byte_rate > 0)
+        {
+            double owed = byte_rate * elapsed_s - (double)stats.bytes;
+
+            due = owed > 0 ? (uint64_t)owed : 0;
+        }
+        else
+        {
+            due = CHUNK_SIZE;
+        }
+
+        while (due > 0)
+        {
+            size_t length = stream_fill(chunk, due < CHUNK_SIZE ? due : CHUNK_SIZE);
+
+            if (length == 0)
+            {
+                break;
+            }
+
+            if (!write_all(fd, chunk, length))
+            {
+                print_stats((now_ns() - start) / 1e9);
+                return 0;
+            }
+
+            stats.bytes += length;
+            due = due > length ? due - length : 0;
+        }
+
+        if (byte_rate > 0)
+        {
+            struct timespec wake;
+
+            next += period_ns;
+            wake.tv_sec = (time_t)(next / 1000000000U);
+            wake.tv_nsec = (long)(next % 1000000000U);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+        }
+    }
+
+    // End on a frame boundary
+    if (!options.replay && frame_position < FRAME_LENGTH)
+    {
+        size_t length = FRAME_LENGTH - frame_position;
+
+        memcpy(chunk, frame_text + frame_position, length);
+        frame_position = FRAME_LENGTH;
+
+        if (write_all(fd, chunk, length))
+        {
+            stats.bytes += length;
+        }
+    }
+
+    print_stats((now_ns() - start) / 1e9);
+
+    return 0;
+}
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "../Project/capture.h"
+#include "capture_file.h"
+
+/* Receiver of the burst captures of the Project firmware (make
+    CAPTURE=1), see Project/capture.h for the dump on the link.
+    - reads the serial line (raw, blocking), a file or a pipe; bytes
+      before a CAPTURE header are skipped
+    - checks the sum of the samples against the END trailer, which also
+      counts the samples the board missed
+    - writes a capture file (capture_file.h): stamps unwrapped, records
+      of fixed size that a reader maps and uses in place
+    - reports the capture and its transfer as one JSON line on stderr
+*/
+
+#define READ_BUFFER_SIZE 65536
+
+// Most samples a dump may announce, the ring of the board is smaller
+#define DUMP_SAMPLES_MAX (1U << 20)
+
+typedef struct
+{
+    uint32_t baud_rate;
+    const char *output;
+} options_t;
+
+static options_t options = {9600, "capture.cap"};
+
+typedef enum
+{
+    DUMP_HEADER,
+    DUMP_SAMPLES,
+    DUMP_TRAILER,
+    DUMP_DONE
+} dump_stage_t;
+
+static struct
+{
+    dump_stage_t stage;
+    char line[CAPTURE_LINE_SIZE];
+    uint32_t line_length;
+    uint32_t samples;
+    uint32_t rate_hz;
+    uint32_t trigger;
+    uint32_t cause;
+    uint8_t *data;
+    uint32_t received;
+    uint32_t sum;
+    uint32_t missed;
+    uint32_t skipped;
+    uint64_t started_ns;
+    uint64_t ended_ns;
+} dump;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+// -------------------- Serial line --------------------
+
+static speed_t baud_to_speed(uint32_t baud_rate)
+{
+    static const struct
+    {
+        uint32_t baud_rate;
+        speed_t speed;
+    } speeds[] = {
+        {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+        {115200, B115200}, {230400, B230400}, {460800, B460800},
+        {921600, B921600}, {1000000, B1000000}, {2000000, B2000000},
+        {4000000, B4000000}};
+
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); ++i)
+    {
+        if (speeds[i].baud_rate == baud_rate)
+        {
+            return speeds[i].speed;
+        }
+    }
+
+    fprintf(stderr, "capdump: unsupported baud rate %u\n", baud_rate);
+    exit(2);
+}
+
+// Raw 8N1, reads block until a byte arrives; files and pipes as they are
+static int source_open(const char *path, uint32_t baud_rate)
+{
+    struct termios tty;
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO
+                                    : open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        die(path);
+    }
+
+    if (!isatty(fd))
+    {
+        return fd;
+    }
+
+    if (tcgetattr(fd, &tty) < 0)
+    {
+        die("tcgetattr");
+    }
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, baud_to_speed(baud_rate));
+    cfsetospeed(&tty, baud_to_speed(baud_rate));
+
+    if (tcsetattr(fd, TCSANOW, &tty) < 0)
+    {
+        die("tcsetattr");
+    }
+
+    tcflush(fd, TCIFLUSH);
+
+    return fd;
+}
+
+// -------------------- Dump --------------------
+
+static int parse_cause(const char *name, uint32_t *cause)
+{
+    for (uint32_t i = 0; i < CAPTURE_CAUSES_NUMBER; ++i)
+    {
+        if (strcmp(name, capture_cause_names[i]) == 0)
+        {
+            *cause = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void parse_header(void)
+{
+    char cause[CAPTURE_LINE_SIZE];
+
+    if (sscanf(dump.line, "CAPTURE %u %u %u %63s", &dump.samples, &dump.rate_hz,
+               &dump.trigger, cause) != 4 ||
+        dump.samples == 0 || dump.samples > DUMP_SAMPLES_MAX ||
+        dump.trigger >= dump.samples || !parse_cause(cause, &dump.cause))
+    {
+        // Not a header (output of another firmware, a line cut by a
+        // reset): the next one is looked for
+        dump.skipped += dump.line_length;
+        return;
+    }
+
+    dump.data = malloc((size_t)dump.samples * CAPTURE_SAMPLE_SIZE);
+
+    if (dump.data == NULL)
+    {
+        die("malloc");
+    }
+
+    dump.stage = DUMP_SAMPLES;
+}
+
+static void parse_trailer(void)
+{
+    unsigned long sum;
+
+    // The count of missed samples is absent from the older firmware
+    if (sscanf(dump.line, "END %lu %u", &sum, &dump.missed) < 1)
+    {
+        fprintf(stderr, "capdump: no trailer after the samples\n");
+        exit(1);
+    }
+
+    if (sum != dump.sum)
+    {
+        fprintf(stderr, "capdump: sum %lu, the samples add up to %u\n", sum, dump.sum);
+        exit(1);
+    }
+
+    dump.stage = DUMP_DONE;
+}
+
+// Bytes of the line: the header is looked for from the start of a line
+static void feed_line(uint8_t byte)
+{
+    if (dump.line_length == CAPTURE_LINE_SIZE - 1)
+    {
+        dump.skipped += dump.line_length;
+        dump.line_length = 0;
+    }
+
+    dump.line[dump.line_length++] = (char)byte;
+
+    if (byte != '\n')
+    {
+        return;
+    }
+
+    dump.line[dump.line_length] = '\0';
+
+    if (dump.stage == DUMP_HEADER)
+    {
+        parse_header();
+    }
+    else
+    {
+        parse_trailer();
+    }
+
+    dump.line_length = 0;
+}
+
+static void feed(const uint8_t *bytes, size_t length)
+{
+    size_t used = 0;
+
+    while (used < length && dump.stage != DUMP_DONE)
+    {
+        if (dump.stage == DUMP_SAMPLES)
+        {
+            size_t total = (size_t)dump.samples * CAPTURE_SAMPLE_SIZE;
+            size_t count = total - dump.received < length - used ? total - dump.received
+                                                                 : length - used;
+
+            memcpy(dump.data + dump.received, bytes + used, count);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                dump.sum += bytes[used + i];
+            }
+
+            dump.received += count;
+            used += count;
+
+            if (dump.received == total)
+            {
+                dump.stage = DUMP_TRAILER;
+            }
+        }
+        else
+        {
+            if (dump.stage == DUMP_HEADER && dump.line_length == 0)
+            {
+                dump.started_ns = now_ns();
+            }
+
+            feed_line(bytes[used++]);
+        }
+    }
+}
+
+static void receive(int fd)
+{
+    static uint8_t buffer[READ_BUFFER_SIZE];
+
+    while (dump.stage != DUMP_DONE)
+    {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+
+        if (length < 0)
+        {
+            die("read");
+        }
+
+        if (length == 0)
+        {
+            fprintf(stderr, "capdump: end of input before the end of a capture\n");
+            exit(1);
+        }
+
+        feed(buffer, (size_t)length);
+    }
+
+    dump.ended_ns = now_ns();
+}
+
+// -------------------- Capture file --------------------
+
+static void write_capture(uint32_t *span_us, uint32_t *spacing_max_us)
+{
+    capture_file_header_t header;
+    capture_record_t *records = calloc(dump.samples, sizeof(records[0]));
+    FILE *file = strcmp(options.output, "-") == 0 ? stdout : fopen(options.output, "wb");
+    uint32_t time_us = 0;
+
+    if (records == NULL)
+    {
+        die("calloc");
+    }
+
+    if (file == NULL)
+    {
+        die(options.output);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_FILE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_FILE_VERSION;
+    header.record_size = sizeof(capture_record_t);
+    header.records = dump.samples;
+    header.rate_hz = dump.rate_hz;
+    header.trigger = dump.trigger;
+    header.cause = dump.cause;
+
+    *spacing_max_us = 0;
+
+    for (uint32_t i = 0; i < dump.samples; ++i)
+    {
+        const uint8_t *sample = dump.data + (size_t)i * CAPTURE_SAMPLE_SIZE;
+        uint16_t stamp = (uint16_t)(sample[0] | sample[1] << 8);
+
+        // Samples are much closer than the 65.5 ms of a wrap
+        if (i > 0)
+        {
+            const uint8_t *previous = sample - CAPTURE_SAMPLE_SIZE;
+            uint16_t spacing = (uint16_t)(stamp - (previous[0] | previous[1] << 8));
+
+            time_us += spacing;
+            *spacing_max_us = spacing > *spacing_max_us ? spacing : *spacing_max_us;
+        }
+
+        records[i].time_us = time_us;
+        records[i].x = (int8_t)sample[2];
+        records[i].y = (int8_t)sample[3];
+        records[i].flags = i == dump.trigger ? CAPTURE_RECORD_TRIGGER : 0;
+    }
+
+    *span_us = time_us;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(records, sizeof(records[0]), dump.samples, file) != dump.samples ||
+        fflush(file) != 0)
+    {
+        die(options.output);
+    }
+
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+
+    free(records);
+}
+
+// -------------------- Main --------------------
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-b baud] [-o output] source\n"
+            "  -b  baud rate of a serial line (default 9600)\n"
+            "  -o  capture file written (default capture.cap, - for stdout)\n"
+            "  source: serial device, file or pipe (- for stdin)\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t span_us;
+    uint32_t spacing_max_us;
+    uint64_t transfer_ns;
+    int option;
+    int fd;
+
+    while ((option = getopt(argc, argv, "b:o:")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            options.baud_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            options.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+    }
+
+    fd = source_open(argv[optind], options.baud_rate);
+    receive(fd);
+    write_capture(&span_us, &spacing_max_us);
+
+    transfer_ns = dump.ended_ns - dump.started_ns;
+
+    fprintf(stderr,
+            "{\"capdump\":\"%s\",\"output\":\"%s\",\"samples\":%u,\"rate_hz\":%u,"
+            "\"trigger\":%u,\"cause\":\"%s\",\"span_ms\":%.1f,\"spacing_us\":{\"mean\":%.1f,"
+            "\"max\":%u},\"missed\":%u,\"skipped_bytes\":%u,\"transfer_ms\":%.1f,"
+            "\"bytes_per_s\":%.0f}\n",
+            argv[optind], options.output, dump.samples, dump.rate_hz, dump.trigger,
+            capture_cause_names[dump.cause], span_us / 1e3,
+            dump.samples > 1 ? (double)span_us / (dump.samples - 1) : 0.0, spacing_max_us,
+            dump.missed, dump.skipped, transfer_ns / 1e6,
+            transfer_ns ? (dump.samples * CAPTURE_SAMPLE_SIZE) * 1e9 / transfer_ns : 0.0);
+
+    free(dump.data);
+
+    return 0;
+}
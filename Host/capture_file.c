@@ -0,0 +1,63 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "capture_file.h"
+
+const capture_file_header_t *capture_file_map(const char *path, size_t *size)
+{
+    const capture_file_header_t *header;
+    struct stat status;
+    void *data;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &status) < 0)
+    {
+        perror(path);
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    if ((size_t)status.st_size < sizeof(*header))
+    {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    header = data;
+    *size = (size_t)status.st_size;
+
+    if (memcmp(header->magic, CAPTURE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CAPTURE_FILE_VERSION ||
+        header->record_size != sizeof(capture_record_t) ||
+        *size < sizeof(*header) + (size_t)header->records * sizeof(capture_record_t))
+    {
+        fprintf(stderr, "%s: not a capture file of version %u\n", path,
+                CAPTURE_FILE_VERSION);
+        munmap(data, *size);
+        return NULL;
+    }
+
+    return header;
+}
+
+void capture_file_unmap(const capture_file_header_t *header, size_t size)
+{
+    munmap((void *)header, size);
+}
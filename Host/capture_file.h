@@ -0,0 +1,57 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* File of a burst capture of the Project firmware (make CAPTURE=1),
+    written by capdump: a header then fixed size records, little endian
+    as the hosts it runs on, so that a reader maps the file and uses the
+    records in place. The stamps of the board (low 16 bits of us) are
+    unwrapped into us since the first record.
+*/
+
+#define CAPTURE_FILE_MAGIC "LIS35CAP"
+#define CAPTURE_FILE_VERSION 1
+
+// Record taken at the trigger
+#define CAPTURE_RECORD_TRIGGER 0x01
+
+typedef struct
+{
+    char magic[8];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t records;
+    uint32_t rate_hz;
+    // Index of the record taken at the trigger, and its cause
+    // (capture_cause_t of Project/capture.h)
+    uint32_t trigger;
+    uint32_t cause;
+    uint32_t reserved;
+} capture_file_header_t;
+
+typedef struct
+{
+    uint32_t time_us;
+    int8_t x;
+    int8_t y;
+    uint8_t flags;
+    uint8_t reserved;
+} capture_record_t;
+
+_Static_assert(sizeof(capture_file_header_t) == 32, "capture file header is 32 bytes");
+_Static_assert(sizeof(capture_record_t) == 8, "capture record is 8 bytes");
+
+// Maps a capture file read-only and checks its header and size; NULL
+// (with a message on stderr) if it is not a capture file
+const capture_file_header_t *capture_file_map(const char *path, size_t *size);
+
+void capture_file_unmap(const capture_file_header_t *header, size_t size);
+
+static inline const capture_record_t *capture_file_records(const capture_file_header_t *header)
+{
+    return (const capture_record_t *)(header + 1);
+}
+
+#endif /* CAPTURE_FILE_H */
@@ -0,0 +1,758 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <linux/uinput.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "frame.h"
+#include "resampler.h"
+
+/* Cursor daemon: moves the mouse cursor from the accelerometer frames of
+    the Project firmware.
+    - serial line in raw non-blocking mode, driver low latency flag,
+      every readable byte is processed as soon as epoll reports it
+    - frames parsed in place, no allocation per frame
+    - the motion of all frames of one read is injected at once through
+      a uinput relative pointer (or printed with -n)
+    - FIRE, USER and MODE of the board are the left, right and middle
+      mouse buttons, injected in order with the motion
+    - with -r, the motion is resampled to the display refresh instead:
+      frames stamped on arrival, tilt interpolated between them (or
+      extrapolated a little), injected by a timer at the given rate
+    - added latency (read to injection) is measured for every frame
+*/
+
+#define READ_BUFFER_SIZE 65536
+
+// Latency histogram: 1 us buckets up to 10 ms, the last one is open
+#define LATENCY_BUCKETS 10001
+
+#define UINPUT_VENDOR 0x0483
+#define UINPUT_PRODUCT 0x5740
+
+typedef struct
+{
+    const char *device;
+    uint32_t baud_rate;
+    double gain;
+    int32_t deadzone;
+    int dry_run;
+    uint32_t stats_interval_s;
+    uint32_t refresh_hz;
+    double lag_ms;
+    double horizon_ms;
+} options_t;
+
+static options_t options = {NULL, 9600, 0.25, 2, 0, 0, 0, 25, 10};
+
+// Motion of the frames of the current read
+static struct
+{
+    double x;
+    double y;
+    uint32_t frames;
+} motion;
+
+// Fractional motion carried to the next injection
+static double remainder_x;
+static double remainder_y;
+
+// Board buttons seen as mouse buttons
+static const struct
+{
+    uint8_t mask;
+    uint16_t code;
+    const char *name;
+} mouse_buttons[] = {
+    {FRAME_BUTTON_FIRE, BTN_LEFT, "left"},
+    {FRAME_BUTTON_USER, BTN_RIGHT, "right"},
+    {FRAME_BUTTON_MODE, BTN_MIDDLE, "middle"}};
+
+#define MOUSE_BUTTONS (sizeof(mouse_buttons) / sizeof(mouse_buttons[0]))
+
+// Buttons pressed in the last frame
+static uint8_t buttons;
+
+// Resampled motion (-r): tilt of the last frames of the current read,
+// stamped once it is over, and the time of the last update
+static resampler_t resampler;
+static frame_t read_frames[RESAMPLER_HISTORY];
+static uint32_t read_frames_used;
+static double update_last_s;
+
+static struct
+{
+    uint64_t reads;
+    uint64_t injections;
+    uint64_t clicks;
+    uint64_t frames;
+    uint64_t parse_ns;
+    uint64_t updates;
+    uint64_t update_ns;
+    uint64_t latency_max_ns;
+    uint32_t latency_us[LATENCY_BUCKETS];
+} stats;
+
+static frame_parser_t parser;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+// -------------------- Serial line --------------------
+
+static speed_t baud_to_speed(uint32_t baud_rate)
+{
+    static const struct
+    {
+        uint32_t baud_rate;
+        speed_t speed;
+    } speeds[] = {
+        {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+        {115200, B115200}, {230400, B230400}, {460800, B460800},
+        {921600, B921600}, {1000000, B1000000}, {2000000, B2000000},
+        {4000000, B4000000}};
+
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); ++i)
+    {
+        if (speeds[i].baud_rate == baud_rate)
+        {
+            return speeds[i].speed;
+        }
+    }
+
+    fprintf(stderr, "cursord: unsupported baud rate %u\n", baud_rate);
+    exit(2);
+}
+
+// Open the serial line:
+// raw 8N1, reads return whatever is available, low latency flag of the
+// driver when there is one (ptys have none)
+static int serial_open(const char *device, uint32_t baud_rate)
+{
+    struct termios tty;
+    struct serial_struct serial;
+    int fd = open(device, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        die(device);
+    }
+
+    // A pipe (from boardemu -o -) needs no line settings
+    if (!isatty(fd))
+    {
+        return fd;
+    }
+
+    if (tcgetattr(fd, &tty) < 0)
+    {
+        die("tcgetattr");
+    }
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, baud_to_speed(baud_rate));
+    cfsetospeed(&tty, baud_to_speed(baud_rate));
+
+    if (tcsetattr(fd, TCSANOW, &tty) < 0)
+    {
+        die("tcsetattr");
+    }
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &serial);
+    }
+
+    tcflush(fd, TCIFLUSH);
+
+    return fd;
+}
+
+// -------------------- Injection --------------------
+
+static int uinput_open(void)
+{
+    struct uinput_setup setup;
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        die("/dev/uinput");
+    }
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_REL) < 0 ||
+        ioctl(fd, UI_SET_RELBIT, REL_X) < 0 ||
+        ioctl(fd, UI_SET_RELBIT, REL_Y) < 0)
+    {
+        die("uinput setup");
+    }
+
+    for (size_t i = 0; i < MOUSE_BUTTONS; ++i)
+    {
+        if (ioctl(fd, UI_SET_KEYBIT, mouse_buttons[i].code) < 0)
+        {
+            die("uinput setup");
+        }
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_USB;
+    setup.id.vendor = UINPUT_VENDOR;
+    setup.id.product = UINPUT_PRODUCT;
+    strcpy(setup.name, "MIMUW-MCP accelerometer");
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0)
+    {
+        die("uinput create");
+    }
+
+    return fd;
+}
+
+// Tilt to cursor speed:
+// no motion inside the dead zone, linear outside of it
+static double axis_motion(double value)
+{
+    if (value > options.deadzone)
+    {
+        return (value - options.deadzone) * options.gain;
+    }
+    else if (value < -options.deadzone)
+    {
+        return (value + options.deadzone) * options.gain;
+    }
+
+    return 0;
+}
+
+static void inject(int uinput_fd)
+{
+    struct input_event events[3];
+    int32_t dx;
+    int32_t dy;
+    uint32_t used = 0;
+
+    remainder_x += motion.x;
+    remainder_y += motion.y;
+    dx = (int32_t)remainder_x;
+    dy = (int32_t)remainder_y;
+    remainder_x -= dx;
+    remainder_y -= dy;
+
+    if (dx == 0 && dy == 0)
+    {
+        return;
+    }
+
+    stats.injections++;
+
+    if (options.dry_run)
+    {
+        printf("%d %d\n", dx, dy);
+        fflush(stdout);
+        return;
+    }
+
+    memset(events, 0, sizeof(events));
+
+    if (dx != 0)
+    {
+        events[used].type = EV_REL;
+        events[used].code = REL_X;
+        events[used].value = dx;
+        used++;
+    }
+
+    if (dy != 0)
+    {
+        events[used].type = EV_REL;
+        events[used].code = REL_Y;
+        events[used].value = dy;
+        used++;
+    }
+
+    events[used].type = EV_SYN;
+    events[used].code = SYN_REPORT;
+    used++;
+
+    if (write(uinput_fd, events, used * sizeof(events[0])) < 0 && errno != EAGAIN)
+    {
+        die("uinput write");
+    }
+}
+
+// Press and release of the mouse buttons that changed, one report
+static void click(int uinput_fd, uint8_t pressed)
+{
+    struct input_event events[MOUSE_BUTTONS + 1];
+    uint32_t used = 0;
+
+    memset(events, 0, sizeof(events));
+
+    for (size_t i = 0; i < MOUSE_BUTTONS; ++i)
+    {
+        uint8_t mask = mouse_buttons[i].mask;
+
+        if ((pressed ^ buttons) & mask)
+        {
+            events[used].type = EV_KEY;
+            events[used].code = mouse_buttons[i].code;
+            events[used].value = (pressed & mask) != 0;
+            used++;
+
+            if (options.dry_run)
+            {
+                printf("%s %d\n", mouse_buttons[i].name, (pressed & mask) != 0);
+            }
+        }
+    }
+
+    buttons = pressed;
+
+    if (used == 0)
+    {
+        return;
+    }
+
+    stats.clicks++;
+
+    if (options.dry_run)
+    {
+        fflush(stdout);
+        return;
+    }
+
+    events[used].type = EV_SYN;
+    events[used].code = SYN_REPORT;
+    used++;
+
+    if (write(uinput_fd, events, used * sizeof(events[0])) < 0 && errno != EAGAIN)
+    {
+        die("uinput write");
+    }
+}
+
+// The motion before a button change is injected first,
+// so a click lands where the cursor was when it happened; a repeated
+// frame carries no new motion
+static void on_frame(void *context, const frame_t *frame)
+{
+    int uinput_fd = *(const int *)context;
+
+    motion.frames++;
+
+    if (options.refresh_hz > 0)
+    {
+        read_frames[read_frames_used++ % RESAMPLER_HISTORY] = *frame;
+    }
+    else if (!frame->repeat)
+    {
+        motion.x += axis_motion(frame->x);
+        motion.y += axis_motion(frame->y);
+    }
+
+    if (frame->buttons != buttons)
+    {
+        inject(uinput_fd);
+        motion.x = 0;
+        motion.y = 0;
+        click(uinput_fd, frame->buttons);
+    }
+}
+
+// -------------------- Resampling --------------------
+
+// The last frame of a read ended when the read returned, the ones
+// before it one frame time on the line earlier each; repeated frames
+// hold no new reading and are left out
+static void stamp_frames(uint64_t received_ns)
+{
+    double frame_s = FRAME_LENGTH * 10.0 / options.baud_rate;
+    uint32_t kept = read_frames_used < RESAMPLER_HISTORY ? read_frames_used
+                                                         : RESAMPLER_HISTORY;
+
+    for (uint32_t i = read_frames_used - kept; i < read_frames_used; ++i)
+    {
+        const frame_t *frame = &read_frames[i % RESAMPLER_HISTORY];
+
+        if (frame->repeat)
+        {
+            continue;
+        }
+
+        resampler_push(&resampler,
+                       received_ns / 1e9 - (read_frames_used - 1 - i) * frame_s,
+                       frame->x, frame->y);
+    }
+}
+
+// One display refresh: the tilt now, as a speed in pixels per frame
+// period, moves the cursor for the time since the last refresh
+static void update(int uinput_fd)
+{
+    uint64_t start = now_ns();
+    double now_s = start / 1e9;
+    double elapsed_s = now_s - update_last_s;
+    double x;
+    double y;
+
+    update_last_s = now_s;
+
+    if (!resampler_sample(&resampler, now_s, &x, &y) || resampler.period_s <= 0)
+    {
+        return;
+    }
+
+    // Back from a pause, one refresh at most
+    if (elapsed_s > 2.0 / options.refresh_hz)
+    {
+        elapsed_s = 1.0 / options.refresh_hz;
+    }
+
+    motion.x = axis_motion(x) * elapsed_s / resampler.period_s;
+    motion.y = axis_motion(y) * elapsed_s / resampler.period_s;
+    inject(uinput_fd);
+
+    stats.updates++;
+    stats.update_ns += now_ns() - start;
+}
+
+// -------------------- Statistics --------------------
+
+static uint64_t latency_percentile(uint32_t percent)
+{
+    uint64_t target = (stats.frames * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (uint32_t us = 0; us < LATENCY_BUCKETS; ++us)
+    {
+        seen += stats.latency_us[us];
+
+        if (seen >= target && seen > 0)
+        {
+            return us;
+        }
+    }
+
+    return 0;
+}
+
+static void print_stats(void)
+{
+    fprintf(stderr,
+            "{\"frames\":%llu,\"repeats\":%llu,\"errors\":%llu,\"dropped_bytes\":%llu,"
+            "\"reads\":%llu,\"injections\":%llu,\"clicks\":%llu,"
+            "\"parse_ns_per_frame\":%.1f,\"updates\":%llu,\"update_ns\":%.1f,"
+            "\"latency_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%.1f}}\n",
+            (unsigned long long)parser.frames,
+            (unsigned long long)parser.repeats,
+            (unsigned long long)parser.errors,
+            (unsigned long long)parser.dropped_bytes,
+            (unsigned long long)stats.reads,
+            (unsigned long long)stats.injections,
+            (unsigned long long)stats.clicks,
+            stats.frames ? (double)stats.parse_ns / stats.frames : 0.0,
+            (unsigned long long)stats.updates,
+            stats.updates ? (double)stats.update_ns / stats.updates : 0.0,
+            (unsigned long long)latency_percentile(50),
+            (unsigned long long)latency_percentile(99),
+            stats.latency_max_ns / 1e3);
+}
+
+// Every frame of a read waits from the end of the read to the injection
+static void record_latency(uint64_t latency_ns, uint32_t frames)
+{
+    uint64_t us = latency_ns / 1000;
+
+    stats.latency_us[us < LATENCY_BUCKETS ? us : LATENCY_BUCKETS - 1] += frames;
+    stats.frames += frames;
+
+    if (latency_ns > stats.latency_max_ns)
+    {
+        stats.latency_max_ns = latency_ns;
+    }
+}
+
+// -------------------- Main loop --------------------
+
+// Drain the serial line:
+// returns 0 when the other end hung up
+static int serial_readable(int serial_fd, int uinput_fd)
+{
+    static uint8_t buffer[READ_BUFFER_SIZE];
+
+    for (;;)
+    {
+        ssize_t length = read(serial_fd, buffer, sizeof(buffer));
+        uint64_t received;
+        uint64_t parsed;
+
+        if (length < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+            {
+                return 1;
+            }
+            if (errno == EIO)
+            {
+                return 0;
+            }
+            die("read");
+        }
+        if (length == 0)
+        {
+            return 1;
+        }
+
+        received = now_ns();
+        stats.reads++;
+
+        motion.x = 0;
+        motion.y = 0;
+        motion.frames = 0;
+        read_frames_used = 0;
+        frame_parser_feed(&parser, buffer, (size_t)length, on_frame, &uinput_fd);
+        parsed = now_ns();
+
+        if (motion.frames == 0)
+        {
+            continue;
+        }
+
+        if (options.refresh_hz > 0)
+        {
+            stamp_frames(received);
+            stats.parse_ns += parsed - received;
+            stats.frames += motion.frames;
+            continue;
+        }
+
+        inject(uinput_fd);
+
+        stats.parse_ns += parsed - received;
+        record_latency(now_ns() - received, motion.frames);
+    }
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-b baud] [-g gain] [-z deadzone] [-s stats_s] [-n]\n"
+            "          [-r refresh_hz [-l lag_ms] [-p horizon_ms]] device\n"
+            "  -g  cursor pixels per frame and digit of tilt (default 0.25)\n"
+            "  -z  tilt ignored around level, in digits (default 2)\n"
+            "  -s  print statistics every stats_s seconds (default at exit)\n"
+            "  -n  print the motion and clicks instead of moving the cursor\n"
+            "  -r  move the cursor refresh_hz times per second, resampled\n"
+            "  -l  resampling lag behind the frames (default 25)\n"
+            "  -p  longest extrapolation past the newest frame (default 10)\n",
+            program);
+    exit(2);
+}
+
+static int add_watch(int epoll_fd, int fd)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int main(int argc, char **argv)
+{
+    sigset_t signals;
+    int option;
+    int serial_fd;
+    int uinput_fd = -1;
+    int signal_fd;
+    int timer_fd = -1;
+    int update_fd = -1;
+    int epoll_fd;
+    int running = 1;
+
+    while ((option = getopt(argc, argv, "b:g:z:s:nr:l:p:")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            options.baud_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            options.gain = strtod(optarg, NULL);
+            break;
+        case 'z':
+            options.deadzone = strtol(optarg, NULL, 0);
+            break;
+        case 's':
+            options.stats_interval_s = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            options.dry_run = 1;
+            break;
+        case 'r':
+            options.refresh_hz = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            options.lag_ms = strtod(optarg, NULL);
+            break;
+        case 'p':
+            options.horizon_ms = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || options.lag_ms < 0 || options.horizon_ms < 0)
+    {
+        usage(argv[0]);
+    }
+    options.device = argv[optind];
+
+    frame_parser_init(&parser);
+    resampler_init(&resampler, options.lag_ms / 1e3, options.horizon_ms / 1e3);
+    serial_fd = serial_open(options.device, options.baud_rate);
+
+    if (!options.dry_run)
+    {
+        uinput_fd = uinput_open();
+    }
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (signal_fd < 0 || epoll_fd < 0 ||
+        add_watch(epoll_fd, serial_fd) < 0 || add_watch(epoll_fd, signal_fd) < 0)
+    {
+        die("epoll");
+    }
+
+    if (options.stats_interval_s > 0)
+    {
+        struct itimerspec interval = {{options.stats_interval_s, 0}, {options.stats_interval_s, 0}};
+
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+        if (timer_fd < 0 || timerfd_settime(timer_fd, 0, &interval, NULL) < 0 ||
+            add_watch(epoll_fd, timer_fd) < 0)
+        {
+            die("timerfd");
+        }
+    }
+
+    if (options.refresh_hz > 0)
+    {
+        long period_ns = 1000000000L / options.refresh_hz;
+        struct itimerspec interval = {{0, period_ns}, {0, period_ns}};
+
+        update_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+        if (update_fd < 0 || timerfd_settime(update_fd, 0, &interval, NULL) < 0 ||
+            add_watch(epoll_fd, update_fd) < 0)
+        {
+            die("timerfd");
+        }
+
+        update_last_s = now_ns() / 1e9;
+    }
+
+    while (running)
+    {
+        struct epoll_event events[5];
+        int ready = epoll_wait(epoll_fd, events, 5, -1);
+
+        if (ready < 0 && errno != EINTR)
+        {
+            die("epoll_wait");
+        }
+
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == serial_fd)
+            {
+                if (!serial_readable(serial_fd, uinput_fd) ||
+                    (events[i].events & (EPOLLHUP | EPOLLERR)))
+                {
+                    // Board unplugged or the pty closed
+                    running = 0;
+                }
+            }
+            else if (fd == signal_fd)
+            {
+                struct signalfd_siginfo info;
+
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info) &&
+                    info.ssi_signo == SIGUSR1)
+                {
+                    print_stats();
+                }
+                else
+                {
+                    running = 0;
+                }
+            }
+            else if (fd == timer_fd)
+            {
+                uint64_t expirations;
+
+                if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+                {
+                    print_stats();
+                }
+            }
+            else if (fd == update_fd)
+            {
+                uint64_t expirations;
+
+                if (read(update_fd, &expirations, sizeof(expirations)) > 0)
+                {
+                    update(uinput_fd);
+                }
+            }
+        }
+    }
+
+    print_stats();
+
+    if (uinput_fd >= 0)
+    {
+        ioctl(uinput_fd, UI_DEV_DESTROY);
+        close(uinput_fd);
+    }
+
+    return 0;
+}
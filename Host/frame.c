@@ -0,0 +1,183 @@
+#include "frame.h"
+
+#define FRAME_POSITION_Y 4
+#define FRAME_POSITION_B 8
+#define FRAME_POSITION_CR 12
+#define FRAME_POSITION_LF 13
+
+void frame_parser_init(frame_parser_t *parser)
+{
+    parser->position = 0;
+    parser->x = 0;
+    parser->y = 0;
+    parser->buttons = 0;
+    parser->repeat = 0;
+    parser->frames = 0;
+    parser->repeats = 0;
+    parser->errors = 0;
+    parser->dropped_bytes = 0;
+}
+
+// Unexpected byte:
+// the partial frame is dropped, c may start the next one
+static void resync(frame_parser_t *parser, uint8_t c)
+{
+    parser->errors++;
+    parser->dropped_bytes += parser->position;
+
+    if (c == 'X')
+    {
+        parser->position = 1;
+        parser->x = 0;
+    }
+    else
+    {
+        parser->position = 0;
+        parser->dropped_bytes++;
+    }
+}
+
+size_t frame_parser_feed(frame_parser_t *parser, const uint8_t *data,
+                         size_t length, frame_callback_t on_frame,
+                         void *context)
+{
+    uint32_t position = parser->position;
+    size_t found = 0;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint8_t c = data[i];
+        uint32_t digit = (uint32_t)c - '0';
+
+        switch (position)
+        {
+        case 0:
+            if (c == 'X')
+            {
+                parser->x = 0;
+                position = 1;
+            }
+            else
+            {
+                parser->dropped_bytes++;
+            }
+            continue;
+
+        case 1:
+        case 2:
+        case 3:
+            if (digit < 10)
+            {
+                parser->x = 10 * parser->x + digit;
+                position++;
+                continue;
+            }
+            break;
+
+        case FRAME_POSITION_Y:
+            if (c == 'Y')
+            {
+                parser->y = 0;
+                position++;
+                continue;
+            }
+            break;
+
+        case 5:
+        case 6:
+        case 7:
+            if (digit < 10)
+            {
+                parser->y = 10 * parser->y + digit;
+                position++;
+                continue;
+            }
+            break;
+
+        case FRAME_POSITION_B:
+            parser->buttons = 0;
+            parser->repeat = c == 'R';
+
+            if (c == 'B' || c == 'R')
+            {
+                position++;
+                continue;
+            }
+            // Former frame without buttons
+            if (c == '\r')
+            {
+                position = FRAME_POSITION_LF;
+                continue;
+            }
+            break;
+
+        case 9:
+        case 10:
+        case 11:
+            if (digit < 10)
+            {
+                parser->buttons = 10 * parser->buttons + digit;
+                position++;
+                continue;
+            }
+            break;
+
+        case FRAME_POSITION_CR:
+            if (c == '\r')
+            {
+                position++;
+                continue;
+            }
+            break;
+
+        case FRAME_POSITION_LF:
+            if (c == '\n' && parser->x <= 255 && parser->y <= 255 &&
+                parser->buttons <= 255)
+            {
+                frame_t frame = {(int8_t)(uint8_t)parser->x, (int8_t)(uint8_t)parser->y,
+                                 (uint8_t)parser->buttons, (uint8_t)parser->repeat};
+
+                position = 0;
+                parser->frames++;
+                parser->repeats += parser->repeat;
+                found++;
+                on_frame(context, &frame);
+                continue;
+            }
+            break;
+        }
+
+        parser->position = position;
+        resync(parser, c);
+        position = parser->position;
+    }
+
+    parser->position = position;
+
+    return found;
+}
+
+// Zero-padded decimal of the register value, as write_to_buffer does
+static void format_value(uint8_t value, char *out)
+{
+    uint32_t digits = value;
+
+    out[2] = (char)('0' + digits % 10);
+    digits /= 10;
+    out[1] = (char)('0' + digits % 10);
+    out[0] = (char)('0' + digits / 10);
+}
+
+size_t frame_format(const frame_t *frame, char *out)
+{
+    out[0] = 'X';
+    format_value((uint8_t)frame->x, out + 1);
+    out[FRAME_POSITION_Y] = 'Y';
+    format_value((uint8_t)frame->y, out + FRAME_POSITION_Y + 1);
+    out[FRAME_POSITION_B] = frame->repeat ? 'R' : 'B';
+    format_value(frame->buttons, out + FRAME_POSITION_B + 1);
+    out[FRAME_POSITION_CR] = '\r';
+    out[FRAME_POSITION_LF] = '\n';
+
+    return FRAME_LENGTH;
+}
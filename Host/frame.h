@@ -0,0 +1,71 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../Common/button_table.h"
+
+/* Frames sent by the Project firmware:
+    XnnnYnnnBnnn\r\n, nnn being the zero-padded decimal value of the OUT_X
+    and OUT_Y registers of the LIS35DE (two's complement, 18 mg/digit)
+    and of the mask of the pressed buttons (bit BUTTON_<name>
+    of Common/button_table.h)
+    A streaming firmware sends XnnnYnnnRnnn\r\n for a frame it sent
+    already, between two readings of the accelerometer: its motion is
+    not new.
+    The former XnnnYnnn\r\n frames are still parsed, with no button.
+*/
+
+#define FRAME_LENGTH 14
+
+// FRAME_BUTTON_<name>: bit of a button in the mask of the frames
+#define FRAME_BUTTON_BIT(name, port, pin, active_high) FRAME_BUTTON_##name = 1U << BUTTON_##name,
+
+enum
+{
+    BOARD_BUTTONS(FRAME_BUTTON_BIT)
+};
+
+#undef FRAME_BUTTON_BIT
+
+// The mask is sent as 3 decimal digits in a uint8_t
+_Static_assert(BUTTONS_NUMBER <= 8, "buttons mask wider than a frame");
+
+typedef struct
+{
+    int8_t x;
+    int8_t y;
+    uint8_t buttons;
+    uint8_t repeat;
+} frame_t;
+
+// Streaming parser: keeps the partial frame between reads, resynchronizes
+// on the next 'X' after any unexpected byte
+typedef struct
+{
+    uint32_t position;
+    uint32_t x;
+    uint32_t y;
+    uint32_t buttons;
+    uint32_t repeat;
+
+    uint64_t frames;
+    uint64_t repeats;
+    uint64_t errors;
+    uint64_t dropped_bytes;
+} frame_parser_t;
+
+typedef void (*frame_callback_t)(void *context, const frame_t *frame);
+
+void frame_parser_init(frame_parser_t *parser);
+
+// Parses length bytes, calls on_frame for every complete frame;
+// returns the number of frames found
+size_t frame_parser_feed(frame_parser_t *parser, const uint8_t *data,
+                         size_t length, frame_callback_t on_frame,
+                         void *context);
+
+// Writes the frame in the firmware format, returns FRAME_LENGTH
+size_t frame_format(const frame_t *frame, char *out);
+
+#endif /* FRAME_H */
@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../Project/sample_pipeline.h"
+#include "capture_file.h"
+#include "frame.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+/* Replay of accelerometer recordings through the sample pipeline of the
+    Project firmware (Project/sample_pipeline.c, the same code as on the
+    board), at full speed.
+    - input: CSV (x,y or time,x,y per line), binary (int8 x, int8 y
+      pairs), a capture of the frames sent by the board, whose button
+      changes are replayed too, or a burst capture file of capdump
+    - reports samples/s, ns and host cycles per sample
+    - output written to a file and/or compared with a golden file
+*/
+
+#define MIN_TIMED_NS 200000000ULL
+
+typedef enum
+{
+    FORMAT_CSV,
+    FORMAT_BINARY,
+    FORMAT_FRAMES,
+    FORMAT_CAPTURE
+} input_format_t;
+
+static const char *const format_names[] = {"csv", "bin", "frames", "cap"};
+
+typedef struct
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t buttons;
+} sample_t;
+
+static sample_t *samples;
+static size_t samples_used;
+static size_t samples_capacity;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+// -------------------- Input --------------------
+
+static void add_sample(uint8_t x, uint8_t y, uint8_t buttons)
+{
+    if (samples_used == samples_capacity)
+    {
+        samples_capacity = samples_capacity ? 2 * samples_capacity : 4096;
+        samples = realloc(samples, samples_capacity * sizeof(samples[0]));
+
+        if (samples == NULL)
+        {
+            die("realloc");
+        }
+    }
+
+    samples[samples_used].x = x;
+    samples[samples_used].y = y;
+    samples[samples_used].buttons = buttons;
+    samples_used++;
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t capacity = 0;
+
+    if (file == NULL)
+    {
+        die(path);
+    }
+
+    *size = 0;
+
+    for (;;)
+    {
+        size_t length;
+
+        if (*size == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 65536;
+            data = realloc(data, capacity);
+
+            if (data == NULL)
+            {
+                die("realloc");
+            }
+        }
+
+        length = fread(data + *size, 1, capacity - *size, file);
+
+        if (length == 0)
+        {
+            break;
+        }
+        *size += length;
+    }
+
+    if (ferror(file))
+    {
+        die(path);
+    }
+
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+
+    return data;
+}
+
+// CSV: the last two columns are X and Y, as signed tilt (-128..127) or
+// register values (0..255); lines without numbers (headers) are skipped
+static void parse_csv(char *text)
+{
+    char *line = strtok(text, "\n");
+
+    while (line != NULL)
+    {
+        long columns[3];
+        int used = 0;
+        char *cursor = line;
+
+        while (used < 3)
+        {
+            char *end;
+            long value = strtol(cursor, &end, 10);
+
+            if (end == cursor)
+            {
+                break;
+            }
+
+            columns[used++] = value;
+            cursor = end + strspn(end, " \t,;\r");
+        }
+
+        if (used >= 2)
+        {
+            add_sample((uint8_t)columns[used - 2], (uint8_t)columns[used - 1], 0);
+        }
+
+        line = strtok(NULL, "\n");
+    }
+}
+
+static void on_frame(void *context, const frame_t *frame)
+{
+    (void)context;
+    add_sample((uint8_t)frame->x, (uint8_t)frame->y, frame->buttons);
+}
+
+static input_format_t format_of(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+
+    if (extension && strcmp(extension, ".csv") == 0)
+    {
+        return FORMAT_CSV;
+    }
+    if (extension && strcmp(extension, ".bin") == 0)
+    {
+        return FORMAT_BINARY;
+    }
+    if (extension && strcmp(extension, ".cap") == 0)
+    {
+        return FORMAT_CAPTURE;
+    }
+
+    return FORMAT_FRAMES;
+}
+
+// Burst capture file: its records are used in place
+static void load_capture(const char *path)
+{
+    size_t size;
+    const capture_file_header_t *header = capture_file_map(path, &size);
+    const capture_record_t *records;
+
+    if (header == NULL)
+    {
+        exit(1);
+    }
+
+    records = capture_file_records(header);
+
+    for (uint32_t i = 0; i < header->records; ++i)
+    {
+        add_sample((uint8_t)records[i].x, (uint8_t)records[i].y, 0);
+    }
+
+    capture_file_unmap(header, size);
+}
+
+static void load(const char *path, input_format_t format)
+{
+    size_t size;
+    uint8_t *data;
+    frame_parser_t parser;
+
+    if (format == FORMAT_CAPTURE)
+    {
+        load_capture(path);
+        return;
+    }
+
+    data = read_file(path, &size);
+
+    switch (format)
+    {
+    case FORMAT_CSV:
+        data = realloc(data, size + 1);
+        data[size] = '\0';
+        parse_csv((char *)data);
+        break;
+
+    case FORMAT_BINARY:
+        for (size_t i = 0; i + 1 < size; i += 2)
+        {
+            add_sample(data[i], data[i + 1], 0);
+        }
+        break;
+
+    case FORMAT_FRAMES:
+        frame_parser_init(&parser);
+        frame_parser_feed(&parser, data, size, on_frame, NULL);
+
+        if (parser.errors != 0)
+        {
+            fprintf(stderr, "replay: %llu malformed frames skipped\n",
+                    (unsigned long long)parser.errors);
+        }
+        break;
+
+    case FORMAT_CAPTURE:
+        // Mapped by load_capture, never read
+        break;
+    }
+
+    free(data);
+}
+
+// -------------------- Pipeline --------------------
+
+// One pass over the recording, as the board does it: X at the update
+// event, Y at the compare event, then the frame is sent; the buttons
+// are written when they change, as from the EXTI interrupts
+static void run_pass(sample_pipeline_t *pipeline, char *out)
+{
+    uint8_t buttons = 0;
+
+    sample_pipeline_buttons(pipeline, buttons);
+
+    for (size_t i = 0; i < samples_used; ++i)
+    {
+        if (samples[i].buttons != buttons)
+        {
+            buttons = samples[i].buttons;
+            sample_pipeline_buttons(pipeline, buttons);
+        }
+
+        sample_pipeline_push(pipeline, SAMPLE_AXIS_X, samples[i].x);
+        sample_pipeline_push(pipeline, SAMPLE_AXIS_Y, samples[i].y);
+        memcpy(out + i * FRAME_LENGTH, pipeline->frame, FRAME_LENGTH);
+    }
+}
+
+// First difference with the golden output, reported by frame;
+// returns 1 if they are identical
+static int golden_compare(const char *path, const char *output, size_t size)
+{
+    size_t golden_size;
+    uint8_t *golden = read_file(path, &golden_size);
+    size_t common = size < golden_size ? size : golden_size;
+    int identical = size == golden_size;
+
+    for (size_t i = 0; i < common; ++i)
+    {
+        if ((uint8_t)output[i] != golden[i])
+        {
+            size_t frame = i / FRAME_LENGTH;
+
+            fprintf(stderr, "replay: frame %zu differs: got %.*s, golden %.*s\n",
+                    frame, FRAME_LENGTH - 2, output + frame * FRAME_LENGTH,
+                    FRAME_LENGTH - 2,
+                    (const char *)golden + frame * FRAME_LENGTH);
+            identical = 0;
+            break;
+        }
+    }
+
+    if (size != golden_size)
+    {
+        fprintf(stderr, "replay: %zu frames, golden has %zu\n",
+                size / FRAME_LENGTH, golden_size / FRAME_LENGTH);
+    }
+
+    free(golden);
+
+    return identical;
+}
+
+static void write_output(const char *path, const char *output, size_t size)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+
+    if (file == NULL || fwrite(output, 1, size, file) != size || fflush(file) != 0)
+    {
+        die(path);
+    }
+
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-f csv|bin|frames|cap] [-o output] [-g golden] [-n passes]\n"
+            "          recording\n"
+            "  -f  input format, by default from the extension (.csv, .bin,\n"
+            "      .cap, anything else is a capture of frames)\n"
+            "  -o  write the frames produced (- for stdout)\n"
+            "  -g  compare the frames produced with a golden file, exit 1 if\n"
+            "      they differ\n"
+            "  -n  timed passes (default: as many as fit in 200 ms)\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *output_path = NULL;
+    const char *golden_path = NULL;
+    input_format_t format;
+    int format_set = 0;
+    uint32_t passes = 0;
+    sample_pipeline_t pipeline;
+    char *output;
+    char *scratch;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t cycles = 0;
+    uint32_t done = 0;
+    int golden_match = -1;
+    int option;
+
+    while ((option = getopt(argc, argv, "f:o:g:n:")) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            for (format = FORMAT_CSV; format <= FORMAT_CAPTURE; ++format)
+            {
+                if (strcmp(optarg, format_names[format]) == 0)
+                {
+                    break;
+                }
+            }
+            if (format > FORMAT_CAPTURE)
+            {
+                usage(argv[0]);
+            }
+            format_set = 1;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'g':
+            golden_path = optarg;
+            break;
+        case 'n':
+            passes = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+    }
+
+    if (!format_set)
+    {
+        format = format_of(argv[optind]);
+    }
+
+    load(argv[optind], format);
+
+    output = malloc(samples_used * FRAME_LENGTH + 1);
+    scratch = malloc(samples_used * FRAME_LENGTH + 1);
+
+    if (output == NULL || scratch == NULL)
+    {
+        die("malloc");
+    }
+
+    // Output of a fresh pipeline, then timed passes over the same data
+    sample_pipeline_init(&pipeline);
+    run_pass(&pipeline, output);
+
+    start = now_ns();
+#ifdef HAVE_CYCLE_COUNTER
+    cycles = __rdtsc();
+#endif
+
+    do
+    {
+        run_pass(&pipeline, scratch);
+        done++;
+        elapsed = now_ns() - start;
+    } while (samples_used > 0 && (passes ? done < passes : elapsed < MIN_TIMED_NS));
+
+#ifdef HAVE_CYCLE_COUNTER
+    cycles = __rdtsc() - cycles;
+#endif
+
+    if (output_path)
+    {
+        write_output(output_path, output, samples_used * FRAME_LENGTH);
+    }
+
+    if (golden_path)
+    {
+        golden_match = golden_compare(golden_path, output, samples_used * FRAME_LENGTH);
+    }
+
+    fprintf(stderr,
+            "{\"replay\":\"%s\",\"format\":\"%s\",\"samples\":%zu,\"passes\":%u,"
+            "\"samples_per_s\":%.0f,\"ns_per_sample\":%.2f,",
+            argv[optind], format_names[format], samples_used, done,
+            elapsed ? (double)samples_used * done * 1e9 / elapsed : 0.0,
+            samples_used ? (double)elapsed / ((double)samples_used * done) : 0.0);
+
+#ifdef HAVE_CYCLE_COUNTER
+    fprintf(stderr, "\"cycles_per_sample\":%.2f,",
+            samples_used ? (double)cycles / ((double)samples_used * done) : 0.0);
+#else
+    fprintf(stderr, "\"cycles_per_sample\":null,");
+#endif
+
+    fprintf(stderr, "\"golden\":%s}\n",
+            golden_match < 0 ? "null" : golden_match ? "\"match\"" : "\"differs\"");
+
+    return golden_match == 0 ? 1 : 0;
+}
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "frame.h"
+#include "resampler.h"
+
+/* Accuracy and cost of the resampling of cursord (-r), offline.
+    - input: a capture of frames taken at a high rate (boardemu -f 1000),
+      the ground truth of the tilt
+    - the frames the board would send at its rate are picked from it and
+      stamped at their arrival, one frame time on the link later
+    - the tilt is resampled at the display refresh and compared with the
+      truth at the same time, as is the newest frame held until the next
+      one (cursord without -r)
+    - reports the error (RMS and max, in digits of tilt), the largest step
+      between two refreshes and the ns per refresh
+*/
+
+#define MIN_TIMED_NS 200000000ULL
+
+typedef struct
+{
+    double x;
+    double y;
+} tilt_t;
+
+typedef struct
+{
+    double capture_hz;
+    double frame_hz;
+    double refresh_hz;
+    double lag_ms;
+    double horizon_ms;
+    uint32_t baud_rate;
+    uint32_t passes;
+} options_t;
+
+static options_t options = {1000, 40, 144, 25, 10, 9600, 0};
+
+static frame_t *captured;
+static size_t captured_used;
+static size_t captured_capacity;
+
+// Frames sent by the board: index in the capture and arrival time
+static size_t *sent_index;
+static double *sent_time_s;
+static size_t sent_used;
+
+static tilt_t *resampled;
+static tilt_t *scratch;
+static size_t refreshes;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+// -------------------- Input --------------------
+
+static void on_frame(void *context, const frame_t *frame)
+{
+    (void)context;
+
+    if (captured_used == captured_capacity)
+    {
+        captured_capacity = captured_capacity ? 2 * captured_capacity : 4096;
+        captured = realloc(captured, captured_capacity * sizeof(captured[0]));
+
+        if (captured == NULL)
+        {
+            die("realloc");
+        }
+    }
+
+    captured[captured_used++] = *frame;
+}
+
+static void load(const char *path)
+{
+    static uint8_t chunk[65536];
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    frame_parser_t parser;
+    size_t length;
+
+    if (file == NULL)
+    {
+        die(path);
+    }
+
+    frame_parser_init(&parser);
+
+    while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        frame_parser_feed(&parser, chunk, length, on_frame, NULL);
+    }
+
+    if (ferror(file))
+    {
+        die(path);
+    }
+
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+}
+
+// The frames the board sends at frame_hz, each one arriving a frame
+// time on the link after its sampling
+static void pick_sent(void)
+{
+    double link_s = FRAME_LENGTH * 10.0 / options.baud_rate;
+
+    sent_index = malloc((captured_used + 1) * sizeof(sent_index[0]));
+    sent_time_s = malloc((captured_used + 1) * sizeof(sent_time_s[0]));
+
+    if (sent_index == NULL || sent_time_s == NULL)
+    {
+        die("malloc");
+    }
+
+    for (size_t i = 0;; ++i)
+    {
+        size_t index = (size_t)llround(i * options.capture_hz / options.frame_hz);
+
+        if (index >= captured_used)
+        {
+            break;
+        }
+
+        sent_index[sent_used] = index;
+        sent_time_s[sent_used] = index / options.capture_hz + link_s;
+        sent_used++;
+    }
+}
+
+static double refresh_time(size_t refresh)
+{
+    return sent_time_s[0] + refresh / options.refresh_hz;
+}
+
+// -------------------- Resampling --------------------
+
+// One pass as cursord does it: the frames arrived by each refresh are
+// pushed, then the tilt is sampled
+static void run_pass(tilt_t *out)
+{
+    resampler_t resampler;
+    size_t next = 0;
+
+    resampler_init(&resampler, options.lag_ms / 1e3, options.horizon_ms / 1e3);
+
+    for (size_t i = 0; i < refreshes; ++i)
+    {
+        double time_s = refresh_time(i);
+
+        while (next < sent_used && sent_time_s[next] <= time_s)
+        {
+            const frame_t *frame = &captured[sent_index[next]];
+
+            resampler_push(&resampler, sent_time_s[next], frame->x, frame->y);
+            next++;
+        }
+
+        resampler_sample(&resampler, time_s, &out[i].x, &out[i].y);
+    }
+}
+
+// -------------------- Accuracy --------------------
+
+typedef struct
+{
+    double square_sum;
+    double max;
+    double step_max;
+    tilt_t last;
+} accuracy_t;
+
+// Tilt of the capture at a time, between its two frames
+static tilt_t truth(double time_s)
+{
+    double position = time_s * options.capture_hz;
+    size_t index = (size_t)position;
+    double weight = position - index;
+    tilt_t tilt;
+
+    if (index + 1 >= captured_used)
+    {
+        index = captured_used - 1;
+        weight = 0;
+    }
+
+    tilt.x = captured[index].x +
+             (captured[index + (weight > 0)].x - captured[index].x) * weight;
+    tilt.y = captured[index].y +
+             (captured[index + (weight > 0)].y - captured[index].y) * weight;
+
+    return tilt;
+}
+
+static void error_add(accuracy_t *error, size_t refresh, tilt_t value, tilt_t expected)
+{
+    double dx = value.x - expected.x;
+    double dy = value.y - expected.y;
+    double distance = sqrt(dx * dx + dy * dy);
+
+    error->square_sum += distance * distance;
+    error->max = distance > error->max ? distance : error->max;
+
+    if (refresh > 0)
+    {
+        double step = hypot(value.x - error->last.x, value.y - error->last.y);
+
+        error->step_max = step > error->step_max ? step : error->step_max;
+    }
+
+    error->last = value;
+}
+
+static void print_error(const char *name, const accuracy_t *error)
+{
+    fprintf(stderr, ",\"%s\":{\"rms\":%.3f,\"max\":%.3f,\"step_max\":%.3f}", name,
+            refreshes ? sqrt(error->square_sum / refreshes) : 0.0, error->max,
+            error->step_max);
+}
+
+static void compare(void)
+{
+    accuracy_t resampled_error = {0};
+    accuracy_t hold_error = {0};
+    size_t newest = 0;
+
+    for (size_t i = 0; i < refreshes; ++i)
+    {
+        double time_s = refresh_time(i);
+        tilt_t expected = truth(time_s);
+        tilt_t hold;
+
+        while (newest + 1 < sent_used && sent_time_s[newest + 1] <= time_s)
+        {
+            newest++;
+        }
+
+        hold.x = captured[sent_index[newest]].x;
+        hold.y = captured[sent_index[newest]].y;
+
+        error_add(&resampled_error, i, resampled[i], expected);
+        error_add(&hold_error, i, hold, expected);
+    }
+
+    print_error("error_digits", &resampled_error);
+    print_error("hold_error_digits", &hold_error);
+}
+
+// -------------------- Main --------------------
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-c capture_hz] [-f frame_hz] [-r refresh_hz] [-l lag_ms]\n"
+            "          [-p horizon_ms] [-b baud] [-n passes] capture\n"
+            "  -c  rate of the capture (default 1000)\n"
+            "  -f  rate of the frames sent by the board (default 40)\n"
+            "  -r  display refresh (default 144)\n"
+            "  -l  resampling lag behind the frames (default 25)\n"
+            "  -p  longest extrapolation past the newest frame (default 10)\n"
+            "  -b  baud rate of the link, for the arrival times (default 9600)\n"
+            "  -n  timed passes (default: as many as fit in 200 ms)\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t start;
+    uint64_t elapsed;
+    uint32_t done = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:f:r:l:p:b:n:")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            options.capture_hz = strtod(optarg, NULL);
+            break;
+        case 'f':
+            options.frame_hz = strtod(optarg, NULL);
+            break;
+        case 'r':
+            options.refresh_hz = strtod(optarg, NULL);
+            break;
+        case 'l':
+            options.lag_ms = strtod(optarg, NULL);
+            break;
+        case 'p':
+            options.horizon_ms = strtod(optarg, NULL);
+            break;
+        case 'b':
+            options.baud_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            options.passes = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || options.capture_hz <= 0 || options.frame_hz <= 0 ||
+        options.frame_hz > options.capture_hz || options.refresh_hz <= 0 ||
+        options.lag_ms < 0 || options.horizon_ms < 0 || options.baud_rate == 0)
+    {
+        usage(argv[0]);
+    }
+
+    load(argv[optind]);
+    pick_sent();
+
+    if (sent_used > 0)
+    {
+        double span_s = captured_used / options.capture_hz - sent_time_s[0];
+
+        refreshes = span_s > 0 ? (size_t)(span_s * options.refresh_hz) : 0;
+    }
+
+    resampled = malloc((refreshes + 1) * sizeof(resampled[0]));
+    scratch = malloc((refreshes + 1) * sizeof(scratch[0]));
+
+    if (resampled == NULL || scratch == NULL)
+    {
+        die("malloc");
+    }
+
+    run_pass(resampled);
+
+    start = now_ns();
+
+    do
+    {
+        run_pass(scratch);
+        done++;
+        elapsed = now_ns() - start;
+    } while (refreshes > 0 &&
+             (options.passes ? done < options.passes : elapsed < MIN_TIMED_NS));
+
+    fprintf(stderr,
+            "{\"resample\":\"%s\",\"capture_hz\":%.0f,\"frame_hz\":%.0f,"
+            "\"refresh_hz\":%.0f,\"lag_ms\":%.1f,\"horizon_ms\":%.1f,"
+            "\"frames\":%zu,\"refreshes\":%zu,\"passes\":%u,\"ns_per_refresh\":%.2f",
+            argv[optind], options.capture_hz, options.frame_hz, options.refresh_hz,
+            options.lag_ms, options.horizon_ms, sent_used, refreshes, done,
+            refreshes ? (double)elapsed / ((double)refreshes * done) : 0.0);
+
+    compare();
+
+    fprintf(stderr, "}\n");
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "resampler.h"
+
+// Weight of a new interval in the frame period
+#define PERIOD_WEIGHT (1.0 / 8)
+
+#define SLOT(index) ((index) % RESAMPLER_HISTORY)
+
+void resampler_init(resampler_t *resampler, double lag_s, double horizon_s)
+{
+    resampler->lag_s = lag_s;
+    resampler->horizon_s = horizon_s;
+    resampler->period_s = 0;
+    resampler->count = 0;
+}
+
+void resampler_push(resampler_t *resampler, double time_s, double x, double y)
+{
+    uint32_t slot = SLOT(resampler->count);
+
+    if (resampler->count > 0)
+    {
+        double interval = time_s - resampler->time_s[SLOT(resampler->count - 1)];
+
+        resampler->period_s = resampler->count == 1
+                                  ? interval
+                                  : resampler->period_s +
+                                        (interval - resampler->period_s) * PERIOD_WEIGHT;
+    }
+
+    resampler->time_s[slot] = time_s;
+    resampler->x[slot] = x;
+    resampler->y[slot] = y;
+    resampler->count++;
+}
+
+int resampler_sample(const resampler_t *resampler, double time_s, double *x,
+                     double *y)
+{
+    uint64_t kept = resampler->count < RESAMPLER_HISTORY ? resampler->count
+                                                        : RESAMPLER_HISTORY;
+    uint32_t newest = SLOT(resampler->count - 1);
+    double t = time_s - resampler->lag_s;
+    double weight;
+    uint32_t from;
+    uint32_t to;
+
+    *x = 0;
+    *y = 0;
+
+    if (kept == 0 ||
+        (resampler->period_s > 0 &&
+         t - resampler->time_s[newest] > RESAMPLER_STALE_PERIODS * resampler->period_s))
+    {
+        return 0;
+    }
+
+    if (t >= resampler->time_s[newest])
+    {
+        // Past the newest frame: trend of the last two, up to the horizon
+        double ahead = t - resampler->time_s[newest];
+
+        if (kept < 2)
+        {
+            *x = resampler->x[newest];
+            *y = resampler->y[newest];
+            return 1;
+        }
+
+        from = SLOT(resampler->count - 2);
+        to = newest;
+        ahead = ahead < resampler->horizon_s ? ahead : resampler->horizon_s;
+        t = resampler->time_s[to] + ahead;
+    }
+    else
+    {
+        // Between two frames, or before the oldest one kept
+        uint64_t index = resampler->count - 1;
+
+        while (index > resampler->count - kept &&
+               resampler->time_s[SLOT(index - 1)] > t)
+        {
+            index--;
+        }
+
+        if (index == resampler->count - kept)
+        {
+            *x = resampler->x[SLOT(index)];
+            *y = resampler->y[SLOT(index)];
+            return 1;
+        }
+
+        from = SLOT(index - 1);
+        to = SLOT(index);
+    }
+
+    if (resampler->time_s[to] <= resampler->time_s[from])
+    {
+        *x = resampler->x[to];
+        *y = resampler->y[to];
+        return 1;
+    }
+
+    weight = (t - resampler->time_s[from]) /
+             (resampler->time_s[to] - resampler->time_s[from]);
+    *x = resampler->x[from] + (resampler->x[to] - resampler->x[from]) * weight;
+    *y = resampler->y[from] + (resampler->y[to] - resampler->y[from]) * weight;
+
+    return 1;
+}
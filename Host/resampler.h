@@ -0,0 +1,45 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+/* Resampling of the tilt frames to any rate (the display refresh):
+    frames are stamped when they arrive, the tilt is read at any time
+    between them by linear interpolation, lag seconds behind the time
+    asked for. A lag of one frame period always falls between two frames
+    (smooth, one period late); a shorter lag runs past the newest frame
+    and extrapolates its trend for at most horizon seconds, then holds.
+    Once the frames stop for RESAMPLER_STALE_PERIODS periods, there is
+    no tilt any more.
+*/
+
+#define RESAMPLER_HISTORY 4
+
+#define RESAMPLER_STALE_PERIODS 4
+
+typedef struct
+{
+    double lag_s;
+    double horizon_s;
+
+    // Frame period, averaged over the arrivals
+    double period_s;
+
+    // Last frames, the newest at (count - 1) % RESAMPLER_HISTORY
+    double time_s[RESAMPLER_HISTORY];
+    double x[RESAMPLER_HISTORY];
+    double y[RESAMPLER_HISTORY];
+    uint64_t count;
+} resampler_t;
+
+void resampler_init(resampler_t *resampler, double lag_s, double horizon_s);
+
+// A frame stamped at time_s, not older than the previous one
+void resampler_push(resampler_t *resampler, double time_s, double x, double y);
+
+// Tilt at time_s - lag_s; returns 0 (no tilt) before the first frame
+// and once the frames stopped
+int resampler_sample(const resampler_t *resampler, double time_s, double *x,
+                     double *y);
+
+#endif /* RESAMPLER_H */
@@ -0,0 +1,38 @@
+#include <gpio.h>
+#include <stm32.h>
+#include "buttons.h"
+
+typedef struct
+{
+    GPIO_TypeDef *gpio;
+    uint32_t pin;
+    uint32_t active_high;
+} button_t;
+
+#define BUTTON_ENTRY(name, port, pin, active_high) {GPIO##port, pin, active_high},
+
+// Indexed by button_id_t
+static const button_t buttons[BUTTONS_NUMBER] = {BOARD_BUTTONS(BUTTON_ENTRY)};
+
+// Configure the buttons:
+// inputs with pull-ups, interrupt on both edges (GPIO and SYSCFG
+// clocks are enabled by RCC_configure)
+void buttons_configure(void)
+{
+    board_buttons_configure();
+}
+
+// Mask of the pressed buttons, read from IDR
+uint8_t buttons_state(void)
+{
+    uint8_t state = 0;
+
+    for (int i = 0; i < BUTTONS_NUMBER; ++i)
+    {
+        uint32_t level = (buttons[i].gpio->IDR >> buttons[i].pin) & 1U;
+
+        state |= (uint8_t)((level ^ buttons[i].active_high ^ 1U) << i);
+    }
+
+    return state;
+}
@@ -0,0 +1,19 @@
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+#include "board_buttons.h"
+
+/* Buttons of the board (button_table.h), bit i of the mask of pressed
+    buttons for button i (button_id_t); every edge raises the EXTI line
+    of its pin */
+_Static_assert(BUTTONS_NUMBER <= 8, "the mask of pressed buttons is one byte");
+
+
+void buttons_configure(void);
+
+
+uint8_t buttons_state(void);
+
+
+#endif /* BUTTONS_H */
@@ -0,0 +1,177 @@
+#include "capture.h"
+
+const char *const capture_cause_names[CAPTURE_CAUSES_NUMBER] = {
+    "none", "button", "threshold", "time"};
+
+// Arm the capture:
+// the ring fills from empty, until a trigger
+void capture_arm(capture_t *capture, uint32_t time_samples)
+{
+    capture->count = 0;
+    capture->trigger = 0;
+    capture->remaining = CAPTURE_POST;
+    capture->cause = CAPTURE_CAUSE_NONE;
+    capture->time_samples = time_samples;
+    capture->missed = 0;
+}
+
+void capture_trigger(capture_t *capture, capture_cause_t cause)
+{
+    if (capture->cause == CAPTURE_CAUSE_NONE)
+    {
+        capture->trigger = capture->count;
+        capture->cause = cause;
+    }
+}
+
+static int32_t tilt_magnitude(uint8_t value)
+{
+    int32_t tilt = (int8_t)value;
+
+    return tilt < 0 ? -tilt : tilt;
+}
+
+// Store a sample, the oldest one is overwritten once the ring is full;
+// the triggers are checked on every sample
+int capture_push(capture_t *capture, uint16_t time_us, uint8_t x, uint8_t y)
+{
+    capture_sample_t *sample = &capture->samples[capture->count % CAPTURE_SAMPLES];
+
+    if (capture->cause != CAPTURE_CAUSE_NONE && capture->remaining == 0)
+    {
+        return 1;
+    }
+
+    sample->time_us = time_us;
+    sample->x = x;
+    sample->y = y;
+
+    if (CAPTURE_THRESHOLD > 0 &&
+        (tilt_magnitude(x) >= CAPTURE_THRESHOLD || tilt_magnitude(y) >= CAPTURE_THRESHOLD))
+    {
+        capture_trigger(capture, CAPTURE_CAUSE_THRESHOLD);
+    }
+
+    if (capture->time_samples != 0 && capture->count + 1 >= capture->time_samples)
+    {
+        capture_trigger(capture, CAPTURE_CAUSE_TIME);
+    }
+
+    capture->count++;
+
+    if (capture->cause != CAPTURE_CAUSE_NONE)
+    {
+        capture->remaining--;
+    }
+
+    return capture->cause != CAPTURE_CAUSE_NONE && capture->remaining == 0;
+}
+
+void capture_miss(capture_t *capture)
+{
+    if (capture->cause == CAPTURE_CAUSE_NONE || capture->remaining != 0)
+    {
+        capture->missed++;
+    }
+}
+
+uint32_t capture_kept(const capture_t *capture)
+{
+    return capture->count < CAPTURE_SAMPLES ? capture->count : CAPTURE_SAMPLES;
+}
+
+// The oldest sample kept is at count - kept: from it to the end of the
+// ring, then from the start
+uint32_t capture_chunk(const capture_t *capture, uint32_t offset, uint32_t limit,
+                       const uint8_t **data)
+{
+    uint32_t total = capture_kept(capture) * CAPTURE_SAMPLE_SIZE;
+    uint32_t first = (capture->count - capture_kept(capture)) % CAPTURE_SAMPLES;
+    uint32_t position = (first * CAPTURE_SAMPLE_SIZE + offset) %
+                        (CAPTURE_SAMPLES * CAPTURE_SAMPLE_SIZE);
+    uint32_t length = CAPTURE_SAMPLES * CAPTURE_SAMPLE_SIZE - position;
+
+    if (offset >= total)
+    {
+        return 0;
+    }
+
+    length = length < total - offset ? length : total - offset;
+    length = length < limit ? length : limit;
+    *data = (const uint8_t *)capture->samples + position;
+
+    return length;
+}
+
+// Line builders, no printf on the board
+static uint32_t append_string(char *line, uint32_t used, const char *string)
+{
+    while (*string != '\0' && used < CAPTURE_LINE_SIZE - 2)
+    {
+        line[used++] = *string++;
+    }
+
+    return used;
+}
+
+static uint32_t append_unsigned(char *line, uint32_t used, uint32_t value)
+{
+    char digits[10];
+    int32_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0 && used < CAPTURE_LINE_SIZE - 2)
+    {
+        line[used++] = digits[--count];
+    }
+
+    return used;
+}
+
+static uint32_t end_line(char *line, uint32_t used)
+{
+    line[used++] = '\r';
+    line[used++] = '\n';
+
+    return used;
+}
+
+uint32_t capture_header(const capture_t *capture, uint32_t rate_hz, char *line)
+{
+    uint32_t used = append_string(line, 0, "CAPTURE ");
+
+    used = append_unsigned(line, used, capture_kept(capture));
+    used = append_string(line, used, " ");
+    used = append_unsigned(line, used, rate_hz);
+    used = append_string(line, used, " ");
+    used = append_unsigned(line, used, capture->trigger - (capture->count - capture_kept(capture)));
+    used = append_string(line, used, " ");
+    used = append_string(line, used, capture_cause_names[capture->cause]);
+
+    return end_line(line, used);
+}
+
+uint32_t capture_trailer(const capture_t *capture, char *line)
+{
+    const uint8_t *bytes = (const uint8_t *)capture->samples;
+    uint32_t sum = 0;
+    uint32_t used;
+
+    // Every slot is sent once the ring is full, the first ones otherwise
+    for (uint32_t i = 0; i < capture_kept(capture) * CAPTURE_SAMPLE_SIZE; ++i)
+    {
+        sum += bytes[i];
+    }
+
+    used = append_string(line, 0, "END ");
+    used = append_unsigned(line, used, sum);
+    used = append_string(line, used, " ");
+    used = append_unsigned(line, used, capture->missed);
+
+    return end_line(line, used);
+}
@@ -0,0 +1,115 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/* Burst capture of the accelerometer (make CAPTURE=1):
+    samples at the full rate of the LIS35DE go into a ring in SRAM until
+    a trigger and CAPTURE_POST samples after it, then the ring is dumped
+    on the link, whatever its speed:
+        CAPTURE <samples> <rate_hz> <trigger> <cause>\r\n
+        <samples> packed samples, oldest first
+        END <sum> <missed>\r\n
+    trigger being the index of the sample taken at the trigger, sum the
+    sum of the bytes of the samples and missed the samples lost since
+    armed (a reading skipped while the bus was busy), each one a gap of
+    a period among the stamps.
+    Independent of the hardware, as the sample pipeline: Host/capdump
+    reads the dump with the same definitions */
+
+#ifndef CAPTURE_SAMPLES
+#define CAPTURE_SAMPLES 16384
+#endif
+
+#ifndef CAPTURE_POST
+#define CAPTURE_POST (CAPTURE_SAMPLES / 2)
+#endif
+
+// The samples after the trigger stay in the ring with the trigger
+#if CAPTURE_POST > CAPTURE_SAMPLES
+#error "CAPTURE_POST must not exceed CAPTURE_SAMPLES"
+#endif
+
+// Trigger on a tilt of at least so many digits on X or Y, 0: off
+#ifndef CAPTURE_THRESHOLD
+#define CAPTURE_THRESHOLD 0
+#endif
+
+// Longest header or trailer line
+#define CAPTURE_LINE_SIZE 64
+
+#define CAPTURE_SAMPLE_SIZE 4
+
+// One sample: low 16 bits of its time in us (little endian), register
+// values of X and Y
+typedef struct
+{
+    uint16_t time_us;
+    uint8_t x;
+    uint8_t y;
+} capture_sample_t;
+
+typedef enum
+{
+    CAPTURE_CAUSE_NONE,
+    CAPTURE_CAUSE_BUTTON,
+    CAPTURE_CAUSE_THRESHOLD,
+    CAPTURE_CAUSE_TIME,
+    CAPTURE_CAUSES_NUMBER
+} capture_cause_t;
+
+// Names of the causes in the header
+extern const char *const capture_cause_names[CAPTURE_CAUSES_NUMBER];
+
+typedef struct
+{
+    capture_sample_t samples[CAPTURE_SAMPLES];
+
+    // Samples taken since armed, the trigger among them, and those
+    // still to take after it
+    uint32_t count;
+    uint32_t trigger;
+    uint32_t remaining;
+    capture_cause_t cause;
+
+    // Trigger after so many samples, 0: off
+    uint32_t time_samples;
+
+    // Samples lost since armed
+    uint32_t missed;
+} capture_t;
+
+
+void capture_arm(capture_t *, uint32_t time_samples);
+
+
+// First trigger only, the next ones are ignored
+void capture_trigger(capture_t *, capture_cause_t);
+
+
+// Stores one sample; returns 1 once the capture is over
+int capture_push(capture_t *, uint16_t time_us, uint8_t x, uint8_t y);
+
+
+// A sample lost, counted until the capture is over
+void capture_miss(capture_t *);
+
+
+// Samples kept in the ring
+uint32_t capture_kept(const capture_t *);
+
+
+// Bytes of the kept samples from offset, oldest first, contiguous in
+// the ring: at most limit, 0 at the end
+uint32_t capture_chunk(const capture_t *, uint32_t offset, uint32_t limit,
+                       const uint8_t **data);
+
+
+// Lines around the samples, return their length
+uint32_t capture_header(const capture_t *, uint32_t rate_hz, char *line);
+
+
+uint32_t capture_trailer(const capture_t *, char *line);
+
+
+#endif /* CAPTURE_H */
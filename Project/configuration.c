@@ -1,77 +1,73 @@
 #include <gpio.h>
 #include <stm32.h>
 #include <delay.h>
+#include "board_buttons.h"
 #include "consts.h"
 #include "configuration.h"
-
-// USART Constants
-#define BAUD_RATE 9600U
-#define HSI_HZ 16000000U
-#define PCLK1_HZ HSI_HZ
+#include "usart2.h"
 
 // I2C Constants
 #define I2C_SPEED_HZ 100000
-#define PCLK1_MHZ 16
+#define PCLK1_MHZ (PCLK1_HZ / 1000000U)
+#ifdef BURST_CAPTURE
+// DR set: 400 Hz output data rate
+#define CTRL_REG1_VALUE 0b11000111
+#else
 #define CTRL_REG1_VALUE 0b01000111
+#endif
 #define CTRL_REG3_VALUE 0b00000100
 
 // Wait Max Time
 #define WAIT_MAX 1000000
 
-// TIM Constants
+// TIM Constants, the period can be redefined at build time
 #define PSC_VALUE 400
+#ifndef ARR_VALUE
+#ifdef BURST_CAPTURE
+// Readings at the output data rate of the capture
+#define ARR_VALUE 99
+#else
 #define ARR_VALUE 1000
+#endif
+#endif
+#define CCR1_VALUE (ARR_VALUE / 2)
+
+/* NVIC Constants:
+    grouping 5, 2 bits of preemption priority and 2 of subpriority;
+    handlers at one preemption priority never nest.
+    - I2C1 events first: the register read state machine must answer
+      the bus before the next event
+    - TIM3, the EXTI lines of the buttons and DMA1 Stream6 at one level:
+      TIM3 and the buttons enqueue frames and start transfers, the DMA
+      handler polls the queue, none interrupts another so the queue
+      needs no critical section; so does TIM4, the frame generator of
+      the load benchmark
+    Each level can be redefined at build time (-DI2C_IRQ_PRIORITY=...)
+*/
+#define IRQ_PRIORITY_GROUPING 5U
+
+#ifndef I2C_IRQ_PRIORITY
+#define I2C_IRQ_PRIORITY 1U
+#endif
+
+#ifndef SAMPLING_IRQ_PRIORITY
+#define SAMPLING_IRQ_PRIORITY 2U
+#endif
+
+#define IRQ_PRIORITY(preemption) \
+    NVIC_EncodePriority(IRQ_PRIORITY_GROUPING, (preemption), 0U)
 
-// Configure USART2:
-// Code from Slides 10 to 11 (w8)
-void USART_configure(void)
+void NVIC_configure()
 {
-    GPIOafConfigure(GPIOA,
-                    2,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_NOPULL,
-                    GPIO_AF_USART2);
-
-    GPIOafConfigure(GPIOA,
-                    3,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_UP,
-                    GPIO_AF_USART2);
-
-    USART2->CR1 = USART_CR1_RE | USART_CR1_TE;
-    USART2->CR2 = 0;
-    USART2->BRR = (PCLK1_HZ + (BAUD_RATE / 2U)) / BAUD_RATE;
+    NVIC_SetPriorityGrouping(IRQ_PRIORITY_GROUPING);
 
-    // Sending and Receceiving using DMA
-    USART2->CR3 = USART_CR3_DMAT | USART_CR3_DMAR;
-}
-
-// Configure DMA1:
-// Code from Slides 12 to 14 (w8)
-void DMA_configure(void)
-{
-    /* USART2 TX (sending stream):
-        uses stream 6 and channel 4, direct transfer mode, 8-bits transfers,
-        high priority, increasing the memory
-        address after every transfer, interrupt after transfer
-        completion
-    */
-    DMA1_Stream6->CR = 4U << 25 |
-                       DMA_SxCR_PL_1 |
-                       DMA_SxCR_MINC |
-                       DMA_SxCR_DIR_0 |
-                       DMA_SxCR_TCIE;
-
-    // Set the peripheral address
-    DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
-
-    DMA1->HIFCR = DMA_HIFCR_CTCIF6;
-}
+    NVIC_SetPriority(I2C1_EV_IRQn, IRQ_PRIORITY(I2C_IRQ_PRIORITY));
+    NVIC_SetPriority(TIM3_IRQn, IRQ_PRIORITY(SAMPLING_IRQ_PRIORITY));
+    NVIC_SetPriority(DMA1_Stream6_IRQn, IRQ_PRIORITY(SAMPLING_IRQ_PRIORITY));
+#ifdef LOAD_BENCH
+    NVIC_SetPriority(TIM4_IRQn, IRQ_PRIORITY(SAMPLING_IRQ_PRIORITY));
+#endif
 
-void NVIC_configure()
-{
     // Code from Slides 14 (w8)
     NVIC_EnableIRQ(DMA1_Stream6_IRQn);
 
@@ -79,6 +75,13 @@ void NVIC_configure()
 
     // 16-bit General-purpose timer
     NVIC_EnableIRQ(TIM3_IRQn);
+
+    // Buttons, the vectors of their lines
+    board_buttons_nvic_configure(BOARD_BUTTONS_LINES, IRQ_PRIORITY(SAMPLING_IRQ_PRIORITY));
+
+#ifdef LOAD_BENCH
+    NVIC_EnableIRQ(TIM4_IRQn);
+#endif
 }
 
 // Wait for a condition to be true:
@@ -186,7 +189,7 @@ void TIM_configure()
     TIM3->PSC = PSC_VALUE;
 
     // Set Auto-reload register
-    // Counts from 0 to 1000
+    // Counts from 0 to ARR_VALUE
     TIM3->ARR = ARR_VALUE;
 
     // Update generation
@@ -199,12 +202,17 @@ void TIM_configure()
     TIM3->DIER = TIM_DIER_UIE | TIM_DIER_CC1IE;
 
     // capture/compare register
-    TIM3->CCR1 = 500;
+    TIM3->CCR1 = CCR1_VALUE;
 
     // Start the timer
     TIM3->CR1 |= TIM_CR1_CEN;
 }
 
+uint32_t TIM_sampling_hz()
+{
+    return PCLK1_HZ / ((PSC_VALUE + 1U) * (ARR_VALUE + 1U));
+}
+
 // Configure RCC:
 // Code from Slide 9 (w8)
 void RCC_configure()
@@ -220,10 +228,11 @@ void RCC_configure()
                     RCC_APB1ENR_I2C1EN |
                     RCC_APB1ENR_TIM3EN;
 
+#ifdef LOAD_BENCH
+    // TIM4 generates the frames of the load benchmark
+    RCC->APB1ENR |= RCC_APB1ENR_TIM4EN;
+#endif
+
     // Enable SYSCFG clock
     RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
 }
-
-void USART_enable(){
-    USART2->CR1 |= USART_CR1_UE;
-}
\ No newline at end of file
@@ -1,12 +1,14 @@
 #ifndef CONFIGURATION_H
 #define CONFIGURATION_H
 
-void USART_configure(void);
-void DMA_configure(void);
+#include <stdint.h>
+
 void NVIC_configure(void);
 void I2C_configure(void);
 void TIM_configure(void);
 void RCC_configure(void);
-void USART_enable(void);
+
+// Rate of the TIM3 readings of the accelerometer
+uint32_t TIM_sampling_hz(void);
 
 #endif /* CONFIGURATION_H */
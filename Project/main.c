@@ -1,21 +1,21 @@
 #include <gpio.h>
 #include <stm32.h>
 #include <string.h>
+#include "buttons.h"
+#include "capture.h"
 #include "configuration.h"
 #include "consts.h"
 #include "messages_queue.h"
+#include "sample_pipeline.h"
+#include "usart2.h"
 
-#define BUFFER_SIZE 11
+#if defined(LOAD_BENCH) && defined(FRAME_STREAM)
+#error "the load benchmark measures the queued path, build it without STREAM"
+#endif
 
-#define BUFFER_POSITION_X 0
-#define BUFFER_POSITION_Y 4
-
-// I2C_SCL_PIN
-#define BUFFER_POSITION_CR 8
-// I2C_SDA_PIN
-#define BUFFER_POSITION_LF 9
-
-#define REGISTER_VALUE_DECIMAL_LENGTH 3
+#if defined(BURST_CAPTURE) && (defined(FRAME_STREAM) || defined(LOAD_BENCH))
+#error "the burst capture owns the link, build it without STREAM and LOAD"
+#endif
 
 // Enum representing the states of accelerometer register
 // value read operation
@@ -40,16 +40,27 @@ static uint32_t communication_step;
 // Integer value for reading acceleration from accelerometer register
 // static uint8_t value_from_register;
 
-// Buffer for sending messages with acceleration values in format
-// Xacc_xYacc_y, where acc_x, acc_y are zero-padded integers
-// corresponding to acceleration on X and Y axes, respectively
-static char buffer[BUFFER_SIZE];
+// Processing of the values read from the accelerometer, its frame
+// in format XnnnYnnnBnnn is the message sent
+static sample_pipeline_t sample_pipeline;
 
+// Mask of the pressed buttons carried by the frames
+static uint8_t buttons_pressed;
+
+#if !defined(FRAME_STREAM) && !defined(BURST_CAPTURE)
 // Static queue for queueing messages
 static messages_queue_t messages_queue;
+#endif
 
 static void initiate_read_from_accelerometer_register(uint8_t register_number)
 {
+    // One reading at a time: a START now would break the one running,
+    // this one is skipped
+    if (read_state != IDLE)
+    {
+        return;
+    }
+
     target_register = register_number;
 
     read_state = WRITING;
@@ -59,53 +70,448 @@ static void initiate_read_from_accelerometer_register(uint8_t register_number)
     I2C1->CR1 |= I2C_CR1_START;
 }
 
-// Starting sending
-// Code from Slide 15 (w8)
-static void send_with_DMA(char *message_text)
+#ifdef FRAME_STREAM
+/* Streaming mode (make STREAM=1):
+    DMA1 Stream6 sends two frame buffers in turn in double buffer mode,
+    started by the first frame and never stopped: the hardware switches
+    buffers and the line never idles, whatever the interrupt latency.
+    A new frame goes to the buffer the stream is not sending; the
+    transfer complete interrupt, after each buffer, gives the latest
+    frame to the buffer just left if it holds an older one. It has a
+    whole frame time to do it, it is not on the path of the data.
+    Between two readings of the accelerometer the latest frame repeats,
+    with STREAM_REPEAT_MARK in place of the 'B' of the buttons: the
+    computer adds the motion of a reading once, however often it goes.
+    A frame changing the buttons is not only the latest: it is kept in
+    a queue of changes, sent before the latest frame and never replaced
+    in its buffer, so a click shorter than a frame time still reaches
+    the link; on a full queue the change waits for the next frame. TIM3
+    and DMA1 Stream6 share a priority level, they never nest */
+#define STREAM_CHANGES_NUMBER 8U
+#define STREAM_REPEAT_MARK 'R'
+
+static struct
 {
-    DMA1_Stream6->M0AR = (uint32_t)message_text;
-    DMA1_Stream6->NDTR = strlen(message_text);
-    DMA1_Stream6->CR |= DMA_SxCR_EN;
+    char frames[2][SAMPLE_FRAME_LENGTH];
+    char latest[SAMPLE_FRAME_LENGTH];
+
+    // Frames published, the one held by each buffer and the last one
+    // given to a buffer
+    uint32_t sequence;
+    uint32_t holds[2];
+    uint32_t filled;
+
+    // Frames changing the buttons not in a buffer yet with their
+    // sequence, positions run freely; buffers holding one not sent yet
+    // and the buttons of the last frame queued
+    char changes[STREAM_CHANGES_NUMBER][SAMPLE_FRAME_LENGTH];
+    uint32_t change_sequences[STREAM_CHANGES_NUMBER];
+    uint32_t changes_read;
+    uint32_t changes_insert;
+    uint32_t change_held[2];
+    uint8_t buttons;
+} stream;
+
+// The oldest change not sent, otherwise the latest frame; marked as a
+// repeat if the other buffer was given it already
+static void stream_fill(uint32_t buffer)
+{
+    uint32_t sequence = stream.sequence;
+
+    if (stream.changes_read != stream.changes_insert)
+    {
+        uint32_t position = stream.changes_read % STREAM_CHANGES_NUMBER;
+
+        memcpy(stream.frames[buffer], stream.changes[position], SAMPLE_FRAME_LENGTH);
+        sequence = stream.change_sequences[position];
+        stream.changes_read++;
+        stream.change_held[buffer] = 1;
+    }
+    else
+    {
+        memcpy(stream.frames[buffer], stream.latest, SAMPLE_FRAME_LENGTH);
+        stream.change_held[buffer] = 0;
+    }
+
+    if (sequence == stream.filled)
+    {
+        stream.frames[buffer][SAMPLE_FRAME_POSITION_B] = STREAM_REPEAT_MARK;
+    }
+
+    stream.filled = sequence;
+    stream.holds[buffer] = sequence;
 }
 
-static void send(char *message_text)
+// The stream takes one byte per byte time, a copy is much shorter: if
+// the buffers are switched during it, the buffer is sent from its first
+// byte ('X' either way) after the copy is over
+static void send(char *message_text, uint8_t buttons)
 {
-    // If the bits EN and TCIFx are cleared, the transfer can be initiated
-    if ((DMA1_Stream6->CR & DMA_SxCR_EN) == 0 &&
-        (DMA1->HISR & DMA_HISR_TCIF6) == 0)
+    uint32_t idle;
+
+    // A copy of its own: the pipeline is written by the I2C interrupt,
+    // which preempts the DMA one
+    memcpy(stream.latest, message_text, SAMPLE_FRAME_LENGTH);
+    stream.sequence++;
+
+    if (buttons != stream.buttons)
     {
-        send_with_DMA(message_text);
+        // Queued with a later frame if full, stream.buttons unchanged
+        if (stream.changes_insert - stream.changes_read != STREAM_CHANGES_NUMBER)
+        {
+            uint32_t position = stream.changes_insert % STREAM_CHANGES_NUMBER;
+
+            memcpy(stream.changes[position], stream.latest, SAMPLE_FRAME_LENGTH);
+            stream.change_sequences[position] = stream.sequence;
+            stream.changes_insert++;
+            stream.buttons = buttons;
+        }
     }
-    else if (!is_queue_full(&messages_queue))
+
+    if (usart2_dma_tx_idle())
+    {
+        stream_fill(0);
+        stream_fill(1);
+        __DMB();
+        usart2_dma_tx_stream(stream.frames[0], stream.frames[1],
+                             SAMPLE_FRAME_LENGTH);
+        return;
+    }
+
+    // Buffers switched, their interrupt pending: it gives the frame to
+    // the buffer just left, counting its content as sent
+    if (usart2_dma_tx_complete())
     {
-        enqueue(&messages_queue, message_text);
+        return;
+    }
+
+    // A change waiting in the next buffer goes out first
+    idle = usart2_dma_tx_current() ^ 1U;
+
+    if (!stream.change_held[idle])
+    {
+        stream_fill(idle);
     }
 }
 
-static void write_to_buffer(uint8_t register_number, uint8_t value)
+// One buffer sent, the other one is being sent
+void DMA1_Stream6_IRQHandler(void)
 {
-    int buffer_offset = (register_number == OUT_X) ? BUFFER_POSITION_X
-                                                   : BUFFER_POSITION_Y;
+    if (usart2_dma_tx_complete())
+    {
+        uint32_t idle = usart2_dma_tx_current() ^ 1U;
 
+        usart2_dma_tx_acknowledge();
+        stream.change_held[idle] = 0;
 
-    for (int i = REGISTER_VALUE_DECIMAL_LENGTH; i > 0; --i)
+        if (stream.changes_read != stream.changes_insert ||
+            stream.holds[idle] != stream.sequence)
+        {
+            stream_fill(idle);
+        }
+        else
+        {
+            // Sent once already
+            stream.frames[idle][SAMPLE_FRAME_POSITION_B] = STREAM_REPEAT_MARK;
+        }
+    }
+}
+#elif defined(BURST_CAPTURE)
+/* Burst capture mode (make CAPTURE=1), see capture.h:
+    the LIS35DE runs at 400 Hz and TIM3 reads it at about this rate;
+    every sample goes into the ring with the time of its Y reading from
+    the cycle counter, no frame is sent. Once the capture is over TIM3
+    stops and DMA1 Stream6 dumps the ring, CAPTURE_CHUNK_BYTES at a
+    time: its transfer complete interrupt starts the next transfer and,
+    after the trailer, arms the capture and starts TIM3 again */
+
+#ifndef CAPTURE_CHUNK_BYTES
+#define CAPTURE_CHUNK_BYTES 32768U
+#endif
+
+#if CAPTURE_CHUNK_BYTES > 65535
+#error "a DMA1 Stream6 transfer is at most 65535 bytes"
+#endif
+
+// Trigger after so many ms, 0: off
+#ifndef CAPTURE_TIME_MS
+#define CAPTURE_TIME_MS 0U
+#endif
+
+#define CYCLES_PER_US (HSI_HZ / 1000000U)
+
+static capture_t capture;
+
+// Pairing of the readings: no X yet after a start of TIM3 (its first
+// event is CC1, a Y), an X waiting for its Y, or the last X paired
+typedef enum
+{
+    CAPTURE_X_NONE,
+    CAPTURE_X_WAITING,
+    CAPTURE_X_PAIRED
+} capture_x_state_t;
+
+// X register value waiting for Y
+static uint8_t capture_x;
+static capture_x_state_t capture_x_state;
+
+typedef enum
+{
+    DUMP_IDLE,
+    DUMP_HEADER,
+    DUMP_SAMPLES,
+    DUMP_TRAILER
+} dump_stage_t;
+
+static struct
+{
+    dump_stage_t stage;
+    uint32_t offset;
+    char line[CAPTURE_LINE_SIZE];
+} dump;
+
+static void capture_rearm(void)
+{
+    capture_arm(&capture,
+                (uint32_t)((uint64_t)CAPTURE_TIME_MS * TIM_sampling_hz() / 1000U));
+}
+
+static void capture_start(void)
+{
+    capture_rearm();
+
+    TIM3->CNT = 0;
+    TIM3->SR = ~(TIM_SR_UIF | TIM_SR_CC1IF);
+    TIM3->CR1 |= TIM_CR1_CEN;
+}
+
+// Before TIM3 starts: the cycle counter stamps the samples
+static void capture_configure(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    capture_rearm();
+}
+
+/* A register read: X waits for Y, which completes the sample. A reading
+    skipped loses its sample: an X with no Y after it is replaced by the
+    next one, a Y with no X before it is dropped */
+static void capture_read(uint8_t register_number, uint8_t value)
+{
+    uint16_t time_us = (uint16_t)(DWT->CYCCNT / CYCLES_PER_US);
+
+    if (register_number == OUT_X)
     {
-        char char_to_buffer = (value % 10) + '0';
-        buffer[buffer_offset + i] = char_to_buffer;
-        value /= 10;
+        if (capture_x_state == CAPTURE_X_WAITING)
+        {
+            capture_miss(&capture);
+        }
+
+        capture_x = value;
+        capture_x_state = CAPTURE_X_WAITING;
+    }
+    else if (capture_x_state == CAPTURE_X_PAIRED)
+    {
+        capture_miss(&capture);
+    }
+    else if (capture_x_state == CAPTURE_X_WAITING)
+    {
+        capture_x_state = CAPTURE_X_PAIRED;
+
+        if (capture_push(&capture, time_us, capture_x, value))
+        {
+            // Over: the dump starts in the DMA interrupt
+            TIM3->CR1 &= ~TIM_CR1_CEN;
+            capture_x_state = CAPTURE_X_NONE;
+            NVIC_SetPendingIRQ(DMA1_Stream6_IRQn);
+        }
     }
 }
 
-// Template of interrupt handler after send completion
+// Next transfer of the dump, or the next capture after it
+static void dump_next(void)
+{
+    const uint8_t *data;
+    uint32_t length;
+
+    switch (dump.stage)
+    {
+    case DUMP_IDLE:
+        dump.stage = DUMP_HEADER;
+        dump.offset = 0;
+        length = capture_header(&capture, TIM_sampling_hz(), dump.line);
+        usart2_dma_tx_start(dump.line, length);
+        break;
+    case DUMP_HEADER:
+    case DUMP_SAMPLES:
+        length = capture_chunk(&capture, dump.offset, CAPTURE_CHUNK_BYTES, &data);
+
+        if (length > 0)
+        {
+            dump.stage = DUMP_SAMPLES;
+            dump.offset += length;
+            usart2_dma_tx_start((const char *)data, length);
+        }
+        else
+        {
+            dump.stage = DUMP_TRAILER;
+            length = capture_trailer(&capture, dump.line);
+            usart2_dma_tx_start(dump.line, length);
+        }
+        break;
+    case DUMP_TRAILER:
+        dump.stage = DUMP_IDLE;
+        capture_start();
+        break;
+    }
+}
+
+// One transfer of the dump sent, or pended at the end of the capture
 void DMA1_Stream6_IRQHandler(void)
 {
-    // Read signalled DMA1 interrupts
-    uint32_t isr = DMA1->HISR;
+    if (usart2_dma_tx_complete())
+    {
+        usart2_dma_tx_acknowledge();
+        dump_next();
+    }
+    else if (dump.stage == DUMP_IDLE)
+    {
+        dump_next();
+    }
+}
+#else
+#ifdef LOAD_BENCH
+#ifndef LOAD_FRAME_LENGTH
+#define LOAD_FRAME_LENGTH SAMPLE_FRAME_LENGTH
+#endif
+
+#if LOAD_FRAME_LENGTH < 4
+#error "LOAD_FRAME_LENGTH must leave room for L, a digit and CR LF"
+#endif
+#endif
+
+// Longest frame sent, with its terminator
+#if defined(LOAD_BENCH) && LOAD_FRAME_LENGTH > SAMPLE_FRAME_LENGTH
+#define TX_FRAME_SIZE (LOAD_FRAME_LENGTH + 1)
+#else
+#define TX_FRAME_SIZE SAMPLE_FRAME_SIZE
+#endif
+
+/* Frames being sent and waiting for the link:
+    send() copies a frame into the next slot of tx_frames, the pipeline
+    can change under a transfer without tearing it; the slots hold the
+    frame on the line and the queued ones, in order. A frame with the
+    buttons of the frame before it only moves the values: it replaces
+    the last frame queued if that one is of its kind. A frame changing
+    the buttons is always queued behind, so a click shorter than a frame
+    time still reaches the link; with every slot taken it is dropped and
+    counted, and the next frame carries the change again */
+#define TX_FRAMES_NUMBER 32U
+
+static char tx_frames[TX_FRAMES_NUMBER][TX_FRAME_SIZE];
+static uint32_t tx_frame_next;
+
+// Buttons of the last frame handed over, and whether the last frame
+// queued only moved the values
+static uint8_t tx_buttons;
+static uint32_t tx_tail_motion;
+
+// Frames and bytes handed to DMA1 Stream6, frames replaced while
+// waiting (or not queued behind a full queue), button changes dropped
+// on a full queue and the deepest queue seen
+static struct
+{
+    __IO uint32_t frames_started;
+    __IO uint32_t bytes_started;
+    __IO uint32_t frames_replaced;
+    __IO uint32_t events_dropped;
+    __IO uint32_t queue_max;
+} tx_stats;
 
-    if (isr & DMA_HISR_TCIF6)
+// Starting sending
+static void send_with_DMA(char *message_text)
+{
+    uint32_t length = strlen(message_text);
+
+    tx_stats.frames_started++;
+    tx_stats.bytes_started += length;
+    usart2_dma_tx_start(message_text, length);
+}
+
+static void send(char *message_text, uint8_t buttons)
+{
+    // If the bits EN and TCIFx are cleared, the transfer can be initiated
+    uint32_t idle = usart2_dma_tx_idle() && !usart2_dma_tx_complete();
+    uint32_t motion = buttons == tx_buttons;
+    size_t size = strlen(message_text) + 1;
+    char *frame;
+
+    // The queued frame is in the slot taken last
+    if (!idle && motion && tx_tail_motion && !is_queue_empty(&messages_queue))
+    {
+        memcpy(tx_frames[(tx_frame_next - 1U) % TX_FRAMES_NUMBER], message_text, size);
+        tx_stats.frames_replaced++;
+        return;
+    }
+
+    // Every slot holds a frame not sent yet
+    if (!idle && messages_queue.used_space == TX_FRAMES_NUMBER - 1U)
     {
-        // Handle transfer completion on stream 5
-        DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+        if (motion)
+        {
+            tx_stats.frames_replaced++;
+        }
+        else
+        {
+            tx_stats.events_dropped++;
+        }
+        return;
+    }
+
+    frame = tx_frames[tx_frame_next];
+    tx_frame_next = (tx_frame_next + 1U) % TX_FRAMES_NUMBER;
+    memcpy(frame, message_text, size);
+    tx_buttons = buttons;
+
+    if (idle)
+    {
+        send_with_DMA(frame);
+    }
+    else
+    {
+        enqueue(&messages_queue, frame);
+        tx_tail_motion = motion;
+
+        if (messages_queue.used_space > tx_stats.queue_max)
+        {
+            tx_stats.queue_max = messages_queue.used_space;
+        }
+    }
+}
+#endif
+
+static void write_to_buffer(uint8_t register_number, uint8_t value)
+{
+#ifdef BURST_CAPTURE
+    capture_read(register_number, value);
+#else
+    sample_pipeline_push(&sample_pipeline,
+                         (register_number == OUT_X) ? SAMPLE_AXIS_X
+                                                    : SAMPLE_AXIS_Y,
+                         value);
+#endif
+}
+
+#if !defined(FRAME_STREAM) && !defined(BURST_CAPTURE)
+// Template of interrupt handler after send completion
+void DMA1_Stream6_IRQHandler(void)
+{
+    if (usart2_dma_tx_complete())
+    {
+        // Handle transfer completion on stream 6
+        usart2_dma_tx_acknowledge();
 
         if (!is_queue_empty(&messages_queue))
         {
@@ -113,6 +519,8 @@ void DMA1_Stream6_IRQHandler(void)
         }
     }
 }
+#endif
+
 void I2C1_EV_IRQHandler()
 {
     uint16_t statreg = I2C1->SR1;
@@ -141,8 +549,10 @@ void I2C1_EV_IRQHandler()
         }
         else
         {
-            // Stop communication
+            // Stop communication, the reading is given up: the next
+            // event finds IDLE and disables the interrupts
             I2C1->CR1 |= I2C_CR1_STOP;
+            read_state = IDLE;
         }
     }
     // Reading from accelerometer register
@@ -193,6 +603,56 @@ void I2C1_EV_IRQHandler()
     }
 }
 
+#ifndef BURST_CAPTURE
+// New mask of the pressed buttons:
+// it goes out at once in a frame of its own, between two samplings,
+// the click does not wait for TIM3
+static void buttons_send(uint8_t state)
+{
+    buttons_pressed = state;
+    sample_pipeline_buttons(&sample_pipeline, state);
+    send(sample_pipeline.frame, state);
+}
+#endif
+
+// A button changed
+static void buttons_changed(void)
+{
+    uint8_t state = buttons_state();
+
+    // Bounces ending at the state already sent
+    if (state != buttons_pressed)
+    {
+#ifdef BURST_CAPTURE
+        // A press triggers the capture, nothing is sent; masked from
+        // the samples pushed by the I2C interrupt
+        if (state & ~buttons_pressed)
+        {
+            __disable_irq();
+            capture_trigger(&capture, CAPTURE_CAUSE_BUTTON);
+            __enable_irq();
+        }
+
+        buttons_pressed = state;
+#else
+        buttons_send(state);
+#endif
+    }
+}
+
+// Dispatch of the EXTI lines, from every EXTI vector:
+// the lines are read and cleared once before the buttons are read, an
+// edge during the handler raises them again
+static void buttons_exti_dispatch(void)
+{
+    if (board_buttons_pending(BOARD_BUTTONS_LINES) != 0)
+    {
+        buttons_changed();
+    }
+}
+
+BOARD_BUTTONS_EXTI_HANDLERS()
+
 void TIM3_IRQHandler(void)
 {
     // Read signalled TIM3 interrupts
@@ -217,30 +677,306 @@ void TIM3_IRQHandler(void)
         // Clear CC1IF flag
         TIM3->SR = ~TIM_SR_CC1IF;
 
-        send(buffer);
+#ifndef BURST_CAPTURE
+        send(sample_pipeline.frame, buttons_pressed);
+#endif
+    }
+}
+
+#ifdef LOAD_BENCH
+/* Sustained load benchmark (make LOAD=1):
+    TIM4 generates frames on top of the accelerometer ones and sends them
+    as the board sends its own: send(), the messages queue, DMA1 Stream6
+    and its transfer complete interrupt. Every LOAD_EVENT_EVERY-th frame
+    is a button change (UP, unused by the computer side), the others are
+    L, a sequence number and CR LF, LOAD_FRAME_LENGTH bytes in all.
+    The rate doubles at every step from LOAD_RATE_HZ. Meanwhile main
+    counts its idle loops, against the count of a step without the
+    generator taken the same way, after a drain: the CPU left, at most
+    1000 per mille, both counts reported. After every step the output
+    is drained and one JSON line reports it; the rate is sustained
+    while no frame is replaced. Button changes queue up (see send): the deepest queue
+    and the changes dropped on a full one tell how far it fell behind.
+*/
+
+#ifndef LOAD_RATE_HZ
+#define LOAD_RATE_HZ 10U
+#endif
+
+#ifndef LOAD_STEPS
+#define LOAD_STEPS 8U
+#endif
+
+#ifndef LOAD_STEP_MS
+#define LOAD_STEP_MS 1000U
+#endif
+
+#ifndef LOAD_EVENT_EVERY
+#define LOAD_EVENT_EVERY 8U
+#endif
+
+// TIM4 counts at 100 kHz, the highest rate
+#define LOAD_TIMER_HZ 100000U
+
+#define LOAD_STEP_CYCLES (HSI_HZ / 1000U * LOAD_STEP_MS)
+
+#define LOAD_REPORT_SIZE 384
+
+static struct
+{
+    char frame[LOAD_FRAME_LENGTH + 1];
+    uint32_t generated;
+    uint32_t events;
+    uint32_t idle_reference;
+    char report[LOAD_REPORT_SIZE];
+} load;
+
+// Next frame of the generator
+void TIM4_IRQHandler(void)
+{
+    TIM4->SR = ~TIM_SR_UIF;
+
+    load.generated++;
+
+    if (load.generated % LOAD_EVENT_EVERY == 0)
+    {
+        load.events++;
+        buttons_send(buttons_pressed ^ (1U << BUTTON_UP));
+    }
+    else
+    {
+        uint32_t number = load.generated;
+
+        // Least significant digits of the sequence number
+        for (int i = LOAD_FRAME_LENGTH - 3; i > 0; --i)
+        {
+            load.frame[i] = (char)('0' + number % 10);
+            number /= 10;
+        }
+
+        send(load.frame, buttons_pressed);
+    }
+}
+
+static void load_timer_start(uint32_t rate_hz)
+{
+    uint32_t ticks = LOAD_TIMER_HZ / rate_hz;
+
+    TIM4->CR1 = 0;
+    TIM4->PSC = PCLK1_HZ / LOAD_TIMER_HZ - 1;
+    TIM4->ARR = (ticks > 1 ? ticks : 2) - 1;
+    TIM4->EGR = TIM_EGR_UG;
+    TIM4->SR = ~TIM_SR_UIF;
+    TIM4->DIER = TIM_DIER_UIE;
+    TIM4->CR1 = TIM_CR1_CEN;
+}
+
+static void load_timer_stop(void)
+{
+    TIM4->CR1 = 0;
+    TIM4->DIER = 0;
+    NVIC_ClearPendingIRQ(TIM4_IRQn);
+}
+
+// Idle loops of main during cycles
+static uint32_t load_idle(uint32_t cycles)
+{
+    uint32_t start = DWT->CYCCNT;
+    uint32_t loops = 0;
+
+    while (DWT->CYCCNT - start < cycles)
+    {
+        loops++;
+    }
+
+    return loops;
+}
+
+// Line builder for the report, no printf on the board
+static uint32_t append_string(uint32_t used, const char *string)
+{
+    while (*string != '\0' && used < LOAD_REPORT_SIZE - 2)
+    {
+        load.report[used++] = *string++;
+    }
+
+    return used;
+}
+
+static uint32_t append_unsigned(uint32_t used, uint32_t value)
+{
+    char digits[10];
+    int32_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0 && used < LOAD_REPORT_SIZE - 2)
+    {
+        load.report[used++] = digits[--count];
+    }
+
+    return used;
+}
+
+static uint32_t append_field(uint32_t used, const char *name, uint32_t value)
+{
+    used = append_string(used, name);
+    return append_unsigned(used, value);
+}
+
+// Started once the link is idle and nothing waits, with the sending
+// interrupts masked so that no frame starts in between; frames sent
+// meanwhile queue behind it
+static void load_report_send(uint32_t used)
+{
+    uint32_t sent = 0;
+
+    load.report[used++] = '\r';
+    load.report[used++] = '\n';
+
+    while (!sent)
+    {
+        __disable_irq();
+
+        if (usart2_dma_tx_idle() && !usart2_dma_tx_complete() &&
+            is_queue_empty(&messages_queue))
+        {
+            usart2_dma_tx_start(load.report, used);
+            sent = 1;
+        }
+
+        __enable_irq();
     }
 }
 
-static void init_buffer()
+// Until the report of the last step and the frames behind it are out
+static void load_drain(void)
 {
-    buffer[BUFFER_POSITION_X] = 'X';
-    buffer[BUFFER_POSITION_Y] = 'Y';
-    buffer[BUFFER_POSITION_CR] = '\r';
-    buffer[BUFFER_POSITION_LF] = '\n';
+    while (!usart2_dma_tx_idle() || !is_queue_empty(&messages_queue))
+    {
+    }
+}
+
+static void load_step(uint32_t rate_hz)
+{
+    uint32_t generated;
+    uint32_t events;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t replaced;
+    uint32_t dropped;
+    uint32_t idle;
+    uint32_t idle_per_mille = 0;
+    uint32_t used = 0;
+
+    load_drain();
+
+    generated = load.generated;
+    events = load.events;
+    frames = tx_stats.frames_started;
+    bytes = tx_stats.bytes_started;
+    replaced = tx_stats.frames_replaced;
+    dropped = tx_stats.events_dropped;
+    tx_stats.queue_max = 0;
+
+    load_timer_start(rate_hz);
+    idle = load_idle(LOAD_STEP_CYCLES);
+    load_timer_stop();
+
+    // Counted over the step, the drain is not
+    generated = load.generated - generated;
+    events = load.events - events;
+    frames = tx_stats.frames_started - frames;
+    bytes = tx_stats.bytes_started - bytes;
+    replaced = tx_stats.frames_replaced - replaced;
+    dropped = tx_stats.events_dropped - dropped;
+
+    // Loops vary a little from step to step, a light step may count
+    // more than the reference
+    if (load.idle_reference != 0)
+    {
+        idle_per_mille = (uint32_t)((uint64_t)idle * 1000U / load.idle_reference);
+        idle_per_mille = idle_per_mille < 1000U ? idle_per_mille : 1000U;
+    }
+
+    used = append_field(used, "{\"load\":\"project\",\"hclk_hz\":", HSI_HZ);
+    used = append_field(used, ",\"baud\":", BAUD_RATE);
+    used = append_field(used, ",\"rate_hz\":", LOAD_TIMER_HZ / (TIM4->ARR + 1));
+    used = append_field(used, ",\"frame_bytes\":", LOAD_FRAME_LENGTH);
+    used = append_field(used, ",\"ms\":", LOAD_STEP_MS);
+    used = append_field(used, ",\"generated\":", generated);
+    used = append_field(used, ",\"events\":", events);
+    used = append_field(used, ",\"frames\":", frames);
+    used = append_field(used, ",\"bytes\":", bytes);
+    used = append_field(used, ",\"frames_per_s\":", frames * 1000U / LOAD_STEP_MS);
+    used = append_field(used, ",\"bytes_per_s\":", bytes * 1000U / LOAD_STEP_MS);
+    used = append_field(used, ",\"replaced\":", replaced);
+    used = append_field(used, ",\"dropped\":", dropped);
+    used = append_field(used, ",\"queue_max\":", tx_stats.queue_max);
+    used = append_field(used, ",\"idle_loops\":", idle);
+    used = append_field(used, ",\"idle_reference\":", load.idle_reference);
+    used = append_field(used, ",\"idle_per_mille\":", idle_per_mille);
+    used = append_string(used, "}");
+
+    load_report_send(used);
 }
 
+static void load_run(void)
+{
+    load.frame[0] = 'L';
+    load.frame[LOAD_FRAME_LENGTH - 2] = '\r';
+    load.frame[LOAD_FRAME_LENGTH - 1] = '\n';
+    load.frame[LOAD_FRAME_LENGTH] = '\0';
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // The accelerometer frames alone, from a drained link as the steps
+    load_drain();
+    load.idle_reference = load_idle(LOAD_STEP_CYCLES);
+
+    for (uint32_t step = 0; step < LOAD_STEPS; ++step)
+    {
+        load_step(LOAD_RATE_HZ << step);
+    }
+}
+#endif
+
 int main(void)
 {
-    init_buffer();
+    sample_pipeline_init(&sample_pipeline);
+
+#ifdef BURST_CAPTURE
+    capture_configure();
+#endif
 
     RCC_configure();
-    USART_configure();
-    DMA_configure();
+
+    // Sending only, by DMA
+    usart2_configure(0, USART_CR3_DMAT);
+#ifndef FRAME_STREAM
+    usart2_dma_tx_configure();
+#endif
+
     I2C_configure();
+
+    buttons_configure();
+    buttons_pressed = buttons_state();
+    sample_pipeline_buttons(&sample_pipeline, buttons_pressed);
+
     NVIC_configure();
     TIM_configure();
 
-    USART_enable();
+    usart2_enable();
+
+#ifdef LOAD_BENCH
+    load_run();
+#endif
 
     for (;;)
     {
@@ -0,0 +1,48 @@
+#include "sample_pipeline.h"
+
+// Initialize the pipeline:
+// fixed characters of the frame, values are filled by the samples and
+// read 000 until then, so that every frame is well formed
+void sample_pipeline_init(sample_pipeline_t *pipeline)
+{
+    for (int i = 1; i <= SAMPLE_VALUE_DECIMAL_LENGTH; ++i)
+    {
+        pipeline->frame[SAMPLE_FRAME_POSITION_X + i] = '0';
+        pipeline->frame[SAMPLE_FRAME_POSITION_Y + i] = '0';
+        pipeline->frame[SAMPLE_FRAME_POSITION_B + i] = '0';
+    }
+
+    pipeline->frame[SAMPLE_FRAME_POSITION_X] = 'X';
+    pipeline->frame[SAMPLE_FRAME_POSITION_Y] = 'Y';
+    pipeline->frame[SAMPLE_FRAME_POSITION_B] = 'B';
+    pipeline->frame[SAMPLE_FRAME_POSITION_CR] = '\r';
+    pipeline->frame[SAMPLE_FRAME_POSITION_LF] = '\n';
+    pipeline->frame[SAMPLE_FRAME_SIZE - 1] = '\0';
+}
+
+// Zero-padded decimal of value after the letter at frame_offset
+static void write_decimal(sample_pipeline_t *pipeline, int frame_offset, uint8_t value)
+{
+    for (int i = SAMPLE_VALUE_DECIMAL_LENGTH; i > 0; --i)
+    {
+        char char_to_frame = (value % 10) + '0';
+        pipeline->frame[frame_offset + i] = char_to_frame;
+        value /= 10;
+    }
+}
+
+// Process one register value read from the accelerometer:
+// written into the frame as a zero-padded decimal
+void sample_pipeline_push(sample_pipeline_t *pipeline, sample_axis_t axis, uint8_t value)
+{
+    int frame_offset = (axis == SAMPLE_AXIS_X) ? SAMPLE_FRAME_POSITION_X
+                                               : SAMPLE_FRAME_POSITION_Y;
+
+    write_decimal(pipeline, frame_offset, value);
+}
+
+// Mask of the pressed buttons, bit i for button i
+void sample_pipeline_buttons(sample_pipeline_t *pipeline, uint8_t buttons)
+{
+    write_decimal(pipeline, SAMPLE_FRAME_POSITION_B, buttons);
+}
@@ -0,0 +1,45 @@
+#ifndef SAMPLE_PIPELINE_H
+#define SAMPLE_PIPELINE_H
+
+#include <stdint.h>
+
+// Frame in format XnnnYnnnBnnn\r\n, nnn being zero-padded values of the
+// accelerometer registers and of the mask of the pressed buttons,
+// terminated for strlen
+#define SAMPLE_FRAME_SIZE 15
+
+// Bytes sent, without the terminator
+#define SAMPLE_FRAME_LENGTH (SAMPLE_FRAME_SIZE - 1)
+
+#define SAMPLE_FRAME_POSITION_X 0
+#define SAMPLE_FRAME_POSITION_Y 4
+#define SAMPLE_FRAME_POSITION_B 8
+#define SAMPLE_FRAME_POSITION_CR 12
+#define SAMPLE_FRAME_POSITION_LF 13
+
+#define SAMPLE_VALUE_DECIMAL_LENGTH 3
+
+typedef enum
+{
+    SAMPLE_AXIS_X,
+    SAMPLE_AXIS_Y
+} sample_axis_t;
+
+// Processing of the accelerometer samples, independent of the hardware:
+// the board feeds it from the I2C interrupt, Host/replay from recordings
+typedef struct
+{
+    char frame[SAMPLE_FRAME_SIZE];
+} sample_pipeline_t;
+
+
+void sample_pipeline_init(sample_pipeline_t *);
+
+
+void sample_pipeline_push(sample_pipeline_t *, sample_axis_t, uint8_t);
+
+
+void sample_pipeline_buttons(sample_pipeline_t *, uint8_t);
+
+
+#endif /* SAMPLE_PIPELINE_H */
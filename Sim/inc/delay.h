@@ -0,0 +1,8 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdint.h>
+
+void Delay(uint32_t count);
+
+#endif /* DELAY_H */
@@ -0,0 +1,65 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+/* Host replacement for the course <gpio.h>:
+    same configuration API, implemented by the simulator on top of its
+    register memory (see Sim/sim_core.c).
+*/
+
+#include <stm32.h>
+
+typedef enum
+{
+    GPIO_OType_PP,
+    GPIO_OType_OD
+} GPIOOType_TypeDef;
+
+typedef enum
+{
+    GPIO_Low_Speed,
+    GPIO_Medium_Speed,
+    GPIO_Fast_Speed,
+    GPIO_High_Speed
+} GPIOSpeed_TypeDef;
+
+typedef enum
+{
+    GPIO_PuPd_NOPULL,
+    GPIO_PuPd_UP,
+    GPIO_PuPd_DOWN
+} GPIOPuPd_TypeDef;
+
+typedef enum
+{
+    EXTI_Mode_Interrupt = 0x00,
+    EXTI_Mode_Event = 0x04
+} EXTIMode_TypeDef;
+
+typedef enum
+{
+    EXTI_Trigger_Rising = 0x08,
+    EXTI_Trigger_Falling = 0x0C,
+    EXTI_Trigger_Rising_Falling = 0x10
+} EXTITrigger_TypeDef;
+
+#define GPIO_AF_TIM1 1U
+#define GPIO_AF_TIM2 1U
+#define GPIO_AF_TIM3 2U
+#define GPIO_AF_TIM4 2U
+#define GPIO_AF_TIM5 2U
+#define GPIO_AF_I2C1 4U
+#define GPIO_AF_USART2 7U
+
+void GPIOoutConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                      GPIOOType_TypeDef otype, GPIOSpeed_TypeDef speed,
+                      GPIOPuPd_TypeDef pupd);
+
+void GPIOafConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                     GPIOOType_TypeDef otype, GPIOSpeed_TypeDef speed,
+                     GPIOPuPd_TypeDef pupd, uint32_t af);
+
+void GPIOinConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                     GPIOPuPd_TypeDef pupd, EXTIMode_TypeDef mode,
+                     EXTITrigger_TypeDef trigger);
+
+#endif /* GPIO_H */
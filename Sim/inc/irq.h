@@ -0,0 +1,13 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+typedef uint32_t irq_level_t;
+
+irq_level_t IRQprotect(uint8_t new_level);
+void IRQunprotect(irq_level_t old_level);
+irq_level_t IRQprotectAll(void);
+void IRQunprotectAll(irq_level_t old_level);
+
+#endif /* IRQ_H */
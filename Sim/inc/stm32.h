@@ -0,0 +1,492 @@
+#ifndef STM32_H
+#define STM32_H
+
+/* Host replacement for the course <stm32.h>:
+    register blocks are laid out as in CMSIS and live at the real
+    STM32F411 addresses, where the simulator maps its register memory
+    (see Sim/sim_core.c). Accesses with side effects are trapped and
+    handed to the peripheral models, so firmware sources compile and run
+    natively without any change.
+*/
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __I volatile const
+
+#define __NVIC_PRIO_BITS 4
+
+// -------------------- Register blocks --------------------
+
+typedef struct
+{
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR;
+    __IO uint32_t PLLCFGR;
+    __IO uint32_t CFGR;
+    __IO uint32_t CIR;
+    __IO uint32_t AHB1RSTR;
+    __IO uint32_t AHB2RSTR;
+    uint32_t RESERVED0[2];
+    __IO uint32_t APB1RSTR;
+    __IO uint32_t APB2RSTR;
+    uint32_t RESERVED1[2];
+    __IO uint32_t AHB1ENR;
+    __IO uint32_t AHB2ENR;
+    uint32_t RESERVED2[2];
+    __IO uint32_t APB1ENR;
+    __IO uint32_t APB2ENR;
+} RCC_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t SR;
+    __IO uint32_t DR;
+    __IO uint32_t BRR;
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t CR3;
+    __IO uint32_t GTPR;
+} USART_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR;
+    __IO uint32_t NDTR;
+    __IO uint32_t PAR;
+    __IO uint32_t M0AR;
+    __IO uint32_t M1AR;
+    __IO uint32_t FCR;
+} DMA_Stream_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t LISR;
+    __IO uint32_t HISR;
+    __IO uint32_t LIFCR;
+    __IO uint32_t HIFCR;
+} DMA_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t OAR1;
+    __IO uint32_t OAR2;
+    __IO uint32_t DR;
+    __IO uint32_t SR1;
+    __IO uint32_t SR2;
+    __IO uint32_t CCR;
+    __IO uint32_t TRISE;
+    __IO uint32_t FLTR;
+} I2C_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SMCR;
+    __IO uint32_t DIER;
+    __IO uint32_t SR;
+    __IO uint32_t EGR;
+    __IO uint32_t CCMR1;
+    __IO uint32_t CCMR2;
+    __IO uint32_t CCER;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+    __IO uint32_t RCR;
+    __IO uint32_t CCR1;
+    __IO uint32_t CCR2;
+    __IO uint32_t CCR3;
+    __IO uint32_t CCR4;
+    __IO uint32_t BDTR;
+    __IO uint32_t DCR;
+    __IO uint32_t DMAR;
+    __IO uint32_t OR;
+} TIM_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t IMR;
+    __IO uint32_t EMR;
+    __IO uint32_t RTSR;
+    __IO uint32_t FTSR;
+    __IO uint32_t SWIER;
+    __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t MEMRMP;
+    __IO uint32_t PMC;
+    __IO uint32_t EXTICR[4];
+    uint32_t RESERVED[2];
+    __IO uint32_t CMPCR;
+} SYSCFG_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+    __IO uint32_t DHCSR;
+    __IO uint32_t DCRSR;
+    __IO uint32_t DCRDR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+// -------------------- Memory map --------------------
+
+#define PERIPH_BASE 0x40000000U
+#define APB1PERIPH_BASE PERIPH_BASE
+#define APB2PERIPH_BASE (PERIPH_BASE + 0x00010000U)
+#define AHB1PERIPH_BASE (PERIPH_BASE + 0x00020000U)
+
+#define TIM2_BASE (APB1PERIPH_BASE + 0x0000U)
+#define TIM3_BASE (APB1PERIPH_BASE + 0x0400U)
+#define TIM4_BASE (APB1PERIPH_BASE + 0x0800U)
+#define TIM5_BASE (APB1PERIPH_BASE + 0x0C00U)
+#define USART2_BASE (APB1PERIPH_BASE + 0x4400U)
+#define I2C1_BASE (APB1PERIPH_BASE + 0x5400U)
+
+#define TIM1_BASE (APB2PERIPH_BASE + 0x0000U)
+#define SYSCFG_BASE (APB2PERIPH_BASE + 0x3800U)
+#define EXTI_BASE (APB2PERIPH_BASE + 0x3C00U)
+
+#define GPIOA_BASE (AHB1PERIPH_BASE + 0x0000U)
+#define GPIOB_BASE (AHB1PERIPH_BASE + 0x0400U)
+#define GPIOC_BASE (AHB1PERIPH_BASE + 0x0800U)
+#define RCC_BASE (AHB1PERIPH_BASE + 0x3800U)
+#define DMA1_BASE (AHB1PERIPH_BASE + 0x6000U)
+#define DMA2_BASE (AHB1PERIPH_BASE + 0x6400U)
+
+#define DMA_STREAM_BASE(dma_base, n) ((dma_base) + 0x010U + 0x018U * (n))
+
+#define DWT_BASE 0xE0001000U
+#define CoreDebug_BASE 0xE000EDF0U
+
+#define TIM1 ((TIM_TypeDef *)TIM1_BASE)
+#define TIM2 ((TIM_TypeDef *)TIM2_BASE)
+#define TIM3 ((TIM_TypeDef *)TIM3_BASE)
+#define TIM4 ((TIM_TypeDef *)TIM4_BASE)
+#define TIM5 ((TIM_TypeDef *)TIM5_BASE)
+#define USART2 ((USART_TypeDef *)USART2_BASE)
+#define I2C1 ((I2C_TypeDef *)I2C1_BASE)
+#define SYSCFG ((SYSCFG_TypeDef *)SYSCFG_BASE)
+#define EXTI ((EXTI_TypeDef *)EXTI_BASE)
+#define GPIOA ((GPIO_TypeDef *)GPIOA_BASE)
+#define GPIOB ((GPIO_TypeDef *)GPIOB_BASE)
+#define GPIOC ((GPIO_TypeDef *)GPIOC_BASE)
+#define RCC ((RCC_TypeDef *)RCC_BASE)
+#define DMA1 ((DMA_TypeDef *)DMA1_BASE)
+#define DMA2 ((DMA_TypeDef *)DMA2_BASE)
+#define DWT ((DWT_Type *)DWT_BASE)
+#define CoreDebug ((CoreDebug_Type *)CoreDebug_BASE)
+
+#define DMA1_Stream0 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 0))
+#define DMA1_Stream1 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 1))
+#define DMA1_Stream2 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 2))
+#define DMA1_Stream3 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 3))
+#define DMA1_Stream4 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 4))
+#define DMA1_Stream5 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 5))
+#define DMA1_Stream6 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 6))
+#define DMA1_Stream7 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA1_BASE, 7))
+#define DMA2_Stream0 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 0))
+#define DMA2_Stream1 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 1))
+#define DMA2_Stream2 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 2))
+#define DMA2_Stream3 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 3))
+#define DMA2_Stream4 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 4))
+#define DMA2_Stream5 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 5))
+#define DMA2_Stream6 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 6))
+#define DMA2_Stream7 ((DMA_Stream_TypeDef *)DMA_STREAM_BASE(DMA2_BASE, 7))
+
+// -------------------- Interrupts --------------------
+
+typedef enum
+{
+    EXTI0_IRQn = 6,
+    EXTI1_IRQn = 7,
+    EXTI2_IRQn = 8,
+    EXTI3_IRQn = 9,
+    EXTI4_IRQn = 10,
+    DMA1_Stream0_IRQn = 11,
+    DMA1_Stream1_IRQn = 12,
+    DMA1_Stream2_IRQn = 13,
+    DMA1_Stream3_IRQn = 14,
+    DMA1_Stream4_IRQn = 15,
+    DMA1_Stream5_IRQn = 16,
+    DMA1_Stream6_IRQn = 17,
+    EXTI9_5_IRQn = 23,
+    TIM1_BRK_TIM9_IRQn = 24,
+    TIM1_UP_TIM10_IRQn = 25,
+    TIM1_TRG_COM_TIM11_IRQn = 26,
+    TIM1_CC_IRQn = 27,
+    TIM2_IRQn = 28,
+    TIM3_IRQn = 29,
+    TIM4_IRQn = 30,
+    I2C1_EV_IRQn = 31,
+    I2C1_ER_IRQn = 32,
+    USART2_IRQn = 38,
+    EXTI15_10_IRQn = 40,
+    DMA1_Stream7_IRQn = 47,
+    TIM5_IRQn = 50,
+    DMA2_Stream0_IRQn = 56,
+    DMA2_Stream1_IRQn = 57,
+    DMA2_Stream2_IRQn = 58,
+    DMA2_Stream3_IRQn = 59,
+    DMA2_Stream4_IRQn = 60,
+    DMA2_Stream5_IRQn = 68,
+    DMA2_Stream6_IRQn = 69,
+    DMA2_Stream7_IRQn = 70,
+    SIM_IRQn_NUMBER = 86
+} IRQn_Type;
+
+// NVIC and core intrinsics are implemented by the simulator
+void NVIC_EnableIRQ(IRQn_Type irqn);
+void NVIC_DisableIRQ(IRQn_Type irqn);
+void NVIC_SetPendingIRQ(IRQn_Type irqn);
+void NVIC_ClearPendingIRQ(IRQn_Type irqn);
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irqn);
+void NVIC_SetPriorityGrouping(uint32_t group);
+uint32_t NVIC_GetPriorityGrouping(void);
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t preempt, uint32_t sub);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+uint32_t __get_BASEPRI(void);
+void __set_BASEPRI(uint32_t basepri);
+void __WFI(void);
+
+static inline void __NOP(void) { __asm__ volatile("" ::: "memory"); }
+static inline void __DSB(void) { __asm__ volatile("" ::: "memory"); }
+static inline void __ISB(void) { __asm__ volatile("" ::: "memory"); }
+static inline void __DMB(void) { __asm__ volatile("" ::: "memory"); }
+
+// -------------------- Bit definitions --------------------
+
+#define RCC_AHB1ENR_GPIOAEN (1U << 0)
+#define RCC_AHB1ENR_GPIOBEN (1U << 1)
+#define RCC_AHB1ENR_GPIOCEN (1U << 2)
+#define RCC_AHB1ENR_DMA1EN (1U << 21)
+#define RCC_AHB1ENR_DMA2EN (1U << 22)
+
+#define RCC_APB1ENR_TIM2EN (1U << 0)
+#define RCC_APB1ENR_TIM3EN (1U << 1)
+#define RCC_APB1ENR_TIM4EN (1U << 2)
+#define RCC_APB1ENR_TIM5EN (1U << 3)
+#define RCC_APB1ENR_USART2EN (1U << 17)
+#define RCC_APB1ENR_I2C1EN (1U << 21)
+
+#define RCC_APB2ENR_TIM1EN (1U << 0)
+#define RCC_APB2ENR_SYSCFGEN (1U << 14)
+
+#define USART_SR_PE (1U << 0)
+#define USART_SR_FE (1U << 1)
+#define USART_SR_NE (1U << 2)
+#define USART_SR_ORE (1U << 3)
+#define USART_SR_IDLE (1U << 4)
+#define USART_SR_RXNE (1U << 5)
+#define USART_SR_TC (1U << 6)
+#define USART_SR_TXE (1U << 7)
+
+#define USART_CR1_RE (1U << 2)
+#define USART_CR1_TE (1U << 3)
+#define USART_CR1_IDLEIE (1U << 4)
+#define USART_CR1_RXNEIE (1U << 5)
+#define USART_CR1_TCIE (1U << 6)
+#define USART_CR1_TXEIE (1U << 7)
+#define USART_CR1_M (1U << 12)
+#define USART_CR1_UE (1U << 13)
+#define USART_CR1_OVER8 (1U << 15)
+
+#define USART_CR3_EIE (1U << 0)
+#define USART_CR3_DMAR (1U << 6)
+#define USART_CR3_DMAT (1U << 7)
+
+#define DMA_SxCR_EN (1U << 0)
+#define DMA_SxCR_DMEIE (1U << 1)
+#define DMA_SxCR_TEIE (1U << 2)
+#define DMA_SxCR_HTIE (1U << 3)
+#define DMA_SxCR_TCIE (1U << 4)
+#define DMA_SxCR_PFCTRL (1U << 5)
+#define DMA_SxCR_DIR (3U << 6)
+#define DMA_SxCR_DIR_0 (1U << 6)
+#define DMA_SxCR_DIR_1 (1U << 7)
+#define DMA_SxCR_CIRC (1U << 8)
+#define DMA_SxCR_PINC (1U << 9)
+#define DMA_SxCR_MINC (1U << 10)
+#define DMA_SxCR_PSIZE (3U << 11)
+#define DMA_SxCR_PSIZE_0 (1U << 11)
+#define DMA_SxCR_PSIZE_1 (1U << 12)
+#define DMA_SxCR_MSIZE (3U << 13)
+#define DMA_SxCR_MSIZE_0 (1U << 13)
+#define DMA_SxCR_MSIZE_1 (1U << 14)
+#define DMA_SxCR_PL (3U << 16)
+#define DMA_SxCR_PL_0 (1U << 16)
+#define DMA_SxCR_PL_1 (1U << 17)
+#define DMA_SxCR_DBM (1U << 18)
+#define DMA_SxCR_CT (1U << 19)
+#define DMA_SxCR_CHSEL (7U << 25)
+
+#define DMA_LISR_FEIF0 (1U << 0)
+#define DMA_LISR_TEIF0 (1U << 3)
+#define DMA_LISR_HTIF0 (1U << 4)
+#define DMA_LISR_TCIF0 (1U << 5)
+#define DMA_LISR_TEIF1 (1U << 9)
+#define DMA_LISR_HTIF1 (1U << 10)
+#define DMA_LISR_TCIF1 (1U << 11)
+#define DMA_LIFCR_CTEIF1 (1U << 9)
+#define DMA_LIFCR_CHTIF1 (1U << 10)
+#define DMA_LIFCR_CTCIF1 (1U << 11)
+
+#define DMA_HISR_TEIF5 (1U << 9)
+#define DMA_HISR_HTIF5 (1U << 10)
+#define DMA_HISR_TCIF5 (1U << 11)
+#define DMA_HISR_TEIF6 (1U << 19)
+#define DMA_HISR_HTIF6 (1U << 20)
+#define DMA_HISR_TCIF6 (1U << 21)
+
+#define DMA_HIFCR_CTEIF5 (1U << 9)
+#define DMA_HIFCR_CHTIF5 (1U << 10)
+#define DMA_HIFCR_CTCIF5 (1U << 11)
+#define DMA_HIFCR_CTEIF6 (1U << 19)
+#define DMA_HIFCR_CHTIF6 (1U << 20)
+#define DMA_HIFCR_CTCIF6 (1U << 21)
+
+#define EXTI_PR_PR0 (1U << 0)
+#define EXTI_PR_PR1 (1U << 1)
+#define EXTI_PR_PR2 (1U << 2)
+#define EXTI_PR_PR3 (1U << 3)
+#define EXTI_PR_PR4 (1U << 4)
+#define EXTI_PR_PR5 (1U << 5)
+#define EXTI_PR_PR6 (1U << 6)
+#define EXTI_PR_PR7 (1U << 7)
+#define EXTI_PR_PR8 (1U << 8)
+#define EXTI_PR_PR9 (1U << 9)
+#define EXTI_PR_PR10 (1U << 10)
+#define EXTI_PR_PR11 (1U << 11)
+#define EXTI_PR_PR12 (1U << 12)
+#define EXTI_PR_PR13 (1U << 13)
+#define EXTI_PR_PR14 (1U << 14)
+#define EXTI_PR_PR15 (1U << 15)
+
+#define I2C_CR1_PE (1U << 0)
+#define I2C_CR1_START (1U << 8)
+#define I2C_CR1_STOP (1U << 9)
+#define I2C_CR1_ACK (1U << 10)
+#define I2C_CR1_POS (1U << 11)
+#define I2C_CR1_SWRST (1U << 15)
+
+#define I2C_CR2_FREQ (0x3FU << 0)
+#define I2C_CR2_ITERREN (1U << 8)
+#define I2C_CR2_ITEVTEN (1U << 9)
+#define I2C_CR2_ITBUFEN (1U << 10)
+#define I2C_CR2_DMAEN (1U << 11)
+#define I2C_CR2_LAST (1U << 12)
+
+#define I2C_SR1_SB (1U << 0)
+#define I2C_SR1_ADDR (1U << 1)
+#define I2C_SR1_BTF (1U << 2)
+#define I2C_SR1_STOPF (1U << 4)
+#define I2C_SR1_RXNE (1U << 6)
+#define I2C_SR1_TXE (1U << 7)
+#define I2C_SR1_BERR (1U << 8)
+#define I2C_SR1_ARLO (1U << 9)
+#define I2C_SR1_AF (1U << 10)
+#define I2C_SR1_OVR (1U << 11)
+
+#define I2C_SR2_MSL (1U << 0)
+#define I2C_SR2_BUSY (1U << 1)
+#define I2C_SR2_TRA (1U << 2)
+
+#define TIM_CR1_CEN (1U << 0)
+#define TIM_CR1_UDIS (1U << 1)
+#define TIM_CR1_URS (1U << 2)
+#define TIM_CR1_OPM (1U << 3)
+#define TIM_CR1_ARPE (1U << 7)
+
+#define TIM_DIER_UIE (1U << 0)
+#define TIM_DIER_CC1IE (1U << 1)
+#define TIM_DIER_CC2IE (1U << 2)
+#define TIM_DIER_CC3IE (1U << 3)
+#define TIM_DIER_CC4IE (1U << 4)
+#define TIM_DIER_UDE (1U << 8)
+#define TIM_DIER_CC1DE (1U << 9)
+#define TIM_DIER_CC2DE (1U << 10)
+#define TIM_DIER_CC3DE (1U << 11)
+#define TIM_DIER_CC4DE (1U << 12)
+
+#define TIM_SR_UIF (1U << 0)
+#define TIM_SR_CC1IF (1U << 1)
+#define TIM_SR_CC2IF (1U << 2)
+#define TIM_SR_CC3IF (1U << 3)
+#define TIM_SR_CC4IF (1U << 4)
+#define TIM_SR_CC1OF (1U << 9)
+#define TIM_SR_CC2OF (1U << 10)
+#define TIM_SR_CC3OF (1U << 11)
+#define TIM_SR_CC4OF (1U << 12)
+
+#define TIM_EGR_UG (1U << 0)
+
+#define TIM_CCMR1_CC1S (3U << 0)
+#define TIM_CCMR1_CC1S_0 (1U << 0)
+#define TIM_CCMR1_OC1PE (1U << 3)
+#define TIM_CCMR1_OC1M (7U << 4)
+#define TIM_CCMR1_OC1M_1 (1U << 5)
+#define TIM_CCMR1_OC1M_2 (1U << 6)
+#define TIM_CCMR1_IC1F (15U << 4)
+#define TIM_CCMR1_CC2S (3U << 8)
+#define TIM_CCMR1_CC2S_0 (1U << 8)
+#define TIM_CCMR1_OC2PE (1U << 11)
+#define TIM_CCMR1_OC2M (7U << 12)
+#define TIM_CCMR1_OC2M_1 (1U << 13)
+#define TIM_CCMR1_OC2M_2 (1U << 14)
+#define TIM_CCMR1_IC2F (15U << 12)
+
+#define TIM_CCMR2_CC3S (3U << 0)
+#define TIM_CCMR2_CC3S_0 (1U << 0)
+#define TIM_CCMR2_OC3PE (1U << 3)
+#define TIM_CCMR2_OC3M (7U << 4)
+#define TIM_CCMR2_OC3M_1 (1U << 5)
+#define TIM_CCMR2_OC3M_2 (1U << 6)
+#define TIM_CCMR2_IC3F (15U << 4)
+#define TIM_CCMR2_CC4S (3U << 8)
+#define TIM_CCMR2_CC4S_0 (1U << 8)
+
+#define TIM_CCER_CC1E (1U << 0)
+#define TIM_CCER_CC1P (1U << 1)
+#define TIM_CCER_CC1NP (1U << 3)
+#define TIM_CCER_CC2E (1U << 4)
+#define TIM_CCER_CC2P (1U << 5)
+#define TIM_CCER_CC2NP (1U << 7)
+#define TIM_CCER_CC3E (1U << 8)
+#define TIM_CCER_CC3P (1U << 9)
+#define TIM_CCER_CC3NP (1U << 11)
+#define TIM_CCER_CC4E (1U << 12)
+#define TIM_CCER_CC4P (1U << 13)
+#define TIM_CCER_CC4NP (1U << 15)
+
+#define TIM_BDTR_MOE (1U << 15)
+
+#define DWT_CTRL_CYCCNTENA_Msk (1U << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1U << 24)
+
+#endif /* STM32_H */
@@ -0,0 +1,2206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "button_table.h"
+#include "scenarios.h"
+#include "sim.h"
+
+/* Board level scenarios: a stimulus scheduled in virtual time (button
+    edges, bytes on the link) and checks of what the firmware sends back.
+    Every scenario ends with one JSON line on stdout and the exit status
+    of the check.
+*/
+
+#define MS 1000000ULL
+#define US 1000ULL
+
+#define LINE_CAPACITY 512
+
+// Virtual time without output after which the link is considered drained
+#define DRAIN_QUIET_NS (250 * MS)
+#define DRAIN_MAX_NS (120000 * MS)
+
+#define PENDING_EVENTS 1024
+
+// Largest spread of the offset between the edge times captured by the
+// firmware ("@<us>" stamps) and the virtual times of the edges
+#define STAMP_SPREAD_MAX_US 2
+
+static scenario_options_t options;
+static const char *scenario_name;
+static uint32_t random_state;
+
+static char line[LINE_CAPACITY];
+static uint32_t line_length;
+static uint64_t last_byte_time;
+static uint64_t output_bytes;
+static uint64_t byte_gap_min;
+static uint64_t byte_gap_max;
+static uint32_t lines;
+static uint32_t malformed;
+
+static void (*line_checker)(const char *text, uint64_t time);
+// Instead of line_checker, for output that is not only lines
+static void (*byte_checker)(uint8_t byte, uint64_t time);
+static void (*finish_check)(void);
+
+static const char *failure;
+
+// -------------------- Helpers --------------------
+
+// xorshift32, deterministic for a seed
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint32_t random_below(uint32_t limit)
+{
+    return random_next() % limit;
+}
+
+// Interval to the next event of a stimulus at options.rate events per second,
+// uniformly spread in [0.5, 1.5] of the mean
+static uint64_t random_interval(void)
+{
+    uint64_t mean = 1000000000ULL / (options.rate ? options.rate : 1);
+
+    return mean / 2 + (mean * random_below(1024)) / 1024;
+}
+
+static void fail(const char *reason)
+{
+    if (failure == NULL)
+    {
+        failure = reason;
+    }
+}
+
+// Value of a numeric field of a report, 0 if it is missing
+static uint32_t report_field(const char *text, const char *name)
+{
+    char key[64];
+    const char *found;
+
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    found = strstr(text, key);
+
+    return found ? (uint32_t)strtoul(found + strlen(key), NULL, 10) : 0;
+}
+
+static void report_begin(void)
+{
+    printf("{\"scenario\":\"%s\",\"firmware\":\"%s\",\"duration_ms\":%u,"
+           "\"rate\":%u,\"seed\":%u,\"lines\":%u,\"malformed\":%u",
+           scenario_name, sim_firmware, options.duration_ms, options.rate,
+           options.seed, lines, malformed);
+}
+
+static void report_end(void)
+{
+    if (malformed != 0)
+    {
+        fail("malformed output");
+    }
+
+    printf(",\"result\":\"%s\"", failure ? "fail" : "pass");
+
+    if (failure)
+    {
+        printf(",\"reason\":\"%s\"", failure);
+    }
+
+    printf("}\n");
+    sim_finish(failure ? 1 : 0);
+}
+
+// -------------------- Output of the firmware --------------------
+
+static void uart_observer(uint8_t byte, uint64_t time_ns)
+{
+    // Time between the ends of two bytes, one byte time on a busy line
+    if (output_bytes > 0)
+    {
+        uint64_t gap = time_ns - last_byte_time;
+
+        byte_gap_min = (output_bytes == 1 || gap < byte_gap_min) ? gap : byte_gap_min;
+        byte_gap_max = gap > byte_gap_max ? gap : byte_gap_max;
+    }
+
+    last_byte_time = time_ns;
+    output_bytes++;
+
+    if (byte_checker)
+    {
+        byte_checker(byte, time_ns);
+        return;
+    }
+
+    if (line_length == LINE_CAPACITY - 1)
+    {
+        malformed++;
+        line_length = 0;
+    }
+
+    line[line_length++] = (char)byte;
+
+    if (byte != '\n')
+    {
+        return;
+    }
+
+    lines++;
+
+    if (line_length < 2 || line[line_length - 2] != '\r')
+    {
+        malformed++;
+    }
+    else
+    {
+        line[line_length - 2] = '\0';
+        line_checker(line, time_ns);
+    }
+
+    line_length = 0;
+}
+
+// Runs the final check once nothing has been sent for DRAIN_QUIET_NS
+static void drain_check(void *start)
+{
+    uint64_t now = sim_time_ns();
+
+    if (now - last_byte_time >= DRAIN_QUIET_NS || now - (uintptr_t)start >= DRAIN_MAX_NS)
+    {
+        finish_check();
+    }
+    else
+    {
+        sim_schedule(now + 50 * MS, drain_check, start);
+    }
+}
+
+static void drain_then(void (*check)(void))
+{
+    uint64_t now = sim_time_ns();
+
+    finish_check = check;
+    sim_schedule(now + 50 * MS, drain_check, (void *)(uintptr_t)now);
+}
+
+// -------------------- Button messages --------------------
+
+static struct
+{
+    uint32_t edges;
+    uint32_t messages;
+    int last_message;
+    uint64_t pending[PENDING_EVENTS];
+    uint32_t pending_head;
+    uint32_t pending_used;
+    uint32_t stamps;
+    int64_t stamp_offset_min;
+    int64_t stamp_offset_max;
+} buttons[SIM_BUTTONS_NUMBER];
+
+static uint32_t repeats;
+static uint32_t records;
+static uint64_t latency_sum;
+static uint64_t latency_max;
+static uint32_t latency_count;
+
+// One more transition expected in the messages of the button, the
+// latency of its message counted from the given time
+static void button_expect(sim_button_t button, uint64_t time)
+{
+    buttons[button].edges++;
+
+    if (buttons[button].pending_used < PENDING_EVENTS)
+    {
+        uint32_t tail = (buttons[button].pending_head + buttons[button].pending_used) % PENDING_EVENTS;
+
+        buttons[button].pending[tail] = time;
+        buttons[button].pending_used++;
+    }
+}
+
+static void button_edge(sim_button_t button, int pressed)
+{
+    sim_button_set(button, pressed);
+    button_expect(button, sim_model_time_ns());
+}
+
+static void button_toggle(sim_button_t button)
+{
+    button_edge(button, !sim_button_pressed(button));
+}
+
+static int word_is(const char *word, size_t length, const char *expected)
+{
+    return length == strlen(expected) && strncmp(word, expected, length) == 0;
+}
+
+// Time of a captured edge against the virtual time of the edge; only
+// the spread of the offset matters, the time bases have different origins
+static void button_stamp(int button, uint64_t edge_time, uint32_t stamp)
+{
+    int64_t offset = (int64_t)(edge_time / US) - stamp;
+
+    if (buttons[button].stamps == 0 || offset < buttons[button].stamp_offset_min)
+    {
+        buttons[button].stamp_offset_min = offset;
+    }
+    if (buttons[button].stamps == 0 || offset > buttons[button].stamp_offset_max)
+    {
+        buttons[button].stamp_offset_max = offset;
+    }
+    buttons[button].stamps++;
+}
+
+// "<NAME> PRESSED" or "<NAME> RELEASED" ("PRESET" is accepted, Task1
+// spells MODE that way), optionally followed by the time of the event in
+// us: " @<us>" captured at the edge, " ~<us>" read by the handler;
+// or a record of coalesced transitions, "<NAME> x<count> final=<STATE>"
+static void button_line(const char *text, uint64_t time)
+{
+    const char *space = strchr(text, ' ');
+    const char *state;
+    const char *stamp = NULL;
+    size_t state_length;
+    char mark = 0;
+    unsigned long stamp_us = 0;
+    unsigned long transitions = 1;
+    int pressed;
+
+    if (space == NULL)
+    {
+        malformed++;
+        return;
+    }
+
+    state = space + 1;
+
+    if (state[0] == 'x')
+    {
+        char *end;
+
+        transitions = strtoul(state + 1, &end, 10);
+
+        if (end == state + 1 || transitions == 0 || strncmp(end, " final=", 7) != 0)
+        {
+            malformed++;
+            return;
+        }
+
+        state = end + 7;
+        records++;
+    }
+    else
+    {
+        stamp = strchr(state, ' ');
+    }
+
+    if (stamp != NULL)
+    {
+        char *end;
+
+        mark = stamp[1];
+        stamp_us = strtoul(stamp + 2, &end, 10);
+
+        if ((mark != '@' && mark != '~') || end == stamp + 2 || *end != '\0')
+        {
+            malformed++;
+            return;
+        }
+    }
+
+    state_length = stamp ? (size_t)(stamp - state) : strlen(state);
+
+    if (word_is(state, state_length, "PRESSED") ||
+        word_is(state, state_length, "PRESET"))
+    {
+        pressed = 1;
+    }
+    else if (word_is(state, state_length, "RELEASED"))
+    {
+        pressed = 0;
+    }
+    else
+    {
+        malformed++;
+        return;
+    }
+
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        size_t length = strlen(sim_button_names[button]);
+
+        if ((size_t)(space - text) != length ||
+            strncmp(text, sim_button_names[button], length) != 0)
+        {
+            continue;
+        }
+
+        // An odd number of transitions changes the state
+        if ((buttons[button].last_message == pressed) == (transitions % 2 == 1))
+        {
+            repeats++;
+        }
+
+        buttons[button].last_message = pressed;
+        buttons[button].messages += transitions;
+
+        // Latency from the oldest edge not reported yet to the end of line
+        if (buttons[button].pending_used > 0)
+        {
+            uint64_t latency = time - buttons[button].pending[buttons[button].pending_head];
+
+            if (mark == '@')
+            {
+                button_stamp(button, buttons[button].pending[buttons[button].pending_head],
+                             (uint32_t)stamp_us);
+            }
+
+            transitions = transitions < buttons[button].pending_used ? transitions
+                                                                     : buttons[button].pending_used;
+            buttons[button].pending_head = (buttons[button].pending_head + transitions) % PENDING_EVENTS;
+            buttons[button].pending_used -= transitions;
+            latency_sum += latency;
+            latency_count++;
+            latency_max = latency > latency_max ? latency : latency_max;
+        }
+        return;
+    }
+
+    malformed++;
+}
+
+static void buttons_report(int final_state)
+{
+    uint32_t edges = 0;
+    uint32_t messages = 0;
+    uint32_t stamps = 0;
+    int64_t stamp_spread = 0;
+
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        edges += buttons[button].edges;
+        messages += buttons[button].messages;
+
+        // Edges and messages are paired in order only if none was lost
+        if (buttons[button].stamps > 0 && buttons[button].messages == buttons[button].edges)
+        {
+            int64_t spread = buttons[button].stamp_offset_max - buttons[button].stamp_offset_min;
+
+            stamps += buttons[button].stamps;
+            stamp_spread = spread > stamp_spread ? spread : stamp_spread;
+        }
+
+        if (final_state && buttons[button].edges > 0 &&
+            buttons[button].last_message != sim_button_pressed(button))
+        {
+            fail("last message does not match the button state");
+        }
+    }
+
+    printf(",\"edges\":%u,\"messages\":%u,\"lost\":%u,\"repeats\":%u,"
+           "\"latency_us\":{\"mean\":%llu,\"max\":%llu}",
+           edges, messages, edges > messages ? edges - messages : 0, repeats,
+           (unsigned long long)(latency_count ? latency_sum / latency_count / US : 0),
+           (unsigned long long)(latency_max / US));
+
+    if (records > 0)
+    {
+        printf(",\"records\":%u,\"bytes_per_edge\":%.2f", records,
+               edges ? (double)output_bytes / edges : 0.0);
+    }
+
+    if (stamps > 0)
+    {
+        printf(",\"stamps\":%u,\"stamp_spread_us\":%lld", stamps, (long long)stamp_spread);
+
+        if (stamp_spread > STAMP_SPREAD_MAX_US)
+        {
+            fail("edge times do not follow the edges");
+        }
+    }
+}
+
+// -------------------- Liveness probe --------------------
+
+// After a stress phase the firmware must still report a single press
+static uint32_t probe_messages;
+
+// Final states are only checked where no message may be dropped
+static int probe_final_state = 1;
+
+static void probe_check(void)
+{
+    if (buttons[SIM_BUTTON_USER].messages < probe_messages + 2 ||
+        buttons[SIM_BUTTON_USER].last_message != 0)
+    {
+        fail("no response to the probe press");
+    }
+
+    report_begin();
+    buttons_report(probe_final_state);
+    report_end();
+}
+
+static void probe_release(void *arg)
+{
+    (void)arg;
+    button_edge(SIM_BUTTON_USER, 0);
+    drain_then(probe_check);
+}
+
+static void probe_press(void *arg)
+{
+    (void)arg;
+    button_edge(SIM_BUTTON_USER, 1);
+    sim_schedule(sim_time_ns() + 100 * MS, probe_release, NULL);
+}
+
+static void probe_start(void)
+{
+    probe_messages = buttons[SIM_BUTTON_USER].messages;
+
+    if (sim_button_pressed(SIM_BUTTON_USER))
+    {
+        button_edge(SIM_BUTTON_USER, 0);
+        probe_messages++;
+    }
+
+    sim_schedule(sim_time_ns() + 100 * MS, probe_press, NULL);
+}
+
+// -------------------- soak --------------------
+
+// Random buttons toggled at the given rate, every edge must be reported
+static void soak_check(void)
+{
+    report_begin();
+    buttons_report(1);
+
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        if (buttons[button].messages != buttons[button].edges)
+        {
+            fail("edges without a message");
+        }
+    }
+
+    if (repeats != 0)
+    {
+        fail("repeated messages");
+    }
+
+    report_end();
+}
+
+static void soak_event(void *arg)
+{
+    (void)arg;
+
+    if (sim_time_ns() >= options.duration_ms * MS)
+    {
+        drain_then(soak_check);
+        return;
+    }
+
+    button_toggle((sim_button_t)random_below(SIM_BUTTONS_NUMBER));
+    sim_schedule(sim_time_ns() + random_interval(), soak_event, NULL);
+}
+
+static void soak_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(100 * MS, soak_event, NULL);
+}
+
+// -------------------- bounce --------------------
+
+// Every 250 ms a button changes state through a burst of 5 to 11 edges
+// 50 to 500 us apart, like a worn contact
+static void bounce_edge(void *arg)
+{
+    button_toggle((sim_button_t)(uintptr_t)arg);
+}
+
+static void bounce_check(void)
+{
+    probe_start();
+}
+
+static void bounce_event(void *arg)
+{
+    sim_button_t button = (sim_button_t)random_below(SIM_BUTTONS_NUMBER);
+    uint32_t edges = 5 + 2 * random_below(4);
+    uint64_t time = sim_time_ns();
+
+    (void)arg;
+
+    if (time >= options.duration_ms * MS)
+    {
+        drain_then(bounce_check);
+        return;
+    }
+
+    for (uint32_t i = 0; i < edges; ++i)
+    {
+        time += 50 * US + random_below(450) * US;
+        sim_schedule(time, bounce_edge, (void *)(uintptr_t)button);
+    }
+
+    sim_schedule(sim_time_ns() + 250 * MS, bounce_event, NULL);
+}
+
+static void bounce_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(100 * MS, bounce_event, NULL);
+}
+
+// -------------------- overflow --------------------
+
+// Edges far above what 9600 baud can carry: messages may be dropped but
+// never torn, and the firmware must recover
+static void overflow_event(void *arg)
+{
+    (void)arg;
+
+    if (sim_time_ns() >= options.duration_ms * MS)
+    {
+        drain_then(probe_start);
+        return;
+    }
+
+    button_toggle((sim_button_t)random_below(SIM_BUTTONS_NUMBER));
+    sim_schedule(sim_time_ns() + random_interval(), overflow_event, NULL);
+}
+
+static void overflow_setup(void)
+{
+    line_checker = button_line;
+    probe_final_state = 0;
+    sim_schedule(100 * MS, overflow_event, NULL);
+}
+
+// -------------------- coalesce --------------------
+
+// The overflow stimulus on a firmware merging the transitions not sent
+// yet: every edge counted, final states reported, and a small fraction
+// of the bytes of one message per edge
+#define COALESCE_BYTES_PER_EDGE_MAX 1.5
+
+// Two edges of a button within one step of the models cancel out before
+// a polling firmware can see them, a few per thousand are tolerated
+#define COALESCE_LOST_MAX_PER_MILLE 2
+
+static void coalesce_check(void)
+{
+    uint32_t edges = 0;
+    uint32_t counted = 0;
+
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        edges += buttons[button].edges;
+        counted += buttons[button].messages;
+    }
+
+    if (counted > edges ||
+        (uint64_t)(edges - counted) * 1000 > (uint64_t)edges * COALESCE_LOST_MAX_PER_MILLE)
+    {
+        fail("transitions not counted");
+    }
+
+    if (records == 0)
+    {
+        fail("no coalesced record");
+    }
+    else if ((double)output_bytes / edges > COALESCE_BYTES_PER_EDGE_MAX)
+    {
+        fail("too many bytes per edge");
+    }
+
+    probe_start();
+}
+
+static void coalesce_event(void *arg)
+{
+    (void)arg;
+
+    if (sim_time_ns() >= options.duration_ms * MS)
+    {
+        drain_then(coalesce_check);
+        return;
+    }
+
+    button_toggle((sim_button_t)random_below(SIM_BUTTONS_NUMBER));
+    sim_schedule(sim_time_ns() + random_interval(), coalesce_event, NULL);
+}
+
+static void coalesce_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(100 * MS, coalesce_event, NULL);
+}
+
+// -------------------- debounce --------------------
+
+// Every 250 ms a button goes through a burst of 2 to 11 edges 50 to
+// 500 us apart: an odd count changes its state, an even one is a glitch
+// leaving it as it was. A debouncing firmware reports every change once
+// and no glitch; the latency runs from the first edge of a burst. At the
+// end 'S' asks for the counters of the firmware, checked against the
+// bursts: at most one window per burst and one per change, a message per
+// event, and each window without a message absorbing at least one edge
+#define DEBOUNCE_REPORT_WAIT_NS (1000 * MS)
+
+static uint32_t glitches;
+static uint32_t debounce_bursts;
+static uint32_t debounce_edges;
+static int debounce_reported;
+
+static void debounce_edge(void *arg)
+{
+    sim_button_t button = (sim_button_t)(uintptr_t)arg;
+
+    sim_button_set(button, !sim_button_pressed(button));
+}
+
+static void debounce_check(const char *counters)
+{
+    uint32_t changes = 0;
+    uint32_t messages = 0;
+    uint32_t windows = report_field(counters, "windows");
+    uint32_t events = report_field(counters, "events");
+    uint32_t absorbed = report_field(counters, "absorbed");
+
+    debounce_reported = 1;
+    report_begin();
+    buttons_report(1);
+    printf(",\"glitches\":%u,\"bursts\":%u,\"burst_edges\":%u,\"counters\":%s",
+           glitches, debounce_bursts, debounce_edges, counters[0] ? counters : "null");
+
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        if (buttons[button].messages != buttons[button].edges)
+        {
+            fail("not one message per change");
+        }
+
+        changes += buttons[button].edges;
+        messages += buttons[button].messages;
+    }
+
+    if (repeats != 0)
+    {
+        fail("repeated messages");
+    }
+
+    if (counters[0] == '\0')
+    {
+        fail("no report of the debounce counters");
+    }
+    else if (events != messages)
+    {
+        fail("debounce events differ from the messages");
+    }
+    else if (windows < changes || windows > debounce_bursts)
+    {
+        fail("debounce windows differ from the bursts");
+    }
+    else if (absorbed < windows - events || absorbed + events > debounce_edges)
+    {
+        fail("debounce absorbed edges out of bounds");
+    }
+
+    report_end();
+}
+
+static void debounce_counters_line(const char *text, uint64_t time)
+{
+    (void)time;
+
+    if (debounce_reported)
+    {
+        return;
+    }
+
+    if (strncmp(text, "{\"debounce\"", 11) != 0)
+    {
+        malformed++;
+        return;
+    }
+
+    debounce_check(text);
+}
+
+static void debounce_counters_missing(void *arg)
+{
+    (void)arg;
+
+    if (!debounce_reported)
+    {
+        debounce_check("");
+    }
+}
+
+// Every message is in, ask for the counters
+static void debounce_request(void)
+{
+    line_checker = debounce_counters_line;
+    sim_uart_send("S", 1);
+    sim_schedule(sim_time_ns() + DEBOUNCE_REPORT_WAIT_NS, debounce_counters_missing, NULL);
+}
+
+static void debounce_event(void *arg)
+{
+    sim_button_t button = (sim_button_t)random_below(SIM_BUTTONS_NUMBER);
+    uint32_t edges = 2 + random_below(10);
+    uint64_t time = sim_time_ns();
+
+    (void)arg;
+
+    if (time >= options.duration_ms * MS)
+    {
+        drain_then(debounce_request);
+        return;
+    }
+
+    for (uint32_t i = 0; i < edges; ++i)
+    {
+        time += 50 * US + random_below(450) * US;
+        sim_schedule(time, debounce_edge, (void *)(uintptr_t)button);
+
+        if (i == 0 && edges % 2 == 1)
+        {
+            button_expect(button, time);
+        }
+    }
+
+    glitches += edges % 2 == 0;
+    debounce_bursts++;
+    debounce_edges += edges;
+
+    sim_schedule(sim_time_ns() + 250 * MS, debounce_event, NULL);
+}
+
+static void debounce_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(100 * MS, debounce_event, NULL);
+}
+
+// -------------------- commands --------------------
+
+// Batches of one to three LED commands "L<led><0|1>" on distinct LEDs at
+// the given rate, some preceded by line noise or by garbage that can not
+// form a command; the LEDs must be in the requested state before the
+// next batch
+static const struct
+{
+    char name;
+    GPIO_TypeDef *gpio;
+    uint32_t pin;
+    int active_low;
+} leds[] = {
+    {'R', GPIOA, 6, 1},
+    {'G', GPIOA, 7, 1},
+    {'B', GPIOB, 0, 1},
+    {'g', GPIOA, 5, 0}};
+
+#define LEDS_NUMBER (sizeof(leds) / sizeof(leds[0]))
+
+// Byte time of the link (9600 baud, 10 bits); a command must take effect
+// within COMMAND_LATENCY_MAX_NS of the last byte of its batch
+#define LINK_BYTE_NS 1041667ULL
+#define COMMAND_LATENCY_MAX_NS (3 * LINK_BYTE_NS)
+#define COMMAND_WATCH_NS (20 * US)
+#define COMMAND_BATCH_MAX 3
+#define COMMAND_GARBAGE_MAX 4
+
+// No '0', '1' or 'T', so a garbage byte never completes a command
+static const char COMMAND_GARBAGE[] = "LRGBgxz?#";
+
+static int led_expected[LEDS_NUMBER];
+static uint32_t commands;
+static uint32_t commands_failed;
+static int commands_pending;
+
+static uint64_t command_end;
+static uint64_t command_latency_sum;
+static uint64_t command_latency_max;
+static uint32_t command_latency_count;
+
+static int led_on(uint32_t led)
+{
+    int level = (sim_gpio_output(leds[led].gpio) >> leds[led].pin) & 1;
+
+    return level ^ leds[led].active_low;
+}
+
+static void commands_verify(void)
+{
+    if (!commands_pending)
+    {
+        return;
+    }
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        if (led_on(led) != led_expected[led])
+        {
+            commands_failed++;
+            led_expected[led] = led_on(led);
+        }
+    }
+}
+
+// Polls the LED of a command changing its state, from the last byte of
+// the command until the LED follows
+static void command_watch(void *arg)
+{
+    uint32_t led = (uint32_t)(uintptr_t)arg;
+    uint64_t now = sim_time_ns();
+
+    if (led_on(led) == led_expected[led])
+    {
+        uint64_t latency = now > command_end ? now - command_end : 0;
+
+        command_latency_sum += latency;
+        command_latency_count++;
+        command_latency_max = latency > command_latency_max ? latency : command_latency_max;
+    }
+    else if (now - command_end < 10 * COMMAND_LATENCY_MAX_NS)
+    {
+        sim_schedule(now + COMMAND_WATCH_NS, command_watch, arg);
+    }
+}
+
+static void commands_check(void)
+{
+    commands_verify();
+
+    report_begin();
+    printf(",\"commands\":%u,\"commands_failed\":%u,"
+           "\"latency_us\":{\"mean\":%llu,\"max\":%llu}",
+           commands, commands_failed,
+           (unsigned long long)(command_latency_count
+                                    ? command_latency_sum / command_latency_count / US
+                                    : 0),
+           (unsigned long long)(command_latency_max / US));
+
+    if (commands_failed != 0)
+    {
+        fail("LED not in the commanded state");
+    }
+    else if (command_latency_max > COMMAND_LATENCY_MAX_NS)
+    {
+        fail("LED command latency above the bound");
+    }
+
+    report_end();
+}
+
+static void commands_event(void *arg)
+{
+    char batch[COMMAND_GARBAGE_MAX + 2 + 3 * COMMAND_BATCH_MAX];
+    uint32_t length = 0;
+    uint32_t batch_leds[COMMAND_BATCH_MAX];
+    int batch_on[COMMAND_BATCH_MAX];
+    uint32_t batch_size = 1 + random_below(COMMAND_BATCH_MAX);
+    uint32_t used = 0;
+
+    (void)arg;
+
+    commands_verify();
+
+    if (sim_time_ns() >= options.duration_ms * MS)
+    {
+        commands_check();
+        return;
+    }
+
+    switch (random_below(4))
+    {
+    case 0:
+        break;
+    case 1:
+        for (uint32_t i = 1 + random_below(COMMAND_GARBAGE_MAX); i > 0; --i)
+        {
+            batch[length++] = COMMAND_GARBAGE[random_below(sizeof(COMMAND_GARBAGE) - 1)];
+        }
+        break;
+    default:
+        batch[length++] = '\r';
+        batch[length++] = '\n';
+        break;
+    }
+
+    for (uint32_t i = 0; i < batch_size; ++i)
+    {
+        uint32_t led;
+
+        do
+        {
+            led = random_below(LEDS_NUMBER);
+        } while (used & (1U << led));
+
+        used |= 1U << led;
+        batch_leds[i] = led;
+        batch_on[i] = random_below(2);
+
+        batch[length++] = 'L';
+        batch[length++] = leds[led].name;
+        batch[length++] = batch_on[i] ? '1' : '0';
+    }
+
+    sim_uart_send(batch, length);
+    command_end = sim_time_ns() + length * LINK_BYTE_NS;
+
+    for (uint32_t i = 0; i < batch_size; ++i)
+    {
+        uint32_t led = batch_leds[i];
+
+        if (led_on(led) != batch_on[i])
+        {
+            sim_schedule(command_end, command_watch, (void *)(uintptr_t)led);
+        }
+
+        led_expected[led] = batch_on[i];
+    }
+
+    commands_pending = 1;
+    commands += batch_size;
+
+    sim_schedule(sim_time_ns() + 1000000000ULL / (options.rate ? options.rate : 1),
+                 commands_event, NULL);
+}
+
+static void commands_setup(void)
+{
+    line_checker = button_line;
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        led_expected[led] = 0;
+    }
+
+    sim_schedule(100 * MS, commands_event, NULL);
+}
+
+// -------------------- pattern --------------------
+
+// LED patterns streamed by DMA (Task0 built with PATTERN=1): every
+// change of a LED falls on the step grid of the sequencer, counted from
+// the first change, and all four LEDs are driven
+#define PATTERN_STEP_NS (50 * MS)
+#define PATTERN_POLL_NS (100 * US)
+
+static int pattern_started;
+static uint64_t pattern_origin;
+static int pattern_levels[LEDS_NUMBER];
+static uint32_t pattern_changes[LEDS_NUMBER];
+static uint32_t pattern_off_grid;
+static uint64_t pattern_drift_max;
+
+static void pattern_check(void)
+{
+    report_begin();
+    printf(",\"changes\":[%u,%u,%u,%u],\"off_grid\":%u,\"drift_us\":%llu",
+           pattern_changes[0], pattern_changes[1], pattern_changes[2],
+           pattern_changes[3], pattern_off_grid,
+           (unsigned long long)(pattern_drift_max / US));
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        if (pattern_changes[led] == 0)
+        {
+            fail("LED never driven by the pattern");
+        }
+    }
+
+    if (pattern_off_grid != 0)
+    {
+        fail("LED change off the step grid");
+    }
+
+    report_end();
+}
+
+// Polls the LEDs, a change is seen at most PATTERN_POLL_NS late
+static void pattern_poll(void *arg)
+{
+    uint64_t now = sim_model_time_ns();
+
+    (void)arg;
+
+    if (now >= options.duration_ms * MS)
+    {
+        pattern_check();
+        return;
+    }
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        int level = led_on(led);
+        uint64_t offset;
+        uint64_t drift;
+
+        if (!pattern_started || level == pattern_levels[led])
+        {
+            pattern_levels[led] = level;
+            continue;
+        }
+
+        if (pattern_origin == 0)
+        {
+            pattern_origin = now;
+        }
+
+        offset = (now - pattern_origin) % PATTERN_STEP_NS;
+        drift = offset < PATTERN_STEP_NS - offset ? offset : PATTERN_STEP_NS - offset;
+        pattern_drift_max = drift > pattern_drift_max ? drift : pattern_drift_max;
+        pattern_off_grid += drift > PATTERN_POLL_NS;
+
+        pattern_levels[led] = level;
+        pattern_changes[led]++;
+    }
+
+    pattern_started = 1;
+    sim_schedule(now + PATTERN_POLL_NS, pattern_poll, NULL);
+}
+
+static void pattern_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(10 * MS, pattern_poll, NULL);
+}
+
+// -------------------- pwm --------------------
+
+// PWM LED engine of Task0: the compare registers of TIM3 CH1..3 and
+// TIM2 CH1 hold the brightness of the LEDs in the order of leds[], up to
+// the period of the timers. Each LED in turn is lit for PWM_PHASE_NS,
+// cross-faded with the next one in PWM_FADE_NS: the two levels always
+// add up to the period (within one ramp step, sampled during the
+// interrupt) and a fade ends on one LED exactly at the period, the
+// others exactly off. The channels are in PWM mode 1 with preload,
+// inverted for the active low LEDs
+#define PWM_PHASE_NS (1000 * MS)
+#define PWM_FADE_NS (250 * MS)
+#define PWM_POLL_NS (1 * MS)
+#define PWM_TIMING_TOLERANCE_PER_MILLE 20
+
+static const struct
+{
+    TIM_TypeDef *tim;
+    uint32_t channel;
+} pwm_channels[] = {
+    {TIM3, 0},
+    {TIM3, 1},
+    {TIM3, 2},
+    {TIM2, 0},
+};
+
+static uint32_t pwm_period;
+static uint32_t pwm_lit[LEDS_NUMBER];
+static uint32_t pwm_led = LEDS_NUMBER;
+static uint64_t pwm_lit_first;
+static uint64_t pwm_lit_last;
+static uint32_t pwm_plateaus;
+static uint64_t pwm_phase_min;
+static uint64_t pwm_phase_max;
+static uint64_t pwm_fade_min;
+static uint64_t pwm_fade_max;
+static uint32_t pwm_out_of_order;
+static uint32_t pwm_above;
+static uint32_t pwm_uneven;
+
+static uint32_t pwm_level(uint32_t led)
+{
+    const TIM_TypeDef *tim = sim_timer(pwm_channels[led].tim);
+
+    return (&tim->CCR1)[pwm_channels[led].channel];
+}
+
+// PWM mode 1 (OCxM = 110), preload, output enabled, polarity of the LED
+static int pwm_configured(uint32_t led)
+{
+    const TIM_TypeDef *tim = sim_timer(pwm_channels[led].tim);
+    uint32_t channel = pwm_channels[led].channel;
+    uint32_t ccmr = (channel < 2 ? tim->CCMR1 : tim->CCMR2) >> (8 * (channel & 1));
+    uint32_t ccer = tim->CCER >> (4 * channel);
+    uint32_t mode = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1PE;
+
+    return (ccmr & (TIM_CCMR1_OC1M | TIM_CCMR1_OC1PE | TIM_CCMR1_CC1S)) == mode &&
+           (ccer & TIM_CCER_CC1E) &&
+           ((ccer & TIM_CCER_CC1P) != 0) == leds[led].active_low &&
+           tim->ARR + 1 == pwm_period;
+}
+
+static int pwm_within(uint64_t value, uint64_t expected)
+{
+    uint64_t slack = expected * PWM_TIMING_TOLERANCE_PER_MILLE / 1000 + 2 * PWM_POLL_NS;
+
+    return value + slack >= expected && value <= expected + slack;
+}
+
+static void pwm_check(void)
+{
+    uint32_t expected = (options.duration_ms * MS - PWM_FADE_NS) / PWM_PHASE_NS + 1;
+
+    report_begin();
+    printf(",\"period\":%u,\"lit\":[%u,%u,%u,%u],\"phase_ms\":{\"min\":%.1f,\"max\":%.1f},"
+           "\"fade_ms\":{\"min\":%.1f,\"max\":%.1f},\"out_of_order\":%u,\"above\":%u,"
+           "\"uneven\":%u",
+           pwm_period, pwm_lit[0], pwm_lit[1], pwm_lit[2], pwm_lit[3],
+           pwm_phase_min / 1e6, pwm_phase_max / 1e6, pwm_fade_min / 1e6,
+           pwm_fade_max / 1e6, pwm_out_of_order, pwm_above, pwm_uneven);
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        if (!pwm_configured(led))
+        {
+            fail("LED channel not in PWM mode 1 with preload");
+        }
+    }
+
+    if (pwm_period == 0 || pwm_above != 0)
+    {
+        fail("compare value above the period");
+    }
+    else if (pwm_plateaus + 1 < expected || pwm_plateaus < 2)
+    {
+        fail("fades not ending on one LED at full brightness");
+    }
+    else if (pwm_out_of_order != 0)
+    {
+        fail("LEDs lit out of order");
+    }
+    else if (pwm_uneven != 0)
+    {
+        fail("cross-fade not adding up to the period");
+    }
+    else if (!pwm_within(pwm_phase_min, PWM_PHASE_NS) || !pwm_within(pwm_phase_max, PWM_PHASE_NS) ||
+             !pwm_within(pwm_fade_min, PWM_FADE_NS) || !pwm_within(pwm_fade_max, PWM_FADE_NS))
+    {
+        fail("phases or fades off their duration");
+    }
+
+    report_end();
+}
+
+// A new lit LED: the next one, a phase after the previous one and a fade
+// after it went out
+static void pwm_next(uint32_t led, uint64_t now)
+{
+    if (pwm_led == LEDS_NUMBER)
+    {
+        pwm_out_of_order += led != 0;
+    }
+    else
+    {
+        uint64_t phase = now - pwm_lit_first;
+        uint64_t fade = now - pwm_lit_last;
+
+        pwm_out_of_order += led != (pwm_led + 1) % LEDS_NUMBER;
+        pwm_phase_min = pwm_plateaus == 1 || phase < pwm_phase_min ? phase : pwm_phase_min;
+        pwm_phase_max = phase > pwm_phase_max ? phase : pwm_phase_max;
+        pwm_fade_min = pwm_plateaus == 1 || fade < pwm_fade_min ? fade : pwm_fade_min;
+        pwm_fade_max = fade > pwm_fade_max ? fade : pwm_fade_max;
+    }
+
+    pwm_led = led;
+    pwm_lit_first = now;
+    pwm_lit[led]++;
+    pwm_plateaus++;
+}
+
+static void pwm_poll(void *arg)
+{
+    uint64_t now = sim_model_time_ns();
+    uint32_t step;
+    uint32_t lit = 0;
+    uint32_t sum = 0;
+    uint32_t full = LEDS_NUMBER;
+
+    (void)arg;
+
+    if (now >= options.duration_ms * MS)
+    {
+        pwm_check();
+        return;
+    }
+
+    pwm_period = sim_timer(TIM3)->ARR + 1;
+    step = (uint32_t)((pwm_period * MS + PWM_FADE_NS - 1) / PWM_FADE_NS);
+
+    for (uint32_t led = 0; led < LEDS_NUMBER; ++led)
+    {
+        uint32_t level = pwm_level(led);
+
+        pwm_above += level > pwm_period;
+        lit += level != 0;
+        sum += level;
+        full = level == pwm_period ? led : full;
+    }
+
+    // Two LEDs only while they cross-fade, the first one fades in alone
+    if (lit > 2 || (lit == 2 && (sum + step < pwm_period || sum > pwm_period + step)))
+    {
+        pwm_uneven++;
+    }
+
+    if (lit == 1 && full != LEDS_NUMBER)
+    {
+        if (full != pwm_led)
+        {
+            pwm_next(full, now);
+        }
+
+        pwm_lit_last = now;
+    }
+
+    sim_schedule(now + PWM_POLL_NS, pwm_poll, NULL);
+}
+
+static void pwm_setup(void)
+{
+    line_checker = button_line;
+    sim_schedule(PWM_POLL_NS, pwm_poll, NULL);
+}
+
+// -------------------- motion --------------------
+
+// Accelerometer frames "XnnnYnnnBnnn": well formed, periodic and
+// matching the scripted motion of the LIS35DE
+#define MOTION_TOLERANCE 4
+
+// Oldest sample a frame may carry at its end of line, and frames that
+// may carry values from before the first reads
+static uint64_t motion_window = 40 * MS;
+static uint32_t motion_warmup = 2;
+
+static int8_t motion_script(uint32_t axis, uint64_t time_ns)
+{
+    // Sweep through the whole range, 2 s per period
+    uint64_t phase = (time_ns / MS + axis * 500) % 2000;
+    int32_t value = phase < 1000 ? (int32_t)phase * 254 / 1000 - 127
+                                 : 127 - ((int32_t)phase - 1000) * 254 / 1000;
+
+    return (int8_t)value;
+}
+
+static uint32_t frames;
+static uint32_t frames_off_script;
+
+// Frames marked as sent already ('R' before the buttons, streaming), and
+// those of them not equal to the frame before
+static uint32_t frame_repeats;
+static uint32_t frame_repeats_changed;
+static uint32_t frame_previous[3];
+static uint64_t frame_first;
+static uint64_t frame_last;
+static uint64_t frame_gap_max;
+
+static int script_near(uint32_t axis, uint8_t value, uint64_t time)
+{
+    // The value was sampled at most motion_window before the end of line
+    for (uint64_t back = 0; back <= motion_window && back <= time; back += MS)
+    {
+        int diff = (int8_t)value - motion_script(axis, time - back);
+
+        if (diff >= -MOTION_TOLERANCE && diff <= MOTION_TOLERANCE)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Optional check of the button field of every well formed frame
+static void (*frame_buttons_checker)(uint32_t buttons, uint64_t time);
+
+static void motion_line(const char *text, uint64_t time)
+{
+    static const char FIELDS[] = "XYB";
+    uint32_t values[3] = {0, 0, 0};
+
+    // The first frame is sent before both axes were read once
+    if (lines == 1)
+    {
+        return;
+    }
+
+    if (strlen(text) != 12)
+    {
+        malformed++;
+        return;
+    }
+
+    for (int field = 0; field < 3; ++field)
+    {
+        const char *digits = text + 4 * field;
+
+        if (digits[0] != FIELDS[field] && !(field == 2 && digits[0] == 'R'))
+        {
+            malformed++;
+            return;
+        }
+
+        for (int i = 1; i < 4; ++i)
+        {
+            if (digits[i] < '0' || digits[i] > '9')
+            {
+                malformed++;
+                return;
+            }
+            values[field] = 10 * values[field] + (uint32_t)(digits[i] - '0');
+        }
+
+        if (values[field] > 255)
+        {
+            malformed++;
+            return;
+        }
+    }
+
+    // The first frames may carry values from before the first reads
+    if (frames >= motion_warmup &&
+        (!script_near(0, (uint8_t)values[0], time) || !script_near(1, (uint8_t)values[1], time)))
+    {
+        frames_off_script++;
+    }
+
+    if (frame_buttons_checker)
+    {
+        frame_buttons_checker(values[2], time);
+    }
+
+    if (text[8] == 'R')
+    {
+        frame_repeats++;
+        frame_repeats_changed += frames != 0 && memcmp(values, frame_previous, sizeof(values)) != 0;
+    }
+
+    memcpy(frame_previous, values, sizeof(values));
+
+    if (frames == 0)
+    {
+        frame_first = time;
+    }
+    else if (time - frame_last > frame_gap_max)
+    {
+        frame_gap_max = time - frame_last;
+    }
+
+    frame_last = time;
+    frames++;
+}
+
+static void motion_check(void *arg)
+{
+    uint64_t period = frames > 1 ? (frame_last - frame_first) / (frames - 1) : 0;
+
+    (void)arg;
+
+    report_begin();
+    printf(",\"frames\":%u,\"frames_off_script\":%u,\"period_us\":%llu,\"max_gap_us\":%llu",
+           frames, frames_off_script, (unsigned long long)(period / US),
+           (unsigned long long)(frame_gap_max / US));
+
+    if (frames < 2)
+    {
+        fail("no frames");
+    }
+    else if (frame_gap_max > 2 * period)
+    {
+        fail("frames stalled");
+    }
+    else if (frames_off_script != 0)
+    {
+        fail("values do not follow the accelerometer");
+    }
+
+    report_end();
+}
+
+static void motion_setup(void)
+{
+    line_checker = motion_line;
+    sim_lis35de_script(motion_script);
+    sim_schedule(options.duration_ms * MS, motion_check, NULL);
+}
+
+// -------------------- stream --------------------
+
+// Frames streamed by DMA in double buffer mode: the motion is followed
+// and the line never idles, every byte ends one byte time after the
+// previous one. A frame written to a buffer waits up to one frame and
+// is sent in one more (21 ms at 9600 baud), on top of the age of its Y
+// value (a sampling period), hence the wider window. Frames go faster
+// than the readings: the frames sent again are marked, no more frames
+// than Y readings are new
+#define STREAM_WINDOW (60 * MS)
+#define STREAM_WARMUP 4
+
+static void stream_check(void *arg)
+{
+    // One I2C transaction per register, X then Y, and a frame published
+    // per Y; the first frame goes before the first Y
+    uint64_t readings = sim_stats.i2c_transactions / 2 + 1;
+
+    (void)arg;
+
+    report_begin();
+    printf(",\"frames\":%u,\"frames_off_script\":%u,\"repeats\":%u,\"y_readings\":%llu,"
+           "\"byte_gap_min_us\":%llu,\"byte_gap_max_us\":%llu",
+           frames, frames_off_script, frame_repeats, (unsigned long long)readings,
+           (unsigned long long)(byte_gap_min / US), (unsigned long long)(byte_gap_max / US));
+
+    if (frames < 2)
+    {
+        fail("no frames");
+    }
+    else if (byte_gap_max > byte_gap_min + byte_gap_min / 100)
+    {
+        fail("line idle between bytes");
+    }
+    else if (frames_off_script != 0)
+    {
+        fail("values do not follow the accelerometer");
+    }
+    else if (frame_repeats == 0 || frame_repeats_changed != 0)
+    {
+        fail("frames sent again not marked");
+    }
+    else if (frames - frame_repeats > readings)
+    {
+        fail("more new frames than readings");
+    }
+
+    report_end();
+}
+
+static void stream_setup(void)
+{
+    line_checker = motion_line;
+    motion_window = STREAM_WINDOW;
+    motion_warmup = STREAM_WARMUP;
+    sim_lis35de_script(motion_script);
+    sim_schedule(options.duration_ms * MS, stream_check, NULL);
+}
+
+// -------------------- clicks --------------------
+
+// Button changes carried by the accelerometer frames: every change is
+// sent at once, in the frame after the one on the line, whatever the
+// sampling period of TIM3. The DMA runs up to two bytes ahead of the
+// line (data and shift registers): at most 2 frames of 14 bytes and 2
+// bytes, at 9600 baud; the edge and the DMA requests are served at the
+// ticks of the simulator (50 us), four of them are allowed
+#define CLICKS_LATENCY_MAX ((2 * 14 + 2) * 10 * 1000000000ULL / 9600 + 200 * US)
+
+// Bit of each simulated button in the mask of the frames, the index of
+// the button in Common/button_table.h
+static const uint32_t CLICKS_BIT[SIM_BUTTONS_NUMBER] = {
+    [SIM_BUTTON_LEFT] = BUTTON_LEFT,
+    [SIM_BUTTON_RIGHT] = BUTTON_RIGHT,
+    [SIM_BUTTON_UP] = BUTTON_UP,
+    [SIM_BUTTON_DOWN] = BUTTON_DOWN,
+    [SIM_BUTTON_FIRE] = BUTTON_FIRE,
+    [SIM_BUTTON_USER] = BUTTON_USER,
+    [SIM_BUTTON_MODE] = BUTTON_MODE};
+
+static struct
+{
+    uint32_t expected;
+    uint32_t seen;
+    uint64_t changed_at;
+    uint32_t pending;
+    uint32_t changes;
+    uint32_t delivered;
+    uint32_t wrong;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+} clicks;
+
+static void clicks_frame(uint32_t buttons, uint64_t time)
+{
+    if (buttons == clicks.seen)
+    {
+        return;
+    }
+
+    clicks.seen = buttons;
+
+    if (!clicks.pending || buttons != clicks.expected)
+    {
+        clicks.wrong++;
+        return;
+    }
+
+    clicks.pending = 0;
+    clicks.delivered++;
+    clicks.latency_sum += time - clicks.changed_at;
+
+    if (time - clicks.changed_at > clicks.latency_max)
+    {
+        clicks.latency_max = time - clicks.changed_at;
+    }
+}
+
+// One button toggled at a time, far enough apart for its frame to be
+// seen before the next change
+static void clicks_event(void *arg)
+{
+    sim_button_t button = (sim_button_t)random_below(SIM_BUTTONS_NUMBER);
+    uint64_t now = sim_model_time_ns();
+
+    (void)arg;
+
+    if (!clicks.pending)
+    {
+        sim_button_set(button, !sim_button_pressed(button));
+        clicks.expected ^= 1U << CLICKS_BIT[button];
+        clicks.changed_at = now;
+        clicks.pending = 1;
+        clicks.changes++;
+    }
+
+    sim_schedule(now + 50 * MS + random_interval(), clicks_event, NULL);
+}
+
+static void clicks_check(void *arg)
+{
+    (void)arg;
+
+    report_begin();
+    printf(",\"frames\":%u,\"changes\":%u,\"delivered\":%u,\"wrong\":%u,"
+           "\"latency_us\":{\"mean\":%llu,\"max\":%llu}",
+           frames, clicks.changes, clicks.delivered, clicks.wrong,
+           (unsigned long long)(clicks.delivered ? clicks.latency_sum / clicks.delivered / US : 0),
+           (unsigned long long)(clicks.latency_max / US));
+
+    if (clicks.changes == 0)
+    {
+        fail("no button change");
+    }
+    else if (clicks.wrong != 0)
+    {
+        fail("button mask differs from the buttons");
+    }
+    else if (clicks.delivered + clicks.pending != clicks.changes)
+    {
+        fail("button change lost");
+    }
+    else if (clicks.latency_max > CLICKS_LATENCY_MAX)
+    {
+        fail("button change late");
+    }
+    else if (frames_off_script != 0)
+    {
+        fail("values do not follow the accelerometer");
+    }
+
+    report_end();
+}
+
+static void clicks_setup(void)
+{
+    // A button frame carries samples up to a period old and waits up to
+    // two frames, as a streamed frame
+    line_checker = motion_line;
+    motion_window = STREAM_WINDOW;
+    frame_buttons_checker = clicks_frame;
+    sim_lis35de_script(motion_script);
+    sim_schedule(100 * MS, clicks_event, NULL);
+    sim_schedule(options.duration_ms * MS, clicks_check, NULL);
+}
+
+// -------------------- taps --------------------
+
+// Clicks shorter than a frame on the line (14 bytes at 9600 baud, 14.6
+// ms): the press and the release each reach the link in a frame of their
+// own, neither replaces the other in the queue of the firmware. A tap
+// still on its way at the end of the run is not counted lost
+#define TAPS_PRESS_NS (2 * MS)
+
+static struct
+{
+    sim_button_t button;
+    uint32_t seen;
+    uint32_t taps;
+    uint32_t presses;
+    uint32_t releases;
+    uint32_t wrong;
+} taps;
+
+static void taps_frame(uint32_t buttons, uint64_t time)
+{
+    uint32_t bit = 1U << CLICKS_BIT[taps.button];
+
+    (void)time;
+
+    if (buttons == taps.seen)
+    {
+        return;
+    }
+
+    if (taps.seen == 0 && buttons == bit)
+    {
+        taps.presses++;
+    }
+    else if (taps.seen == bit && buttons == 0)
+    {
+        taps.releases++;
+    }
+    else
+    {
+        taps.wrong++;
+    }
+
+    taps.seen = buttons;
+}
+
+static void taps_release(void *arg)
+{
+    (void)arg;
+
+    sim_button_set(taps.button, 0);
+}
+
+// One tap at a time, far enough apart for both frames to be seen
+// before the next one
+static void taps_event(void *arg)
+{
+    uint64_t now = sim_model_time_ns();
+
+    (void)arg;
+
+    taps.button = (sim_button_t)random_below(SIM_BUTTONS_NUMBER);
+    taps.taps++;
+    sim_button_set(taps.button, 1);
+    sim_schedule(now + TAPS_PRESS_NS, taps_release, NULL);
+    sim_schedule(now + 100 * MS + random_interval(), taps_event, NULL);
+}
+
+static void taps_check(void *arg)
+{
+    (void)arg;
+
+    report_begin();
+    printf(",\"frames\":%u,\"taps\":%u,\"presses\":%u,\"releases\":%u,\"wrong\":%u",
+           frames, taps.taps, taps.presses, taps.releases, taps.wrong);
+
+    if (taps.taps == 0)
+    {
+        fail("no tap");
+    }
+    else if (taps.wrong != 0)
+    {
+        fail("button mask differs from the buttons");
+    }
+    else if (taps.presses + 1 < taps.taps || taps.releases + 1 < taps.taps)
+    {
+        fail("tap lost");
+    }
+
+    report_end();
+}
+
+static void taps_setup(void)
+{
+    line_checker = motion_line;
+    motion_window = STREAM_WINDOW;
+    frame_buttons_checker = taps_frame;
+    sim_lis35de_script(motion_script);
+    sim_schedule(100 * MS, taps_event, NULL);
+    sim_schedule(options.duration_ms * MS, taps_check, NULL);
+}
+
+// -------------------- storm --------------------
+
+// Edge storm benchmark of task2 built with STORM_BENCH: the firmware
+// injects the edges itself (EXTI->SWIER) and ends with a JSON report,
+// passed through; the button messages in between must be well formed,
+// the percentiles of the latency in order up to its maximum
+static void storm_line(const char *text, uint64_t time)
+{
+    uint32_t p50 = report_field(text, "p50");
+    uint32_t p99 = report_field(text, "p99");
+
+    (void)time;
+
+    if (text[0] != '{')
+    {
+        return;
+    }
+
+    report_begin();
+    printf(",\"report\":%s", text);
+
+    if (strncmp(text, "{\"storm\"", 8) != 0)
+    {
+        fail("unexpected report");
+    }
+    else if (p50 > p99 || p99 > report_field(text, "max"))
+    {
+        fail("latency percentiles above the maximum");
+    }
+
+    report_end();
+}
+
+static void storm_timeout(void *arg)
+{
+    (void)arg;
+
+    report_begin();
+    fail("no storm report");
+    report_end();
+}
+
+static void storm_setup(void)
+{
+    line_checker = storm_line;
+    sim_schedule(DRAIN_MAX_NS, storm_timeout, NULL);
+}
+
+// -------------------- load --------------------
+
+// Sustained load benchmark of the project built with LOAD_BENCH: TIM4
+// adds frames at a rate doubling every step, one JSON report per step,
+// passed through. The first step (10 frames/s on top of 40) fits the
+// link and loses no frame, the last one keeps it busy with button
+// changes queued behind it; the queue never holds more than its slots
+// and the link is never beaten (by more than the frame started at the
+// end of the step). Updates of TIM4 closer than a step of virtual time
+// raise one interrupt, up to 1% of the frames of the last steps are not
+// generated here. The CPU left is the idle loops of the step against
+// those of a step without the generator, at most 1000 per mille; loops
+// counted in real time vary with the load of the host, a step may count
+// up to LOAD_IDLE_EXCESS_PER_MILLE more than the reference
+#define LOAD_STEPS 8
+#define LOAD_QUEUE_MAX 31
+#define LOAD_RATE_TOLERANCE_PER_MILLE 10
+#define LOAD_LINK_BYTES_PER_S (9600 / 10)
+#define LOAD_BUSY_PER_MILLE 900
+#define LOAD_FRAME_LENGTH 14
+#define LOAD_IDLE_EXCESS_PER_MILLE 200
+
+static char load_reports[LOAD_STEPS * LINE_CAPACITY];
+static uint32_t load_reports_used;
+static uint32_t load_steps;
+static uint32_t load_frames;
+
+static void load_step(const char *text)
+{
+    uint32_t rate = report_field(text, "rate_hz");
+    uint32_t generated = report_field(text, "generated");
+    uint32_t expected = rate * report_field(text, "ms") / 1000;
+    uint32_t bytes_per_s = report_field(text, "bytes_per_s");
+    uint64_t idle_loops = report_field(text, "idle_loops");
+    uint64_t idle_reference = report_field(text, "idle_reference");
+    uint64_t idle_expected = idle_reference ? idle_loops * 1000 / idle_reference : 0;
+
+    load_reports_used += snprintf(load_reports + load_reports_used,
+                                  sizeof(load_reports) - load_reports_used, "%s%s",
+                                  load_steps ? "," : "", text);
+    load_steps++;
+
+    if (strncmp(text, "{\"load\"", 7) != 0)
+    {
+        fail("unexpected report");
+    }
+    else if (generated > expected + 1 ||
+             generated + 1 + expected * LOAD_RATE_TOLERANCE_PER_MILLE / 1000 < expected)
+    {
+        fail("frames not generated at the rate");
+    }
+    else if (report_field(text, "queue_max") > LOAD_QUEUE_MAX)
+    {
+        fail("more frames queued than slots");
+    }
+    else if (bytes_per_s > LOAD_LINK_BYTES_PER_S + LOAD_FRAME_LENGTH)
+    {
+        fail("faster than the link");
+    }
+    else if (idle_reference == 0 ||
+             idle_loops * 1000 > idle_reference * (1000 + LOAD_IDLE_EXCESS_PER_MILLE))
+    {
+        fail("idle loops out of bounds");
+    }
+    else if (report_field(text, "idle_per_mille") != (idle_expected < 1000 ? idle_expected : 1000))
+    {
+        fail("idle per mille not the share of the reference");
+    }
+    else if (load_steps == 1 &&
+             (report_field(text, "replaced") != 0 || report_field(text, "dropped") != 0))
+    {
+        fail("frames replaced or dropped below the link capacity");
+    }
+    else if (load_steps == LOAD_STEPS && report_field(text, "queue_max") <= 1)
+    {
+        fail("button changes not queued behind the busy link");
+    }
+    else if (load_steps == LOAD_STEPS &&
+             bytes_per_s < LOAD_LINK_BYTES_PER_S * LOAD_BUSY_PER_MILLE / 1000)
+    {
+        fail("link not saturated");
+    }
+}
+
+static void load_line(const char *text, uint64_t time)
+{
+    (void)time;
+
+    // Frames of the generator: L, the sequence number
+    if (text[0] == 'L')
+    {
+        if (strlen(text) != LOAD_FRAME_LENGTH - 2 ||
+            strspn(text + 1, "0123456789") != LOAD_FRAME_LENGTH - 3)
+        {
+            fail("malformed generated frame");
+        }
+
+        load_frames++;
+        return;
+    }
+
+    if (text[0] != '{')
+    {
+        return;
+    }
+
+    load_step(text);
+
+    if (load_steps < LOAD_STEPS && failure == NULL)
+    {
+        return;
+    }
+
+    report_begin();
+    printf(",\"generated_frames\":%u,\"reports\":[%s]", load_frames, load_reports);
+    report_end();
+}
+
+static void load_timeout(void *arg)
+{
+    (void)arg;
+
+    report_begin();
+    printf(",\"steps\":%u", load_steps);
+    fail("no load report");
+    report_end();
+}
+
+static void load_setup(void)
+{
+    line_checker = load_line;
+    sim_lis35de_script(motion_script);
+    sim_schedule(DRAIN_MAX_NS, load_timeout, NULL);
+}
+
+// -------------------- burst --------------------
+
+// Burst capture of the project built with BURST_CAPTURE and a ring of
+// BURST_SAMPLES: FIRE is pressed once the ring is full, the dump that
+// follows holds the whole ring, the trigger sample BURST_POST samples
+// before the end, samples stamped on the grid of the reads of TIM3 (399
+// Hz, the rate of the firmware), whose values follow the motion at their
+// stamps, and the sum of their bytes. The I2C events are served at the
+// ticks of the simulator, in real time: a reading may end late enough
+// for the next one to be skipped, its sample is missing from the ring. A
+// missing sample is a gap of one period in the stamps, the trailer
+// counts it: the gaps of the ring must be among the samples missed,
+// however many the load of the host makes
+#define BURST_SAMPLES 256
+#define BURST_POST (BURST_SAMPLES / 2)
+#define BURST_RATE_HZ 399
+// TIM3 period: 401 * 100 cycles of 16 MHz
+#define BURST_PERIOD_US (401 * 100 / 16)
+#define BURST_PERIOD_TOLERANCE_PER_MILLE 2
+#define BURST_STAMP_SLACK_US 2000
+#define BURST_PRESS_AT (2000 * MS)
+#define BURST_WINDOW (5 * MS)
+
+static struct
+{
+    enum
+    {
+        BURST_HEADER,
+        BURST_DATA,
+        BURST_TRAILER
+    } stage;
+    uint32_t samples;
+    uint32_t rate_hz;
+    uint32_t trigger;
+    char cause[16];
+    uint8_t data[BURST_SAMPLES * 4];
+    uint32_t received;
+    uint32_t sum;
+    uint32_t off_script;
+    int64_t trigger_delay_us;
+    uint32_t spacing_min_us;
+    uint32_t spacing_max_us;
+    uint32_t spacing_mean_us;
+    uint32_t missed;
+    uint32_t gaps;
+    uint32_t trigger_periods;
+} burst;
+
+static void burst_report(void)
+{
+    report_begin();
+    printf(",\"samples\":%u,\"rate_hz\":%u,\"trigger\":%u,\"cause\":\"%s\","
+           "\"trigger_delay_us\":%lld,\"spacing_us\":{\"mean\":%u,\"min\":%u,\"max\":%u},"
+           "\"samples_off_script\":%u,\"missed\":%u,\"gaps\":%u",
+           burst.samples, burst.rate_hz, burst.trigger, burst.cause,
+           (long long)burst.trigger_delay_us, burst.spacing_mean_us, burst.spacing_min_us, burst.spacing_max_us,
+           burst.off_script, burst.missed, burst.gaps);
+    report_end();
+}
+
+static uint16_t burst_stamp(uint32_t index)
+{
+    return (uint16_t)(burst.data[4 * index] | burst.data[4 * index + 1] << 8);
+}
+
+// Stamps unwrapped from the one of the trigger sample, taken at the
+// first reading after the press: a period after the previous sample, or
+// more if the readings between were skipped
+static void burst_check_samples(void)
+{
+    int64_t press_us = (int64_t)(BURST_PRESS_AT / US);
+    int64_t time_us = press_us + (int16_t)(uint16_t)(burst_stamp(burst.trigger) - press_us);
+    int64_t first_us;
+    uint32_t periods;
+
+    burst.trigger_delay_us = time_us - press_us;
+    burst.trigger_periods = ((uint16_t)(burst_stamp(burst.trigger) - burst_stamp(burst.trigger - 1)) +
+                             BURST_PERIOD_US / 2) /
+                            BURST_PERIOD_US;
+    burst.spacing_min_us = UINT32_MAX;
+
+    for (uint32_t i = burst.trigger; i > 0; --i)
+    {
+        time_us -= (uint16_t)(burst_stamp(i) - burst_stamp(i - 1));
+    }
+
+    first_us = time_us;
+
+    for (uint32_t i = 0; i < burst.samples; ++i)
+    {
+        if (i > 0)
+        {
+            uint32_t spacing = (uint16_t)(burst_stamp(i) - burst_stamp(i - 1));
+
+            time_us += spacing;
+            burst.spacing_min_us = spacing < burst.spacing_min_us ? spacing : burst.spacing_min_us;
+            burst.spacing_max_us = spacing > burst.spacing_max_us ? spacing : burst.spacing_max_us;
+        }
+
+        if (!script_near(0, burst.data[4 * i + 2], (uint64_t)time_us * US) ||
+            !script_near(1, burst.data[4 * i + 3], (uint64_t)time_us * US))
+        {
+            burst.off_script++;
+        }
+    }
+
+    // Periods from the first stamp to the last one, a gap for each
+    // sample missing
+    periods = (uint32_t)((time_us - first_us + BURST_PERIOD_US / 2) / BURST_PERIOD_US);
+    burst.gaps = periods - (burst.samples - 1);
+    burst.spacing_mean_us = (uint32_t)((time_us - first_us) / periods);
+}
+
+static void burst_byte(uint8_t byte, uint64_t time)
+{
+    uint32_t sum;
+
+    (void)time;
+
+    if (burst.stage == BURST_DATA)
+    {
+        burst.data[burst.received++] = byte;
+        burst.sum += byte;
+
+        if (burst.received == 4 * burst.samples)
+        {
+            burst.stage = BURST_TRAILER;
+        }
+
+        return;
+    }
+
+    if (line_length == LINE_CAPACITY - 1)
+    {
+        malformed++;
+        line_length = 0;
+    }
+
+    line[line_length++] = (char)byte;
+
+    if (byte != '\n')
+    {
+        return;
+    }
+
+    line[line_length - 1] = '\0';
+    line_length = 0;
+    lines++;
+
+    if (burst.stage == BURST_HEADER)
+    {
+        if (sscanf(line, "CAPTURE %u %u %u %15s\r", &burst.samples, &burst.rate_hz,
+                   &burst.trigger, burst.cause) != 4 ||
+            burst.samples > BURST_SAMPLES || burst.trigger >= burst.samples)
+        {
+            fail("malformed capture header");
+            burst_report();
+        }
+
+        burst.stage = BURST_DATA;
+        return;
+    }
+
+    if (sscanf(line, "END %u %u\r", &sum, &burst.missed) != 2)
+    {
+        fail("malformed capture trailer");
+    }
+    else if (sum != burst.sum)
+    {
+        fail("capture sum differs from the samples");
+    }
+    else if (burst.samples != BURST_SAMPLES)
+    {
+        fail("ring not dumped whole");
+    }
+    else if (strcmp(burst.cause, "button") != 0 || burst.trigger != BURST_SAMPLES - BURST_POST)
+    {
+        fail("not triggered by the button");
+    }
+    else if (burst.rate_hz != BURST_RATE_HZ)
+    {
+        fail("unexpected rate");
+    }
+    else
+    {
+        burst_check_samples();
+
+        if (burst.trigger_delay_us < 0 ||
+            burst.trigger_delay_us > BURST_PERIOD_US * burst.trigger_periods + BURST_STAMP_SLACK_US)
+        {
+            fail("trigger sample not at the press");
+        }
+        else if (burst.spacing_mean_us * 1000 <
+                     BURST_PERIOD_US * (1000 - BURST_PERIOD_TOLERANCE_PER_MILLE) ||
+                 burst.spacing_mean_us * 1000 >
+                     BURST_PERIOD_US * (1000 + BURST_PERIOD_TOLERANCE_PER_MILLE))
+        {
+            fail("samples not one reading apart");
+        }
+        else if (burst.gaps > burst.missed)
+        {
+            fail("samples missing, not counted by the trailer");
+        }
+        else if (burst.off_script != 0)
+        {
+            fail("values do not follow the accelerometer");
+        }
+    }
+
+    burst_report();
+}
+
+static void burst_press(void *arg)
+{
+    sim_button_set(SIM_BUTTON_FIRE, arg != NULL);
+
+    if (arg != NULL)
+    {
+        sim_schedule(sim_model_time_ns() + 100 * MS, burst_press, NULL);
+    }
+}
+
+static void burst_timeout(void *arg)
+{
+    (void)arg;
+
+    fail("no capture dump");
+    burst_report();
+}
+
+static void burst_setup(void)
+{
+    byte_checker = burst_byte;
+    motion_window = BURST_WINDOW;
+    sim_lis35de_script(motion_script);
+    sim_schedule(BURST_PRESS_AT, burst_press, &burst);
+    sim_schedule(DRAIN_MAX_NS, burst_timeout, NULL);
+}
+
+// -------------------- Table --------------------
+
+static const struct
+{
+    const char *name;
+    void (*setup)(void);
+    uint32_t default_rate;
+    const char *description;
+} scenarios[] = {
+    {"soak", soak_setup, 20, "random button edges, every edge reported"},
+    {"bounce", bounce_setup, 0, "bursts of contact bounce on the buttons"},
+    {"debounce", debounce_setup, 0, "bounces and glitches, one message per change"},
+    {"overflow", overflow_setup, 5000, "edges beyond the link capacity, then a probe"},
+    {"commands", commands_setup, 20, "LED command batches on the link"},
+    {"pattern", pattern_setup, 0, "LED patterns played by DMA on the step grid"},
+    {"pwm", pwm_setup, 0, "LED brightness by timer PWM, cross-faded in turn"},
+    {"motion", motion_setup, 0, "accelerometer frames against a scripted motion"},
+    {"stream", stream_setup, 0, "accelerometer frames back to back on the link"},
+    {"clicks", clicks_setup, 10, "button changes in the accelerometer frames"},
+    {"taps", taps_setup, 10, "clicks shorter than a frame on the link"},
+    {"storm", storm_setup, 0, "report of the firmware storm benchmark"},
+    {"load", load_setup, 0, "reports of the firmware load benchmark"},
+    {"burst", burst_setup, 0, "dump of the firmware burst capture after a press"},
+    {"coalesce", coalesce_setup, 5000, "edges beyond the link capacity, merged transitions"}};
+
+int scenario_setup(const char *name, const scenario_options_t *scenario_options)
+{
+    for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+    {
+        if (strcmp(scenarios[i].name, name) == 0)
+        {
+            scenario_name = name;
+            options = *scenario_options;
+            options.rate = options.rate ? options.rate : scenarios[i].default_rate;
+            random_state = options.seed ? options.seed : 1;
+
+            for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+            {
+                buttons[button].last_message = -1;
+            }
+
+            sim_uart_observe(uart_observer);
+            scenarios[i].setup();
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void scenario_list(void)
+{
+    for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+    {
+        fprintf(stderr, "  %-10s %s\n", scenarios[i].name, scenarios[i].description);
+    }
+}
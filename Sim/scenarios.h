@@ -0,0 +1,23 @@
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t duration_ms;
+    // Stimulus events per second (button edges, commands)
+    uint32_t rate;
+    uint32_t seed;
+} scenario_options_t;
+
+// Name of the firmware the simulator is linked with (task1, task2, project)
+extern const char *const sim_firmware;
+
+// Schedules the stimulus and the final check of a scenario,
+// returns 0 if the scenario does not exist
+int scenario_setup(const char *name, const scenario_options_t *options);
+
+void scenario_list(void);
+
+#endif /* SCENARIOS_H */
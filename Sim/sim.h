@@ -0,0 +1,102 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stm32.h>
+
+// Passive: register memory only, no side effects (benchmarks)
+// Active: peripheral models, virtual time and interrupts
+typedef enum
+{
+    SIM_PASSIVE,
+    SIM_ACTIVE
+} sim_mode_t;
+
+// Clock of the simulated core and of APB1/APB2 timers, HSI as in the
+// firmware
+#define SIM_CORE_HZ 16000000U
+
+#define SIM_NS_TO_CYCLES(ns) ((ns) * (SIM_CORE_HZ / 1000000U) / 1000U)
+
+// Maps the register memory at the STM32 addresses; must run before any
+// firmware code touches a register
+void sim_init(sim_mode_t mode);
+
+// Starts virtual time and interrupt delivery:
+// speed scales virtual time to host time, tick_us is the period
+// (host time) at which peripherals advance and interrupts are delivered
+void sim_start(double speed, uint32_t tick_us);
+
+// Virtual time since sim_start, in nanoseconds
+uint64_t sim_time_ns(void);
+
+// Virtual time the peripheral models have reached; in a scheduled
+// callback, the time it was scheduled at
+uint64_t sim_model_time_ns(void);
+
+// Runs callback(arg) in "hardware" context once virtual time reaches time_ns
+void sim_schedule(uint64_t time_ns, void (*callback)(void *), void *arg);
+
+// Prints the report of the run and terminates the process
+void sim_finish(int status);
+
+// -------------------- Board --------------------
+
+typedef enum
+{
+    SIM_BUTTON_USER,
+    SIM_BUTTON_LEFT,
+    SIM_BUTTON_RIGHT,
+    SIM_BUTTON_UP,
+    SIM_BUTTON_DOWN,
+    SIM_BUTTON_FIRE,
+    SIM_BUTTON_MODE,
+    SIM_BUTTONS_NUMBER
+} sim_button_t;
+
+extern const char *const sim_button_names[SIM_BUTTONS_NUMBER];
+
+// Drives the pin of a button, active-low buttons are inverted here
+void sim_button_set(sim_button_t button, int pressed);
+int sim_button_pressed(sim_button_t button);
+
+// Drives an input pin, edges reach EXTI like on the board
+void sim_gpio_input(GPIO_TypeDef *gpio, uint32_t pin, int level);
+
+// Current output data register of a port
+uint32_t sim_gpio_output(GPIO_TypeDef *gpio);
+
+// Registers of a timer as the models see them: configuration and
+// compare values of its channels
+const TIM_TypeDef *sim_timer(TIM_TypeDef *tim);
+
+// -------------------- USART2 (host side of the link) --------------------
+
+// Queues bytes to be received by the board, one byte time apart
+void sim_uart_send(const char *data, uint32_t length);
+
+// Called with every byte the board finishes transmitting
+void sim_uart_observe(void (*observer)(uint8_t byte, uint64_t time_ns));
+
+// -------------------- LIS35DE --------------------
+
+// Value of OUT_X (axis 0), OUT_Y (axis 1) or OUT_Z (axis 2) at a given time
+void sim_lis35de_script(int8_t (*axis_value)(uint32_t axis, uint64_t time_ns));
+
+// -------------------- Statistics --------------------
+
+typedef struct
+{
+    uint64_t register_traps;
+    uint64_t ticks;
+    uint64_t irq_count[SIM_IRQn_NUMBER];
+    uint64_t preemptions;
+    uint64_t uart_tx_bytes;
+    uint64_t uart_rx_bytes;
+    uint64_t uart_overruns;
+    uint64_t i2c_transactions;
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+#endif /* SIM_H */
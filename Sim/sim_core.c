@@ -0,0 +1,883 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <delay.h>
+#include <gpio.h>
+#include <irq.h>
+#include "sim_internal.h"
+
+/* Simulator core:
+    - register memory: every region is a memfd mapped twice, once at the
+      STM32 address for the firmware (trapped view) and once anywhere for
+      the models (alias)
+    - register traps: a trapped access raises SIGSEGV, the page is opened
+      and the faulting instruction single-stepped (x86 trap flag), SIGTRAP
+      closes the page again and runs the side effect of the access
+    - virtual time and interrupts: SIGALRM ticks advance the models and
+      run pending interrupt handlers on the firmware thread, preempting
+      main code or lower priority handlers like the NVIC does
+*/
+
+#define PAGE_SIZE 4096U
+#define PAGE_OF(address) ((address) & ~(uintptr_t)(PAGE_SIZE - 1))
+
+#define TRAP_FLAG 0x100
+
+#define TICK_SIGNAL SIGALRM
+
+#define THREAD_PRIORITY 0x100
+
+#define SCHEDULE_CAPACITY 65536
+
+// Longest step of virtual time; when the host process is descheduled
+// for longer, the simulated board is paused instead of skipping events
+#define MAX_TIME_STEP_NS 1000000U
+
+// -------------------- Register memory --------------------
+
+typedef struct
+{
+    uintptr_t base;
+    size_t size;
+    uint8_t *alias;
+} region_t;
+
+static region_t regions[] = {
+    {PERIPH_BASE, 0x27000, NULL},
+    {0xE0000000U, 0x10000, NULL}};
+
+#define REGIONS_NUMBER (sizeof(regions) / sizeof(regions[0]))
+
+// Pages with read side effects (data registers, counters):
+// every access is trapped there, elsewhere only writes are
+static const uintptr_t read_trapped_pages[] = {
+    PAGE_OF(TIM2_BASE),
+    PAGE_OF(USART2_BASE),
+    PAGE_OF(I2C1_BASE),
+    PAGE_OF(TIM1_BASE),
+    PAGE_OF(DWT_BASE)};
+
+static sim_mode_t sim_mode;
+
+sim_stats_t sim_stats;
+
+static region_t *find_region(uintptr_t address)
+{
+    for (uint32_t i = 0; i < REGIONS_NUMBER; ++i)
+    {
+        if (address >= regions[i].base &&
+            address < regions[i].base + regions[i].size)
+        {
+            return &regions[i];
+        }
+    }
+
+    return NULL;
+}
+
+void *sim_alias(uintptr_t address)
+{
+    region_t *region = find_region(address);
+
+    if (region == NULL)
+    {
+        fprintf(stderr, "sim: no register at %#lx\n", (unsigned long)address);
+        abort();
+    }
+
+    return region->alias + (address - region->base);
+}
+
+static int page_protection(uintptr_t page)
+{
+    for (uint32_t i = 0; i < sizeof(read_trapped_pages) / sizeof(read_trapped_pages[0]); ++i)
+    {
+        if (read_trapped_pages[i] == page)
+        {
+            return PROT_NONE;
+        }
+    }
+
+    return PROT_READ;
+}
+
+static void map_region(region_t *region)
+{
+    int fd = memfd_create("sim-registers", 0);
+
+    if (fd < 0 || ftruncate(fd, region->size) != 0)
+    {
+        perror("sim: memfd");
+        exit(2);
+    }
+
+    region->alias = mmap(NULL, region->size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+
+    if (region->alias == MAP_FAILED ||
+        mmap((void *)region->base, region->size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0) != (void *)region->base)
+    {
+        perror("sim: mapping registers");
+        exit(2);
+    }
+
+    close(fd);
+}
+
+static void protect_registers(void)
+{
+    for (uint32_t i = 0; i < REGIONS_NUMBER; ++i)
+    {
+        for (uintptr_t page = regions[i].base;
+             page < regions[i].base + regions[i].size;
+             page += PAGE_SIZE)
+        {
+            mprotect((void *)page, PAGE_SIZE, page_protection(page));
+        }
+    }
+}
+
+// -------------------- Register traps --------------------
+
+static struct
+{
+    int active;
+    int write;
+    uintptr_t address;
+    uint32_t old_value;
+    int tick_was_blocked;
+} trap;
+
+static void advance_to_now(void);
+
+static void segv_handler(int signal_number, siginfo_t *info, void *context)
+{
+    ucontext_t *uc = context;
+    uintptr_t address = (uintptr_t)info->si_addr;
+
+    (void)signal_number;
+
+    if (find_region(address) == NULL || trap.active)
+    {
+        // A real crash, let it happen again with the default action
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    // The models catch up before the access, a write must not be seen
+    // by them before its side effects are applied
+    advance_to_now();
+
+    trap.active = 1;
+    trap.write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+    trap.address = address & ~(uintptr_t)3;
+    trap.old_value = *(uint32_t *)sim_alias(trap.address);
+    sim_stats.register_traps++;
+
+    if (!trap.write)
+    {
+        sim_peripherals_before_read(trap.address);
+    }
+
+    // Execute the access with the page open, no tick in between
+    mprotect((void *)PAGE_OF(address), PAGE_SIZE, PROT_READ | PROT_WRITE);
+    uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+    trap.tick_was_blocked = sigismember(&uc->uc_sigmask, TICK_SIGNAL);
+    sigaddset(&uc->uc_sigmask, TICK_SIGNAL);
+}
+
+static void trap_handler(int signal_number, siginfo_t *info, void *context)
+{
+    ucontext_t *uc = context;
+
+    (void)signal_number;
+    (void)info;
+
+    if (!trap.active)
+    {
+        signal(SIGTRAP, SIG_DFL);
+        return;
+    }
+
+    uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+    mprotect((void *)PAGE_OF(trap.address), PAGE_SIZE,
+             page_protection(PAGE_OF(trap.address)));
+    trap.active = 0;
+
+    if (trap.write)
+    {
+        sim_peripherals_after_write(trap.address, trap.old_value);
+    }
+    else
+    {
+        sim_peripherals_after_read(trap.address);
+    }
+
+    if (!trap.tick_was_blocked)
+    {
+        sigdelset(&uc->uc_sigmask, TICK_SIGNAL);
+    }
+
+    sim_kick();
+}
+
+// -------------------- Virtual time and schedule --------------------
+
+static struct timespec start_time;
+static double time_speed = 1.0;
+static int started;
+
+uint64_t sim_now;
+
+uint64_t sim_time_ns(void)
+{
+    static uint64_t last_host;
+    static uint64_t paused;
+    struct timespec now;
+    uint64_t host;
+
+    if (!started)
+    {
+        return sim_now;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    host = (uint64_t)(((now.tv_sec - start_time.tv_sec) * 1e9 +
+                       (now.tv_nsec - start_time.tv_nsec)) *
+                      time_speed);
+
+    if (host > last_host + MAX_TIME_STEP_NS)
+    {
+        paused += host - last_host - MAX_TIME_STEP_NS;
+    }
+    last_host = host > last_host ? host : last_host;
+
+    return last_host - paused;
+}
+
+uint64_t sim_model_time_ns(void)
+{
+    return sim_now;
+}
+
+typedef struct
+{
+    uint64_t time;
+    uint64_t sequence;
+    void (*callback)(void *);
+    void *arg;
+} event_t;
+
+static event_t schedule[SCHEDULE_CAPACITY];
+static uint32_t schedule_used;
+static uint64_t schedule_sequence;
+
+static int event_before(const event_t *a, const event_t *b)
+{
+    return a->time < b->time ||
+           (a->time == b->time && a->sequence < b->sequence);
+}
+
+void sim_schedule(uint64_t time_ns, void (*callback)(void *), void *arg)
+{
+    uint32_t i = schedule_used;
+
+    if (schedule_used == SCHEDULE_CAPACITY)
+    {
+        fprintf(stderr, "sim: schedule full\n");
+        exit(2);
+    }
+
+    schedule[i] = (event_t){time_ns, schedule_sequence++, callback, arg};
+    schedule_used++;
+
+    // Sift up
+    while (i > 0 && event_before(&schedule[i], &schedule[(i - 1) / 2]))
+    {
+        event_t swap = schedule[i];
+        schedule[i] = schedule[(i - 1) / 2];
+        schedule[(i - 1) / 2] = swap;
+        i = (i - 1) / 2;
+    }
+}
+
+static event_t schedule_pop(void)
+{
+    event_t top = schedule[0];
+    uint32_t i = 0;
+
+    schedule[0] = schedule[--schedule_used];
+
+    // Sift down
+    for (;;)
+    {
+        uint32_t smallest = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = 2 * i + 2;
+
+        if (left < schedule_used && event_before(&schedule[left], &schedule[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < schedule_used && event_before(&schedule[right], &schedule[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+
+        event_t swap = schedule[i];
+        schedule[i] = schedule[smallest];
+        schedule[smallest] = swap;
+        i = smallest;
+    }
+
+    return top;
+}
+
+// Advances the models to time now, running scheduled events in order
+static void step(uint64_t now)
+{
+    while (schedule_used > 0 && schedule[0].time <= now)
+    {
+        event_t event = schedule_pop();
+
+        if (event.time > sim_now)
+        {
+            sim_peripherals_advance(event.time);
+        }
+        event.callback(event.arg);
+    }
+
+    if (now > sim_now)
+    {
+        sim_peripherals_advance(now);
+    }
+}
+
+static void advance_to_now(void)
+{
+    if (started)
+    {
+        step(sim_time_ns());
+    }
+}
+
+// -------------------- NVIC --------------------
+
+static void sim_default_handler(void);
+
+#define WEAK_HANDLER(name) \
+    void name(void) __attribute__((weak, alias("sim_default_handler")))
+
+WEAK_HANDLER(EXTI0_IRQHandler);
+WEAK_HANDLER(EXTI1_IRQHandler);
+WEAK_HANDLER(EXTI2_IRQHandler);
+WEAK_HANDLER(EXTI3_IRQHandler);
+WEAK_HANDLER(EXTI4_IRQHandler);
+WEAK_HANDLER(DMA1_Stream0_IRQHandler);
+WEAK_HANDLER(DMA1_Stream1_IRQHandler);
+WEAK_HANDLER(DMA1_Stream2_IRQHandler);
+WEAK_HANDLER(DMA1_Stream3_IRQHandler);
+WEAK_HANDLER(DMA1_Stream4_IRQHandler);
+WEAK_HANDLER(DMA1_Stream5_IRQHandler);
+WEAK_HANDLER(DMA1_Stream6_IRQHandler);
+WEAK_HANDLER(EXTI9_5_IRQHandler);
+WEAK_HANDLER(TIM1_BRK_TIM9_IRQHandler);
+WEAK_HANDLER(TIM1_UP_TIM10_IRQHandler);
+WEAK_HANDLER(TIM1_TRG_COM_TIM11_IRQHandler);
+WEAK_HANDLER(TIM1_CC_IRQHandler);
+WEAK_HANDLER(TIM2_IRQHandler);
+WEAK_HANDLER(TIM3_IRQHandler);
+WEAK_HANDLER(TIM4_IRQHandler);
+WEAK_HANDLER(I2C1_EV_IRQHandler);
+WEAK_HANDLER(I2C1_ER_IRQHandler);
+WEAK_HANDLER(USART2_IRQHandler);
+WEAK_HANDLER(EXTI15_10_IRQHandler);
+WEAK_HANDLER(DMA1_Stream7_IRQHandler);
+WEAK_HANDLER(TIM5_IRQHandler);
+WEAK_HANDLER(DMA2_Stream0_IRQHandler);
+WEAK_HANDLER(DMA2_Stream1_IRQHandler);
+WEAK_HANDLER(DMA2_Stream2_IRQHandler);
+WEAK_HANDLER(DMA2_Stream3_IRQHandler);
+WEAK_HANDLER(DMA2_Stream4_IRQHandler);
+WEAK_HANDLER(DMA2_Stream5_IRQHandler);
+WEAK_HANDLER(DMA2_Stream6_IRQHandler);
+WEAK_HANDLER(DMA2_Stream7_IRQHandler);
+
+static void (*const vectors[SIM_IRQn_NUMBER])(void) = {
+    [EXTI0_IRQn] = EXTI0_IRQHandler,
+    [EXTI1_IRQn] = EXTI1_IRQHandler,
+    [EXTI2_IRQn] = EXTI2_IRQHandler,
+    [EXTI3_IRQn] = EXTI3_IRQHandler,
+    [EXTI4_IRQn] = EXTI4_IRQHandler,
+    [DMA1_Stream0_IRQn] = DMA1_Stream0_IRQHandler,
+    [DMA1_Stream1_IRQn] = DMA1_Stream1_IRQHandler,
+    [DMA1_Stream2_IRQn] = DMA1_Stream2_IRQHandler,
+    [DMA1_Stream3_IRQn] = DMA1_Stream3_IRQHandler,
+    [DMA1_Stream4_IRQn] = DMA1_Stream4_IRQHandler,
+    [DMA1_Stream5_IRQn] = DMA1_Stream5_IRQHandler,
+    [DMA1_Stream6_IRQn] = DMA1_Stream6_IRQHandler,
+    [EXTI9_5_IRQn] = EXTI9_5_IRQHandler,
+    [TIM1_BRK_TIM9_IRQn] = TIM1_BRK_TIM9_IRQHandler,
+    [TIM1_UP_TIM10_IRQn] = TIM1_UP_TIM10_IRQHandler,
+    [TIM1_TRG_COM_TIM11_IRQn] = TIM1_TRG_COM_TIM11_IRQHandler,
+    [TIM1_CC_IRQn] = TIM1_CC_IRQHandler,
+    [TIM2_IRQn] = TIM2_IRQHandler,
+    [TIM3_IRQn] = TIM3_IRQHandler,
+    [TIM4_IRQn] = TIM4_IRQHandler,
+    [I2C1_EV_IRQn] = I2C1_EV_IRQHandler,
+    [I2C1_ER_IRQn] = I2C1_ER_IRQHandler,
+    [USART2_IRQn] = USART2_IRQHandler,
+    [EXTI15_10_IRQn] = EXTI15_10_IRQHandler,
+    [DMA1_Stream7_IRQn] = DMA1_Stream7_IRQHandler,
+    [TIM5_IRQn] = TIM5_IRQHandler,
+    [DMA2_Stream0_IRQn] = DMA2_Stream0_IRQHandler,
+    [DMA2_Stream1_IRQn] = DMA2_Stream1_IRQHandler,
+    [DMA2_Stream2_IRQn] = DMA2_Stream2_IRQHandler,
+    [DMA2_Stream3_IRQn] = DMA2_Stream3_IRQHandler,
+    [DMA2_Stream4_IRQn] = DMA2_Stream4_IRQHandler,
+    [DMA2_Stream5_IRQn] = DMA2_Stream5_IRQHandler,
+    [DMA2_Stream6_IRQn] = DMA2_Stream6_IRQHandler,
+    [DMA2_Stream7_IRQn] = DMA2_Stream7_IRQHandler};
+
+static struct
+{
+    uint8_t enabled[SIM_IRQn_NUMBER];
+    uint8_t pending[SIM_IRQn_NUMBER];
+    uint8_t priority[SIM_IRQn_NUMBER];
+    uint32_t group;
+    uint32_t primask;
+    uint32_t basepri;
+    // Group priority of the running handler, THREAD_PRIORITY in main code
+    uint32_t running;
+    IRQn_Type active;
+} nvic = {.running = THREAD_PRIORITY};
+
+static void sim_default_handler(void)
+{
+    fprintf(stderr, "sim: IRQ %d enabled without a handler\n", nvic.active);
+    exit(3);
+}
+
+static uint32_t subpriority_bits(void)
+{
+    return nvic.group >= 3 ? nvic.group - 3 : 0;
+}
+
+// Preemption is decided on the group priority only
+static uint32_t group_priority(uint32_t priority)
+{
+    return priority >> subpriority_bits();
+}
+
+void NVIC_EnableIRQ(IRQn_Type irqn)
+{
+    nvic.enabled[irqn] = 1;
+    sim_kick();
+}
+
+void NVIC_DisableIRQ(IRQn_Type irqn)
+{
+    nvic.enabled[irqn] = 0;
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irqn)
+{
+    nvic.pending[irqn] = 1;
+    sim_kick();
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irqn)
+{
+    nvic.pending[irqn] = 0;
+}
+
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority)
+{
+    nvic.priority[irqn] = priority & ((1U << __NVIC_PRIO_BITS) - 1);
+}
+
+uint32_t NVIC_GetPriority(IRQn_Type irqn)
+{
+    return nvic.priority[irqn];
+}
+
+void NVIC_SetPriorityGrouping(uint32_t group)
+{
+    nvic.group = group & 7;
+}
+
+uint32_t NVIC_GetPriorityGrouping(void)
+{
+    return nvic.group;
+}
+
+// Same computation as in CMSIS
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t preempt, uint32_t sub)
+{
+    uint32_t group_bits = group & 7;
+    uint32_t preempt_bits = (7 - group_bits) > __NVIC_PRIO_BITS
+                                ? __NVIC_PRIO_BITS
+                                : 7 - group_bits;
+    uint32_t sub_bits = (group_bits + __NVIC_PRIO_BITS) < 7
+                            ? 0
+                            : group_bits - 7 + __NVIC_PRIO_BITS;
+
+    return ((preempt & ((1U << preempt_bits) - 1)) << sub_bits) |
+           (sub & ((1U << sub_bits) - 1));
+}
+
+void __disable_irq(void)
+{
+    nvic.primask = 1;
+}
+
+void __enable_irq(void)
+{
+    nvic.primask = 0;
+    sim_kick();
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return nvic.primask;
+}
+
+void __set_PRIMASK(uint32_t primask)
+{
+    nvic.primask = primask & 1;
+    sim_kick();
+}
+
+uint32_t __get_BASEPRI(void)
+{
+    return nvic.basepri;
+}
+
+void __set_BASEPRI(uint32_t basepri)
+{
+    nvic.basepri = basepri & 0xFF;
+    sim_kick();
+}
+
+// Highest priority interrupt allowed to run now, -1 if none
+static int dispatchable_irq(void)
+{
+    uint32_t limit = nvic.running;
+    int best = -1;
+    uint32_t best_priority = 0;
+
+    if (nvic.primask)
+    {
+        return -1;
+    }
+
+    if (nvic.basepri != 0)
+    {
+        uint32_t masked = group_priority(nvic.basepri >> (8 - __NVIC_PRIO_BITS));
+        limit = masked < limit ? masked : limit;
+    }
+
+    for (int irqn = 0; irqn < SIM_IRQn_NUMBER; ++irqn)
+    {
+        if (!nvic.enabled[irqn] ||
+            (!nvic.pending[irqn] && !sim_peripherals_irq_line((IRQn_Type)irqn)))
+        {
+            continue;
+        }
+
+        if (group_priority(nvic.priority[irqn]) < limit &&
+            (best < 0 || nvic.priority[irqn] < best_priority))
+        {
+            best = irqn;
+            best_priority = nvic.priority[irqn];
+        }
+    }
+
+    return best;
+}
+
+static void run_handler(IRQn_Type irqn)
+{
+    sigset_t tick;
+    uint32_t interrupted = nvic.running;
+    IRQn_Type interrupted_irq = nvic.active;
+
+    sigemptyset(&tick);
+    sigaddset(&tick, TICK_SIGNAL);
+
+    if (interrupted != THREAD_PRIORITY)
+    {
+        sim_stats.preemptions++;
+    }
+
+    nvic.pending[irqn] = 0;
+    nvic.running = group_priority(nvic.priority[irqn]);
+    nvic.active = irqn;
+    sim_stats.irq_count[irqn]++;
+
+    // Higher priority interrupts may preempt the handler
+    pthread_sigmask(SIG_UNBLOCK, &tick, NULL);
+    vectors[irqn]();
+    pthread_sigmask(SIG_BLOCK, &tick, NULL);
+
+    nvic.running = interrupted;
+    nvic.active = interrupted_irq;
+}
+
+static void dispatch(void)
+{
+    for (;;)
+    {
+        int irqn;
+
+        // Models keep running during interrupt storms
+        advance_to_now();
+
+        irqn = dispatchable_irq();
+
+        if (irqn < 0)
+        {
+            break;
+        }
+
+        run_handler((IRQn_Type)irqn);
+    }
+}
+
+static void tick_handler(int signal_number)
+{
+    (void)signal_number;
+
+    sim_stats.ticks++;
+    dispatch();
+}
+
+void sim_kick(void)
+{
+    if (started && !trap.active && dispatchable_irq() >= 0)
+    {
+        raise(TICK_SIGNAL);
+    }
+}
+
+// -------------------- Lifecycle --------------------
+
+void sim_init(sim_mode_t mode)
+{
+    struct sigaction action;
+
+    sim_mode = mode;
+
+    for (uint32_t i = 0; i < REGIONS_NUMBER; ++i)
+    {
+        map_region(&regions[i]);
+    }
+
+    sim_peripherals_reset();
+
+    if (mode == SIM_PASSIVE)
+    {
+        return;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaddset(&action.sa_mask, TICK_SIGNAL);
+
+    action.sa_sigaction = segv_handler;
+    sigaction(SIGSEGV, &action, NULL);
+
+    action.sa_sigaction = trap_handler;
+    sigaction(SIGTRAP, &action, NULL);
+
+    protect_registers();
+}
+
+void sim_start(double speed, uint32_t tick_us)
+{
+    struct sigaction action;
+    struct itimerval timer;
+
+    if (sim_mode != SIM_ACTIVE)
+    {
+        return;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = tick_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(TICK_SIGNAL, &action, NULL);
+
+    time_speed = speed;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    started = 1;
+
+    timer.it_interval.tv_sec = tick_us / 1000000;
+    timer.it_interval.tv_usec = tick_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+void sim_finish(int status)
+{
+    struct itimerval stop = {0};
+
+    setitimer(ITIMER_REAL, &stop, NULL);
+
+    printf("{\"sim\":{\"virtual_ms\":%.3f,\"ticks\":%llu,\"register_traps\":%llu,"
+           "\"preemptions\":%llu,\"uart_tx_bytes\":%llu,\"uart_rx_bytes\":%llu,"
+           "\"uart_overruns\":%llu,\"i2c_transactions\":%llu,\"irqs\":{",
+           sim_now / 1e6,
+           (unsigned long long)sim_stats.ticks,
+           (unsigned long long)sim_stats.register_traps,
+           (unsigned long long)sim_stats.preemptions,
+           (unsigned long long)sim_stats.uart_tx_bytes,
+           (unsigned long long)sim_stats.uart_rx_bytes,
+           (unsigned long long)sim_stats.uart_overruns,
+           (unsigned long long)sim_stats.i2c_transactions);
+
+    for (int irqn = 0, first = 1; irqn < SIM_IRQn_NUMBER; ++irqn)
+    {
+        if (sim_stats.irq_count[irqn] != 0)
+        {
+            printf("%s\"%d\":%llu", first ? "" : ",", irqn,
+                   (unsigned long long)sim_stats.irq_count[irqn]);
+            first = 0;
+        }
+    }
+
+    printf("}}}\n");
+    fflush(stdout);
+    _exit(status);
+}
+
+// -------------------- <gpio.h>, <irq.h>, <delay.h> --------------------
+
+void GPIOoutConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                      GPIOOType_TypeDef otype, GPIOSpeed_TypeDef speed,
+                      GPIOPuPd_TypeDef pupd)
+{
+    GPIO_TypeDef *regs = SIM_REG(gpio);
+
+    regs->MODER = (regs->MODER & ~(3U << (2 * pin))) | (1U << (2 * pin));
+    regs->OTYPER = (regs->OTYPER & ~(1U << pin)) | ((uint32_t)otype << pin);
+    regs->OSPEEDR = (regs->OSPEEDR & ~(3U << (2 * pin))) | ((uint32_t)speed << (2 * pin));
+    regs->PUPDR = (regs->PUPDR & ~(3U << (2 * pin))) | ((uint32_t)pupd << (2 * pin));
+    sim_gpio_configured(gpio, pin);
+}
+
+void GPIOafConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                     GPIOOType_TypeDef otype, GPIOSpeed_TypeDef speed,
+                     GPIOPuPd_TypeDef pupd, uint32_t af)
+{
+    GPIO_TypeDef *regs = SIM_REG(gpio);
+
+    regs->MODER = (regs->MODER & ~(3U << (2 * pin))) | (2U << (2 * pin));
+    regs->OTYPER = (regs->OTYPER & ~(1U << pin)) | ((uint32_t)otype << pin);
+    regs->OSPEEDR = (regs->OSPEEDR & ~(3U << (2 * pin))) | ((uint32_t)speed << (2 * pin));
+    regs->PUPDR = (regs->PUPDR & ~(3U << (2 * pin))) | ((uint32_t)pupd << (2 * pin));
+    regs->AFR[pin >> 3] = (regs->AFR[pin >> 3] & ~(15U << (4 * (pin & 7)))) |
+                          (af << (4 * (pin & 7)));
+    sim_gpio_configured(gpio, pin);
+}
+
+void GPIOinConfigure(GPIO_TypeDef *const gpio, uint32_t pin,
+                     GPIOPuPd_TypeDef pupd, EXTIMode_TypeDef mode,
+                     EXTITrigger_TypeDef trigger)
+{
+    GPIO_TypeDef *regs = SIM_REG(gpio);
+    SYSCFG_TypeDef *syscfg = SIM_REG(SYSCFG);
+    EXTI_TypeDef *exti = SIM_REG(EXTI);
+    uint32_t port = ((uintptr_t)gpio - GPIOA_BASE) / 0x400U;
+    uint32_t line = 1U << pin;
+
+    regs->MODER &= ~(3U << (2 * pin));
+    regs->PUPDR = (regs->PUPDR & ~(3U << (2 * pin))) | ((uint32_t)pupd << (2 * pin));
+
+    syscfg->EXTICR[pin >> 2] = (syscfg->EXTICR[pin >> 2] & ~(15U << (4 * (pin & 3)))) |
+                               (port << (4 * (pin & 3)));
+
+    exti->RTSR = (trigger == EXTI_Trigger_Rising || trigger == EXTI_Trigger_Rising_Falling)
+                     ? exti->RTSR | line
+                     : exti->RTSR & ~line;
+    exti->FTSR = (trigger == EXTI_Trigger_Falling || trigger == EXTI_Trigger_Rising_Falling)
+                     ? exti->FTSR | line
+                     : exti->FTSR & ~line;
+
+    if (mode == EXTI_Mode_Interrupt)
+    {
+        exti->IMR |= line;
+    }
+    else
+    {
+        exti->EMR |= line;
+    }
+
+    sim_gpio_configured(gpio, pin);
+}
+
+irq_level_t IRQprotect(uint8_t new_level)
+{
+    irq_level_t old_level = __get_BASEPRI();
+
+    __set_BASEPRI((uint32_t)new_level << (8 - __NVIC_PRIO_BITS));
+    return old_level;
+}
+
+void IRQunprotect(irq_level_t old_level)
+{
+    __set_BASEPRI(old_level);
+}
+
+irq_level_t IRQprotectAll(void)
+{
+    irq_level_t old_level = __get_PRIMASK();
+
+    __disable_irq();
+    return old_level;
+}
+
+void IRQunprotectAll(irq_level_t old_level)
+{
+    if (!old_level)
+    {
+        __enable_irq();
+    }
+}
+
+void Delay(uint32_t count)
+{
+    while (count--)
+    {
+        __NOP();
+    }
+}
+
+// Sleeps until the next tick, like the core until the next interrupt
+void __WFI(void)
+{
+    sigset_t mask;
+
+    if (sim_mode != SIM_ACTIVE || !started)
+    {
+        return;
+    }
+
+    pthread_sigmask(SIG_BLOCK, NULL, &mask);
+    sigdelset(&mask, TICK_SIGNAL);
+    sigsuspend(&mask);
+}
@@ -0,0 +1,47 @@
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include "sim.h"
+
+// Interface between the simulator core (memory, time, NVIC) and the
+// peripheral models. Models always use the writable alias of the
+// register memory, only firmware code goes through the trapped view.
+
+// Writable alias of a register address
+void *sim_alias(uintptr_t address);
+
+#define SIM_REG(peripheral) \
+    ((__typeof__(peripheral))sim_alias((uintptr_t)(peripheral)))
+
+// Memory behind a 32-bit address stored in a DMA register
+static inline uint8_t *sim_memory(uint32_t address)
+{
+    return (uint8_t *)(uintptr_t)address;
+}
+
+// Time the models have been advanced to
+extern uint64_t sim_now;
+
+// Requests a tick as soon as interrupts can be taken,
+// used when an access made an interrupt pending
+void sim_kick(void);
+
+// ---- sim_peripherals.c ----
+
+void sim_peripherals_reset(void);
+
+// Processes every internal event of the models up to time now
+void sim_peripherals_advance(uint64_t now);
+
+// Hooks of trapped register accesses
+void sim_peripherals_before_read(uintptr_t address);
+void sim_peripherals_after_read(uintptr_t address);
+void sim_peripherals_after_write(uintptr_t address, uint32_t old_value);
+
+// Is the interrupt request line of irqn active
+int sim_peripherals_irq_line(IRQn_Type irqn);
+
+// Configuration done by <gpio.h> functions
+void sim_gpio_configured(GPIO_TypeDef *gpio, uint32_t pin);
+
+#endif /* SIM_INTERNAL_H */
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "scenarios.h"
+#include "sim.h"
+
+// Entry point of the firmware, renamed with -Dmain=firmware_main
+int firmware_main(void);
+
+#ifndef SIM_FIRMWARE
+#define SIM_FIRMWARE "firmware"
+#endif
+
+const char *const sim_firmware = SIM_FIRMWARE;
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s -s scenario [-d duration_ms] [-r rate] [-S seed]\n"
+            "          [-x speed] [-t tick_us]\n"
+            "scenarios:\n",
+            program);
+    scenario_list();
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    scenario_options_t options = {5000, 0, 1};
+    const char *scenario = NULL;
+    double speed = 1.0;
+    uint32_t tick_us = 50;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:d:r:S:x:t:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            scenario = optarg;
+            break;
+        case 'd':
+            options.duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            options.rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            options.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'x':
+            speed = strtod(optarg, NULL);
+            break;
+        case 't':
+            tick_us = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (scenario == NULL || speed <= 0 || tick_us == 0)
+    {
+        usage(argv[0]);
+    }
+
+    sim_init(SIM_ACTIVE);
+
+    if (!scenario_setup(scenario, &options))
+    {
+        usage(argv[0]);
+    }
+
+    sim_start(speed, tick_us);
+
+    firmware_main();
+
+    // The firmware returned from main, on the board it would hang here
+    for (;;)
+    {
+        __WFI();
+    }
+}
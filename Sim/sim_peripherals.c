@@ -0,0 +1,1443 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <gpio.h>
+#include "sim_internal.h"
+
+/* Peripheral models, cycle-approximate:
+    - GPIO/EXTI: input pins driven by the board model, edges latch EXTI_PR
+      through SYSCFG_EXTICR, RTSR/FTSR; SWIER, BSRR, w1c PR
+    - USART2: shift register and data register, one frame time per byte
+      derived from BRR, TXE/TC/RXNE/IDLE/ORE, DMA requests on TXE/RXNE
+    - DMA1/DMA2: item by item transfers on peripheral requests, normal,
+      circular and double buffer modes, HT/TC/TE flags in LISR/HISR
+    - TIM1..TIM5: up-counting with prescaler, update and output compare
+      flags, input capture of pin edges, update and compare 1 DMA
+      requests of TIM1
+    - I2C1: master mode event sequence (SB, ADDR, TXE, BTF, RXNE, STOP),
+      nine bit times per byte, with a LIS35DE on the bus
+    - DWT: CYCCNT counting core cycles of virtual time
+*/
+
+#define PORTS_NUMBER 3
+
+#define LIS35DE_ADDRESS 0x1C
+#define LIS35DE_WHO_AM_I 0x0F
+#define LIS35DE_CTRL_REG1 0x20
+#define LIS35DE_OUT_X 0x29
+#define LIS35DE_OUT_Y 0x2B
+#define LIS35DE_OUT_Z 0x2D
+#define LIS35DE_POWER_ON 0x40
+
+#define UART_RX_FIFO_SIZE 65536
+
+// -------------------- Register access on the bus --------------------
+
+static uint32_t bus_read(uintptr_t address, uint32_t size)
+{
+    uint32_t value;
+
+    sim_peripherals_before_read(address);
+    value = *(uint32_t *)sim_alias(address);
+    sim_peripherals_after_read(address);
+
+    return size == 4 ? value : value & ((1U << (8 * size)) - 1);
+}
+
+static void bus_write(uintptr_t address, uint32_t value, uint32_t size)
+{
+    uint32_t *reg = sim_alias(address);
+    uint32_t old_value = *reg;
+
+    *reg = size == 4 ? value : value & ((1U << (8 * size)) - 1);
+    sim_peripherals_after_write(address, old_value);
+}
+
+// -------------------- GPIO --------------------
+
+static const uintptr_t gpio_bases[PORTS_NUMBER] = {GPIOA_BASE, GPIOB_BASE, GPIOC_BASE};
+
+static struct
+{
+    uint32_t driven;
+    uint32_t level;
+} pins[PORTS_NUMBER];
+
+static void timers_capture(uint32_t port, uint32_t pin, int rising);
+
+static int port_of(GPIO_TypeDef *gpio)
+{
+    for (int port = 0; port < PORTS_NUMBER; ++port)
+    {
+        if (gpio_bases[port] == (uintptr_t)gpio)
+        {
+            return port;
+        }
+    }
+
+    return -1;
+}
+
+// Level seen on an input pin: driven by the board or pulled
+static uint32_t input_levels(uint32_t port)
+{
+    GPIO_TypeDef *gpio = SIM_REG((GPIO_TypeDef *)gpio_bases[port]);
+    uint32_t pulled_up = 0;
+
+    for (uint32_t pin = 0; pin < 16; ++pin)
+    {
+        if (((gpio->PUPDR >> (2 * pin)) & 3U) == GPIO_PuPd_UP)
+        {
+            pulled_up |= 1U << pin;
+        }
+    }
+
+    return (pins[port].level & pins[port].driven) | (pulled_up & ~pins[port].driven);
+}
+
+static void update_idr(uint32_t port)
+{
+    GPIO_TypeDef *gpio = SIM_REG((GPIO_TypeDef *)gpio_bases[port]);
+    uint32_t outputs = 0;
+
+    for (uint32_t pin = 0; pin < 16; ++pin)
+    {
+        if (((gpio->MODER >> (2 * pin)) & 3U) == 1U)
+        {
+            outputs |= 1U << pin;
+        }
+    }
+
+    gpio->IDR = (input_levels(port) & ~outputs) | (gpio->ODR & outputs);
+}
+
+static void exti_edge(uint32_t port, uint32_t pin, int rising)
+{
+    SYSCFG_TypeDef *syscfg = SIM_REG(SYSCFG);
+    EXTI_TypeDef *exti = SIM_REG(EXTI);
+    uint32_t line = 1U << pin;
+    uint32_t selected = (syscfg->EXTICR[pin >> 2] >> (4 * (pin & 3))) & 15U;
+
+    if (selected != port)
+    {
+        return;
+    }
+
+    if ((rising && (exti->RTSR & line)) || (!rising && (exti->FTSR & line)))
+    {
+        exti->PR |= line;
+    }
+}
+
+void sim_gpio_input(GPIO_TypeDef *gpio, uint32_t pin, int level)
+{
+    int port = port_of(gpio);
+    uint32_t mask = 1U << pin;
+    uint32_t before;
+    uint32_t after;
+
+    if (port < 0)
+    {
+        return;
+    }
+
+    before = input_levels(port) & mask;
+    pins[port].driven |= mask;
+    pins[port].level = level ? pins[port].level | mask : pins[port].level & ~mask;
+    after = input_levels(port) & mask;
+
+    update_idr(port);
+
+    if (before != after)
+    {
+        exti_edge(port, pin, after != 0);
+        timers_capture(port, pin, after != 0);
+    }
+}
+
+uint32_t sim_gpio_output(GPIO_TypeDef *gpio)
+{
+    return SIM_REG(gpio)->ODR;
+}
+
+void sim_gpio_configured(GPIO_TypeDef *gpio, uint32_t pin)
+{
+    int port = port_of(gpio);
+
+    (void)pin;
+
+    if (port >= 0)
+    {
+        update_idr(port);
+    }
+}
+
+static void gpio_after_write(uint32_t port, uintptr_t offset)
+{
+    GPIO_TypeDef *gpio = SIM_REG((GPIO_TypeDef *)gpio_bases[port]);
+
+    if (offset == offsetof(GPIO_TypeDef, BSRR))
+    {
+        uint32_t bsrr = gpio->BSRR;
+
+        // Set wins over reset, as in hardware
+        gpio->ODR = (gpio->ODR & ~(bsrr >> 16)) | (bsrr & 0xFFFFU);
+        gpio->BSRR = 0;
+    }
+
+    update_idr(port);
+}
+
+// -------------------- Board --------------------
+
+const char *const sim_button_names[SIM_BUTTONS_NUMBER] = {
+    "USER", "LEFT", "RIGHT", "UP", "DOWN", "FIRE", "MODE"};
+
+static const struct
+{
+    uintptr_t gpio;
+    uint32_t pin;
+    int active_low;
+} buttons[SIM_BUTTONS_NUMBER] = {
+    {GPIOC_BASE, 13, 1},
+    {GPIOB_BASE, 3, 1},
+    {GPIOB_BASE, 4, 1},
+    {GPIOB_BASE, 5, 1},
+    {GPIOB_BASE, 6, 1},
+    {GPIOB_BASE, 10, 1},
+    {GPIOA_BASE, 0, 0}};
+
+static uint8_t buttons_pressed[SIM_BUTTONS_NUMBER];
+
+void sim_button_set(sim_button_t button, int pressed)
+{
+    buttons_pressed[button] = pressed != 0;
+    sim_gpio_input((GPIO_TypeDef *)buttons[button].gpio, buttons[button].pin,
+                   (pressed != 0) ^ buttons[button].active_low);
+}
+
+int sim_button_pressed(sim_button_t button)
+{
+    return buttons_pressed[button];
+}
+
+// -------------------- EXTI --------------------
+
+static void exti_after_write(uintptr_t offset, uint32_t old_value)
+{
+    EXTI_TypeDef *exti = SIM_REG(EXTI);
+
+    if (offset == offsetof(EXTI_TypeDef, PR))
+    {
+        uint32_t written = exti->PR;
+
+        exti->PR = old_value & ~written;
+        exti->SWIER &= ~written;
+    }
+    else if (offset == offsetof(EXTI_TypeDef, SWIER))
+    {
+        uint32_t raised = exti->SWIER & ~old_value;
+
+        exti->SWIER |= old_value;
+        exti->PR |= raised & exti->IMR;
+    }
+}
+
+static int exti_irq_line(uint32_t lines)
+{
+    EXTI_TypeDef *exti = SIM_REG(EXTI);
+
+    return (exti->PR & exti->IMR & lines) != 0;
+}
+
+// -------------------- DMA --------------------
+
+static const uint8_t dma_flag_shift[4] = {0, 6, 16, 22};
+
+#define DMA_FEIF 0x01U
+#define DMA_TEIF 0x08U
+#define DMA_HTIF 0x10U
+#define DMA_TCIF 0x20U
+
+static struct
+{
+    uint32_t initial;
+    uint32_t position;
+} dma_streams[2][8];
+
+static uintptr_t dma_base(uint32_t dma)
+{
+    return dma == 0 ? DMA1_BASE : DMA2_BASE;
+}
+
+static DMA_Stream_TypeDef *dma_stream(uint32_t dma, uint32_t stream)
+{
+    return SIM_REG((DMA_Stream_TypeDef *)DMA_STREAM_BASE(dma_base(dma), stream));
+}
+
+static volatile uint32_t *dma_isr(uint32_t dma, uint32_t stream)
+{
+    DMA_TypeDef *regs = SIM_REG((DMA_TypeDef *)dma_base(dma));
+
+    return stream < 4 ? &regs->LISR : &regs->HISR;
+}
+
+static void dma_set_flags(uint32_t dma, uint32_t stream, uint32_t flags)
+{
+    *dma_isr(dma, stream) |= flags << dma_flag_shift[stream & 3];
+}
+
+static uint32_t dma_flags(uint32_t dma, uint32_t stream)
+{
+    return (*dma_isr(dma, stream) >> dma_flag_shift[stream & 3]) & 0x3DU;
+}
+
+static uint32_t dma_item_size(uint32_t cr)
+{
+    return 1U << ((cr & DMA_SxCR_MSIZE) >> 13);
+}
+
+// Moves one data item of the stream; called on a peripheral request
+static void dma_transfer_item(uint32_t dma, uint32_t stream)
+{
+    DMA_Stream_TypeDef *regs = dma_stream(dma, stream);
+    uint32_t cr = regs->CR;
+    uint32_t size = dma_item_size(cr);
+    uint32_t memory = (cr & DMA_SxCR_CT) ? regs->M1AR : regs->M0AR;
+    uint32_t position = dma_streams[dma][stream].position;
+    uint8_t *item;
+    uint32_t value = 0;
+
+    if (cr & DMA_SxCR_MINC)
+    {
+        memory += position * size;
+    }
+
+    item = sim_memory(memory);
+
+    // Bookkeeping first, the peripheral access may request the next item
+    regs->NDTR--;
+    dma_streams[dma][stream].position++;
+
+    if (regs->NDTR == dma_streams[dma][stream].initial / 2)
+    {
+        dma_set_flags(dma, stream, DMA_HTIF);
+    }
+
+    if (regs->NDTR == 0)
+    {
+        dma_set_flags(dma, stream, DMA_TCIF);
+
+        if (cr & (DMA_SxCR_CIRC | DMA_SxCR_DBM))
+        {
+            regs->NDTR = dma_streams[dma][stream].initial;
+            dma_streams[dma][stream].position = 0;
+
+            if (cr & DMA_SxCR_DBM)
+            {
+                regs->CR ^= DMA_SxCR_CT;
+            }
+        }
+        else
+        {
+            regs->CR &= ~DMA_SxCR_EN;
+        }
+    }
+
+    if ((cr & DMA_SxCR_DIR) == DMA_SxCR_DIR_0)
+    {
+        memcpy(&value, item, size);
+        bus_write(regs->PAR, value, size);
+    }
+    else
+    {
+        value = bus_read(regs->PAR, size);
+        memcpy(item, &value, size);
+    }
+}
+
+// Peripheral request on a stream: served if the stream is enabled and
+// its channel selects the requesting peripheral
+static int dma_request(uint32_t dma, uint32_t stream, uint32_t channel)
+{
+    DMA_Stream_TypeDef *regs = dma_stream(dma, stream);
+
+    if (!(regs->CR & DMA_SxCR_EN) ||
+        ((regs->CR & DMA_SxCR_CHSEL) >> 25) != channel ||
+        regs->NDTR == 0)
+    {
+        return 0;
+    }
+
+    dma_transfer_item(dma, stream);
+    return 1;
+}
+
+static void usart_dma_enabled(void);
+
+static void dma_stream_after_write(uint32_t dma, uint32_t stream,
+                                   uintptr_t offset, uint32_t old_value)
+{
+    DMA_Stream_TypeDef *regs = dma_stream(dma, stream);
+
+    if (offset != offsetof(DMA_Stream_TypeDef, CR))
+    {
+        return;
+    }
+
+    if ((regs->CR & DMA_SxCR_EN) && !(old_value & DMA_SxCR_EN))
+    {
+        if (regs->NDTR == 0)
+        {
+            regs->CR &= ~DMA_SxCR_EN;
+            dma_set_flags(dma, stream, DMA_TEIF);
+            return;
+        }
+
+        dma_streams[dma][stream].initial = regs->NDTR;
+        dma_streams[dma][stream].position = 0;
+
+        if (dma == 0)
+        {
+            usart_dma_enabled();
+        }
+    }
+    else if (!(regs->CR & DMA_SxCR_EN) && (old_value & DMA_SxCR_EN))
+    {
+        // Disabling an active stream completes it
+        dma_set_flags(dma, stream, DMA_TCIF);
+    }
+}
+
+static void dma_after_write(uint32_t dma, uintptr_t offset, uint32_t old_value)
+{
+    DMA_TypeDef *regs = SIM_REG((DMA_TypeDef *)dma_base(dma));
+
+    if (offset == offsetof(DMA_TypeDef, LIFCR))
+    {
+        regs->LISR &= ~regs->LIFCR;
+        regs->LIFCR = 0;
+    }
+    else if (offset == offsetof(DMA_TypeDef, HIFCR))
+    {
+        regs->HISR &= ~regs->HIFCR;
+        regs->HIFCR = 0;
+    }
+    else if (offset >= 0x10 && offset < 0x10 + 8 * 0x18)
+    {
+        dma_stream_after_write(dma, (offset - 0x10) / 0x18,
+                               (offset - 0x10) % 0x18, old_value);
+    }
+}
+
+static int dma_irq_line(uint32_t dma, uint32_t stream)
+{
+    uint32_t cr = dma_stream(dma, stream)->CR;
+    uint32_t flags = dma_flags(dma, stream);
+
+    return ((flags & DMA_TCIF) && (cr & DMA_SxCR_TCIE)) ||
+           ((flags & DMA_HTIF) && (cr & DMA_SxCR_HTIE)) ||
+           ((flags & DMA_TEIF) && (cr & DMA_SxCR_TEIE));
+}
+
+// -------------------- USART2 --------------------
+
+static struct
+{
+    int shifting;
+    uint64_t shift_end;
+    uint8_t shift;
+    int tdr_full;
+    uint8_t tdr;
+    uint8_t rdr;
+
+    uint8_t rx_fifo[UART_RX_FIFO_SIZE];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint64_t rx_next;
+    uint64_t idle_at;
+    int idle_armed;
+
+    void (*observer)(uint8_t byte, uint64_t time_ns);
+} usart;
+
+static uint64_t usart_frame_ns(void)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+    uint64_t bits = (regs->CR1 & USART_CR1_M) ? 11 : 10;
+
+    if (regs->BRR == 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t)regs->BRR * bits * 1000000000U / SIM_CORE_HZ;
+}
+
+static void usart_request_tx(void)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+
+    // USART2_TX: DMA1 stream 6 channel 4
+    if ((regs->CR1 & USART_CR1_UE) && (regs->SR & USART_SR_TXE) &&
+        (regs->CR3 & USART_CR3_DMAT))
+    {
+        dma_request(0, 6, 4);
+    }
+}
+
+static void usart_write_dr(uint8_t value, uint64_t time)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+
+    if ((regs->CR1 & (USART_CR1_UE | USART_CR1_TE)) != (USART_CR1_UE | USART_CR1_TE))
+    {
+        return;
+    }
+
+    regs->SR &= ~USART_SR_TC;
+
+    if (!usart.shifting)
+    {
+        usart.shift = value;
+        usart.shifting = 1;
+        usart.shift_end = time + usart_frame_ns();
+        regs->SR |= USART_SR_TXE;
+        usart_request_tx();
+    }
+    else
+    {
+        usart.tdr = value;
+        usart.tdr_full = 1;
+        regs->SR &= ~USART_SR_TXE;
+    }
+}
+
+static void usart_transmitted(uint64_t time)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+
+    sim_stats.uart_tx_bytes++;
+
+    if (usart.observer)
+    {
+        usart.observer(usart.shift, time);
+    }
+
+    if (usart.tdr_full)
+    {
+        usart.shift = usart.tdr;
+        usart.tdr_full = 0;
+        usart.shift_end = time + usart_frame_ns();
+        regs->SR |= USART_SR_TXE;
+        usart_request_tx();
+    }
+    else
+    {
+        usart.shifting = 0;
+        regs->SR |= USART_SR_TC;
+    }
+}
+
+static void usart_received(uint64_t time)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+    uint8_t byte = usart.rx_fifo[usart.rx_head];
+
+    usart.rx_head = (usart.rx_head + 1) % UART_RX_FIFO_SIZE;
+    usart.rx_count--;
+    usart.rx_next = time + usart_frame_ns();
+    usart.idle_at = usart.rx_next;
+    usart.idle_armed = 1;
+
+    if ((regs->CR1 & (USART_CR1_UE | USART_CR1_RE)) != (USART_CR1_UE | USART_CR1_RE))
+    {
+        return;
+    }
+
+    sim_stats.uart_rx_bytes++;
+
+    if (regs->SR & USART_SR_RXNE)
+    {
+        regs->SR |= USART_SR_ORE;
+        sim_stats.uart_overruns++;
+        return;
+    }
+
+    usart.rdr = byte;
+    regs->SR |= USART_SR_RXNE;
+
+    // USART2_RX: DMA1 stream 5 channel 4
+    if (regs->CR3 & USART_CR3_DMAR)
+    {
+        dma_request(0, 5, 4);
+    }
+}
+
+static void usart_advance(uint64_t now)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+
+    for (;;)
+    {
+        int tx = usart.shifting && usart.shift_end <= now;
+        int rx = usart.rx_count > 0 && usart.rx_next <= now;
+
+        if (tx && (!rx || usart.shift_end <= usart.rx_next))
+        {
+            usart_transmitted(usart.shift_end);
+        }
+        else if (rx)
+        {
+            usart_received(usart.rx_next);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (usart.idle_armed && usart.rx_count == 0 && usart.idle_at <= now)
+    {
+        usart.idle_armed = 0;
+        regs->SR |= USART_SR_IDLE;
+    }
+}
+
+static void usart_dma_enabled(void)
+{
+    usart_request_tx();
+}
+
+void sim_uart_send(const char *data, uint32_t length)
+{
+    if (usart.rx_count == 0)
+    {
+        uint64_t earliest = sim_now + usart_frame_ns();
+        usart.rx_next = usart.rx_next > earliest ? usart.rx_next : earliest;
+    }
+
+    for (uint32_t i = 0; i < length && usart.rx_count < UART_RX_FIFO_SIZE; ++i)
+    {
+        usart.rx_fifo[(usart.rx_head + usart.rx_count) % UART_RX_FIFO_SIZE] = (uint8_t)data[i];
+        usart.rx_count++;
+    }
+}
+
+void sim_uart_observe(void (*observer)(uint8_t byte, uint64_t time_ns))
+{
+    usart.observer = observer;
+}
+
+static void usart_after_write(uintptr_t offset, uint32_t old_value)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+
+    switch (offset)
+    {
+    case offsetof(USART_TypeDef, DR):
+        usart_write_dr((uint8_t)regs->DR, sim_now);
+        break;
+    case offsetof(USART_TypeDef, SR):
+        // Only RXNE and TC are cleared by writing 0
+        regs->SR = old_value & (regs->SR | ~(USART_SR_RXNE | USART_SR_TC));
+        break;
+    case offsetof(USART_TypeDef, CR1):
+    case offsetof(USART_TypeDef, CR3):
+        usart_request_tx();
+        break;
+    }
+}
+
+static int usart_irq_line(void)
+{
+    USART_TypeDef *regs = SIM_REG(USART2);
+    uint32_t sr = regs->SR;
+    uint32_t cr1 = regs->CR1;
+
+    return ((sr & USART_SR_TXE) && (cr1 & USART_CR1_TXEIE)) ||
+           ((sr & USART_SR_TC) && (cr1 & USART_CR1_TCIE)) ||
+           ((sr & (USART_SR_RXNE | USART_SR_ORE)) && (cr1 & USART_CR1_RXNEIE)) ||
+           ((sr & USART_SR_IDLE) && (cr1 & USART_CR1_IDLEIE));
+}
+
+// -------------------- Timers --------------------
+
+#define TIMERS_NUMBER 5
+
+static const uintptr_t timer_bases[TIMERS_NUMBER] = {
+    TIM1_BASE, TIM2_BASE, TIM3_BASE, TIM4_BASE, TIM5_BASE};
+
+static struct
+{
+    uint64_t last_cycles;
+    uint64_t prescaler_count;
+    uint32_t prescaler;
+    uint64_t counter;
+} timers[TIMERS_NUMBER];
+
+// Update DMA requests of TIM1 (DMA2 stream 5 channel 6)
+static void timer_update_dma(uint32_t timer, uint64_t updates)
+{
+    TIM_TypeDef *regs = SIM_REG((TIM_TypeDef *)timer_bases[timer]);
+
+    if (timer != 0 || !(regs->DIER & TIM_DIER_UDE))
+    {
+        return;
+    }
+
+    for (uint64_t i = 0; i < updates; ++i)
+    {
+        dma_request(1, 5, 6);
+    }
+}
+
+// Compare 1 DMA requests of TIM1 (DMA2 stream 1 channel 6)
+static void timer_compare_dma(uint32_t timer, uint32_t channel)
+{
+    TIM_TypeDef *regs = SIM_REG((TIM_TypeDef *)timer_bases[timer]);
+
+    if (timer != 0 || channel != 0 || !(regs->DIER & TIM_DIER_CC1DE))
+    {
+        return;
+    }
+
+    dma_request(1, 1, 6);
+}
+
+// Is a counter value in (from, from + ticks] congruent to value mod period
+static int timer_crossed(uint64_t from, uint64_t ticks, uint64_t value, uint64_t period)
+{
+    if (ticks >= period)
+    {
+        return 1;
+    }
+
+    return (value > from && value <= from + ticks) ||
+           (value + period > from && value + period <= from + ticks);
+}
+
+static void timer_advance(uint32_t timer, uint64_t now)
+{
+    TIM_TypeDef *regs = SIM_REG((TIM_TypeDef *)timer_bases[timer]);
+    uint64_t cycles = SIM_NS_TO_CYCLES(now);
+    uint64_t period = (uint64_t)regs->ARR + 1;
+    uint64_t ticks;
+    uint64_t updates;
+    const volatile uint32_t *ccr = &regs->CCR1;
+    uint32_t ccmr;
+
+    if (!(regs->CR1 & TIM_CR1_CEN) || cycles <= timers[timer].last_cycles)
+    {
+        timers[timer].last_cycles = cycles;
+        return;
+    }
+
+    timers[timer].prescaler_count += cycles - timers[timer].last_cycles;
+    timers[timer].last_cycles = cycles;
+    ticks = timers[timer].prescaler_count / (timers[timer].prescaler + 1);
+    timers[timer].prescaler_count %= timers[timer].prescaler + 1;
+
+    if (ticks == 0)
+    {
+        return;
+    }
+
+    for (uint32_t channel = 0; channel < 4; ++channel)
+    {
+        ccmr = channel < 2 ? regs->CCMR1 : regs->CCMR2;
+
+        // Output compare channels only
+        if (((ccmr >> (8 * (channel & 1))) & 3U) == 0 &&
+            timer_crossed(timers[timer].counter, ticks, ccr[channel], period))
+        {
+            regs->SR |= TIM_SR_CC1IF << channel;
+            timer_compare_dma(timer, channel);
+        }
+    }
+
+    updates = (timers[timer].counter + ticks) / period;
+    timers[timer].counter = (timers[timer].counter + ticks) % period;
+    regs->CNT = (uint32_t)timers[timer].counter;
+
+    if (updates > 0)
+    {
+        // The prescaler is preloaded, it changes on update events
+        timers[timer].prescaler = regs->PSC;
+
+        if (!(regs->CR1 & TIM_CR1_UDIS))
+        {
+            regs->SR |= TIM_SR_UIF;
+            timer_update_dma(timer, updates);
+        }
+    }
+}
+
+// Input capture of a pin edge on the timer channel the pin is routed to
+static void timers_capture(uint32_t port, uint32_t pin, int rising)
+{
+    static const struct
+    {
+        uint8_t port;
+        uint8_t pin;
+        uint8_t af;
+        uint8_t timer;
+        uint8_t channel;
+    } routes[] = {
+        {0, 0, 1, 1, 0},  // PA0 TIM2_CH1
+        {0, 0, 2, 4, 0},  // PA0 TIM5_CH1
+        {0, 5, 1, 1, 0},  // PA5 TIM2_CH1
+        {0, 6, 2, 2, 0},  // PA6 TIM3_CH1
+        {0, 7, 2, 2, 1},  // PA7 TIM3_CH2
+        {1, 0, 2, 2, 2},  // PB0 TIM3_CH3
+        {1, 3, 1, 1, 1},  // PB3 TIM2_CH2
+        {1, 4, 2, 2, 0},  // PB4 TIM3_CH1
+        {1, 5, 2, 2, 1},  // PB5 TIM3_CH2
+        {1, 6, 2, 3, 0},  // PB6 TIM4_CH1
+        {1, 10, 1, 1, 2}, // PB10 TIM2_CH3
+    };
+    GPIO_TypeDef *gpio = SIM_REG((GPIO_TypeDef *)gpio_bases[port]);
+
+    if (((gpio->MODER >> (2 * pin)) & 3U) != 2U)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < sizeof(routes) / sizeof(routes[0]); ++i)
+    {
+        uint32_t af = (gpio->AFR[pin >> 3] >> (4 * (pin & 7))) & 15U;
+        TIM_TypeDef *regs;
+        uint32_t channel = routes[i].channel;
+        uint32_t ccmr;
+        uint32_t ccer;
+        uint32_t polarity;
+        volatile uint32_t *ccr;
+
+        if (routes[i].port != port || routes[i].pin != pin || routes[i].af != af)
+        {
+            continue;
+        }
+
+        regs = SIM_REG((TIM_TypeDef *)timer_bases[routes[i].timer]);
+        timer_advance(routes[i].timer, sim_now);
+
+        ccmr = channel < 2 ? regs->CCMR1 : regs->CCMR2;
+        ccer = regs->CCER >> (4 * channel);
+        polarity = ccer & (TIM_CCER_CC1P | TIM_CCER_CC1NP);
+
+        // Capture enabled, channel mapped on its own input (CCxS = 01)
+        if (!(ccer & TIM_CCER_CC1E) || ((ccmr >> (8 * (channel & 1))) & 3U) != 1U)
+        {
+            return;
+        }
+
+        if (polarity == (TIM_CCER_CC1P | TIM_CCER_CC1NP) ||
+            (polarity == 0 && rising) ||
+            (polarity == TIM_CCER_CC1P && !rising))
+        {
+            ccr = &regs->CCR1 + channel;
+            *ccr = regs->CNT;
+
+            if (regs->SR & (TIM_SR_CC1IF << channel))
+            {
+                regs->SR |= TIM_SR_CC1OF << channel;
+            }
+            regs->SR |= TIM_SR_CC1IF << channel;
+        }
+        return;
+    }
+}
+
+const TIM_TypeDef *sim_timer(TIM_TypeDef *tim)
+{
+    return SIM_REG(tim);
+}
+
+static void timers_advance(uint64_t now)
+{
+    for (uint32_t timer = 0; timer < TIMERS_NUMBER; ++timer)
+    {
+        timer_advance(timer, now);
+    }
+}
+
+static void timer_after_write(uint32_t timer, uintptr_t offset, uint32_t old_value)
+{
+    TIM_TypeDef *regs = SIM_REG((TIM_TypeDef *)timer_bases[timer]);
+
+    switch (offset)
+    {
+    case offsetof(TIM_TypeDef, CR1):
+        if ((regs->CR1 & TIM_CR1_CEN) && !(old_value & TIM_CR1_CEN))
+        {
+            timers[timer].last_cycles = SIM_NS_TO_CYCLES(sim_now);
+        }
+        break;
+    case offsetof(TIM_TypeDef, SR):
+        // rc_w0: writing 0 clears, writing 1 keeps
+        regs->SR = old_value & regs->SR;
+        break;
+    case offsetof(TIM_TypeDef, EGR):
+        if (regs->EGR & TIM_EGR_UG)
+        {
+            timers[timer].counter = 0;
+            timers[timer].prescaler_count = 0;
+            timers[timer].prescaler = regs->PSC;
+            regs->CNT = 0;
+
+            if (!(regs->CR1 & TIM_CR1_URS))
+            {
+                regs->SR |= TIM_SR_UIF;
+            }
+        }
+        regs->EGR = 0;
+        break;
+    case offsetof(TIM_TypeDef, CNT):
+        timers[timer].counter = regs->CNT;
+        break;
+    }
+}
+
+// Reading CCRx clears CCxIF
+static void timers_after_read(uintptr_t address)
+{
+    for (uint32_t timer = 0; timer < TIMERS_NUMBER; ++timer)
+    {
+        uintptr_t first = timer_bases[timer] + offsetof(TIM_TypeDef, CCR1);
+
+        if (address >= first && address < first + 4 * sizeof(uint32_t))
+        {
+            SIM_REG((TIM_TypeDef *)timer_bases[timer])->SR &=
+                ~(TIM_SR_CC1IF << ((address - first) / sizeof(uint32_t)));
+            return;
+        }
+    }
+}
+
+static int timer_irq_line(uint32_t timer, uint32_t flags)
+{
+    TIM_TypeDef *regs = SIM_REG((TIM_TypeDef *)timer_bases[timer]);
+
+    return (regs->SR & regs->DIER & flags) != 0;
+}
+
+// -------------------- I2C1 and LIS35DE --------------------
+
+typedef enum
+{
+    I2C_EVENT_NONE,
+    I2C_EVENT_START,
+    I2C_EVENT_ADDRESS,
+    I2C_EVENT_TRANSMITTED,
+    I2C_EVENT_RECEIVED,
+    I2C_EVENT_STOP
+} i2c_event_t;
+
+static struct
+{
+    i2c_event_t event;
+    uint64_t event_at;
+    uint8_t address;
+    int reading;
+    int shifting;
+    uint8_t shift;
+    int dr_full;
+    uint8_t dr;
+    uint8_t rx;
+    int stop_requested;
+    int pointer_set;
+} i2c;
+
+static struct
+{
+    uint8_t regs[0x40];
+    uint8_t pointer;
+    int8_t (*script)(uint32_t axis, uint64_t time_ns);
+} lis35de;
+
+// Slow circular tilt, about 4 s per revolution
+static int8_t default_script(uint32_t axis, uint64_t time_ns)
+{
+    double phase = 2 * M_PI * (double)time_ns / 4e9;
+
+    switch (axis)
+    {
+    case 0:
+        return (int8_t)(40 * sin(phase));
+    case 1:
+        return (int8_t)(40 * cos(phase));
+    default:
+        return 54;
+    }
+}
+
+void sim_lis35de_script(int8_t (*axis_value)(uint32_t axis, uint64_t time_ns))
+{
+    lis35de.script = axis_value;
+}
+
+static uint8_t lis35de_read(uint64_t time)
+{
+    uint8_t reg = lis35de.pointer & 0x3F;
+    uint8_t value;
+
+    if (lis35de.pointer & 0x80)
+    {
+        lis35de.pointer = (uint8_t)(0x80 | (reg + 1));
+    }
+
+    switch (reg)
+    {
+    case LIS35DE_OUT_X:
+    case LIS35DE_OUT_Y:
+    case LIS35DE_OUT_Z:
+        if (!(lis35de.regs[LIS35DE_CTRL_REG1] & LIS35DE_POWER_ON))
+        {
+            return 0;
+        }
+        value = (uint8_t)lis35de.script((reg - LIS35DE_OUT_X) / 2, time);
+        break;
+    default:
+        value = lis35de.regs[reg];
+        break;
+    }
+
+    return value;
+}
+
+static void lis35de_write(uint8_t value)
+{
+    uint8_t reg = lis35de.pointer & 0x3F;
+
+    lis35de.regs[reg] = value;
+
+    if (lis35de.pointer & 0x80)
+    {
+        lis35de.pointer = (uint8_t)(0x80 | (reg + 1));
+    }
+}
+
+// Bit time from CCR in standard mode: the period is 2 * CCR PCLK1 cycles
+static uint64_t i2c_bit_ns(void)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+    uint32_t mhz = regs->CR2 & I2C_CR2_FREQ;
+
+    if (mhz == 0 || (regs->CCR & 0xFFFU) == 0)
+    {
+        return 10000;
+    }
+
+    return 2ULL * (regs->CCR & 0xFFFU) * 1000 / mhz;
+}
+
+static void i2c_schedule(i2c_event_t event, uint64_t time, uint32_t bits)
+{
+    i2c.event = event;
+    i2c.event_at = time + bits * i2c_bit_ns();
+}
+
+static void i2c_stop(void)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+
+    regs->CR1 &= ~I2C_CR1_STOP;
+    regs->SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF | I2C_SR1_SB | I2C_SR1_ADDR);
+    regs->SR2 = 0;
+    i2c.shifting = 0;
+    i2c.dr_full = 0;
+    i2c.stop_requested = 0;
+    i2c.event = I2C_EVENT_NONE;
+    sim_stats.i2c_transactions++;
+}
+
+static void i2c_transmit(uint8_t value, uint64_t time)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+
+    regs->SR1 &= ~I2C_SR1_BTF;
+
+    if (!i2c.shifting)
+    {
+        i2c.shift = value;
+        i2c.shifting = 1;
+        regs->SR1 |= I2C_SR1_TXE;
+        i2c_schedule(I2C_EVENT_TRANSMITTED, time, 9);
+    }
+    else
+    {
+        i2c.dr = value;
+        i2c.dr_full = 1;
+        regs->SR1 &= ~I2C_SR1_TXE;
+    }
+}
+
+static void i2c_event(uint64_t time)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+    i2c_event_t event = i2c.event;
+
+    i2c.event = I2C_EVENT_NONE;
+
+    switch (event)
+    {
+    case I2C_EVENT_START:
+        regs->CR1 &= ~I2C_CR1_START;
+        regs->SR1 = (regs->SR1 & ~(I2C_SR1_BTF | I2C_SR1_TXE)) | I2C_SR1_SB;
+        regs->SR2 |= I2C_SR2_MSL | I2C_SR2_BUSY;
+        i2c.shifting = 0;
+        i2c.dr_full = 0;
+        break;
+
+    case I2C_EVENT_ADDRESS:
+        if ((i2c.address >> 1) != LIS35DE_ADDRESS)
+        {
+            regs->SR1 |= I2C_SR1_AF;
+            break;
+        }
+        i2c.reading = i2c.address & 1;
+        i2c.pointer_set = 0;
+        regs->SR1 |= I2C_SR1_ADDR;
+        regs->SR2 = (regs->SR2 & ~I2C_SR2_TRA) | (i2c.reading ? 0 : I2C_SR2_TRA);
+        break;
+
+    case I2C_EVENT_TRANSMITTED:
+        if (!i2c.pointer_set)
+        {
+            lis35de.pointer = i2c.shift;
+            i2c.pointer_set = 1;
+        }
+        else
+        {
+            lis35de_write(i2c.shift);
+        }
+
+        i2c.shifting = 0;
+
+        if (i2c.dr_full)
+        {
+            i2c.dr_full = 0;
+            i2c_transmit(i2c.dr, time);
+        }
+        else
+        {
+            regs->SR1 |= I2C_SR1_TXE | I2C_SR1_BTF;
+
+            if (regs->CR1 & I2C_CR1_STOP)
+            {
+                i2c_schedule(I2C_EVENT_STOP, time, 1);
+            }
+        }
+        break;
+
+    case I2C_EVENT_RECEIVED:
+        i2c.rx = lis35de_read(time);
+
+        if (regs->SR1 & I2C_SR1_RXNE)
+        {
+            regs->SR1 |= I2C_SR1_BTF;
+        }
+        regs->SR1 |= I2C_SR1_RXNE;
+
+        if (i2c.stop_requested || (regs->CR1 & I2C_CR1_STOP))
+        {
+            i2c_stop();
+        }
+        break;
+
+    case I2C_EVENT_STOP:
+        i2c_stop();
+        break;
+
+    case I2C_EVENT_NONE:
+        break;
+    }
+}
+
+static void i2c_advance(uint64_t now)
+{
+    while (i2c.event != I2C_EVENT_NONE && i2c.event_at <= now)
+    {
+        i2c_event(i2c.event_at);
+    }
+}
+
+static void i2c_after_write(uintptr_t offset)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+
+    if (offset == offsetof(I2C_TypeDef, CR1))
+    {
+        if (!(regs->CR1 & I2C_CR1_PE))
+        {
+            return;
+        }
+
+        if (regs->CR1 & I2C_CR1_START)
+        {
+            i2c_schedule(I2C_EVENT_START, sim_now, 1);
+        }
+        else if (regs->CR1 & I2C_CR1_STOP)
+        {
+            if (i2c.event == I2C_EVENT_RECEIVED)
+            {
+                // Generated after the byte being received
+                i2c.stop_requested = 1;
+            }
+            else if (!i2c.shifting)
+            {
+                i2c_schedule(I2C_EVENT_STOP, sim_now, 1);
+            }
+        }
+    }
+    else if (offset == offsetof(I2C_TypeDef, DR))
+    {
+        uint8_t value = (uint8_t)regs->DR;
+
+        if (regs->SR1 & I2C_SR1_SB)
+        {
+            regs->SR1 &= ~I2C_SR1_SB;
+            i2c.address = value;
+            i2c_schedule(I2C_EVENT_ADDRESS, sim_now, 9);
+        }
+        else if ((regs->SR2 & I2C_SR2_TRA) && !(regs->SR1 & I2C_SR1_ADDR))
+        {
+            i2c_transmit(value, sim_now);
+        }
+    }
+}
+
+static void i2c_after_read(uintptr_t offset)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+
+    if (offset == offsetof(I2C_TypeDef, SR2) && (regs->SR1 & I2C_SR1_ADDR))
+    {
+        // ADDR is cleared by reading SR1 and then SR2
+        regs->SR1 &= ~I2C_SR1_ADDR;
+
+        if (i2c.reading)
+        {
+            i2c_schedule(I2C_EVENT_RECEIVED, sim_now, 9);
+        }
+        else
+        {
+            regs->SR1 |= I2C_SR1_TXE;
+        }
+    }
+    else if (offset == offsetof(I2C_TypeDef, DR) && (regs->SR1 & I2C_SR1_RXNE))
+    {
+        regs->SR1 &= ~(I2C_SR1_RXNE | I2C_SR1_BTF);
+
+        if (i2c.reading && (regs->SR2 & I2C_SR2_MSL) && (regs->CR1 & I2C_CR1_ACK))
+        {
+            i2c_schedule(I2C_EVENT_RECEIVED, sim_now, 9);
+        }
+    }
+}
+
+static int i2c_event_line(void)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+    uint32_t sr1 = regs->SR1;
+    uint32_t cr2 = regs->CR2;
+
+    if (!(cr2 & I2C_CR2_ITEVTEN))
+    {
+        return 0;
+    }
+
+    return (sr1 & (I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_BTF | I2C_SR1_STOPF)) ||
+           ((cr2 & I2C_CR2_ITBUFEN) && (sr1 & (I2C_SR1_TXE | I2C_SR1_RXNE)));
+}
+
+static int i2c_error_line(void)
+{
+    I2C_TypeDef *regs = SIM_REG(I2C1);
+
+    return (regs->CR2 & I2C_CR2_ITERREN) &&
+           (regs->SR1 & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_AF | I2C_SR1_OVR));
+}
+
+// -------------------- DWT --------------------
+
+static uint64_t cycle_counter_offset;
+
+// -------------------- Model interface --------------------
+
+void sim_peripherals_reset(void)
+{
+    GPIO_TypeDef *gpiob = SIM_REG(GPIOB);
+    GPIO_TypeDef *gpioc = SIM_REG(GPIOC);
+
+    SIM_REG(USART2)->SR = USART_SR_TXE | USART_SR_TC;
+    lis35de.regs[LIS35DE_WHO_AM_I] = 0x3B;
+    lis35de.regs[LIS35DE_CTRL_REG1] = 0x07;
+    lis35de.script = default_script;
+
+    for (uint32_t timer = 0; timer < TIMERS_NUMBER; ++timer)
+    {
+        SIM_REG((TIM_TypeDef *)timer_bases[timer])->ARR = 0xFFFF;
+    }
+    SIM_REG(TIM2)->ARR = 0xFFFFFFFFU;
+    SIM_REG(TIM5)->ARR = 0xFFFFFFFFU;
+
+    // Buttons released: joystick and USER pulled up on the board
+    for (int button = 0; button < SIM_BUTTONS_NUMBER; ++button)
+    {
+        sim_button_set((sim_button_t)button, 0);
+    }
+
+    // Reset values of MODER and PUPDR of the debug pins
+    SIM_REG(GPIOA)->MODER = 0xA8000000U;
+    gpiob->MODER = 0x00000280U;
+    gpioc->MODER = 0;
+
+    for (uint32_t port = 0; port < PORTS_NUMBER; ++port)
+    {
+        update_idr(port);
+    }
+}
+
+void sim_peripherals_advance(uint64_t now)
+{
+    usart_advance(now);
+    i2c_advance(now);
+    timers_advance(now);
+    sim_now = now;
+}
+
+void sim_peripherals_before_read(uintptr_t address)
+{
+    if (address == (uintptr_t)&USART2->DR)
+    {
+        SIM_REG(USART2)->DR = usart.rdr;
+    }
+    else if (address == (uintptr_t)&I2C1->DR)
+    {
+        SIM_REG(I2C1)->DR = i2c.rx;
+    }
+    else if (address == (uintptr_t)&DWT->CYCCNT)
+    {
+        SIM_REG(DWT)->CYCCNT = (uint32_t)(SIM_NS_TO_CYCLES(sim_now) - cycle_counter_offset);
+    }
+}
+
+void sim_peripherals_after_read(uintptr_t address)
+{
+    if (address == (uintptr_t)&USART2->DR)
+    {
+        // Reading DR after SR clears the receive and idle flags
+        SIM_REG(USART2)->SR &= ~(USART_SR_RXNE | USART_SR_IDLE | USART_SR_ORE);
+    }
+    else if (address >= I2C1_BASE && address < I2C1_BASE + sizeof(I2C_TypeDef))
+    {
+        i2c_after_read(address - I2C1_BASE);
+    }
+    else
+    {
+        timers_after_read(address);
+    }
+}
+
+void sim_peripherals_after_write(uintptr_t address, uint32_t old_value)
+{
+    for (uint32_t port = 0; port < PORTS_NUMBER; ++port)
+    {
+        if (address >= gpio_bases[port] && address < gpio_bases[port] + sizeof(GPIO_TypeDef))
+        {
+            gpio_after_write(port, address - gpio_bases[port]);
+            return;
+        }
+    }
+
+    for (uint32_t timer = 0; timer < TIMERS_NUMBER; ++timer)
+    {
+        if (address >= timer_bases[timer] && address < timer_bases[timer] + sizeof(TIM_TypeDef))
+        {
+            timer_after_write(timer, address - timer_bases[timer], old_value);
+            return;
+        }
+    }
+
+    if (address >= EXTI_BASE && address < EXTI_BASE + sizeof(EXTI_TypeDef))
+    {
+        exti_after_write(address - EXTI_BASE, old_value);
+    }
+    else if (address >= USART2_BASE && address < USART2_BASE + sizeof(USART_TypeDef))
+    {
+        usart_after_write(address - USART2_BASE, old_value);
+    }
+    else if (address >= DMA1_BASE && address < DMA1_BASE + 0x400)
+    {
+        dma_after_write(0, address - DMA1_BASE, old_value);
+    }
+    else if (address >= DMA2_BASE && address < DMA2_BASE + 0x400)
+    {
+        dma_after_write(1, address - DMA2_BASE, old_value);
+    }
+    else if (address >= I2C1_BASE && address < I2C1_BASE + sizeof(I2C_TypeDef))
+    {
+        i2c_after_write(address - I2C1_BASE);
+    }
+    else if (address == (uintptr_t)&DWT->CYCCNT)
+    {
+        cycle_counter_offset = SIM_NS_TO_CYCLES(sim_now) - SIM_REG(DWT)->CYCCNT;
+    }
+}
+
+int sim_peripherals_irq_line(IRQn_Type irqn)
+{
+    switch (irqn)
+    {
+    case EXTI0_IRQn:
+    case EXTI1_IRQn:
+    case EXTI2_IRQn:
+    case EXTI3_IRQn:
+    case EXTI4_IRQn:
+        return exti_irq_line(1U << (irqn - EXTI0_IRQn));
+    case EXTI9_5_IRQn:
+        return exti_irq_line(0x03E0U);
+    case EXTI15_10_IRQn:
+        return exti_irq_line(0xFC00U);
+    case DMA1_Stream0_IRQn:
+    case DMA1_Stream1_IRQn:
+    case DMA1_Stream2_IRQn:
+    case DMA1_Stream3_IRQn:
+    case DMA1_Stream4_IRQn:
+    case DMA1_Stream5_IRQn:
+    case DMA1_Stream6_IRQn:
+        return dma_irq_line(0, irqn - DMA1_Stream0_IRQn);
+    case DMA1_Stream7_IRQn:
+        return dma_irq_line(0, 7);
+    case DMA2_Stream0_IRQn:
+    case DMA2_Stream1_IRQn:
+    case DMA2_Stream2_IRQn:
+    case DMA2_Stream3_IRQn:
+    case DMA2_Stream4_IRQn:
+        return dma_irq_line(1, irqn - DMA2_Stream0_IRQn);
+    case DMA2_Stream5_IRQn:
+    case DMA2_Stream6_IRQn:
+    case DMA2_Stream7_IRQn:
+        return dma_irq_line(1, 5 + irqn - DMA2_Stream5_IRQn);
+    case TIM1_UP_TIM10_IRQn:
+        return timer_irq_line(0, TIM_SR_UIF);
+    case TIM1_CC_IRQn:
+        return timer_irq_line(0, TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF);
+    case TIM2_IRQn:
+    case TIM3_IRQn:
+    case TIM4_IRQn:
+        return timer_irq_line(1 + irqn - TIM2_IRQn, 0x1FU);
+    case TIM5_IRQn:
+        return timer_irq_line(4, 0x1FU);
+    case I2C1_EV_IRQn:
+        return i2c_event_line();
+    case I2C1_ER_IRQn:
+        return i2c_error_line();
+    case USART2_IRQn:
+        return usart_irq_line();
+    default:
+        return 0;
+    }
+}
@@ -1,85 +1,364 @@
-#include <delay.h>
 #include <gpio.h>
+#include <irq.h>
 #include <stm32.h>
+#include "board.h"
 
-#define RED_LED_GPIO GPIOA
-#define GREEN_LED_GPIO GPIOA
-#define BLUE_LED_GPIO GPIOB
-#define GREEN2_LED_GPIO GPIOA
+#ifdef LED_PATTERN
+/* Pattern sequencer (make PATTERN=1):
+   a pattern is PATTERN_STEPS words of BSRR per port, one step every
+   STEP_MS. TIM1 paces the steps: its update requests DMA2 Stream5
+   (channel 6), which writes the next word to GPIOA->BSRR, and its
+   compare 1 at the same count requests DMA2 Stream1 (channel 6) for
+   GPIOB->BSRR. Both streams run in double buffer mode with the two
+   memory registers on the same pattern, so the pattern loops with no
+   CPU at all and the timing is that of the timer.
+   pattern_play() takes effect at a pattern boundary: the transfer
+   complete interrupt of each stream, once per pattern, points the
+   memory register that stream just left at the new pattern, which
+   then starts whole at the next boundary. Each stream is refilled from
+   its own interrupt: Stream1 is requested by compare 1, not by the
+   update, and has not always switched when Stream5 completes */
+#define STEP_MS 50U
+#define PATTERN_STEPS 20U
 
-#define RED_LED_PIN 6
-#define GREEN_LED_PIN 7
-#define BLUE_LED_PIN 0
-#define GREEN2_LED_PIN 5
+/* TIM1 counts milliseconds, on the APB2 clock */
+#define STEP_TIMER_HZ 1000U
+#define STEP_PSC_VALUE (PCLK2_HZ / STEP_TIMER_HZ - 1U)
 
-#define RedLEDon() \
-RED_LED_GPIO->BSRR = 1 << (RED_LED_PIN + 16)
-#define RedLEDoff() \
-RED_LED_GPIO->BSRR = 1 << RED_LED_PIN
+/* A word sets or resets every LED pin of its port, so a step does not
+   depend on the previous ones; red, green and blue are active low */
+#define PORTA_STEP(red, green, green2) \
+  ((1U << (RED_LED_PIN + ((red) ? 16 : 0))) | \
+   (1U << (GREEN_LED_PIN + ((green) ? 16 : 0))) | \
+   (1U << (GREEN2_LED_PIN + ((green2) ? 0 : 16))))
+#define PORTB_STEP(blue) \
+  (1U << (BLUE_LED_PIN + ((blue) ? 16 : 0)))
 
-#define GreenLEDon() \
-GREEN_LED_GPIO->BSRR = 1 << (GREEN_LED_PIN + 16)
-#define GreenLEDoff() \
-GREEN_LED_GPIO->BSRR = 1 << GREEN_LED_PIN
+#define A_ PORTA_STEP(0, 0, 0)
+#define AR PORTA_STEP(1, 0, 0)
+#define AG PORTA_STEP(0, 1, 0)
+#define Ag PORTA_STEP(0, 0, 1)
+#define B_ PORTB_STEP(0)
+#define BB PORTB_STEP(1)
 
-#define BlueLEDon() \
-BLUE_LED_GPIO->BSRR = 1 << (BLUE_LED_PIN + 16)
-#define BlueLEDoff() \
-BLUE_LED_GPIO->BSRR = 1 << BLUE_LED_PIN
+typedef struct {
+  uint32_t porta[PATTERN_STEPS];
+  uint32_t portb[PATTERN_STEPS];
+} pattern_t;
 
-#define Green2LEDon() \
-GREEN2_LED_GPIO->BSRR = 1 << GREEN2_LED_PIN
-#define Green2LEDoff() \
-GREEN2_LED_GPIO->BSRR = 1 << (GREEN2_LED_PIN + 16)
+/* Each LED in turn, as the Delay() loop used to do */
+static const pattern_t sequence = {
+  {AR, AR, AR, AR, AR, AG, AG, AG, AG, AG,
+   A_, A_, A_, A_, A_, Ag, Ag, Ag, Ag, Ag},
+  {B_, B_, B_, B_, B_, B_, B_, B_, B_, B_,
+   BB, BB, BB, BB, BB, B_, B_, B_, B_, B_}};
+
+static const pattern_t heartbeat = {
+  {Ag, A_, A_, Ag, A_, A_, A_, A_, A_, A_,
+   A_, A_, A_, A_, A_, A_, A_, A_, A_, A_},
+  {B_, B_, B_, B_, B_, B_, B_, B_, B_, B_,
+   B_, B_, B_, B_, B_, B_, B_, B_, B_, B_}};
+
+/* Status code 3: three red blinks */
+static const pattern_t status_code = {
+  {AR, A_, AR, A_, AR, A_, A_, A_, A_, A_,
+   A_, A_, A_, A_, A_, A_, A_, A_, A_, A_},
+  {B_, B_, B_, B_, B_, B_, B_, B_, B_, B_,
+   B_, B_, B_, B_, B_, B_, B_, B_, B_, B_}};
+
+static const pattern_t error_blink = {
+  {AR, AR, A_, A_, AR, AR, A_, A_, AR, AR,
+   A_, A_, AR, AR, A_, A_, AR, AR, A_, A_},
+  {B_, B_, BB, BB, B_, B_, BB, BB, B_, B_,
+   BB, BB, B_, B_, BB, BB, B_, B_, BB, BB}};
+
+static const pattern_t *const playlist[] = {
+  &sequence, &heartbeat, &status_code, &error_blink};
+
+#define PLAYLIST_LENGTH (sizeof(playlist) / sizeof(playlist[0]))
+
+/* Patterns played before the next one of the playlist */
+#define PLAYS 3U
+
+static const pattern_t *volatile pattern_next;
+static __IO uint32_t porta_swaps;
+static __IO uint32_t portb_swaps;
+static __IO uint32_t pattern_cycles;
+
+/* Play pattern from the next boundary but one, the current one ends */
+static void pattern_play(const pattern_t *pattern) {
+  pattern_next = pattern;
+  /* Published after the pattern, both memory registers of both streams
+     to move */
+  porta_swaps = 2;
+  portb_swaps = 2;
+}
+
+/* Point the memory register a stream is not reading at words */
+static void stream_swap(DMA_Stream_TypeDef *stream, const uint32_t *words) {
+  if (stream->CR & DMA_SxCR_CT)
+    stream->M0AR = (uint32_t)words;
+  else
+    stream->M1AR = (uint32_t)words;
+}
+
+/* Pattern boundary of port A: Stream5 switched its memory registers */
+void DMA2_Stream5_IRQHandler(void) {
+  DMA2->HIFCR = DMA_HIFCR_CTCIF5;
+  pattern_cycles++;
+
+  if (porta_swaps > 0) {
+    stream_swap(DMA2_Stream5, pattern_next->porta);
+    porta_swaps--;
+  }
+}
+
+/* Pattern boundary of port B: Stream1 switched its memory registers */
+void DMA2_Stream1_IRQHandler(void) {
+  DMA2->LIFCR = DMA_LIFCR_CTCIF1;
+
+  if (portb_swaps > 0) {
+    stream_swap(DMA2_Stream1, pattern_next->portb);
+    portb_swaps--;
+  }
+}
+
+/* Words to bsrr on channel 6 requests, in a loop over both buffers,
+   interrupt at every switch */
+static void stream_start(DMA_Stream_TypeDef *stream, volatile uint32_t *bsrr,
+                         const uint32_t *words) {
+  stream->PAR = (uint32_t)bsrr;
+  stream->M0AR = (uint32_t)words;
+  stream->M1AR = (uint32_t)words;
+  stream->NDTR = PATTERN_STEPS;
+  stream->CR = 6U << 25 |
+    DMA_SxCR_DBM | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 |
+    DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_TCIE;
+  stream->CR |= DMA_SxCR_EN;
+}
+
+static void leds_run(void) {
+  uint32_t next = 1;
+
+  RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+  RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;
+  __NOP();
+
+  /* All off before the pins become outputs */
+  GPIOA->BSRR = A_;
+  GPIOB->BSRR = B_;
+
+  GPIOoutConfigure(RED_LED_GPIO,
+                   RED_LED_PIN,
+                   GPIO_OType_PP,
+                   GPIO_Low_Speed,
+                   GPIO_PuPd_NOPULL);
+
+  GPIOoutConfigure(GREEN_LED_GPIO,
+                   GREEN_LED_PIN,
+                   GPIO_OType_PP,
+                   GPIO_Low_Speed,
+                   GPIO_PuPd_NOPULL);
+
+  GPIOoutConfigure(BLUE_LED_GPIO,
+                   BLUE_LED_PIN,
+                   GPIO_OType_PP,
+                   GPIO_Low_Speed,
+                   GPIO_PuPd_NOPULL);
+
+  GPIOoutConfigure(GREEN2_LED_GPIO,
+                   GREEN2_LED_PIN,
+                   GPIO_OType_PP,
+                   GPIO_Low_Speed,
+                   GPIO_PuPd_NOPULL);
+
+  stream_start(DMA2_Stream5, &GPIOA->BSRR, sequence.porta);
+  stream_start(DMA2_Stream1, &GPIOB->BSRR, sequence.portb);
+  NVIC_EnableIRQ(DMA2_Stream5_IRQn);
+  NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+
+  /* Milliseconds, a step per period; compare 1 at 0 coincides with the
+     update. The update event loads the prescaler before any request */
+  TIM1->PSC = STEP_PSC_VALUE;
+  TIM1->ARR = STEP_MS - 1U;
+  TIM1->CCR1 = 0;
+  TIM1->CR1 = TIM_CR1_URS;
+  TIM1->EGR = TIM_EGR_UG;
+  TIM1->SR = 0;
+  TIM1->DIER = TIM_DIER_UDE | TIM_DIER_CC1DE;
+  TIM1->CR1 |= TIM_CR1_CEN;
+
+  for (;;) {
+    uint32_t start = pattern_cycles;
+
+    while (pattern_cycles - start < PLAYS)
+      __WFI();
+
+    pattern_play(playlist[next]);
+    next = (next + 1) % PLAYLIST_LENGTH;
+  }
+}
+
+#else
+
+/* PWM LED engine:
+   the four LEDs are driven by timer channels, PA6/PA7/PB0 by TIM3
+   CH1/CH2/CH3 and PA5 by TIM2 CH1, at PWM_HZ with a duty cycle of
+   0..PWM_PERIOD. The red, green and blue LEDs are active low, their
+   channels have an inverted polarity so that a duty cycle is a
+   brightness for every LED. The compare registers are preloaded: a new
+   duty cycle takes effect at the next update, never mid-period.
+   The update interrupt of TIM3 (every PWM period, 1 ms) moves each LED
+   one step of its ramp and the sequence one tick; the core sleeps in
+   between */
+#define TIMER_HZ 1000000U
+#define PWM_HZ 1000U
+#define PWM_PERIOD (TIMER_HZ / PWM_HZ)
+#define PSC_VALUE (PCLK1_HZ / TIMER_HZ - 1U)
+
+/* Sequence: each LED in turn for PHASE_MS, cross-faded in FADE_MS */
+#define PHASE_MS 1000U
+#define FADE_MS 250U
+
+#define LEDS_NUMBER 4
+
+typedef struct {
+  volatile uint32_t *ccr;
+  uint32_t level;
+  uint32_t target;
+  uint32_t step;
+} led_t;
+
+static led_t leds[LEDS_NUMBER];
+
+static uint32_t phase = 0;
+static uint32_t phase_ms = 0;
+
+/* Ramp a LED from its current level to target in ms milliseconds */
+static void led_fade(led_t *led, uint32_t target, uint32_t ms) {
+  uint32_t distance = target > led->level ?
+    target - led->level : led->level - target;
+
+  led->target = target;
+  led->step = ms ? (distance + ms - 1) / ms : distance;
+}
+
+static void led_advance(led_t *led) {
+  if (led->level < led->target)
+    led->level = led->target - led->level > led->step ?
+      led->level + led->step : led->target;
+  else if (led->level > led->target)
+    led->level = led->level - led->target > led->step ?
+      led->level - led->step : led->target;
+
+  *led->ccr = led->level;
+}
+
+/* PWM update: one ramp step per LED, one tick of the sequence */
+void TIM3_IRQHandler(void) {
+  TIM3->SR = ~TIM_SR_UIF;
+
+  for (int i = 0; i < LEDS_NUMBER; ++i)
+    led_advance(&leds[i]);
+
+  if (++phase_ms == PHASE_MS) {
+    phase_ms = 0;
+    led_fade(&leds[phase], 0, FADE_MS);
+    phase = (phase + 1) % LEDS_NUMBER;
+    led_fade(&leds[phase], PWM_PERIOD, FADE_MS);
+  }
+}
+
+/* PWM mode 1 with preload on channel (0-based) of tim */
+static void pwm_channel(TIM_TypeDef *tim, uint32_t channel,
+                        uint32_t active_low) {
+  uint32_t mode = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1PE;
+
+  if (channel < 2)
+    tim->CCMR1 |= mode << (8 * channel);
+  else
+    tim->CCMR2 |= mode << (8 * (channel - 2));
+
+  tim->CCER |= (TIM_CCER_CC1E | (active_low ? TIM_CCER_CC1P : 0))
+    << (4 * channel);
+}
+
+static void pwm_timer(TIM_TypeDef *tim) {
+  tim->PSC = PSC_VALUE;
+  tim->ARR = PWM_PERIOD - 1;
+  tim->CR1 = TIM_CR1_ARPE | TIM_CR1_URS;
+  /* Load the prescaler and the compare registers, all LEDs off */
+  tim->EGR = TIM_EGR_UG;
+  tim->SR = 0;
+}
+
+static void leds_run(void) {
+  RCC->APB1ENR |= RCC_APB1ENR_TIM2EN |
+    RCC_APB1ENR_TIM3EN;
+  __NOP();
+
+  leds[0].ccr = &TIM3->CCR1;
+  leds[1].ccr = &TIM3->CCR2;
+  leds[2].ccr = &TIM3->CCR3;
+  leds[3].ccr = &TIM2->CCR1;
+
+  pwm_channel(TIM3, 0, 1);
+  pwm_channel(TIM3, 1, 1);
+  pwm_channel(TIM3, 2, 1);
+  pwm_channel(TIM2, 0, 0);
+
+  pwm_timer(TIM2);
+  pwm_timer(TIM3);
+
+  GPIOafConfigure(RED_LED_GPIO,
+                  RED_LED_PIN,
+                  GPIO_OType_PP,
+                  GPIO_Low_Speed,
+                  GPIO_PuPd_NOPULL,
+                  GPIO_AF_TIM3);
+
+  GPIOafConfigure(GREEN_LED_GPIO,
+                  GREEN_LED_PIN,
+                  GPIO_OType_PP,
+                  GPIO_Low_Speed,
+                  GPIO_PuPd_NOPULL,
+                  GPIO_AF_TIM3);
+
+  GPIOafConfigure(BLUE_LED_GPIO,
+                  BLUE_LED_PIN,
+                  GPIO_OType_PP,
+                  GPIO_Low_Speed,
+                  GPIO_PuPd_NOPULL,
+                  GPIO_AF_TIM3);
+
+  GPIOafConfigure(GREEN2_LED_GPIO,
+                  GREEN2_LED_PIN,
+                  GPIO_OType_PP,
+                  GPIO_Low_Speed,
+                  GPIO_PuPd_NOPULL,
+                  GPIO_AF_TIM2);
+
+  led_fade(&leds[phase], PWM_PERIOD, FADE_MS);
+
+  TIM3->DIER = TIM_DIER_UIE;
+  NVIC_EnableIRQ(TIM3_IRQn);
+
+  /* Started back to back, the periods of the two timers stay aligned */
+  TIM2->CR1 |= TIM_CR1_CEN;
+  TIM3->CR1 |= TIM_CR1_CEN;
+
+  for (;;)
+    __WFI();
+}
+
+#endif
 
 int main() {
   RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN |
     RCC_AHB1ENR_GPIOBEN;
   __NOP();
-  RedLEDoff();
-  GreenLEDoff();
-  BlueLEDoff();
-  Green2LEDoff();
-
-
- GPIOoutConfigure(RED_LED_GPIO,
-		  RED_LED_PIN,
-		  GPIO_OType_PP,
-		  GPIO_Low_Speed,
-		  GPIO_PuPd_NOPULL);
-
- GPIOoutConfigure(GREEN_LED_GPIO,
-		  GREEN_LED_PIN,
-		  GPIO_OType_PP,
-		  GPIO_Low_Speed,
-		  GPIO_PuPd_NOPULL);
-
- GPIOoutConfigure(BLUE_LED_GPIO,
-		  BLUE_LED_PIN,
-		  GPIO_OType_PP,
-		  GPIO_Low_Speed,
-		  GPIO_PuPd_NOPULL);
-
- GPIOoutConfigure(GREEN2_LED_GPIO,
-		  GREEN2_LED_PIN,
-		  GPIO_OType_PP,
-		  GPIO_Low_Speed,
-		  GPIO_PuPd_NOPULL);
-
- 
-
- for (;;) {
-   RedLEDon();
-   Delay(4000000);
-   RedLEDoff();
-   GreenLEDon();
-   Delay(4000000);
-   GreenLEDoff();
-   BlueLEDon();
-   Delay(4000000);
-   BlueLEDoff();
-   Green2LEDon();
-   Delay(4000000);
-   Green2LEDoff();
- }
+
+  leds_run();
+
+  return 0;
 }
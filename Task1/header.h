@@ -3,50 +3,64 @@
 #include <stm32.h>
 #include <stdlib.h>
 #include <string.h>
+#include "board.h"
+#include "button_table.h"
+#include "usart2.h"
 
-#define RED_LED_GPIO GPIOA
-#define GREEN_LED_GPIO GPIOA
-#define BLUE_LED_GPIO GPIOB
-#define GREEN2_LED_GPIO GPIOA
-#define RED_LED_PIN 6
-#define GREEN_LED_PIN 7
-#define BLUE_LED_PIN 0
-#define GREEN2_LED_PIN 5
-
-#define RedLEDon() \
-    RED_LED_GPIO->BSRR = 1 << (RED_LED_PIN + 16)
-#define RedLEDoff() \
-    RED_LED_GPIO->BSRR = 1 << RED_LED_PIN
-
-#define GreenLEDon() \
-    GREEN_LED_GPIO->BSRR = 1 << (GREEN_LED_PIN + 16)
-#define GreenLEDoff() \
-    GREEN_LED_GPIO->BSRR = 1 << GREEN_LED_PIN
-
-#define BlueLEDon() \
-    BLUE_LED_GPIO->BSRR = 1 << (BLUE_LED_PIN + 16)
-#define BlueLEDoff() \
-    BLUE_LED_GPIO->BSRR = 1 << BLUE_LED_PIN
-
-#define Green2LEDon() \
-    GREEN2_LED_GPIO->BSRR = 1 << GREEN2_LED_PIN
-#define Green2LEDoff() \
-    GREEN2_LED_GPIO->BSRR = 1 << (GREEN2_LED_PIN + 16)
-
-#define HSI_HZ 16000000U
-#define PCLK1_HZ HSI_HZ
-#define BAUD_RATE 9600U
-
-#define USART_WordLength_8b 0x0000
-#define USART_Parity_No 0x0000
-#define USART_Enable USART_CR1_UE
-#define USART_FlowControl_None 0x0000
-#define USART_StopBits_1 0x0000
-
-#define USART_Mode_Rx_Tx (USART_CR1_RE | \
-                          USART_CR1_TE)
-
-#define SEND_BUFFER_SIZE  512
-#define RECV_BUFFER_SIZE  128
-
-#define BUTTON_NUMS 7
\ No newline at end of file
+// Messages waiting for the link, a power of two; 64 entries of 8 bytes
+// take the RAM of the former 512 byte send buffer and hold more messages
+#define TX_QUEUE_SIZE 64U
+
+/* Messages of the buttons (README), TASK1_BUTTON(name, pressed): name is
+    a button of button_table.h, which gives its pin and level, and the
+    order is the one of the bits of the Task1 masks, USER first, so the
+    messages of buttons changing in one scan keep their order. MODE keeps
+    its "MODE PRESET" of the protocol
+*/
+#define TASK1_BUTTONS(TASK1_BUTTON)           \
+    TASK1_BUTTON(USER, "USER PRESSED\r\n")   \
+    TASK1_BUTTON(LEFT, "LEFT PRESSED\r\n")   \
+    TASK1_BUTTON(RIGHT, "RIGHT PRESSED\r\n") \
+    TASK1_BUTTON(UP, "UP PRESSED\r\n")       \
+    TASK1_BUTTON(DOWN, "DOWN PRESSED\r\n")   \
+    TASK1_BUTTON(FIRE, "FIRE PRESSED\r\n")   \
+    TASK1_BUTTON(MODE, "MODE PRESET\r\n")
+
+#define TASK1_BUTTON_INDEX(name, pressed) TASK1_BUTTON_##name,
+
+// Bit of a button in the Task1 masks, index of its messages
+enum
+{
+    TASK1_BUTTONS(TASK1_BUTTON_INDEX)
+    BUTTON_NUMS
+};
+
+// Every button of the board once: a missing one does not compile
+_Static_assert((int)BUTTON_NUMS == (int)BUTTONS_NUMBER, "Task1 buttons differ from the board");
+
+// Longest coalesced record, "RIGHT x4294967295 final=RELEASED\r\n"
+#define RECORD_LENGTH 40
+
+// Debounce mode (make DEBOUNCE=1): a button is sampled again
+// DEBOUNCE_TICKS slots of DEBOUNCE_SLOT_US after its first change,
+// TIM5 counts microseconds and updates once per slot. The byte 'S' on
+// the link asks for the counters of the wheel, one line:
+// {"debounce":"task1","windows":<n>,"events":<n>,"absorbed":<n>}
+#define DEBOUNCE_PSC_VALUE (PCLK1_HZ / 1000000U - 1U)
+#define DEBOUNCE_SLOT_US 1000U
+
+// Slots of the timer wheel, a power of two
+#define DEBOUNCE_SLOTS 16U
+#define DEBOUNCE_SLOTS_MASK (DEBOUNCE_SLOTS - 1U)
+
+#ifndef DEBOUNCE_TICKS
+#define DEBOUNCE_TICKS 8U
+#endif
+
+// A button is booked in a later slot, within one turn of the wheel
+#if DEBOUNCE_TICKS < 1 || DEBOUNCE_TICKS >= DEBOUNCE_SLOTS
+#error "DEBOUNCE_TICKS must be between 1 and DEBOUNCE_SLOTS - 1"
+#endif
+
+// Longest report of the counters, three 10 digit counts
+#define DEBOUNCE_REPORT_LENGTH 96
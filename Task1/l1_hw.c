@@ -1,247 +1,609 @@
 #include "header.h"
 
-// Messages have 2* button numbers size, 7 released 7 pressed
-static const char *MESSAGES[2 * BUTTON_NUMS] = {
-    "USER PRESSED\r\n",
-    "USER RELEASED\r\n",
-    "LEFT PRESSED\r\n",
-    "LEFT RELEASED\r\n",
-    "RIGHT PRESSED\r\n",
-    "RIGHT RELEASED\r\n",
-    "UP PRESSED\r\n",
-    "UP RELEASED\r\n",
-    "DOWN PRESSED\r\n",
-    "DOWN RELEASED\r\n",
-    "FIRE PRESSED\r\n",
-    "FIRE RELEASED\r\n",
-    "MODE PRESET\r\n",
-    "MODE RELEASED\r\n"};
-
-static const uint32_t MSG_LENGTHS[2 * BUTTON_NUMS] = {
-    14, 15, 14, 15, 15, 16, 12, 13, 14, 15, 14, 15, 13, 15};
-
-static __IO uint32_t
-    red_led_state;
-static __IO uint32_t
-    green_led_state;
-static __IO uint32_t
-    blue_led_state;
-static __IO uint32_t
-    green2_led_state;
-
-static uint32_t button_states[BUTTON_NUMS] = {0};
-static uint32_t button_to_reg_map[BUTTON_NUMS] = {13, 3, 4, 5, 6, 10, 0};
-
-static uint32_t send_buffer_pos = 0;
-static uint32_t send_buffer_used = 0;
-static uint32_t send_pos = 0;
-static char send_buffer[SEND_BUFFER_SIZE];
-
-static uint32_t get_reg_for_button(uint32_t button_num)
-{
-    if (button_num == 0)
-    {
-        return GPIOC->IDR;
-    }
-    else if (button_num < 6)
+typedef struct
+{
+    const char *text;
+    uint32_t length;
+} message_t;
+
+// Length known at compile time, without the terminating '\0'
+#define MESSAGE(text) {text, sizeof(text) - 1}
+
+// Messages have 2* button numbers size, 7 released 7 pressed:
+// index 2 * button + released, in the order of TASK1_BUTTONS
+#define BUTTON_MESSAGES(name, pressed) \
+    MESSAGE(pressed),                  \
+    MESSAGE(#name " RELEASED\r\n"),
+
+static const message_t MESSAGES[2 * BUTTON_NUMS] = {TASK1_BUTTONS(BUTTON_MESSAGES)};
+
+/* Button scanner:
+    bit i of a button mask is set while button i of TASK1_BUTTONS is
+    released; the IDR of every port is read once and each pin shifted to
+    the bit of its button, constant shifts generated from the board table,
+    then the buttons pressed at level 1 are inverted
+*/
+#define BUTTON_LEVEL(name, port, pin, active_high) \
+    | ((idr_##port >> (pin)) & 1U) << TASK1_BUTTON_##name
+
+#define BUTTON_ACTIVE_HIGH(name, port, pin, active_high) \
+    | ((active_high) ? 1U << TASK1_BUTTON_##name : 0U)
+
+// Released buttons of the last scan
+static uint32_t button_mask = 0;
+
+// Iterations of the main loop, read with a debugger for the loop rate
+static __IO uint32_t loop_count = 0;
+
+/* Transmit queue:
+    entries point at constant text (MESSAGES, or the record of a run in
+    coalescing mode) that is never copied; USART2_IRQHandler writes DR
+    from the entry at read_pos on TXE and masks TXEIE once the queue is
+    empty. The main loop only inserts. Positions run freely and are
+    masked on access
+*/
+static struct
+{
+    message_t entries[TX_QUEUE_SIZE];
+    uint32_t sent;
+    __IO uint32_t read_pos;
+    __IO uint32_t insert_pos;
+} tx_queue;
+
+static uint32_t get_message_index(uint32_t button_num)
+{
+    return 2 * button_num + ((button_mask >> button_num) & 1);
+}
+
+// reads every port once and returns the released buttons
+static uint32_t scan_buttons(void)
+{
+    uint32_t idr_A = GPIOA->IDR;
+    uint32_t idr_B = GPIOB->IDR;
+    uint32_t idr_C = GPIOC->IDR;
+
+    return (0U BOARD_BUTTONS(BUTTON_LEVEL)) ^ (0U BOARD_BUTTONS(BUTTON_ACTIVE_HIGH));
+}
+
+/* Command parser:
+    every received byte goes once through a state machine driven by
+    tables, a command is "L<led><0|1|T>"; an unexpected byte drops the
+    partial command, an 'L' starts a new one, so no byte is buffered.
+    In debounce mode 'S' asks for the report of the counters.
+    Commands only update the pending BSRR value of the port of their LED,
+    a batch ("LR1LGTLB0") is applied with one write per port at the end
+    of the line or when the line goes idle
+*/
+typedef enum
+{
+    PARSE_IDLE,
+    PARSE_LED,
+    PARSE_ACTION,
+    PARSE_STATES
+} parse_state_t;
+
+typedef enum
+{
+    CLASS_OTHER,
+    CLASS_START,
+    CLASS_LED,
+    CLASS_ACTION,
+    CLASS_END,
+    CLASS_REPORT,
+    CLASSES
+} char_class_t;
+
+typedef enum
+{
+    EFFECT_NONE,
+    EFFECT_SELECT,
+    EFFECT_DISPATCH,
+    EFFECT_APPLY,
+    EFFECT_REPORT
+} parse_effect_t;
+
+typedef struct
+{
+    uint8_t char_class;
+    uint8_t argument;
+} char_entry_t;
+
+typedef struct
+{
+    uint8_t next;
+    uint8_t effect;
+} transition_t;
+
+typedef struct
+{
+    uint32_t port;
+    uint32_t pin;
+    uint32_t active_low;
+} led_t;
+
+#define LED_PORTS_NUMBER 2
+
+static GPIO_TypeDef *const LED_PORTS[LED_PORTS_NUMBER] = {GPIOA, GPIOB};
+
+// R, G, B, g; the port is an index in LED_PORTS
+static const led_t LEDS[] = {
+    {0, RED_LED_PIN, 1},
+    {0, GREEN_LED_PIN, 1},
+    {1, BLUE_LED_PIN, 1},
+    {0, GREEN2_LED_PIN, 0}};
+
+// Argument of a LED byte: index in LEDS, of an action byte: index in LED_ACTIONS
+static const char_entry_t CHARS[256] = {
+    ['L'] = {CLASS_START, 0},
+    ['R'] = {CLASS_LED, 0},
+    ['G'] = {CLASS_LED, 1},
+    ['B'] = {CLASS_LED, 2},
+    ['g'] = {CLASS_LED, 3},
+    ['0'] = {CLASS_ACTION, 0},
+    ['1'] = {CLASS_ACTION, 1},
+    ['T'] = {CLASS_ACTION, 2},
+    ['\r'] = {CLASS_END, 0},
+    ['\n'] = {CLASS_END, 0},
+#ifdef BUTTON_DEBOUNCE
+    ['S'] = {CLASS_REPORT, 0},
+#endif
+};
+
+static const transition_t TRANSITIONS[PARSE_STATES][CLASSES] = {
+    [PARSE_IDLE] = {
+        [CLASS_OTHER] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_START] = {PARSE_LED, EFFECT_NONE},
+        [CLASS_LED] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_ACTION] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_END] = {PARSE_IDLE, EFFECT_APPLY},
+        [CLASS_REPORT] = {PARSE_IDLE, EFFECT_REPORT}},
+    [PARSE_LED] = {
+        [CLASS_OTHER] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_START] = {PARSE_LED, EFFECT_NONE},
+        [CLASS_LED] = {PARSE_ACTION, EFFECT_SELECT},
+        [CLASS_ACTION] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_END] = {PARSE_IDLE, EFFECT_APPLY},
+        [CLASS_REPORT] = {PARSE_IDLE, EFFECT_REPORT}},
+    [PARSE_ACTION] = {
+        [CLASS_OTHER] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_START] = {PARSE_LED, EFFECT_NONE},
+        [CLASS_LED] = {PARSE_IDLE, EFFECT_NONE},
+        [CLASS_ACTION] = {PARSE_IDLE, EFFECT_DISPATCH},
+        [CLASS_END] = {PARSE_IDLE, EFFECT_APPLY},
+        [CLASS_REPORT] = {PARSE_IDLE, EFFECT_REPORT}}};
+
+static uint32_t parse_state = PARSE_IDLE;
+static uint32_t parse_led = 0;
+
+// Report asked by the link, sent by the loop once the queue is empty
+static uint32_t report_requested = 0;
+
+// BSRR values not written yet, per port
+static uint32_t pending_bsrr[LED_PORTS_NUMBER] = {0};
+
+// Level of a LED pin once the pending writes are applied
+static uint32_t led_level(const led_t *led)
+{
+    uint32_t pending = pending_bsrr[led->port];
+
+    if (pending & (1U << led->pin))
     {
-        return GPIOB->IDR;
+        return 1;
     }
-    else
+    else if (pending & (1U << (led->pin + 16)))
     {
-        return GPIOA->IDR;
+        return 0;
     }
+
+    return (LED_PORTS[led->port]->ODR >> led->pin) & 1;
 }
 
-static uint32_t get_message_index(uint32_t button_num)
+static void set_led_level(const led_t *led, uint32_t high)
+{
+    uint32_t set = 1U << led->pin;
+    uint32_t reset = 1U << (led->pin + 16);
+
+    pending_bsrr[led->port] = (pending_bsrr[led->port] & ~(set | reset)) |
+                              (high ? set : reset);
+}
+
+static void led_off(const led_t *led)
+{
+    set_led_level(led, led->active_low);
+}
+
+static void led_on(const led_t *led)
 {
-    if (button_num < 6)
+    set_led_level(led, !led->active_low);
+}
+
+static void led_toggle(const led_t *led)
+{
+    set_led_level(led, !led_level(led));
+}
+
+static void (*const LED_ACTIONS[])(const led_t *) = {led_off, led_on, led_toggle};
+
+// Write the pending values, one BSRR write per port
+static void apply_led_commands(void)
+{
+    for (uint32_t port = 0; port < LED_PORTS_NUMBER; ++port)
     {
-        return 2 * button_num + button_states[button_num];
+        if (pending_bsrr[port] != 0)
+        {
+            LED_PORTS[port]->BSRR = pending_bsrr[port];
+            pending_bsrr[port] = 0;
+        }
     }
-    else
+}
+
+// Feed one received byte to the parser, in constant time
+static void parse_byte(uint8_t c)
+{
+    const char_entry_t *entry = &CHARS[c];
+    const transition_t *transition = &TRANSITIONS[parse_state][entry->char_class];
+
+    switch (transition->effect)
     {
-        return 2 * button_num + 1 - button_states[button_num];
+    case EFFECT_SELECT:
+        parse_led = entry->argument;
+        break;
+    case EFFECT_DISPATCH:
+        LED_ACTIONS[entry->argument](&LEDS[parse_led]);
+        break;
+    case EFFECT_APPLY:
+        apply_led_commands();
+        break;
+    case EFFECT_REPORT:
+        report_requested = 1;
+        break;
     }
+
+    parse_state = transition->next;
 }
 
-// receives button number and returns his state
-static uint32_t get_button_state_from_controller(uint32_t button_num)
+// Queue a reference to the text, dropped when the queue is full
+static void tx_enqueue(const char *text, uint32_t length)
 {
-    uint32_t reg_base = get_reg_for_button(button_num);
-    uint32_t reg_offset = button_to_reg_map[button_num];
-    return (reg_base >> reg_offset) & 1;
+    uint32_t insert_pos = tx_queue.insert_pos;
+
+    if (insert_pos - tx_queue.read_pos == TX_QUEUE_SIZE)
+    {
+        return;
+    }
+
+    tx_queue.entries[insert_pos % TX_QUEUE_SIZE].text = text;
+    tx_queue.entries[insert_pos % TX_QUEUE_SIZE].length = length;
+    tx_queue.insert_pos = insert_pos + 1;
+
+    // Published before the interrupt is unmasked
+    USART2->CR1 |= USART_CR1_TXEIE;
 }
 
-// parser for received buffer
-static uint32_t parse_query(char *recv_buffer, uint32_t buffer_used)
+// One byte per TXE, so the link runs at line rate whatever the main loop does
+void USART2_IRQHandler(void)
 {
-    if (buffer_used < 2 && recv_buffer[0] != 'L')
+    uint32_t read_pos = tx_queue.read_pos;
+    const message_t *entry = &tx_queue.entries[read_pos % TX_QUEUE_SIZE];
+
+    if (!(USART2->SR & USART_SR_TXE))
     {
-        return 1;
+        return;
     }
-    else if (buffer_used < 2)
+
+    if (read_pos == tx_queue.insert_pos)
     {
-        return 0;
+        USART2->CR1 &= ~USART_CR1_TXEIE;
+        return;
     }
-    else if (buffer_used < 3 && recv_buffer[1] != 'R' && recv_buffer[1] != 'G' && recv_buffer[1] != 'B' && recv_buffer[1] != 'g')
+
+    USART2->DR = entry->text[tx_queue.sent++];
+
+    if (tx_queue.sent == entry->length)
     {
-        return 1;
+        tx_queue.sent = 0;
+        tx_queue.read_pos = read_pos + 1;
+
+        if (read_pos + 1 == tx_queue.insert_pos)
+        {
+            USART2->CR1 &= ~USART_CR1_TXEIE;
+        }
     }
-    else if (buffer_used < 3)
+}
+
+#ifndef EVENT_COALESCE
+static void append_message(uint32_t button_num)
+{
+    const message_t *message = &MESSAGES[get_message_index(button_num)];
+
+    tx_enqueue(message->text, message->length);
+}
+#endif
+
+#ifdef EVENT_COALESCE
+/* Coalescing mode (make COALESCE=1):
+    while the transmit queue drains, transitions are only counted per
+    button; once it is empty every button that changed gets one record,
+    "LEFT x17 final=RELEASED" (17 transitions, the last one a release),
+    in the order of its first transition. A single transition keeps its
+    message
+*/
+static uint32_t run_counts[BUTTON_NUMS] = {0};
+static uint32_t run_messages[BUTTON_NUMS] = {0};
+static uint32_t run_order[BUTTON_NUMS] = {0};
+static uint32_t run_used = 0;
+
+// Rewritten only while the transmit queue is empty
+static char run_records[BUTTON_NUMS][RECORD_LENGTH];
+
+static void count_transition(uint32_t button_num)
+{
+    if (run_counts[button_num] == 0)
     {
-        return 0;
+        run_order[run_used] = button_num;
+        run_used++;
     }
-    else if (buffer_used < 4 && recv_buffer[2] != '0' && recv_buffer[2] != '1' && recv_buffer[2] != 'T')
+
+    run_counts[button_num]++;
+    run_messages[button_num] = get_message_index(button_num);
+}
+
+// "<NAME> x<count> final=<STATE>\r\n", from the message of the last transition
+static void append_record(uint32_t button_num)
+{
+    const char *message = MESSAGES[run_messages[button_num]].text;
+    const char *state = strchr(message, ' ') + 1;
+    uint32_t count = run_counts[button_num];
+    char *record = run_records[button_num];
+    char digits[10];
+    uint32_t digits_count = 0;
+    uint32_t used = state - message;
+
+    do
     {
-        return 1;
+        digits[digits_count++] = '0' + count % 10;
+        count /= 10;
+    } while (count != 0);
+
+    memcpy(record, message, used);
+    record[used++] = 'x';
+
+    while (digits_count > 0)
+    {
+        record[used++] = digits[--digits_count];
     }
-    else if (buffer_used < 4)
+
+    memcpy(record + used, " final=", 7);
+    used += 7;
+
+    // The state word keeps the "\r\n" of the message
+    memcpy(record + used, state, strlen(state));
+    used += strlen(state);
+
+    tx_enqueue(record, used);
+}
+
+// Queue every run once the transmit queue is empty, BUTTON_NUMS entries fit
+static void flush_runs()
+{
+    if (tx_queue.read_pos != tx_queue.insert_pos)
     {
-        char LED_char = recv_buffer[1];
-        char opt_char = recv_buffer[2];
+        return;
+    }
 
-        if (LED_char == 'R')
+    for (uint32_t i = 0; i < run_used; ++i)
+    {
+        uint32_t button_num = run_order[i];
+
+        if (run_counts[button_num] == 1)
         {
-            if (opt_char == '0')
-            {
-                RedLEDoff();
-            }
-            else if (opt_char == '1')
-            {
-                RedLEDon();
-            }
-            else
-            {
-                red_led_state = red_led_state ^ (1 << RED_LED_PIN | 1 << (RED_LED_PIN + 16));
-                RED_LED_GPIO->BSRR = red_led_state;
-            }
+            tx_enqueue(MESSAGES[run_messages[button_num]].text,
+                       MESSAGES[run_messages[button_num]].length);
         }
-        else if (LED_char == 'G')
+        else
         {
-            if (opt_char == '0')
-            {
-                GreenLEDoff();
-            }
-            else if (opt_char == '1')
-            {
-                GreenLEDon();
-            }
-            else
-            {
-                green_led_state = green_led_state ^ (1 << GREEN_LED_PIN | 1 << (GREEN_LED_PIN + 16));
-                GREEN_LED_GPIO->BSRR = green_led_state;
-            }
+            append_record(button_num);
         }
-        else if (LED_char == 'B')
+
+        run_counts[button_num] = 0;
+    }
+
+    run_used = 0;
+}
+#endif
+
+#ifdef BUTTON_DEBOUNCE
+/* Debounce mode (make DEBOUNCE=1):
+    the first change of a button books it in the wheel slot
+    DEBOUNCE_TICKS ahead and its next changes are only counted; the loop
+    advances the wheel on every update of TIM5, which runs only while a
+    button waits. When its slot comes a button is reported if its level
+    differs from the last one reported, so a bounce gives one message
+*/
+static struct
+{
+    uint8_t slots[DEBOUNCE_SLOTS];
+    uint32_t now;
+    uint32_t waiting;
+    uint32_t reported;
+} wheel;
+
+// Windows opened, messages let through and changes absorbed, sent on
+// the link when asked
+static struct
+{
+    __IO uint32_t windows;
+    __IO uint32_t events;
+    __IO uint32_t absorbed;
+} debounce_stats;
+
+// Take the changes of a scan: returns the buttons whose slot came and
+// whose level differs from their last report
+static uint32_t debounce(uint32_t changed)
+{
+    uint32_t opened = changed & ~wheel.waiting;
+    uint32_t due = 0;
+    uint32_t settled;
+
+    debounce_stats.absorbed += __builtin_popcount(changed & wheel.waiting);
+
+    if (opened != 0)
+    {
+        // An idle wheel restarts a full slot from now
+        if (wheel.waiting == 0)
         {
-            if (opt_char == '0')
-            {
-                BlueLEDoff();
-            }
-            else if (opt_char == '1')
-            {
-                BlueLEDon();
-            }
-            else
-            {
-                blue_led_state = blue_led_state ^ (1 << BLUE_LED_PIN | 1 << (BLUE_LED_PIN + 16));
-                BLUE_LED_GPIO->BSRR = blue_led_state;
-            }
+            TIM5->CNT = 0;
+            TIM5->SR = 0;
+            TIM5->CR1 |= TIM_CR1_CEN;
         }
-        else
+
+        wheel.slots[(wheel.now + DEBOUNCE_TICKS) & DEBOUNCE_SLOTS_MASK] |= opened;
+        wheel.waiting |= opened;
+        debounce_stats.windows += __builtin_popcount(opened);
+    }
+
+    if (wheel.waiting != 0 && (TIM5->SR & TIM_SR_UIF))
+    {
+        TIM5->SR = ~TIM_SR_UIF;
+
+        wheel.now = (wheel.now + 1) & DEBOUNCE_SLOTS_MASK;
+        due = wheel.slots[wheel.now];
+        wheel.slots[wheel.now] = 0;
+        wheel.waiting &= ~due;
+
+        if (wheel.waiting == 0)
         {
-            if (opt_char == '0')
-            {
-                Green2LEDoff();
-            }
-            else if (opt_char == '1')
-            {
-                Green2LEDon();
-            }
-            else
-            {
-                green2_led_state = green2_led_state ^ ( 1 << (GREEN2_LED_PIN + 16) | 1 << GREEN2_LED_PIN);
-                GREEN2_LED_GPIO->BSRR = green2_led_state;
-            }
+            TIM5->CR1 &= ~TIM_CR1_CEN;
         }
     }
 
-    return 2;
+    settled = due & (button_mask ^ wheel.reported);
+    wheel.reported ^= settled;
+
+    // The first change of a window without a message is absorbed too
+    debounce_stats.events += __builtin_popcount(settled);
+    debounce_stats.absorbed += __builtin_popcount(due & ~settled);
+
+    return settled;
 }
 
-//
-static void append_message(uint32_t button_num)
-{
-    uint32_t message_index = get_message_index(button_num);
-    uint32_t message_len = MSG_LENGTHS[message_index];
-    uint32_t i = 0;
+// Rewritten only while the transmit queue is empty
+static char debounce_line[DEBOUNCE_REPORT_LENGTH];
 
-    if (send_buffer_used + message_len > SEND_BUFFER_SIZE)
+static uint32_t append_string(uint32_t used, const char *string)
+{
+    while (*string != '\0')
     {
-        return;
+        debounce_line[used++] = *string++;
     }
 
-    while (MESSAGES[message_index][i] != '\0')
+    return used;
+}
+
+static uint32_t append_unsigned(uint32_t used, uint32_t value)
+{
+    char digits[10];
+    uint32_t count = 0;
+
+    do
     {
-        send_buffer[send_buffer_pos] = MESSAGES[message_index][i];
-        __NOP();
-        send_buffer_pos = (send_buffer_pos + 1) % SEND_BUFFER_SIZE;
-        send_buffer_used++;
-        i++;
-    }
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
 
-    /*for (uint32_t i = 0; i < message_len; ++i)
+    while (count > 0)
     {
-        send_buffer[send_buffer_pos] = MESSAGES[message_index][i];
-        __NOP();
-        send_buffer_pos = (send_buffer_pos + 1) % SEND_BUFFER_SIZE;
-        send_buffer_used++;
-    }*/
+        debounce_line[used++] = digits[--count];
+    }
+
+    return used;
 }
 
-// go through the 7 buttons and check their states according to controller
-static void check_buttons_states()
+// The counters as one line, once the messages before the request are out
+static void debounce_report(void)
 {
-    for (uint32_t i = 0; i < BUTTON_NUMS; ++i)
-    {
-        uint32_t state_on_controller = get_button_state_from_controller(i);
+    uint32_t used;
 
-        if (state_on_controller != button_states[i])
-        {
-            button_states[i] = state_on_controller;
-            append_message(i);
-        }
+    if (!report_requested || tx_queue.read_pos != tx_queue.insert_pos)
+    {
+        return;
     }
+
+    report_requested = 0;
+
+    used = append_string(0, "{\"debounce\":\"task1\",\"windows\":");
+    used = append_unsigned(used, debounce_stats.windows);
+    used = append_string(used, ",\"events\":");
+    used = append_unsigned(used, debounce_stats.events);
+    used = append_string(used, ",\"absorbed\":");
+    used = append_unsigned(used, debounce_stats.absorbed);
+    used = append_string(used, "}\r\n");
+
+    tx_enqueue(debounce_line, used);
 }
 
-int main(void)
+// Microsecond counter reloaded every slot, stopped until a first change
+static void debounce_configure(void)
 {
-    char recv_buffer[RECV_BUFFER_SIZE];
+    TIM5->PSC = DEBOUNCE_PSC_VALUE;
+    TIM5->ARR = DEBOUNCE_SLOT_US - 1U;
+    TIM5->CR1 = TIM_CR1_URS;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->SR = 0;
+
+    wheel.reported = button_mask;
+}
+#endif
+
+// scan the buttons and handle only the ones that changed, lowest first
+static void check_buttons_states()
+{
+    uint32_t levels = scan_buttons();
+    uint32_t changed = levels ^ button_mask;
+
+    button_mask = levels;
 
-    uint32_t recv_buffer_used = 0;
+#ifdef BUTTON_DEBOUNCE
+    changed = debounce(changed);
+    debounce_report();
+#endif
 
-    uint32_t parser_return_value;
+    while (changed != 0)
+    {
+        uint32_t i = __builtin_ctz(changed);
+
+        changed &= changed - 1;
+#ifdef EVENT_COALESCE
+        count_transition(i);
+#else
+        append_message(i);
+#endif
+    }
+
+#ifdef EVENT_COALESCE
+    flush_runs();
+#endif
+}
 
+int main(void)
+{
     RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN |
                     RCC_AHB1ENR_GPIOBEN |
                     RCC_AHB1ENR_GPIOCEN;
 
     RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
 
-    __NOP();
-
-    USART2->CR1 = USART_Mode_Rx_Tx |
-                  USART_WordLength_8b |
-                  USART_Parity_No;
+#ifdef BUTTON_DEBOUNCE
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+#endif
 
-    USART2->CR2 = USART_StopBits_1;
-    USART2->CR3 = USART_FlowControl_None;
+    __NOP();
 
-    USART2->BRR = (PCLK1_HZ + (BAUD_RATE / 2U)) /
-                  BAUD_RATE;
+    usart2_configure(0, 0);
+    usart2_enable();
 
-    USART2->CR1 |= USART_Enable;
+    // Transmission only, TXEIE is set while the queue holds entries
+    NVIC_EnableIRQ(USART2_IRQn);
 
     __NOP();
 
@@ -250,11 +612,6 @@ int main(void)
     BlueLEDoff();
     Green2LEDoff();
 
-    red_led_state = 1 << RED_LED_PIN;
-    green_led_state = 1 << GREEN_LED_PIN;
-    blue_led_state = 1 << BLUE_LED_PIN;
-    green2_led_state = 1 << (GREEN2_LED_PIN + 16);
-
     GPIOoutConfigure(RED_LED_GPIO,
                      RED_LED_PIN,
                      GPIO_OType_PP,
@@ -279,56 +636,38 @@ int main(void)
                      GPIO_Low_Speed,
                      GPIO_PuPd_NOPULL);
 
-    GPIOafConfigure(GPIOA,
-                    2,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_NOPULL,
-                    GPIO_AF_USART2);
-
-    GPIOafConfigure(GPIOA,
-                    3,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_NOPULL,
-                    GPIO_AF_USART2);
-
-    for (uint32_t i = 0; i < BUTTON_NUMS; ++i)
-    {
-        button_states[i] = get_button_state_from_controller(i);
-    }
+    button_mask = scan_buttons();
+
+#ifdef BUTTON_DEBOUNCE
+    debounce_configure();
+#endif
 
     __NOP();
 
     for (;;)
     {
-        // character received
-        if (USART2->SR & USART_SR_RXNE)
-        {
-            char c;
-            c = USART2->DR;
-
-            recv_buffer[recv_buffer_used] = c;
-            recv_buffer_used++;
-        }
+        loop_count++;
 
-        // parse received buffer
-        parser_return_value = parse_query(recv_buffer, recv_buffer_used);
+        uint32_t status = USART2->SR;
 
-        if (parser_return_value != 0)
+        // character received; reading SR then DR also clears IDLE
+        if (status & USART_SR_RXNE)
         {
-            recv_buffer_used = 0;
+            parse_byte(USART2->DR);
         }
 
-        check_buttons_states();
-
-        // send character
-        if (send_buffer_used > 0 && (USART2->SR & USART_SR_TXE))
+        // line idle after a batch without end of line, possibly read with
+        // its last byte: the byte is parsed first, then the batch applied
+        if (status & USART_SR_IDLE)
         {
-            USART2->DR = send_buffer[send_pos];
-            __NOP();
-            send_pos = (send_pos + 1) % SEND_BUFFER_SIZE;
-            send_buffer_used--;
+            if (!(status & USART_SR_RXNE))
+            {
+                (void)USART2->DR;
+            }
+
+            apply_led_commands();
         }
+
+        check_buttons_states();
     }
 }
\ No newline at end of file
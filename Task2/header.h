@@ -5,15 +5,110 @@
 #include <irq.h>
 #include <stm32.h>
 #include <string.h>
+#include "board.h"
+#include "board_buttons.h"
+#include "usart2.h"
 
-#define BAUD_RATE 9600U
-#define HSI_HZ 16000000U
-#define PCLK1_HZ HSI_HZ
+#define CONTROLLER_BUTTONS_NUMBER BUTTONS_NUMBER
 
-#define CONTROLLER_BUTTONS_NUMBER 7
+#define LEDS_NUMBER 4
 
-#define MAXSIZE 512
+// Event queue size in events, a power of two
+#define EVENT_QUEUE_SIZE 2048U
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1U)
 
-#define ENABLE_PERIPHERAL USART2->CR1 |= USART_CR1_UE
+// Button event: button index and released bit packed in one byte
+#define EVENT_ID(button, released) ((uint8_t)((button) << 1 | (released)))
+#define EVENT_BUTTON(event) ((event) >> 1)
+#define EVENT_RELEASED(event) ((event) & 1U)
+
+/* Button capture mode (make CAPTURE=1):
+    the buttons on timer channels are sampled by input capture on both
+    edges instead of EXTI, every event carries the time of its edge
+    - LEFT PB3 TIM2_CH2, FIRE PB10 TIM2_CH3, MODE PA0 TIM2_CH1
+    - RIGHT PB4 TIM3_CH1, UP PB5 TIM3_CH2
+    - DOWN PB6 TIM4_CH1
+    - USER PC13 has no timer channel and stays on EXTI
+    The timers count microseconds; TIM3 and TIM4 are 16-bit and are
+    extended to 32 bits by their update interrupt
+*/
+#define CAPTURE_TICK_HZ 1000000U
+#define CAPTURE_PSC_VALUE (PCLK1_HZ / CAPTURE_TICK_HZ - 1U)
+
+/* Coalescing mode (make COALESCE=1):
+    the transitions of a button not sent yet are merged into one record,
+    "LEFT x17 final=RELEASED" (17 transitions, the last one a release);
+    a single transition keeps its message. Records are rendered when the
+    link is free, in the order of the first transition of each button
+*/
+#define RECORD_LENGTH 40U
+
+/* Debounce mode (make DEBOUNCE=1):
+    the first edge of a button masks its EXTI line; the button is sampled
+    again DEBOUNCE_TICKS slots of DEBOUNCE_SLOT_US later, on a timer wheel
+    of DEBOUNCE_SLOTS slots advanced by the update interrupt of TIM5.
+    DEBOUNCE_TICKS can be redefined at build time (-DDEBOUNCE_TICKS=...).
+    The byte 'S' on the link asks for the counters of the wheel, one line
+    after the messages queued before it:
+    {"debounce":"task2","windows":<n>,"events":<n>,"absorbed":<n>}
+*/
+#define DEBOUNCE_TICK_HZ 1000000U
+#define DEBOUNCE_PSC_VALUE (PCLK1_HZ / DEBOUNCE_TICK_HZ - 1U)
+#define DEBOUNCE_SLOT_US 1000U
+
+// Slots of the timer wheel, a power of two
+#define DEBOUNCE_SLOTS 16U
+#define DEBOUNCE_SLOTS_MASK (DEBOUNCE_SLOTS - 1U)
+
+#ifndef DEBOUNCE_TICKS
+#define DEBOUNCE_TICKS 8U
+#endif
+
+// A button is booked in a later slot, within one turn of the wheel
+#if DEBOUNCE_TICKS < 1 || DEBOUNCE_TICKS >= DEBOUNCE_SLOTS
+#error "DEBOUNCE_TICKS must be between 1 and DEBOUNCE_SLOTS - 1"
+#endif
+
+// Longest report of the counters, three 10 digit counts
+#define DEBOUNCE_REPORT_LENGTH 96U
+
+// Longest transfer of rendered messages in bytes
+#define TX_BUFFER_SIZE 256U
+
+// Circular receive buffer of DMA1 Stream5 in bytes
+#define RX_BUFFER_SIZE 64U
+
+/* Interrupt priorities:
+    grouping 5 splits the 4 priority bits into 2 bits of preemption
+    priority and 2 of subpriority. A handler is preempted only by a
+    handler of a smaller preemption priority; handlers of the same one
+    never nest, the subpriority only orders them when both are pending.
+    - TX: DMA1 Stream6, the only reader of the event queue and the only
+      one starting transfers; above the buttons so that the UART is fed
+      during storms
+    - RX: DMA1 Stream5 and USART2 (IDLE), both parse the receive buffer,
+      at one level they never run concurrently
+    - BUTTON: EXTI lines, capture timers (TIM2, TIM3, TIM4) and the
+      debounce timer (TIM5), the only writers of the event queue; a push
+      is published by insert_pos, so no critical section is needed
+    Level 0 is left free. Each level can be redefined at build time
+    (-DTX_IRQ_PRIORITY=...)
+*/
+#define IRQ_PRIORITY_GROUPING 5U
+
+#ifndef TX_IRQ_PRIORITY
+#define TX_IRQ_PRIORITY 1U
+#endif
+
+#ifndef RX_IRQ_PRIORITY
+#define RX_IRQ_PRIORITY 2U
+#endif
+
+#ifndef BUTTON_IRQ_PRIORITY
+#define BUTTON_IRQ_PRIORITY 3U
+#endif
+
+#define IRQ_PRIORITY(preemption) \
+    NVIC_EncodePriority(IRQ_PRIORITY_GROUPING, (preemption), 0U)
 
 #endif
\ No newline at end of file
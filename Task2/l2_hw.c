@@ -1,5 +1,17 @@
 #include "header.h"
 
+#if defined(STORM_BENCH) && defined(BUTTON_CAPTURE)
+#error "the storm benchmark injects EXTI events, build it without CAPTURE"
+#endif
+
+#if defined(EVENT_COALESCE) && (defined(BUTTON_CAPTURE) || defined(STORM_BENCH))
+#error "coalesced records carry no time and no message per event"
+#endif
+
+#if defined(BUTTON_DEBOUNCE) && (defined(BUTTON_CAPTURE) || defined(STORM_BENCH))
+#error "debouncing masks the EXTI lines the capture and storm modes rely on"
+#endif
+
 typedef struct
 {
     GPIO_TypeDef *gpio;
@@ -7,75 +19,505 @@ typedef struct
     char *message_press;
     char *message_release;
     uint32_t neg;
+    uint32_t press_length;
+    uint32_t release_length;
+#ifdef BUTTON_CAPTURE
+    // Mark of the time ending the messages: '@' time of the edge
+    // captured by a timer, '~' time read by the EXTI handler
+    char stamp;
+#endif
 } button_t;
 
+/* Event queue:
+    one byte per button event, EVENT_ID(button, released); the text is
+    rendered into tx_buffer only when DMA1 Stream6 can take it.
+    Positions run freely and are masked on access.
+    The EXTI handlers only push, DMA1_Stream6_IRQHandler only renders,
+    at a higher priority (see header.h)
+*/
+static struct
+{
+    uint8_t events[EVENT_QUEUE_SIZE];
+#ifdef BUTTON_CAPTURE
+    uint32_t times[EVENT_QUEUE_SIZE];
+#endif
+    uint32_t read_pos;
+    __IO uint32_t insert_pos;
+} event_queue;
+
+// Messages of the transfer in progress
+static char tx_buffer[TX_BUFFER_SIZE];
+
+// Bytes handed to DMA1 Stream6 and events dropped on a full queue
+static struct
+{
+    __IO uint32_t bytes_started;
+    __IO uint32_t events_dropped;
+} tx_stats;
+
+#ifdef BUTTON_DEBOUNCE
+// Windows opened, events posted and edges absorbed; edges of a masked
+// line only latch its pending bit, so absorbed is a lower bound. A
+// report asked by the link goes with the next transfer that has room
+static struct
+{
+    __IO uint32_t windows;
+    __IO uint32_t events;
+    __IO uint32_t absorbed;
+    __IO uint32_t report_requested;
+} debounce_stats;
+#endif
+
+typedef struct
+{
+    char name;
+    GPIO_TypeDef *gpio;
+    uint32_t pin;
+    uint32_t active_low;
+} led_t;
+
+/* Receive state:
+    DMA1 Stream5 writes the circular buffer, the bytes between read_pos
+    and the DMA position are parsed in place;
+    a command is "L<led><0|1|T>", as in Task1
+*/
 static struct
 {
-    char *buffer[MAXSIZE];
-    int32_t read_pos;
-    int32_t insert_pos;
-    int32_t used;
-} messages;
+    char buffer[RX_BUFFER_SIZE];
+    uint32_t read_pos;
+    uint32_t state;
+    const led_t *led;
+} rx;
+
+static const led_t leds[LEDS_NUMBER] = {
+    {'R', RED_LED_GPIO, RED_LED_PIN, 1},
+    {'G', GREEN_LED_GPIO, GREEN_LED_PIN, 1},
+    {'B', BLUE_LED_GPIO, BLUE_LED_PIN, 1},
+    {'g', GREEN2_LED_GPIO, GREEN2_LED_PIN, 0}};
+
+// Messages and their lengths known at compile time, from the buttons of
+// the board (button_table.h)
+#define CONTROLLER_BUTTON(name, port, pin, active_high) \
+    {GPIO##port,                                        \
+     pin,                                               \
+     #name " PRESSED\r\n",                              \
+     #name " RELEASED\r\n",                             \
+     active_high,                                       \
+     sizeof(#name " PRESSED\r\n") - 1,                  \
+     sizeof(#name " RELEASED\r\n") - 1},
 
 static button_t controller_buttons[CONTROLLER_BUTTONS_NUMBER] = {
-    {GPIOB, 3, "LEFT PRESSED\r\n", "LEFT RELEASED\r\n", 0},
-    {GPIOB, 4, "RIGHT PRESSED\r\n", "RIGHT RELEASED\r\n", 0},
-    {GPIOB, 5, "UP PRESSED\r\n", "UP RELEASED\r\n", 0},
-    {GPIOB, 6, "DOWN PRESSED\r\n", "DOWN RELEASED\r\n", 0},
-    {GPIOB, 10, "FIRE PRESSED\r\n", "FIRE RELEASED\r\n", 0},
-    {GPIOC, 13, "USER PRESSED\r\n", "USER RELEASED\r\n", 0},
-    {GPIOA, 0, "MODE PRESSED\r\n", "MODE RELEASED\r\n", 1}};
+    BOARD_BUTTONS(CONTROLLER_BUTTON)};
+
+// Buttons left on EXTI, the others are moved to timer channels by
+// capture_configure
+#ifdef BUTTON_CAPTURE
+#define EXTI_BUTTONS_LINES BOARD_BUTTON_LINE(USER)
+#else
+#define EXTI_BUTTONS_LINES BOARD_BUTTONS_LINES
+#endif
 
 // --------------------- Queue ---------------------
 
-// Clear the Message Queue:
-// sets all the fields of the messages struct to 0
+// Clear the Event Queue:
+// sets all the positions of the event_queue struct to 0
 static void clear_queue(void)
 {
-    messages.read_pos = 0;
-    messages.insert_pos = 0;
-    messages.used = 0;
+    event_queue.read_pos = 0;
+    event_queue.insert_pos = 0;
 }
 
-// Check if the Message Queue is empty:
+// Check if the Event Queue is empty:
 // returns 1 if the queue is empty, 0 otherwise
 static int32_t is_queue_empty(void)
 {
-    return messages.used == 0;
+    return event_queue.insert_pos == event_queue.read_pos;
 }
 
-// Check if the Message Queue is full:
+// Check if the Event Queue is full:
 // returns 1 if the queue is full, 0 otherwise
 static int32_t is_queue_full(void)
 {
-    return messages.used == MAXSIZE;
+    return event_queue.insert_pos - event_queue.read_pos == EVENT_QUEUE_SIZE;
+}
+
+// Push an event to the Event Queue:
+// the event is stored before insert_pos publishes it to the renderer
+static void queue_push(uint8_t event)
+{
+    event_queue.events[event_queue.insert_pos & EVENT_QUEUE_MASK] = event;
+    __DMB();
+    event_queue.insert_pos++;
+}
+
+#ifdef BUTTON_CAPTURE
+// Longest end of a stamped message: " @4294967295\r\n"
+#define STAMP_LENGTH 14U
+
+// Write the end of a stamped message, " <mark><time in us>\r\n":
+// returns the number of bytes written
+static uint32_t format_stamp(char *out, char mark, uint32_t time)
+{
+    char digits[10];
+    uint32_t count = 0;
+    uint32_t used = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + time % 10);
+        time /= 10;
+    } while (time != 0);
+
+    out[used++] = ' ';
+    out[used++] = mark;
+
+    while (count > 0)
+    {
+        out[used++] = digits[--count];
+    }
+
+    out[used++] = '\r';
+    out[used++] = '\n';
+
+    return used;
 }
+#endif
 
-static char *queue_poll(void)
+#if defined(STORM_BENCH) || defined(BUTTON_DEBOUNCE)
+// Line builder for the reports, no printf on the board
+static uint32_t append_string(uint32_t used, const char *string)
 {
-    char *ptr = messages.buffer[messages.read_pos];
-    messages.read_pos = (messages.read_pos + 1) % MAXSIZE;
-    messages.used--;
-    return ptr;
+    while (*string != '\0' && used < TX_BUFFER_SIZE - 2)
+    {
+        tx_buffer[used++] = *string++;
+    }
+
+    return used;
 }
 
-// Push a message to the Message Queue:
-static void queue_push(char *ptr)
+static uint32_t append_unsigned(uint32_t used, uint32_t value)
 {
-    messages.buffer[messages.insert_pos] = ptr;
-    messages.insert_pos = (messages.insert_pos + 1) % MAXSIZE;
-    messages.used++;
+    char digits[10];
+    int32_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0 && used < TX_BUFFER_SIZE - 2)
+    {
+        tx_buffer[used++] = digits[--count];
+    }
+
+    return used;
+}
+#endif
+
+#ifdef BUTTON_DEBOUNCE
+// Append the report of the debounce counters after used bytes, if asked
+// and if it fits: returns the number of bytes written in all
+static uint32_t render_debounce_report(uint32_t used)
+{
+    if (!debounce_stats.report_requested || used + DEBOUNCE_REPORT_LENGTH > TX_BUFFER_SIZE)
+    {
+        return used;
+    }
+
+    debounce_stats.report_requested = 0;
+
+    used = append_string(used, "{\"debounce\":\"task2\",\"windows\":");
+    used = append_unsigned(used, debounce_stats.windows);
+    used = append_string(used, ",\"events\":");
+    used = append_unsigned(used, debounce_stats.events);
+    used = append_string(used, ",\"absorbed\":");
+    used = append_unsigned(used, debounce_stats.absorbed);
+    used = append_string(used, "}");
+
+    tx_buffer[used++] = '\r';
+    tx_buffer[used++] = '\n';
+
+    return used;
+}
+#endif
+
+#ifndef EVENT_COALESCE
+// Render queued events into tx_buffer, as many as fit:
+// returns the number of bytes written
+static uint32_t render_events(void)
+{
+    uint32_t used = 0;
+
+    while (!is_queue_empty())
+    {
+        uint32_t position = event_queue.read_pos & EVENT_QUEUE_MASK;
+        uint8_t event = event_queue.events[position];
+        button_t *button = &controller_buttons[EVENT_BUTTON(event)];
+        char *message = EVENT_RELEASED(event) ? button->message_release
+                                              : button->message_press;
+        uint32_t length = EVENT_RELEASED(event) ? button->release_length
+                                                : button->press_length;
+
+#ifdef BUTTON_CAPTURE
+        char stamp[STAMP_LENGTH];
+        uint32_t stamp_length = format_stamp(stamp, button->stamp,
+                                             event_queue.times[position]);
+
+        // The stamp replaces the "\r\n" of the message
+        length -= 2;
+
+        if (used + length + stamp_length > TX_BUFFER_SIZE)
+        {
+            break;
+        }
+
+        memcpy(tx_buffer + used, message, length);
+        memcpy(tx_buffer + used + length, stamp, stamp_length);
+        used += length + stamp_length;
+#else
+        if (used + length > TX_BUFFER_SIZE)
+        {
+            break;
+        }
+
+        memcpy(tx_buffer + used, message, length);
+        used += length;
+#endif
+        event_queue.read_pos++;
+    }
+
+    return used;
+}
+#endif
+
+#ifdef EVENT_COALESCE
+// --------------------- Coalescing ---------------------
+
+/* Runs of transitions:
+    the queue is folded into one run per button, count and last state,
+    kept in the order of the first transition until rendered. Only
+    DMA1_Stream6_IRQHandler touches them, a burst never fills the queue
+    since the handler also folds while a transfer runs
+*/
+static struct
+{
+    uint32_t count[CONTROLLER_BUTTONS_NUMBER];
+    uint8_t released[CONTROLLER_BUTTONS_NUMBER];
+    uint8_t order[CONTROLLER_BUTTONS_NUMBER];
+    uint32_t used;
+} runs;
+
+// Queued events from which the button handlers have the queue folded
+// without waiting for the transfer to complete
+#define FOLD_THRESHOLD (EVENT_QUEUE_SIZE / 2U)
+
+// Move every queued event into the run of its button
+static void fold_events(void)
+{
+    while (!is_queue_empty())
+    {
+        uint8_t event = event_queue.events[event_queue.read_pos & EVENT_QUEUE_MASK];
+        uint32_t button = EVENT_BUTTON(event);
+
+        if (runs.count[button] == 0)
+        {
+            runs.order[runs.used++] = (uint8_t)button;
+        }
+
+        runs.count[button]++;
+        runs.released[button] = EVENT_RELEASED(event);
+        event_queue.read_pos++;
+    }
+}
+
+// Write "<NAME> x<count> final=<STATE>\r\n" from the messages of the button:
+// returns the number of bytes written, at most RECORD_LENGTH
+static uint32_t format_record(char *out, button_t *button, uint32_t count,
+                              uint32_t released)
+{
+    const char *message = released ? button->message_release : button->message_press;
+    uint32_t length = released ? button->release_length : button->press_length;
+    const char *state = strchr(message, ' ') + 1;
+    char digits[10];
+    uint32_t digits_count = 0;
+    uint32_t used = 0;
+
+    do
+    {
+        digits[digits_count++] = (char)('0' + count % 10);
+        count /= 10;
+    } while (count != 0);
+
+    memcpy(out, message, state - message);
+    used = state - message;
+    out[used++] = 'x';
+
+    while (digits_count > 0)
+    {
+        out[used++] = digits[--digits_count];
+    }
+
+    memcpy(out + used, " final=", 7);
+    used += 7;
+
+    // The state word keeps the "\r\n" of the message
+    memcpy(out + used, state, length - (state - message));
+    used += length - (state - message);
+
+    return used;
+}
+
+// Render the runs into tx_buffer, as many as fit, a run of one
+// transition as its message: returns the number of bytes written
+static uint32_t render_runs(void)
+{
+    uint32_t used = 0;
+    uint32_t done;
+
+    fold_events();
+
+    for (done = 0; done < runs.used; ++done)
+    {
+        uint32_t index = runs.order[done];
+        button_t *button = &controller_buttons[index];
+        char record[RECORD_LENGTH];
+        char *text = record;
+        uint32_t length;
+
+        if (runs.count[index] == 1)
+        {
+            text = runs.released[index] ? button->message_release : button->message_press;
+            length = runs.released[index] ? button->release_length : button->press_length;
+        }
+        else
+        {
+            length = format_record(record, button, runs.count[index], runs.released[index]);
+        }
+
+        if (used + length > TX_BUFFER_SIZE)
+        {
+            break;
+        }
+
+        memcpy(tx_buffer + used, text, length);
+        used += length;
+        runs.count[index] = 0;
+    }
+
+    // Runs left for the next transfer stay in order
+    memmove(runs.order, runs.order + done, runs.used - done);
+    runs.used -= done;
+
+    return used;
+}
+#endif
+
+// --------------------- Commands ---------------------
+
+static const led_t *find_led(char name)
+{
+    for (int i = 0; i < LEDS_NUMBER; ++i)
+    {
+        if (leds[i].name == name)
+        {
+            return leds + i;
+        }
+    }
+
+    return NULL;
+}
+
+// Switch a LED on or off, active-low LEDs are on at level 0
+static void led_set(const led_t *led, uint32_t on)
+{
+    uint32_t high = on ^ led->active_low;
+
+    led->gpio->BSRR = 1U << (led->pin + (high ? 0 : 16));
+}
+
+static void led_toggle(const led_t *led)
+{
+    uint32_t high = (led->gpio->ODR >> led->pin) & 1;
+
+    led->gpio->BSRR = 1U << (led->pin + (high ? 16 : 0));
+}
+
+// Feed one received byte to the command parser:
+// an unexpected byte drops the partial command, an 'L' starts a new one;
+// in debounce mode 'S' asks for the report of the counters
+static void parse_byte(char c)
+{
+#ifdef BUTTON_DEBOUNCE
+    if (c == 'S')
+    {
+        debounce_stats.report_requested = 1;
+        rx.state = 0;
+
+        // Started by the transmit handler, which preempts this one
+        if (usart2_dma_tx_idle())
+        {
+            NVIC_SetPendingIRQ(DMA1_Stream6_IRQn);
+        }
+        return;
+    }
+#endif
+
+    switch (rx.state)
+    {
+    case 1:
+        rx.led = find_led(c);
+
+        if (rx.led != NULL)
+        {
+            rx.state = 2;
+            return;
+        }
+        break;
+
+    case 2:
+        if (c == '0' || c == '1')
+        {
+            led_set(rx.led, c == '1');
+            rx.state = 0;
+            return;
+        }
+        if (c == 'T')
+        {
+            led_toggle(rx.led);
+            rx.state = 0;
+            return;
+        }
+        break;
+    }
+
+    rx.state = c == 'L' ? 1 : 0;
+}
+
+// Parse every byte written by DMA1 Stream5 since the last call;
+// NDTR counts down from RX_BUFFER_SIZE and reloads at the end of the buffer
+static void receive_process(void)
+{
+    uint32_t write_pos = (RX_BUFFER_SIZE - DMA1_Stream5->NDTR) % RX_BUFFER_SIZE;
+
+    while (rx.read_pos != write_pos)
+    {
+        parse_byte(rx.buffer[rx.read_pos]);
+        rx.read_pos = (rx.read_pos + 1) % RX_BUFFER_SIZE;
+    }
 }
 
 // -------------------- Configures --------------------
 
-static void configure_button(button_t *button)
+static void configure_led(const led_t *led)
 {
-    GPIOinConfigure(button->gpio,
-                    button->reg,
-                    GPIO_PuPd_UP,
-                    EXTI_Mode_Interrupt,
-                    EXTI_Trigger_Rising_Falling);
+    led_set(led, 0);
+
+    GPIOoutConfigure(led->gpio,
+                     led->pin,
+                     GPIO_OType_PP,
+                     GPIO_Low_Speed,
+                     GPIO_PuPd_NOPULL);
 }
 
 // Configure RCC:
@@ -91,86 +533,85 @@ static void RCC_configure(void)
     // Enable USART2 clock
     RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
 
-    // Enable SYSCFG clock
-    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
-}
-
-// Configure UART2:
-// Code from Slides 10 to 11 (w8)
-static void UART_configure(void)
-{
-    GPIOafConfigure(GPIOA,
-                    2,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_NOPULL,
-                    GPIO_AF_USART2);
-
-    GPIOafConfigure(GPIOA,
-                    3,
-                    GPIO_OType_PP,
-                    GPIO_Fast_Speed,
-                    GPIO_PuPd_UP,
-                    GPIO_AF_USART2);
+#ifdef BUTTON_CAPTURE
+    // Enable the clocks of the capture timers
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN |
+                    RCC_APB1ENR_TIM3EN |
+                    RCC_APB1ENR_TIM4EN;
+#endif
 
-    USART2->CR1 = USART_CR1_RE | USART_CR1_TE;
-    USART2->CR2 = 0;
-    USART2->BRR = (PCLK1_HZ + (BAUD_RATE / 2U)) / BAUD_RATE;
+#ifdef BUTTON_DEBOUNCE
+    // Enable the clock of the debounce timer
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+#endif
 
-    // Sending and Receceiving using DMA
-    USART2->CR3 = USART_CR3_DMAT | USART_CR3_DMAR;
+    // Enable SYSCFG clock
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
 }
 
 // Configure DMA1:
 // Code from Slides 12 to 14 (w8)
 static void DMA_configure(void)
 {
-    /* USART2 TX:
-        uses stream 6 and channel 4, direct transfer mode, 8-bits transfers,
-        high priority, increasing the memory
-        address after every transfer, interrupt after transfer
-        completion
-    */
-    DMA1_Stream6->CR = 4U << 25 |
-                       DMA_SxCR_PL_1 |
-                       DMA_SxCR_MINC |
-                       DMA_SxCR_DIR_0 |
-                       DMA_SxCR_TCIE;
-
-    // Set the peripheral address
-    DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+    usart2_dma_tx_configure();
 
     /* USART2 RX:
         uses stream 5 and channel 4, direct transfer mode, 8-bits transfers,
-        high priority, increasing the memory
-        address after every transfer, interrupt after transfer
-        completion
+        high priority, increasing the memory address after every
+        transfer, circular mode over rx.buffer, interrupts at half and
+        full buffer
     */
     DMA1_Stream5->CR = 4U << 25 |
                        DMA_SxCR_PL_1 |
                        DMA_SxCR_MINC |
+                       DMA_SxCR_CIRC |
+                       DMA_SxCR_HTIE |
                        DMA_SxCR_TCIE;
 
-    // Set the peripheral address
+    // Set the peripheral and buffer addresses
     DMA1_Stream5->PAR = (uint32_t)&USART2->DR;
+    DMA1_Stream5->M0AR = (uint32_t)rx.buffer;
+    DMA1_Stream5->NDTR = RX_BUFFER_SIZE;
+
+    DMA1->HIFCR = DMA_HIFCR_CTCIF5 |
+                  DMA_HIFCR_CHTIF5;
 
-    DMA1->HIFCR = DMA_HIFCR_CTCIF6 |
-                  DMA_HIFCR_CTCIF5;
+    // Reception runs for ever
+    DMA1_Stream5->CR |= DMA_SxCR_EN;
 }
 
 // Configure NVIC:
+// priorities as planned in header.h
 static void NVIC_configure(void)
 {
+    NVIC_SetPriorityGrouping(IRQ_PRIORITY_GROUPING);
+
+    NVIC_SetPriority(DMA1_Stream6_IRQn, IRQ_PRIORITY(TX_IRQ_PRIORITY));
+    NVIC_SetPriority(DMA1_Stream5_IRQn, IRQ_PRIORITY(RX_IRQ_PRIORITY));
+    NVIC_SetPriority(USART2_IRQn, IRQ_PRIORITY(RX_IRQ_PRIORITY));
+#ifdef BUTTON_CAPTURE
+    NVIC_SetPriority(TIM2_IRQn, IRQ_PRIORITY(BUTTON_IRQ_PRIORITY));
+    NVIC_SetPriority(TIM3_IRQn, IRQ_PRIORITY(BUTTON_IRQ_PRIORITY));
+    NVIC_SetPriority(TIM4_IRQn, IRQ_PRIORITY(BUTTON_IRQ_PRIORITY));
+#endif
+#ifdef BUTTON_DEBOUNCE
+    NVIC_SetPriority(TIM5_IRQn, IRQ_PRIORITY(BUTTON_IRQ_PRIORITY));
+    NVIC_EnableIRQ(TIM5_IRQn);
+#endif
+
     // Code from Slides 14 (w8)
     NVIC_EnableIRQ(DMA1_Stream6_IRQn);
     NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+    NVIC_EnableIRQ(USART2_IRQn);
+
+#ifdef BUTTON_CAPTURE
+    NVIC_EnableIRQ(TIM2_IRQn);
+    NVIC_EnableIRQ(TIM3_IRQn);
+    NVIC_EnableIRQ(TIM4_IRQn);
+#endif
 
-    // Code from Slides 28 (w5)
-    NVIC_EnableIRQ(EXTI0_IRQn);
-    NVIC_EnableIRQ(EXTI3_IRQn);
-    NVIC_EnableIRQ(EXTI4_IRQn);
-    NVIC_EnableIRQ(EXTI9_5_IRQn);
-    NVIC_EnableIRQ(EXTI15_10_IRQn);
+    // The vectors of the lines of the buttons left on EXTI
+    board_buttons_nvic_configure(EXTI_BUTTONS_LINES, IRQ_PRIORITY(BUTTON_IRQ_PRIORITY));
 }
 
 // --------------------- Handlers ---------------------
@@ -180,130 +621,706 @@ static uint32_t is_pressed(button_t *button)
     return ((button->gpio->IDR >> button->reg) & 1) ^ button->neg;
 }
 
-// Starting sending
-// Code from Slide 15 (w8)
-static void send_to_DMA1(char *message)
+// Send the queued events, as many as fit in one transfer
+static void send_pending(void)
 {
-    DMA1_Stream6->M0AR = (uint32_t)message;
-    DMA1_Stream6->NDTR = strlen(message);
-    DMA1_Stream6->CR |= DMA_SxCR_EN;
+#ifdef EVENT_COALESCE
+    uint32_t length = render_runs();
+#else
+    uint32_t length = render_events();
+#endif
+
+#ifdef BUTTON_DEBOUNCE
+    length = render_debounce_report(length);
+#endif
+
+    if (length != 0)
+    {
+        tx_stats.bytes_started += length;
+        usart2_dma_tx_start(tx_buffer, length);
+    }
 }
 
-static void receive_from_DMA1(char *message)
+// Queue an event, dropped if the queue is full; time is only kept in
+// capture mode
+static void post_event(uint8_t event, uint32_t time)
 {
-    DMA1_Stream5->M0AR = (uint32_t)message;
-    DMA1_Stream5->NDTR = strlen(message);
-    DMA1_Stream5->CR |= DMA_SxCR_EN;
+    if (!is_queue_full())
+    {
+#ifdef BUTTON_CAPTURE
+        event_queue.times[event_queue.insert_pos & EVENT_QUEUE_MASK] = time;
+#else
+        (void)time;
+#endif
+        queue_push(event);
+    }
+    else
+    {
+        tx_stats.events_dropped++;
+    }
+
+    // If the DMA is idle, the transfer is started by its handler,
+    // which preempts this one; otherwise the event goes with the
+    // batch rendered at completion
+    if (usart2_dma_tx_idle())
+    {
+        NVIC_SetPendingIRQ(DMA1_Stream6_IRQn);
+    }
+#ifdef EVENT_COALESCE
+    // During a transfer, the handler folds a long queue into the runs
+    else if (event_queue.insert_pos - event_queue.read_pos >= FOLD_THRESHOLD)
+    {
+        NVIC_SetPendingIRQ(DMA1_Stream6_IRQn);
+    }
+#endif
 }
 
-// Interrupt handler:
-// Solution to problem on Slide 18 (w8)
-static void interrupt_handler(uint32_t EXTI_PR_STATE,
-                              uint32_t LINE_INTERRUPT_STATE,
-                              button_t *button)
+// Time of an EXTI event: read by the handler on the capture time base
+#ifdef BUTTON_CAPTURE
+#define EXTI_EVENT_TIME() (TIM2->CNT)
+#else
+#define EXTI_EVENT_TIME() 0U
+#endif
+
+#ifdef BUTTON_DEBOUNCE
+// --------------------- Debounce ---------------------
+
+/* Debounce mode (make DEBOUNCE=1):
+    the first edge of a button masks its EXTI line and books the button
+    in the wheel slot DEBOUNCE_TICKS ahead; TIM5 runs only while a button
+    waits. When the slot comes the pin is sampled once and an event is
+    posted only if the level differs from the last one posted, then the
+    line is unmasked. One event per stable transition, however long the
+    bounce, as long as it settles within the window
+*/
+static struct
+{
+    uint8_t slots[DEBOUNCE_SLOTS];
+    uint32_t now;
+    uint32_t waiting;
+    uint8_t posted[CONTROLLER_BUTTONS_NUMBER];
+} wheel;
+
+// First edge of a button: mask its line until its slot comes
+static void debounce_open(button_t *button)
 {
-    if (EXTI_PR_STATE & LINE_INTERRUPT_STATE)
+    uint32_t index = button - controller_buttons;
+    uint32_t line = 1U << button->reg;
+
+    EXTI->IMR &= ~line;
+    EXTI->PR = line;
+
+    wheel.slots[(wheel.now + DEBOUNCE_TICKS) & DEBOUNCE_SLOTS_MASK] |= 1U << index;
+    debounce_stats.windows++;
+
+    // An idle wheel restarts a full slot from now
+    if (wheel.waiting == 0)
     {
-        // Write message according to button pressed/released state
-        char *message = is_pressed(button)
-                            ? button->message_release
-                            : button->message_press;
+        TIM5->CNT = 0;
+        TIM5->SR = 0;
+        TIM5->CR1 |= TIM_CR1_CEN;
+    }
 
-        // If the bits EN and TCIFx are cleared, the transfer can be initiated
-        if ((DMA1_Stream6->CR & DMA_SxCR_EN) == 0 &&
-            (DMA1->HISR & DMA_HISR_TCIF6) == 0)
-        {
+    wheel.waiting |= 1U << index;
+}
 
-            send_to_DMA1(message);
-        }
-        // If queue not full, push message to queue
-        // "If this condition is not met, the transfer must be queued"
-        // the condition being: DMA1_Stream6->CR & DMA_SxCR_EN == 0 && DMA1->HISR & DMA_HISR_TCIF6 == 0
-        else if (!is_queue_full())
-        {
-            queue_push(message);
-        }
+// Sample a settled button and unmask its line
+static void debounce_close(uint32_t index)
+{
+    button_t *button = &controller_buttons[index];
+    uint32_t line = 1U << button->reg;
+    uint32_t latched = EXTI->PR & line;
+    uint32_t level;
+
+    // Cleared before the sample, a later edge opens a new window on unmask
+    EXTI->PR = line;
+    level = is_pressed(button);
+
+    // Edges of a window: odd if the level changed, at least two otherwise
+    if (level != wheel.posted[index])
+    {
+        wheel.posted[index] = level;
+        debounce_stats.events++;
+        debounce_stats.absorbed += latched ? 2 : 0;
+        post_event(EVENT_ID(index, level), EXTI_EVENT_TIME());
+    }
+    else
+    {
+        debounce_stats.absorbed += 2;
+    }
+
+    EXTI->IMR |= line;
+}
+
+// Next slot of the wheel, one update every DEBOUNCE_SLOT_US
+void TIM5_IRQHandler(void)
+{
+    uint32_t due;
+
+    TIM5->SR = ~TIM_SR_UIF;
+
+    wheel.now = (wheel.now + 1) & DEBOUNCE_SLOTS_MASK;
+    due = wheel.slots[wheel.now];
+    wheel.slots[wheel.now] = 0;
+    wheel.waiting &= ~due;
+
+    if (wheel.waiting == 0)
+    {
+        TIM5->CR1 &= ~TIM_CR1_CEN;
+    }
+
+    while (due != 0)
+    {
+        uint32_t index = __builtin_ctz(due);
+
+        due &= due - 1;
+        debounce_close(index);
+    }
+}
+
+// Microsecond counter reloaded every slot, stopped until a first edge
+static void debounce_configure(void)
+{
+    TIM5->PSC = DEBOUNCE_PSC_VALUE;
+    TIM5->ARR = DEBOUNCE_SLOT_US - 1U;
+    TIM5->CR1 = TIM_CR1_URS;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->SR = 0;
+    TIM5->DIER = TIM_DIER_UIE;
 
-        // There is an event triggering an interrupt
-        EXTI->PR = LINE_INTERRUPT_STATE;
+    for (int i = 0; i < CONTROLLER_BUTTONS_NUMBER; ++i)
+    {
+        wheel.posted[i] = is_pressed(&controller_buttons[i]);
     }
 }
+#endif
+
+// Dispatch of the EXTI lines:
+// every EXTI vector runs it; EXTI->PR is read once and the pending lines
+// are walked lowest first, one table load per line
+static void buttons_exti_dispatch(void)
+{
+#ifdef BUTTON_DEBOUNCE
+    // A masked line only latches the edges of a button waiting on the
+    // wheel, debounce_open clears the others
+    uint32_t pending = EXTI->PR & EXTI->IMR & EXTI_BUTTONS_LINES;
+#else
+    uint32_t pending = board_buttons_pending(EXTI_BUTTONS_LINES);
+#endif
+
+    while (pending != 0)
+    {
+        uint32_t index = board_button_of_line(__builtin_ctz(pending));
+
+        pending &= pending - 1;
 
-// Template of interrupt handler after send completion
+#ifdef BUTTON_DEBOUNCE
+        debounce_open(&controller_buttons[index]);
+#else
+        // Queue the event according to button pressed/released state
+        post_event(EVENT_ID(index, is_pressed(&controller_buttons[index])),
+                   EXTI_EVENT_TIME());
+#endif
+    }
+}
+
+// Interrupt handler after send completion, or pended by a button:
+// the only place transfers are started
 void DMA1_Stream6_IRQHandler(void)
+{
+    if (usart2_dma_tx_complete())
+    {
+        // Handle transfer completion on stream 6
+        usart2_dma_tx_acknowledge();
+    }
+
+    // If there is something to send, start next transfer with all of it
+    if (usart2_dma_tx_idle())
+    {
+        send_pending();
+    }
+#ifdef EVENT_COALESCE
+    else
+    {
+        fold_events();
+    }
+#endif
+}
+
+// Receive buffer half or fully written:
+// parse before the DMA comes back over the bytes
+void DMA1_Stream5_IRQHandler(void)
 {
     // Read signalled DMA1 interrupts
     uint32_t isr = DMA1->HISR;
 
-    if (isr & DMA_HISR_TCIF6)
+    if (isr & (DMA_HISR_HTIF5 | DMA_HISR_TCIF5))
     {
-        // Handle transfer completion on stream 5
-        DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+        DMA1->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5;
+        receive_process();
+    }
+}
 
-        // If there is something to send, start next transfer
-        if (!is_queue_empty())
+// Line idle after received bytes: a command ended
+void USART2_IRQHandler(void)
+{
+    if (USART2->SR & USART_SR_IDLE)
+    {
+        // IDLE is cleared by reading SR then DR
+        (void)USART2->DR;
+        receive_process();
+    }
+}
+
+// External interrupts: every EXTI vector runs buttons_exti_dispatch
+BOARD_BUTTONS_EXTI_HANDLERS()
+
+#ifdef BUTTON_CAPTURE
+// --------------------- Capture ---------------------
+
+/* Timer input capture of button edges (make CAPTURE=1):
+    each channel latches the counter on both edges of its pin, so the
+    time of an edge does not depend on when the handler runs. The
+    handlers only read the capture registers. IDR is not read at every
+    edge: the edges alternate, the polarity follows from the level at
+    start; after an overcapture (edges overwritten before being read)
+    it is taken from the pin again, so the last event of a burst always
+    has the level the pin settled to.
+*/
+
+typedef struct
+{
+    TIM_TypeDef *tim;
+    uint32_t af;
+    // 32-bit counter; 16-bit ones are extended by the update interrupt
+    uint32_t wide;
+    uint32_t high;
+} capture_timer_t;
+
+typedef struct
+{
+    capture_timer_t *timer;
+    uint32_t channel;
+    uint32_t button;
+    // Released state after the last edge queued
+    uint32_t released;
+} capture_t;
+
+#define CAPTURES_NUMBER 6
+
+static capture_timer_t capture_timers[] = {
+    {TIM2, GPIO_AF_TIM2, 1, 0},
+    {TIM3, GPIO_AF_TIM3, 0, 0},
+    {TIM4, GPIO_AF_TIM4, 0, 0}};
+
+static capture_t captures[CAPTURES_NUMBER] = {
+    {&capture_timers[0], 1, BUTTON_LEFT, 0},  // PB3 TIM2_CH2
+    {&capture_timers[1], 0, BUTTON_RIGHT, 0}, // PB4 TIM3_CH1
+    {&capture_timers[1], 1, BUTTON_UP, 0},    // PB5 TIM3_CH2
+    {&capture_timers[2], 0, BUTTON_DOWN, 0},  // PB6 TIM4_CH1
+    {&capture_timers[0], 2, BUTTON_FIRE, 0},  // PB10 TIM2_CH3
+    {&capture_timers[0], 0, BUTTON_MODE, 0},  // PA0 TIM2_CH1
+};
+
+// Released state at the edge just read after an overcapture: the pin
+// level now, undone by an edge latched again meanwhile
+static uint32_t capture_resync(capture_t *capture, button_t *button)
+{
+    TIM_TypeDef *tim = capture->timer->tim;
+    uint32_t flag = TIM_SR_CC1IF << capture->channel;
+    uint32_t latched;
+    uint32_t released;
+
+    // Retried if an edge comes between the two reads
+    do
+    {
+        latched = tim->SR & flag;
+        released = is_pressed(button);
+    } while ((tim->SR & flag) != latched);
+
+    return latched ? released ^ 1U : released;
+}
+
+// Queue the edge latched by a channel; sr is the status read by the
+// handler, its UIF tells an overflow not counted yet
+static void capture_edge(capture_t *capture, uint32_t sr)
+{
+    capture_timer_t *timer = capture->timer;
+    TIM_TypeDef *tim = timer->tim;
+    button_t *button = &controller_buttons[capture->button];
+
+    // Reading CCRx clears CCxIF
+    uint32_t count = (&tim->CCR1)[capture->channel];
+    uint32_t time = count;
+
+    if (!timer->wide)
+    {
+        // A count in the lower half was captured after the overflow
+        time = timer->high + count;
+
+        if ((sr & TIM_SR_UIF) && count < 0x8000U)
         {
-            send_to_DMA1(queue_poll());
+            time += 1U << 16;
         }
     }
+
+    if (tim->SR & (TIM_SR_CC1OF << capture->channel))
+    {
+        tim->SR = ~(TIM_SR_CC1OF << capture->channel);
+        capture->released = capture_resync(capture, button);
+    }
+    else
+    {
+        capture->released ^= 1U;
+    }
+
+    post_event(EVENT_ID(capture->button, capture->released), time);
 }
 
-// Template of interrupt handler after receive completion
-void DMA1_Stream5_IRQHandler()
+static void capture_handler(capture_timer_t *timer)
 {
-    // Read signalled DMA1 interrupts
-    uint32_t isr = DMA1->HISR;
+    uint32_t sr = timer->tim->SR;
 
-    if (isr & DMA_HISR_TCIF5)
+    for (int i = 0; i < CAPTURES_NUMBER; ++i)
     {
-        // Handle transfer completion on stream 5
-        DMA1->HIFCR = DMA_HIFCR_CTCIF5;
-       
-        // Enable receiving again. 
-        receive_from_DMA1(queue_poll());
+        if (captures[i].timer == timer &&
+            (sr & (TIM_SR_CC1IF << captures[i].channel)))
+        {
+            capture_edge(&captures[i], sr);
+        }
+    }
+
+    if (!timer->wide && (sr & TIM_SR_UIF))
+    {
+        timer->tim->SR = ~TIM_SR_UIF;
+        timer->high += 1U << 16;
     }
 }
 
-// External interrupt:
-// A set bit in the EXTI->PR register means that there is an event which can trigger an interrupt
+// LEFT, FIRE, MODE
+void TIM2_IRQHandler(void)
+{
+    capture_handler(&capture_timers[0]);
+}
 
-// Button 6 (MODE) Register 0
-void EXTI0_IRQHandler(void)
+// RIGHT, UP
+void TIM3_IRQHandler(void)
 {
-    uint32_t interrupt_state = EXTI->PR;
-    interrupt_handler(interrupt_state, EXTI_PR_PR0, &controller_buttons[6]);
+    capture_handler(&capture_timers[1]);
 }
 
-// Button 0 (LEFT) Register 3
-void EXTI3_IRQHandler(void)
+// DOWN
+void TIM4_IRQHandler(void)
 {
-    uint32_t interrupt_state = EXTI->PR;
-    interrupt_handler(interrupt_state, EXTI_PR_PR3, &controller_buttons[0]);
+    capture_handler(&capture_timers[2]);
 }
 
-// Button 1 (RIGHT) Register 4
-void EXTI4_IRQHandler(void)
+// Count microseconds, the prescaler is loaded without an update interrupt
+static void configure_capture_timer(capture_timer_t *timer)
 {
-    uint32_t interrupt_state = EXTI->PR;
-    interrupt_handler(interrupt_state, EXTI_PR_PR4, &controller_buttons[1]);
+    TIM_TypeDef *tim = timer->tim;
+
+    tim->PSC = CAPTURE_PSC_VALUE;
+    tim->ARR = timer->wide ? 0xFFFFFFFFU : 0xFFFFU;
+    tim->CR1 = TIM_CR1_URS;
+    tim->EGR = TIM_EGR_UG;
+    tim->SR = 0;
+    tim->DIER = timer->wide ? 0 : TIM_DIER_UIE;
 }
 
-// Buttons 2, 3 (UP, DOWN) Register 5, 6
-void EXTI9_5_IRQHandler(void)
+// Move a button from its EXTI line to its timer channel,
+// input capture on both edges without filter
+static void configure_capture(capture_t *capture)
 {
-    uint32_t interrupt_state = EXTI->PR;
-    interrupt_handler(interrupt_state, EXTI_PR_PR5, &controller_buttons[2]);
-    interrupt_handler(interrupt_state, EXTI_PR_PR6, &controller_buttons[3]);
+    TIM_TypeDef *tim = capture->timer->tim;
+    button_t *button = &controller_buttons[capture->button];
+    uint32_t channel = capture->channel;
+    uint32_t line = 1U << button->reg;
+
+    EXTI->IMR &= ~line;
+    EXTI->RTSR &= ~line;
+    EXTI->FTSR &= ~line;
+    EXTI->PR = line;
+
+    GPIOafConfigure(button->gpio,
+                    button->reg,
+                    GPIO_OType_PP,
+                    GPIO_Low_Speed,
+                    GPIO_PuPd_UP,
+                    capture->timer->af);
+
+    capture->released = is_pressed(button);
+    button->stamp = '@';
+
+    // CCxS = 01: the channel captures its own input
+    if (channel < 2)
+    {
+        tim->CCMR1 |= TIM_CCMR1_CC1S_0 << (8 * channel);
+    }
+    else
+    {
+        tim->CCMR2 |= TIM_CCMR2_CC3S_0 << (8 * (channel - 2));
+    }
+
+    tim->CCER |= (TIM_CCER_CC1E | TIM_CCER_CC1P | TIM_CCER_CC1NP) << (4 * channel);
+    tim->DIER |= TIM_DIER_CC1IE << channel;
+}
+
+static void capture_configure(void)
+{
+    for (int i = 0; i < CONTROLLER_BUTTONS_NUMBER; ++i)
+    {
+        controller_buttons[i].stamp = '~';
+    }
+
+    for (uint32_t i = 0; i < sizeof(capture_timers) / sizeof(capture_timers[0]); ++i)
+    {
+        configure_capture_timer(&capture_timers[i]);
+    }
+
+    for (int i = 0; i < CAPTURES_NUMBER; ++i)
+    {
+        configure_capture(&captures[i]);
+    }
+
+    // Started back to back, the time bases differ by less than a tick
+    for (uint32_t i = 0; i < sizeof(capture_timers) / sizeof(capture_timers[0]); ++i)
+    {
+        capture_timers[i].tim->CR1 |= TIM_CR1_CEN;
+    }
+}
+#endif
+
+#ifdef STORM_BENCH
+// --------------------- Storm ---------------------
+
+/* Edge storm benchmark (make STORM=1):
+    instead of waiting for real edges, main injects bursts of button
+    events with EXTI->SWIER (the pins keep their level, the messages
+    report it). For every event it measures the time from the trigger to
+    the first byte of its message handed by DMA1 Stream6 to the UART,
+    in DWT cycles, and counts the events lost on a full queue.
+    The result is sent as one JSON line once the output is drained.
+*/
+
+#ifndef STORM_BURSTS
+#define STORM_BURSTS 4U
+#endif
+
+#ifndef STORM_EDGES
+#define STORM_EDGES 128U
+#endif
+
+// Cycles between two edges of a burst, 50 us at 16 MHz
+#ifndef STORM_GAP_CYCLES
+#define STORM_GAP_CYCLES 800U
+#endif
+
+// Quiet time between the end of the output and the next burst, 10 ms
+#define STORM_QUIET_CYCLES 160000U
+
+#define CYCLES_PER_US (HSI_HZ / 1000000U)
+
+// Bucket 0 holds 0 us, bucket k holds [2^(k-1), 2^k) us, up to 33 s
+#define STORM_BUCKETS 26
+
+static struct
+{
+    uint32_t injected;
+    uint32_t lost;
+    uint32_t measured;
+    uint32_t max_cycles;
+    uint32_t histogram[STORM_BUCKETS];
+
+    // Events waiting for their first byte: trigger time and offset of
+    // the first byte in the output, counted as tx_stats.bytes_started
+    uint32_t time[STORM_EDGES];
+    uint32_t offset[STORM_EDGES];
+    uint32_t head;
+    uint32_t used;
+    uint32_t bytes_queued;
+} storm;
+
+static uint32_t storm_random = 1;
+
+// Bytes moved to the UART so far; retried if a transfer started meanwhile
+static uint32_t storm_bytes_handed(void)
+{
+    uint32_t started;
+    uint32_t remaining;
+
+    do
+    {
+        started = tx_stats.bytes_started;
+        remaining = DMA1_Stream6->NDTR;
+    } while (started != tx_stats.bytes_started);
+
+    return started - remaining;
+}
+
+static void storm_record(uint32_t cycles)
+{
+    uint32_t us = cycles / CYCLES_PER_US;
+    uint32_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+
+    storm.histogram[bucket < STORM_BUCKETS ? bucket : STORM_BUCKETS - 1]++;
+    storm.max_cycles = cycles > storm.max_cycles ? cycles : storm.max_cycles;
+    storm.measured++;
+}
+
+// Takes the latency of every event whose first byte went out
+static void storm_poll(void)
+{
+    uint32_t handed = storm_bytes_handed();
+    uint32_t now = DWT->CYCCNT;
+
+    while (storm.used > 0 && (int32_t)(handed - storm.offset[storm.head]) > 0)
+    {
+        storm_record(now - storm.time[storm.head]);
+        storm.head = (storm.head + 1) % STORM_EDGES;
+        storm.used--;
+    }
+}
+
+static void storm_inject(void)
+{
+    button_t *button;
+    uint32_t inserted = event_queue.insert_pos;
+    uint32_t time;
+    uint32_t slot;
+    uint8_t event;
+
+    storm_random ^= storm_random << 13;
+    storm_random ^= storm_random >> 17;
+    storm_random ^= storm_random << 5;
+    button = &controller_buttons[storm_random % CONTROLLER_BUTTONS_NUMBER];
+
+    time = DWT->CYCCNT;
+    EXTI->SWIER = 1U << button->reg;
+
+    // The EXTI handler runs before the next instruction
+    __DSB();
+    __ISB();
+
+    storm.injected++;
+
+    if (event_queue.insert_pos == inserted)
+    {
+        storm.lost++;
+        return;
+    }
+
+    event = event_queue.events[inserted & EVENT_QUEUE_MASK];
+    slot = (storm.head + storm.used) % STORM_EDGES;
+
+    storm.time[slot] = time;
+    storm.offset[slot] = storm.bytes_queued;
+    storm.used++;
+    storm.bytes_queued += EVENT_RELEASED(event) ? button->release_length
+                                                : button->press_length;
+}
+
+// Upper bound in us of the bucket holding the given fraction of events,
+// no more than the longest latency measured
+static uint32_t storm_percentile(uint32_t per_mille)
+{
+    uint32_t rank = (storm.measured * per_mille + 999) / 1000;
+    uint32_t max_us = storm.max_cycles / CYCLES_PER_US;
+    uint32_t count = 0;
+
+    for (int bucket = 0; bucket < STORM_BUCKETS; ++bucket)
+    {
+        count += storm.histogram[bucket];
+
+        if (count >= rank && count > 0)
+        {
+            uint32_t bound = bucket == 0 ? 0 : 1U << bucket;
+
+            return bound < max_us ? bound : max_us;
+        }
+    }
+
+    return 0;
 }
 
-// Buttons 4, 5 (FIRE, USER) Register 10, 13
-void EXTI15_10_IRQHandler(void)
+static void storm_report(void)
 {
-    uint32_t interrupt_state = EXTI->PR;
-    interrupt_handler(interrupt_state, EXTI_PR_PR10, &controller_buttons[4]);
-    interrupt_handler(interrupt_state, EXTI_PR_PR13, &controller_buttons[5]);
+    uint32_t used = 0;
+    int last = STORM_BUCKETS - 1;
+
+    while (last > 0 && storm.histogram[last] == 0)
+    {
+        last--;
+    }
+
+    used = append_string(used, "{\"storm\":\"task2\",\"bursts\":");
+    used = append_unsigned(used, STORM_BURSTS);
+    used = append_string(used, ",\"edges\":");
+    used = append_unsigned(used, STORM_EDGES);
+    used = append_string(used, ",\"gap_us\":");
+    used = append_unsigned(used, STORM_GAP_CYCLES / CYCLES_PER_US);
+    used = append_string(used, ",\"injected\":");
+    used = append_unsigned(used, storm.injected);
+    used = append_string(used, ",\"lost\":");
+    used = append_unsigned(used, storm.lost);
+    used = append_string(used, ",\"latency_us\":{\"p50\":");
+    used = append_unsigned(used, storm_percentile(500));
+    used = append_string(used, ",\"p99\":");
+    used = append_unsigned(used, storm_percentile(990));
+    used = append_string(used, ",\"max\":");
+    used = append_unsigned(used, storm.max_cycles / CYCLES_PER_US);
+    used = append_string(used, "},\"histogram_log2_us\":[");
+
+    for (int bucket = 0; bucket <= last; ++bucket)
+    {
+        used = append_unsigned(used, storm.histogram[bucket]);
+        used = append_string(used, bucket < last ? "," : "]}");
+    }
+
+    tx_buffer[used++] = '\r';
+    tx_buffer[used++] = '\n';
+    usart2_dma_tx_start(tx_buffer, used);
 }
 
+static void storm_wait(uint32_t cycles)
+{
+    uint32_t start = DWT->CYCCNT;
+
+    while (DWT->CYCCNT - start < cycles)
+    {
+        storm_poll();
+    }
+}
+
+static void storm_run(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    storm.bytes_queued = tx_stats.bytes_started;
+
+    for (uint32_t burst = 0; burst < STORM_BURSTS; ++burst)
+    {
+        for (uint32_t edge = 0; edge < STORM_EDGES; ++edge)
+        {
+            storm_inject();
+            storm_wait(STORM_GAP_CYCLES);
+        }
+
+        // Drained: every first byte out and the last transfer complete
+        while (storm.used > 0 || !usart2_dma_tx_idle())
+        {
+            storm_poll();
+        }
+
+        storm_wait(STORM_QUIET_CYCLES);
+    }
+
+    storm_report();
+}
+#endif
+
 // --------------------- Main ---------------------
 
 int main(void)
@@ -314,16 +1331,32 @@ int main(void)
 
     __NOP();
 
-    UART_configure();
+    // The end of a burst of received bytes raises IDLE, both directions
+    // go by DMA
+    usart2_configure(USART_CR1_IDLEIE, USART_CR3_DMAT | USART_CR3_DMAR);
     DMA_configure();
     NVIC_configure();
 
-    for (int i = 0; i < CONTROLLER_BUTTONS_NUMBER; ++i)
+    board_buttons_configure();
+
+#ifdef BUTTON_CAPTURE
+    capture_configure();
+#endif
+
+#ifdef BUTTON_DEBOUNCE
+    debounce_configure();
+#endif
+
+    for (int i = 0; i < LEDS_NUMBER; ++i)
     {
-        configure_button(controller_buttons + i);
+        configure_led(leds + i);
     }
 
-    ENABLE_PERIPHERAL;
+    usart2_enable();
+
+#ifdef STORM_BENCH
+    storm_run();
+#endif
 
     for (;;) {}
 